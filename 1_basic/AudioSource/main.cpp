@@ -16,9 +16,14 @@
 
 #include "StreamingWavePlayer.h"
 #include "KinectAudio.h"
+#include "DepthColorRegistration.h"
+#include "KernelBenchmark.h"
 
 const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
 
+// Ԃ̌vŁAf[^擾Ԋu(~bA1t[)
+const DWORD BENCHMARK_READ_INTERVAL = 33;
+
 class KinectSample
 {
 private:
@@ -36,6 +41,8 @@ private:
   DWORD width;
   DWORD height;
 
+  DepthColorRegistration registration;
+
 public:
 
   KinectSample()
@@ -140,6 +147,25 @@ public:
     }
   }
 
+  // f[^̎擾̏Ԃv(o͂͂Ȃ)
+  void benchmark( KernelBenchmark& kernelBenchmark )
+  {
+    if ( (kinect == 0) || !isInitialized ) {
+      throw std::runtime_error( "Kinect ڑĂ" );
+    }
+
+    kernelBenchmark.printHeader( std::cout, "AudioSource" );
+
+    // C[vƓA1t[̉܂Ă擾(҂Ԃ͊܂߂Ȃ)
+    kernelBenchmark.run( "KinectAudio::read",
+      [&]( int i ) {
+        ::Sleep( BENCHMARK_READ_INTERVAL );
+      },
+      [&]( int i ) {
+        audio.read();
+      } );
+  }
+
 private:
 
   static void CALLBACK StatusChanged( HRESULT hrStatus, const OLECHAR* instanceName, const OLECHAR* uniqueDeviceName, void* pUserData )
@@ -210,6 +236,11 @@ private:
     // w肵𑜓x́AʃTCY擾
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
 
+    // JRGBJւ̍Wϊe[u쐬
+    //   ڑȂꍇ͕ʂKinectȂ̂ŁAÕe[u͎g킸ɍ쐬Ȃ
+    registration.reset();
+    registration.initialize( kinect, CAMERA_RESOLUTION, CAMERA_RESOLUTION );
+
     // ͂̏
     audio.initialize( kinect );
     audio.setSystemMode( 4 );
@@ -230,8 +261,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 摜f[^Rs[
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+      //   傫ȂAÕt[ image ̃obt@g܂킷
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // t[f[^
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
@@ -252,15 +284,11 @@ private:
         USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
         USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
 
-        LONG depthX = i % width;
-        LONG depthY = i / width;
         LONG colorX = 0;
         LONG colorY = 0;
 
-        // J̍WARGBJ̍Wɕϊ
-        kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-          CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-          0, depthX , depthY, depth[i], &colorX, &colorY );
+        // J̍WARGBJ̍Wɕϊ(ϊe[uQƂ)
+        registration.getColorPixel( i, depth[i], colorX, colorY );
 
         // vC[
         if ( player != 0 ) {
@@ -331,13 +359,23 @@ private:
   }
 };
 
-void main()
+// 
+//   (Ȃ)      Kinect̉摜\āAXs[J[ɏo͂
+//   benchmark   Kinect̉ŏԂv
+void main( int argc, char* argv[] )
 {
 
   try {
     KinectSample kinect;
     kinect.initialize();
-    kinect.run();
+
+    if ( (argc > 1) && (std::string( argv[1] ) == "benchmark") ) {
+      KernelBenchmark kernelBenchmark;
+      kinect.benchmark( kernelBenchmark );
+    }
+    else {
+      kinect.run();
+    }
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
@@ -7,6 +7,9 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "DepthColorRegistration.h"
+#include "KernelBenchmark.h"
+
 
 
 #define ERROR_CHECK( ret )  \
@@ -30,6 +33,8 @@ private:
   DWORD width;
   DWORD height;
 
+  DepthColorRegistration registration;
+
 public:
 
   KinectSample()
@@ -70,6 +75,9 @@ public:
 
     // w肵𑜓x́AʃTCY擾
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+
+    // JRGBJւ̍Wϊe[u쐬
+    registration.initialize( kinect, CAMERA_RESOLUTION, CAMERA_RESOLUTION );
   }
 
   void run()
@@ -96,6 +104,27 @@ public:
     }
   }
 
+  // J̕`̏Ԃv(\͂Ȃ)
+  //   t[̎擾ƉAdrawDepthImage ̏Ɋ܂܂
+  void benchmark( KernelBenchmark& kernelBenchmark )
+  {
+    cv::Mat image;
+
+    kernelBenchmark.printHeader( std::cout, "DepthCamera" );
+
+    // f[^̍XV҂āARGBJ̉摜擾(҂Ԃ͊܂߂Ȃ)
+    kernelBenchmark.run( "drawDepthImage",
+      [&]( int i ) {
+        ::WaitForSingleObject( streamEvent, INFINITE );
+        ::ResetEvent( streamEvent );
+
+        drawRgbImage( image );
+      },
+      [&]( int i ) {
+        drawDepthImage( image );
+      } );
+  }
+
 private:
 
   void createInstance()
@@ -127,8 +156,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 摜f[^Rs[
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+      //   傫ȂAÕt[ image ̃obt@g܂킷
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // t[f[^
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
@@ -148,15 +178,11 @@ private:
       for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
         USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
 
-        LONG depthX = i % width;
-        LONG depthY = i / width;
-        LONG colorX = depthX;
-        LONG colorY = depthY;
+        LONG colorX = 0;
+        LONG colorY = 0;
 
-        // J̍WARGBJ̍Wɕϊ
-        kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-          CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-          0, depthX , depthY, depth[i], &colorX, &colorY );
+        // J̍WARGBJ̍Wɕϊ(ϊe[uQƂ)
+        registration.getColorPixel( i, depth[i], colorX, colorY );
 
         // ȏ̋`悵Ȃ
         if ( distance >= 1000 ) {
@@ -173,13 +199,23 @@ private:
   }
 };
 
-void main()
+// 
+//   (Ȃ)      Kinect̉摜\
+//   benchmark   Kinect̃t[ŏԂv
+void main( int argc, char* argv[] )
 {
 
   try {
     KinectSample kinect;
     kinect.initialize();
-    kinect.run();
+
+    if ( (argc > 1) && (std::string( argv[1] ) == "benchmark") ) {
+      KernelBenchmark kernelBenchmark;
+      kinect.benchmark( kernelBenchmark );
+    }
+    else {
+      kinect.run();
+    }
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
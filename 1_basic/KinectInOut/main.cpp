@@ -7,6 +7,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "DepthColorRegistration.h"
+
 #define CODE2STR( code ) case code : return #code; break
 
 const char* NuiGetErrorCodeString( HRESULT hrStatus ) 
@@ -70,6 +72,8 @@ private:
   DWORD width;
   DWORD height;
 
+  DepthColorRegistration registration;
+
 public:
 
   KinectSample()
@@ -242,6 +246,11 @@ private:
     // w肵𑜓x́AʃTCY擾
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
 
+    // JRGBJւ̍Wϊe[u쐬
+    //   ڑȂꍇ͕ʂKinectȂ̂ŁAÕe[u͎g킸ɍ쐬Ȃ
+    registration.reset();
+    registration.initialize( kinect, CAMERA_RESOLUTION, CAMERA_RESOLUTION );
+
 		// 
 		isInitialized = true;
 	}
@@ -256,8 +265,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 摜f[^Rs[
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+      //   傫ȂAÕt[ image ̃obt@g܂킷
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // t[f[^
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
@@ -278,15 +288,11 @@ private:
         USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
         USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
 
-        LONG depthX = i % width;
-        LONG depthY = i / width;
         LONG colorX = 0;
         LONG colorY = 0;
 
-        // J̍WARGBJ̍Wɕϊ
-        kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-          CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-          0, depthX , depthY, depth[i], &colorX, &colorY );
+        // J̍WARGBJ̍Wɕϊ(ϊe[uQƂ)
+        registration.getColorPixel( i, depth[i], colorX, colorY );
 
 				// vC[
         if ( player != 0 ) {
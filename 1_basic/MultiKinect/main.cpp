@@ -209,8 +209,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 摜f[^Rs[
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+      //   傫ȂAÕt[ image ̃obt@g܂킷
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // t[f[^
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
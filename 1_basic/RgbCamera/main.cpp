@@ -108,8 +108,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 画像データをコピーする
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 画像データをコピーする(解放したフレームのバッファはSDKが再利用するので、参照せずにコピーする)
+      //   大きさが同じなら、前のフレームの image のバッファを使いまわす
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // フレームデータを解放する
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
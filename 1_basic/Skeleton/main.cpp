@@ -7,6 +7,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "DepthColorRegistration.h"
+
 
 
 #define ERROR_CHECK( ret )  \
@@ -30,6 +32,8 @@ private:
   DWORD width;
   DWORD height;
 
+  DepthColorRegistration registration;
+
 public:
 
   KinectSample()
@@ -73,6 +77,9 @@ public:
 
     // w肵𑜓x́AʃTCY擾
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+
+    // JRGBJւ̍Wϊe[u쐬
+    registration.initialize( kinect, CAMERA_RESOLUTION, CAMERA_RESOLUTION );
   }
 
   void run()
@@ -131,8 +138,9 @@ private:
     NUI_LOCKED_RECT colorData;
     imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-    // 摜f[^Rs[
-    image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+    // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+    //   傫ȂAÕt[ image ̃obt@g܂킷
+    cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
     // t[f[^
     ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
@@ -156,15 +164,11 @@ private:
       USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
       USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
 
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX = depthX;
-      LONG colorY = depthY;
+      LONG colorX = 0;
+      LONG colorY = 0;
 
-      // J̍WARGBJ̍Wɕϊ
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-        CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-        0, depthX , depthY, 0, &colorX, &colorY );
+      // J̍WARGBJ̍Wɕϊ(ϊe[uQƂ)
+      registration.getColorPixel( i, 0, colorX, colorY );
 
       // vC[
       if ( player != 0 ) {
@@ -0,0 +1,403 @@
+﻿#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// NuiApi.hの前にWindows.hをインクルードする
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "../Finger/DepthCodec.h"
+#include "../Finger/DepthColorRegistration.h"
+#include "../Finger/DepthUnpack.h"
+#include "../Finger/FrameResolution.h"
+#include "../Finger/RecordedFrameSource.h"
+
+#define ERROR_CHECK( ret )  \
+  if ( ret != S_OK ) {    \
+    std::stringstream ss;	\
+    ss << "failed " #ret " " << std::hex << ret << std::endl;			\
+    throw std::runtime_error( ss.str().c_str() );			\
+  }
+
+// 計測に使うフレーム数
+const int FRAME_COUNT = 30;
+
+// 記録したファイルから読み込む最大のフレーム数
+const int MAX_RECORDED_FRAME_COUNT = 300;
+
+// 処理時間の計測
+class Stopwatch
+{
+public:
+
+  Stopwatch()
+    : start_( cv::getTickCount() )
+  {
+  }
+
+  // 経過時間(ミリ秒)を取得する
+  double elapsed() const
+  {
+    return (cv::getTickCount() - start_) * 1000.0 / cv::getTickFrequency();
+  }
+
+private:
+
+  int64 start_;
+};
+
+class KinectBenchmark
+{
+private:
+
+  INuiSensor* kinect;
+  HANDLE depthStreamHandle;
+  HANDLE streamEvent;
+
+  NUI_IMAGE_RESOLUTION colorResolution;
+  NUI_IMAGE_RESOLUTION depthResolution;
+  DWORD width;
+  DWORD height;
+
+  // 記録した距離データ
+  std::vector< std::vector< USHORT > > depthFrames;
+
+public:
+
+  KinectBenchmark()
+    : kinect( 0 )
+    , colorResolution( NUI_IMAGE_RESOLUTION_640x480 )
+    , depthResolution( NUI_IMAGE_RESOLUTION_640x480 )
+  {
+  }
+
+  ~KinectBenchmark()
+  {
+    // 終了処理
+    if ( kinect != 0 ) {
+      kinect->NuiShutdown();
+      kinect->Release();
+    }
+  }
+
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
+  {
+    this->colorResolution = colorResolution;
+    this->depthResolution = depthResolution;
+
+    createInstance();
+
+    // Kinectの設定を初期化する
+    ERROR_CHECK( kinect->NuiInitialize( NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX ) );
+
+    // 距離カメラを初期化する
+    ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, depthResolution,
+      0, 2, 0, &depthStreamHandle ) );
+
+    // フレーム更新イベントのハンドルを作成する
+    streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
+    ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+
+    // 指定した解像度の、画面サイズを取得する
+    ::NuiImageResolutionToSize( depthResolution, width, height );
+  }
+
+  // 計測に使う距離データを記録する
+  void record()
+  {
+    while ( depthFrames.size() < FRAME_COUNT ) {
+      // データの更新を待つ
+      ::WaitForSingleObject( streamEvent, INFINITE );
+      ::ResetEvent( streamEvent );
+
+      NUI_IMAGE_FRAME depthFrame = { 0 };
+      HRESULT ret = kinect->NuiImageStreamGetNextFrame( depthStreamHandle, 0, &depthFrame );
+      if ( ret != S_OK ) {
+        continue;
+      }
+
+      NUI_LOCKED_RECT depthData = { 0 };
+      depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
+
+      USHORT* depth = (USHORT*)depthData.pBits;
+      depthFrames.push_back( std::vector< USHORT >( depth, depth + (width * height) ) );
+
+      ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( depthStreamHandle, &depthFrame ) );
+    }
+  }
+
+  // 計測に使う距離データを、記録したファイルから読み込む(Kinectは使わない)
+  void load( const std::string& fileName )
+  {
+    RecordedFrameSource recorded;
+    recorded.open( fileName, false );
+    colorResolution = recorded.getColorResolution();
+    depthResolution = recorded.getDepthResolution();
+    ::NuiImageResolutionToSize( depthResolution, width, height );
+
+    while ( (depthFrames.size() < MAX_RECORDED_FRAME_COUNT) && recorded.waitFrame() ) {
+      ImageFrame depthFrame = { 0 };
+      if ( recorded.getDepthFrame( depthFrame ) != S_OK ) {
+        continue;
+      }
+
+      USHORT* depth = (USHORT*)depthFrame.bits;
+      depthFrames.push_back( std::vector< USHORT >( depth, depth + (width * height) ) );
+      recorded.releaseDepthFrame( depthFrame );
+    }
+
+    if ( depthFrames.empty() ) {
+      throw std::runtime_error( "距離データが記録されていません : " + fileName );
+    }
+  }
+
+  void run()
+  {
+    // 座標変換の比較にはKinectが必要
+    if ( kinect != 0 ) {
+      benchmarkRegistration();
+    }
+
+    benchmarkDepthUnpack();
+    checkDepthCodec();
+    benchmarkDepthCodec();
+  }
+
+private:
+
+  void createInstance()
+  {
+    // 接続されているKinectの数を取得する
+    int count = 0;
+    ERROR_CHECK( ::NuiGetSensorCount( &count ) );
+    if ( count == 0 ) {
+      throw std::runtime_error( "Kinect を接続してください" );
+    }
+
+    // 最初のKinectのインスタンスを作成する
+    ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
+
+    // Kinectの状態を取得する
+    HRESULT status = kinect->NuiStatus();
+    if ( status != S_OK ) {
+      throw std::runtime_error( "Kinect が利用可能ではありません" );
+    }
+  }
+
+  // 距離カメラからRGBカメラへの座標変換
+  //   1画素ごとにSDKを呼び出す場合と、変換テーブルを参照する場合を比較する
+  void benchmarkRegistration()
+  {
+    std::vector< LONG > sdkCoordinates( width * height * 2 );
+    std::vector< LONG > tableCoordinates( width * height * 2 );
+
+    DepthColorRegistration registration;
+    Stopwatch build;
+    registration.initialize( kinect, colorResolution, depthResolution );
+    double buildTime = build.elapsed();
+
+    double sdkTime = 0;
+    double tableTime = 0;
+    LONG maxError = 0;
+    for ( size_t f = 0; f < depthFrames.size(); ++f ) {
+      const USHORT* depth = &depthFrames[f][0];
+
+      // 1画素ごとにSDKを呼び出す
+      Stopwatch sdk;
+      for ( int i = 0; i < (int)(width * height); ++i ) {
+        LONG depthX = i % width;
+        LONG depthY = i / width;
+        kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+          colorResolution, depthResolution,
+          0, depthX , depthY, depth[i], &sdkCoordinates[i * 2], &sdkCoordinates[i * 2 + 1] );
+      }
+      sdkTime += sdk.elapsed();
+
+      // 変換テーブルを参照する
+      Stopwatch table;
+      registration.mapFrame( depth, &tableCoordinates[0] );
+      tableTime += table.elapsed();
+
+      // 変換結果の誤差
+      for ( size_t i = 0; i < sdkCoordinates.size(); ++i ) {
+        maxError = std::max( maxError, std::abs( sdkCoordinates[i] - tableCoordinates[i] ) );
+      }
+    }
+
+    std::cout << "[registration]" << std::endl;
+    std::cout << "  build table : " << buildTime << " ms" << std::endl;
+    std::cout << "  sdk         : " << sdkTime / depthFrames.size() << " ms/frame" << std::endl;
+    std::cout << "  table       : " << tableTime / depthFrames.size() << " ms/frame" << std::endl;
+    std::cout << "  max error   : " << maxError << " pixel" << std::endl;
+  }
+
+  // 距離とプレイヤーの分離
+  //   1画素ごとにSDKの関数を呼び出す場合と、1画素ずつ分ける場合、SSE2で分ける場合を比較する
+  void benchmarkDepthUnpack()
+  {
+    const int count = width * height;
+    std::vector< USHORT > sdkDistance( count );
+    std::vector< BYTE > sdkPlayer( count );
+    std::vector< USHORT > distance( count );
+    std::vector< BYTE > player( count );
+
+    double sdkTime = 0;
+    double scalarTime = 0;
+    double sse2Time = 0;
+    for ( size_t f = 0; f < depthFrames.size(); ++f ) {
+      const USHORT* depth = &depthFrames[f][0];
+
+      // 1画素ごとにSDKの関数を呼び出す
+      Stopwatch sdk;
+      for ( int i = 0; i < count; ++i ) {
+        sdkDistance[i] = ::NuiDepthPixelToDepth( depth[i] );
+        sdkPlayer[i] = (BYTE)::NuiDepthPixelToPlayerIndex( depth[i] );
+      }
+      sdkTime += sdk.elapsed();
+
+      // 1画素ずつ分ける
+      Stopwatch scalar;
+      DepthUnpacker::unpackScalar( depth, count, &distance[0], &player[0] );
+      scalarTime += scalar.elapsed();
+      checkDepthUnpack( sdkDistance, sdkPlayer, distance, player );
+
+      // SSE2で分ける
+      Stopwatch sse2;
+      DepthUnpacker::unpack( depth, count, &distance[0], &player[0], true );
+      sse2Time += sse2.elapsed();
+      checkDepthUnpack( sdkDistance, sdkPlayer, distance, player );
+    }
+
+    // 1ナノ秒あたりの画素数
+    double pixels = (double)count * depthFrames.size();
+    std::cout << "[depth unpack]" << std::endl;
+    std::cout << "  sdk         : " << sdkTime / depthFrames.size() << " ms/frame, "
+              << pixels / (sdkTime * 1000000) << " pixels/ns" << std::endl;
+    std::cout << "  scalar      : " << scalarTime / depthFrames.size() << " ms/frame, "
+              << pixels / (scalarTime * 1000000) << " pixels/ns" << std::endl;
+    std::cout << "  sse2        : " << sse2Time / depthFrames.size() << " ms/frame, "
+              << pixels / (sse2Time * 1000000) << " pixels/ns" << std::endl;
+  }
+
+  void checkDepthUnpack( const std::vector< USHORT >& expectedDistance, const std::vector< BYTE >& expectedPlayer,
+    const std::vector< USHORT >& distance, const std::vector< BYTE >& player )
+  {
+    if ( (distance != expectedDistance) || (player != expectedPlayer) ) {
+      throw std::runtime_error( "距離とプレイヤーの分離の結果が一致しません" );
+    }
+  }
+
+  // 距離データの圧縮
+  //   圧縮率と、圧縮、展開の速度を計測する
+  void benchmarkDepthCodec()
+  {
+    DepthCodec codec;
+    std::vector< BYTE > encoded;
+    std::vector< USHORT > decoded( width * height );
+
+    double encodeTime = 0;
+    double decodeTime = 0;
+    double encodedSize = 0;
+    for ( size_t f = 0; f < depthFrames.size(); ++f ) {
+      const USHORT* depth = &depthFrames[f][0];
+
+      Stopwatch encode;
+      size_t size = codec.encode( depth, width, height, encoded );
+      encodeTime += encode.elapsed();
+      encodedSize += size;
+
+      Stopwatch decode;
+      codec.decode( &encoded[0], size, &decoded[0], width, height );
+      decodeTime += decode.elapsed();
+    }
+
+    double frameCount = (double)depthFrames.size();
+    double rawSize = width * height * sizeof(USHORT);
+    std::cout << "[depth codec]" << std::endl;
+    std::cout << "  raw         : " << rawSize / 1024 << " KB/frame" << std::endl;
+    std::cout << "  encoded     : " << encodedSize / frameCount / 1024 << " KB/frame" << std::endl;
+    std::cout << "  ratio       : " << rawSize * frameCount / encodedSize << std::endl;
+    std::cout << "  encode      : " << encodeTime / frameCount << " ms/frame, "
+              << rawSize * frameCount / (encodeTime * 1000) << " MB/s" << std::endl;
+    std::cout << "  decode      : " << decodeTime / frameCount << " ms/frame, "
+              << rawSize * frameCount / (decodeTime * 1000) << " MB/s" << std::endl;
+  }
+
+  // 距離データの圧縮を確認する
+  //   計測に使うフレームと、極端な値のフレームを圧縮、展開して、元に戻ることを確認する
+  void checkDepthCodec()
+  {
+    for ( size_t f = 0; f < depthFrames.size(); ++f ) {
+      checkDepthCodec( depthFrames[f], width, height );
+    }
+
+    // 8画素の倍数でない大きさ(SSE2で処理できない端の画素)も確認する
+    const int sizes[][2] = { { (int)width, (int)height }, { 37, 5 }, { 1, 1 } };
+    for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i ) {
+      int w = sizes[i][0];
+      int h = sizes[i][1];
+
+      std::vector< USHORT > frame( w * h, 0 );
+      checkDepthCodec( frame, w, h );
+
+      std::fill( frame.begin(), frame.end(), (USHORT)0xFFFF );
+      checkDepthCodec( frame, w, h );
+
+      srand( 0 );
+      for ( size_t j = 0; j < frame.size(); ++j ) {
+        frame[j] = (USHORT)((rand() << 8) ^ rand());
+      }
+      checkDepthCodec( frame, w, h );
+    }
+
+    std::cout << "[depth codec round trip]" << std::endl;
+    std::cout << "  ok" << std::endl;
+  }
+
+  void checkDepthCodec( const std::vector< USHORT >& frame, int w, int h )
+  {
+    DepthCodec codec;
+    std::vector< BYTE > encoded;
+    size_t size = codec.encode( &frame[0], w, h, encoded );
+
+    std::vector< USHORT > decoded( frame.size() );
+    codec.decode( &encoded[0], size, &decoded[0], w, h );
+    if ( decoded != frame ) {
+      std::stringstream ss;
+      ss << "距離データの圧縮と展開の結果が一致しません (" << w << "x" << h << ")";
+      throw std::runtime_error( ss.str() );
+    }
+  }
+};
+
+// 引数
+//   (なし)         Kinectの距離データで計測する
+//   <ファイル名>   記録したファイルの距離データで計測する(座標変換は計測しない)
+//
+//   -color <解像度> RGBカメラの解像度(座標変換の変換先、ResolutionSelector を参照)
+//   -depth <解像度> 距離カメラの解像度(ファイルの場合は記録したときの解像度)
+void main( int argc, char* argv[] )
+{
+  try {
+    ResolutionSelector resolutions;
+    resolutions.select( argc, argv );
+
+    KinectBenchmark benchmark;
+    if ( argc > 1 ) {
+      benchmark.load( argv[1] );
+    }
+    else {
+      benchmark.initialize( resolutions.getColorResolution(), resolutions.getDepthResolution() );
+      benchmark.record();
+    }
+
+    benchmark.run();
+  }
+  catch ( std::exception& ex ) {
+    std::cout << ex.what() << std::endl;
+  }
+}
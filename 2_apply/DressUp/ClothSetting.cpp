@@ -2,6 +2,10 @@
 
 
 ClothSetting::ClothSetting(void)
+  : sink( 0 )
+  , colorResolution( NUI_IMAGE_RESOLUTION_640x480 )
+  , depthResolution( NUI_IMAGE_RESOLUTION_640x480 )
+  , matteRadius( -1 )
 {
 }
 
@@ -29,6 +33,25 @@ void ClothSetting::setClothImage( std::string fileName )
   }
 }
 
+// d˂摜̏o͐w肷(0̏ꍇ͉ʂɕ\)
+void ClothSetting::setSink( FrameSink* frameSink )
+{
+  sink = frameSink;
+}
+
+// Kinect̉𑜓xw肷(w肵Ȃꍇ͂ǂ640x480)
+void ClothSetting::setResolution( NUI_IMAGE_RESOLUTION color, NUI_IMAGE_RESOLUTION depth )
+{
+  colorResolution = color;
+  depthResolution = depth;
+}
+
+// [U̗֊s킹tB^̔aw肷(w肵Ȃꍇ GuidedMatte ̊l)
+void ClothSetting::setMatteRadius( int radius )
+{
+  matteRadius = radius;
+}
+
 std::vector<cv::Point> ClothSetting::getPoints()
 {
   return points;
@@ -53,7 +76,13 @@ void ClothSetting::mouseCallback( int event, int x, int y, int flags )
       else if( points.size() == 4 ) {
         KinectControl kinect;
         kinect.setCloth( cloth, points );
-        kinect.initialize();
+        if ( sink != 0 ) {
+          kinect.setSink( sink );
+        }
+        if ( matteRadius >= 0 ) {
+          kinect.setMatteRadius( matteRadius );
+        }
+        kinect.initialize( colorResolution, depthResolution );
         kinect.run();
       }
       else {
@@ -10,6 +10,9 @@ public:
   ~ClothSetting(void);
 
   void setClothImage( std::string fileName );
+  void setSink( FrameSink* frameSink );
+  void setResolution( NUI_IMAGE_RESOLUTION color, NUI_IMAGE_RESOLUTION depth );
+  void setMatteRadius( int radius );
   std::vector<cv::Point> getPoints();
   cv::Mat getClothImage();
 
@@ -17,6 +20,10 @@ private:
   cv::Mat cloth;
   cv::Mat marked;
   std::vector<cv::Point> points;
+  FrameSink* sink;
+  NUI_IMAGE_RESOLUTION colorResolution;
+  NUI_IMAGE_RESOLUTION depthResolution;
+  int matteRadius;
 
   static void _mouseCallback( int event, int x, int y, int flags, void* param )
   {
@@ -0,0 +1,211 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <stdexcept>
+#include <string>
+
+// コンパイル時に決まる画像の大きさ
+//
+// 画素ごとの処理を、画像の大きさを定数にしたテンプレートで書くと、画素番号と
+// 座標の変換(i % width、i / width、y * width)やループの回数がすべて定数になる。
+// 対応する解像度ごとに実体化しておき、実行時の解像度から dispatchDepthSize などで選ぶ。
+template< int Width, int Height >
+struct FrameSize
+{
+  static const int WIDTH = Width;
+  static const int HEIGHT = Height;
+  static const int PIXELS = Width * Height;
+};
+
+typedef FrameSize< 80, 60 > FrameSize80x60;
+typedef FrameSize< 320, 240 > FrameSize320x240;
+typedef FrameSize< 640, 480 > FrameSize640x480;
+typedef FrameSize< 1280, 960 > FrameSize1280x960;
+
+// 距離カメラの解像度に合わせて、kernel( FrameSize<幅, 高さ>() ) を呼び出す
+//   対応する解像度 : 80x60、320x240、640x480
+template< typename Kernel >
+void dispatchDepthSize( NUI_IMAGE_RESOLUTION resolution, Kernel kernel )
+{
+  switch ( resolution ) {
+  case NUI_IMAGE_RESOLUTION_80x60:
+    kernel( FrameSize80x60() );
+    break;
+  case NUI_IMAGE_RESOLUTION_320x240:
+    kernel( FrameSize320x240() );
+    break;
+  case NUI_IMAGE_RESOLUTION_640x480:
+    kernel( FrameSize640x480() );
+    break;
+  default:
+    throw std::runtime_error( "対応していない距離カメラの解像度です" );
+  }
+}
+
+// RGBカメラの解像度に合わせて、kernel( FrameSize<幅, 高さ>() ) を呼び出す
+//   対応する解像度 : 640x480、1280x960
+template< typename Kernel >
+void dispatchColorSize( NUI_IMAGE_RESOLUTION resolution, Kernel kernel )
+{
+  switch ( resolution ) {
+  case NUI_IMAGE_RESOLUTION_640x480:
+    kernel( FrameSize640x480() );
+    break;
+  case NUI_IMAGE_RESOLUTION_1280x960:
+    kernel( FrameSize1280x960() );
+    break;
+  default:
+    throw std::runtime_error( "対応していないRGBカメラの解像度です" );
+  }
+}
+
+// 距離カメラの大きさを決めたあとで、RGBカメラの大きさを選ぶ
+template< typename Kernel, typename DepthSize >
+class ColorSizeDispatcher
+{
+public:
+
+  ColorSizeDispatcher( Kernel kernel )
+    : kernel_( kernel )
+  {
+  }
+
+  template< typename ColorSize >
+  void operator()( ColorSize colorSize )
+  {
+    kernel_( DepthSize(), colorSize );
+  }
+
+private:
+
+  Kernel kernel_;
+};
+
+template< typename Kernel >
+class DepthSizeDispatcher
+{
+public:
+
+  DepthSizeDispatcher( Kernel kernel, NUI_IMAGE_RESOLUTION colorResolution )
+    : kernel_( kernel )
+    , colorResolution_( colorResolution )
+  {
+  }
+
+  template< typename DepthSize >
+  void operator()( DepthSize )
+  {
+    dispatchColorSize( colorResolution_, ColorSizeDispatcher< Kernel, DepthSize >( kernel_ ) );
+  }
+
+private:
+
+  Kernel kernel_;
+  NUI_IMAGE_RESOLUTION colorResolution_;
+};
+
+// 距離カメラとRGBカメラの解像度の組み合わせに合わせて、kernel( 距離カメラの FrameSize, RGBカメラの FrameSize ) を呼び出す
+template< typename Kernel >
+void dispatchFrameSize( NUI_IMAGE_RESOLUTION depthResolution, NUI_IMAGE_RESOLUTION colorResolution, Kernel kernel )
+{
+  dispatchDepthSize( depthResolution, DepthSizeDispatcher< Kernel >( kernel, colorResolution ) );
+}
+
+// 解像度の名前("640x480" など)から解像度を求める(わからない場合は NUI_IMAGE_RESOLUTION_INVALID)
+inline NUI_IMAGE_RESOLUTION parseResolution( const std::string& name )
+{
+  if ( name == "80x60" ) {
+    return NUI_IMAGE_RESOLUTION_80x60;
+  }
+  else if ( name == "320x240" ) {
+    return NUI_IMAGE_RESOLUTION_320x240;
+  }
+  else if ( name == "640x480" ) {
+    return NUI_IMAGE_RESOLUTION_640x480;
+  }
+  else if ( name == "1280x960" ) {
+    return NUI_IMAGE_RESOLUTION_1280x960;
+  }
+
+  return NUI_IMAGE_RESOLUTION_INVALID;
+}
+
+// RGBカメラと距離カメラの解像度を、コマンドラインの引数から選ぶ
+//
+//   -color <解像度> : RGBカメラの解像度(640x480、1280x960)
+//   -depth <解像度> : 距離カメラの解像度(80x60、320x240、640x480)
+//
+// 指定しなかった場合は、コンストラクタで指定した解像度を使う。
+class ResolutionSelector
+{
+public:
+
+  ResolutionSelector( NUI_IMAGE_RESOLUTION colorResolution = NUI_IMAGE_RESOLUTION_640x480,
+    NUI_IMAGE_RESOLUTION depthResolution = NUI_IMAGE_RESOLUTION_640x480 )
+    : colorResolution_( colorResolution )
+    , depthResolution_( depthResolution )
+  {
+  }
+
+  // 引数から解像度の指定を取り出す
+  //   取り出した引数は argv から取り除き、argc を減らす
+  void select( int& argc, char* argv[] )
+  {
+    std::string color = take( argc, argv, "-color" );
+    if ( !color.empty() ) {
+      colorResolution_ = parseResolution( color );
+      dispatchColorSize( colorResolution_, Validator() );
+    }
+
+    std::string depth = take( argc, argv, "-depth" );
+    if ( !depth.empty() ) {
+      depthResolution_ = parseResolution( depth );
+      dispatchDepthSize( depthResolution_, Validator() );
+    }
+  }
+
+  NUI_IMAGE_RESOLUTION getColorResolution() const
+  {
+    return colorResolution_;
+  }
+
+  NUI_IMAGE_RESOLUTION getDepthResolution() const
+  {
+    return depthResolution_;
+  }
+
+private:
+
+  // 対応している解像度かどうかだけを調べる(対応していない場合は例外になる)
+  struct Validator
+  {
+    template< typename Size >
+    void operator()( Size )
+    {
+    }
+  };
+
+  // 引数から "option <値>" を取り出す(ない場合は空の文字列)
+  static std::string take( int& argc, char* argv[], const std::string& option )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == option ) {
+        std::string value = argv[i + 1];
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return value;
+      }
+    }
+
+    return "";
+  }
+
+private:
+
+  NUI_IMAGE_RESOLUTION colorResolution_;
+  NUI_IMAGE_RESOLUTION depthResolution_;
+};
@@ -0,0 +1,480 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "SpscQueue.h"
+
+// 処理した画像の出力先
+//
+// メインループは、1フレーム分の画像を present() で渡してから endFrame() を呼ぶ。
+// 画面への表示はこのインタフェースの実装の一つで、表示しない(ヘッドレス)場合は
+// NullFrameSink を使う。
+class FrameSink
+{
+public:
+
+  virtual ~FrameSink()
+  {
+  }
+
+  // 画像を出力する
+  //   name : 画像の種類(画面に表示する場合はウィンドウ名)
+  virtual void present( const std::string& name, const cv::Mat& image ) = 0;
+
+  // 1フレーム分の出力を終える(終了を要求された場合はfalse)
+  virtual bool endFrame() = 0;
+
+  // 出力が追いつかない場合に、フレームを捨ててよいかどうか
+  virtual bool isDroppable() const
+  {
+    return true;
+  }
+
+  // 画面に表示するかどうか
+  virtual bool isVisible() const
+  {
+    return false;
+  }
+};
+
+// 何も出力しない(ヘッドレス)
+class NullFrameSink : public FrameSink
+{
+public:
+
+  void present( const std::string& name, const cv::Mat& image )
+  {
+  }
+
+  bool endFrame()
+  {
+    return true;
+  }
+};
+
+// 画面に表示する
+//
+// cv::waitKey() はウィンドウの更新のために、最小の1ミリ秒だけ待つ。
+// 'q' キーで終了を要求する。
+class ScreenFrameSink : public FrameSink
+{
+public:
+
+  // コンストラクタ
+  //   wait : 1フレームごとに cv::waitKey() で待つ時間(ミリ秒)
+  ScreenFrameSink( int wait = 1 )
+    : wait_( wait )
+  {
+  }
+
+  void present( const std::string& name, const cv::Mat& image )
+  {
+    cv::imshow( name, image );
+  }
+
+  bool endFrame()
+  {
+    // 終了のためのキー入力チェック兼、表示のためのウェイト
+    int key = cv::waitKey( wait_ );
+    return key != 'q';
+  }
+
+  bool isVisible() const
+  {
+    return true;
+  }
+
+private:
+
+  int wait_;
+};
+
+// 連番の画像ファイルに保存する
+//
+// ファイル名は「接頭辞_画像の種類_フレーム番号.png」になる。
+// フレームを捨てずにすべて保存する。
+class ImageSequenceFrameSink : public FrameSink
+{
+public:
+
+  ImageSequenceFrameSink()
+    : frameNumber_( 0 )
+  {
+  }
+
+  // 保存を始める
+  void open( const std::string& prefix )
+  {
+    prefix_ = prefix;
+    frameNumber_ = 0;
+  }
+
+  void present( const std::string& name, const cv::Mat& image )
+  {
+    std::stringstream ss;
+    ss << prefix_ << "_" << toFileName( name ) << "_" << std::setw( 6 ) << std::setfill( '0' ) << frameNumber_ << ".png";
+
+    std::string fileName = ss.str();
+    if ( !cv::imwrite( fileName, image ) ) {
+      throw std::runtime_error( "画像を保存できません : " + fileName );
+    }
+  }
+
+  bool endFrame()
+  {
+    ++frameNumber_;
+    return true;
+  }
+
+  bool isDroppable() const
+  {
+    return false;
+  }
+
+private:
+
+  // ファイル名に使えない文字を '_' にする
+  static std::string toFileName( const std::string& name )
+  {
+    std::string fileName = name;
+    for ( size_t i = 0; i < fileName.size(); ++i ) {
+      if ( std::string( " \\/:*?\"<>|" ).find( fileName[i] ) != std::string::npos ) {
+        fileName[i] = '_';
+      }
+    }
+
+    return fileName;
+  }
+
+private:
+
+  std::string prefix_;
+  int frameNumber_;
+};
+
+// 共有メモリの先頭に置くヘッダー
+//
+// 読み出す側は、sequence が偶数であることを確認してから画像をコピーし、
+// コピーの後で sequence が変わっていないことを確認する(奇数は書き込み中)。
+struct SharedFrameHeader
+{
+  DWORD magic;                // SHARED_FRAME_MAGIC
+  DWORD capacity;             // 画像データの領域の大きさ(バイト)
+  volatile LONG sequence;     // 書き込むたびに2ずつ増える
+  DWORD frameNumber;          // 書き込んだフレームの番号
+  int width;
+  int height;
+  int type;                   // cv::Mat の型(CV_8UC4 など)
+  DWORD step;                 // 1行のバイト数
+};
+
+const DWORD SHARED_FRAME_MAGIC = 0x4D524653;  // "SFRM"
+
+// 共有メモリに書き込む
+//
+// 画像の種類ごとに「名前_画像の種類」という名前の共有メモリを作成し、
+// ヘッダー(SharedFrameHeader)の後に最新の画像を書き込む。
+// 共有メモリの大きさは最初の画像で決まり、それより大きな画像は書き込めない。
+class SharedMemoryFrameSink : public FrameSink
+{
+public:
+
+  SharedMemoryFrameSink()
+    : frameNumber_( 0 )
+  {
+  }
+
+  ~SharedMemoryFrameSink()
+  {
+    close();
+  }
+
+  // 書き込みを始める
+  void open( const std::string& name )
+  {
+    close();
+    name_ = name;
+  }
+
+  void close()
+  {
+    for ( std::map< std::string, Mapping >::iterator it = mappings_.begin(); it != mappings_.end(); ++it ) {
+      ::UnmapViewOfFile( it->second.header );
+      ::CloseHandle( it->second.handle );
+    }
+
+    mappings_.clear();
+    frameNumber_ = 0;
+  }
+
+  void present( const std::string& name, const cv::Mat& image )
+  {
+    Mapping& mapping = getMapping( name, image );
+
+    DWORD rowSize = (DWORD)(image.cols * image.elemSize());
+    if ( rowSize * image.rows > mapping.header->capacity ) {
+      throw std::runtime_error( "共有メモリより大きな画像は書き込めません : " + name );
+    }
+
+    SharedFrameHeader* header = mapping.header;
+    ::InterlockedIncrement( &header->sequence );
+
+    header->frameNumber = frameNumber_;
+    header->width = image.cols;
+    header->height = image.rows;
+    header->type = image.type();
+    header->step = rowSize;
+
+    BYTE* data = (BYTE*)(header + 1);
+    for ( int y = 0; y < image.rows; ++y ) {
+      memcpy( data + (y * rowSize), image.ptr( y ), rowSize );
+    }
+
+    ::InterlockedIncrement( &header->sequence );
+  }
+
+  bool endFrame()
+  {
+    ++frameNumber_;
+    return true;
+  }
+
+private:
+
+  struct Mapping
+  {
+    HANDLE handle;
+    SharedFrameHeader* header;
+  };
+
+  // 画像の種類の共有メモリを取得する(ない場合は作成する)
+  Mapping& getMapping( const std::string& name, const cv::Mat& image )
+  {
+    std::map< std::string, Mapping >::iterator it = mappings_.find( name );
+    if ( it != mappings_.end() ) {
+      return it->second;
+    }
+
+    DWORD capacity = (DWORD)(image.total() * image.elemSize());
+    std::string mappingName = name_ + "_" + name;
+    HANDLE handle = ::CreateFileMappingA( INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0,
+      sizeof(SharedFrameHeader) + capacity, mappingName.c_str() );
+    if ( handle == 0 ) {
+      throw std::runtime_error( "共有メモリを作成できません : " + mappingName );
+    }
+
+    SharedFrameHeader* header = (SharedFrameHeader*)::MapViewOfFile( handle, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+    if ( header == 0 ) {
+      ::CloseHandle( handle );
+      throw std::runtime_error( "共有メモリを割り当てられません : " + mappingName );
+    }
+
+    memset( header, 0, sizeof(SharedFrameHeader) );
+    header->magic = SHARED_FRAME_MAGIC;
+    header->capacity = capacity;
+
+    Mapping mapping = { handle, header };
+    return mappings_[name] = mapping;
+  }
+
+private:
+
+  std::string name_;
+  std::map< std::string, Mapping > mappings_;
+  DWORD frameNumber_;
+};
+
+// 別のスレッドで出力する
+//
+// present() は画像をコピーしてキューに入れるだけで、出力は専用のスレッドで行う。
+// 出力先がフレームを捨ててよい場合(画面、共有メモリなど)は、出力が追いつかなくても
+// 最新のフレームだけを出力して、呼び出したメインループを待たせない。
+// 画面に表示する場合、ウィンドウは出力のスレッドで作成される。
+class AsyncFrameSink : public FrameSink
+{
+public:
+
+  AsyncFrameSink()
+    : sink_( 0 )
+    , thread_( 0 )
+    , queue_( 0 )
+    , isQuit_( 0 )
+  {
+  }
+
+  ~AsyncFrameSink()
+  {
+    close();
+  }
+
+  // 出力を始める
+  void open( FrameSink* sink )
+  {
+    close();
+
+    sink_ = sink;
+    isQuit_ = 0;
+    queue_ = new SpscQueue< Frame >( 2, sink_->isDroppable() ? QUEUE_DROP_OLDEST : QUEUE_BLOCK );
+    thread_ = ::CreateThread( 0, 0, &AsyncFrameSink::threadProc, this, 0, 0 );
+  }
+
+  // 出力を終える(キューに残っているフレームを出力してから終える)
+  void close()
+  {
+    if ( thread_ == 0 ) {
+      return;
+    }
+
+    queue_->close();
+    ::WaitForSingleObject( thread_, INFINITE );
+    ::CloseHandle( thread_ );
+    thread_ = 0;
+
+    delete queue_;
+    queue_ = 0;
+  }
+
+  void present( const std::string& name, const cv::Mat& image )
+  {
+    pending_.names.push_back( name );
+    pending_.images.push_back( image.clone() );
+  }
+
+  bool endFrame()
+  {
+    queue_->push( pending_ );
+    pending_ = Frame();
+    return isQuit_ == 0;
+  }
+
+  bool isDroppable() const
+  {
+    return sink_->isDroppable();
+  }
+
+  bool isVisible() const
+  {
+    return sink_->isVisible();
+  }
+
+private:
+
+  // 1フレーム分の画像
+  struct Frame
+  {
+    std::vector< std::string > names;
+    std::vector< cv::Mat > images;
+  };
+
+  static DWORD WINAPI threadProc( LPVOID param )
+  {
+    ((AsyncFrameSink*)param)->presentFrames();
+    return 0;
+  }
+
+  // キューからフレームを取り出して出力する
+  void presentFrames()
+  {
+    try {
+      Frame frame;
+      while ( queue_->pop( frame ) ) {
+        for ( size_t i = 0; i < frame.names.size(); ++i ) {
+          sink_->present( frame.names[i], frame.images[i] );
+        }
+
+        if ( !sink_->endFrame() ) {
+          ::InterlockedExchange( &isQuit_, 1 );
+        }
+      }
+    }
+    catch ( std::exception& ex ) {
+      // 出力できなくなった場合は、メインループに終了を要求する
+      std::cout << "AsyncFrameSink::presentFrames " << ex.what() << std::endl;
+      ::InterlockedExchange( &isQuit_, 1 );
+      queue_->close();
+
+      Frame frame;
+      while ( queue_->pop( frame ) ) {
+      }
+    }
+  }
+
+private:
+
+  FrameSink* sink_;
+  HANDLE thread_;
+  SpscQueue< Frame >* queue_;
+  volatile LONG isQuit_;
+
+  Frame pending_;   // present() で受け取った、キューに入れる前の画像
+};
+
+// 引数で指定した出力先
+//
+//   screen           画面に表示する(指定しない場合)
+//   null             出力しない(ヘッドレス)
+//   images:<接頭辞>  連番の画像ファイルに保存する
+//   shm:<名前>       共有メモリに書き込む
+class FrameSinkSelector
+{
+public:
+
+  // 引数から出力先の指定(-sink <出力先>)を取り出して、出力先を返す
+  //   取り出した引数は argv から取り除き、argc を減らす
+  FrameSink* select( int& argc, char* argv[] )
+  {
+    std::string spec = "screen";
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-sink" ) {
+        spec = argv[i + 1];
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        break;
+      }
+    }
+
+    return select( spec );
+  }
+
+  FrameSink* select( const std::string& spec )
+  {
+    std::string type = spec.substr( 0, spec.find( ':' ) );
+    std::string argument = (spec.find( ':' ) != std::string::npos) ? spec.substr( spec.find( ':' ) + 1 ) : "";
+
+    if ( type == "screen" ) {
+      return &screen_;
+    }
+    else if ( type == "null" ) {
+      return &null_;
+    }
+    else if ( (type == "images") && !argument.empty() ) {
+      images_.open( argument );
+      return &images_;
+    }
+    else if ( (type == "shm") && !argument.empty() ) {
+      shared_.open( argument );
+      return &shared_;
+    }
+
+    throw std::runtime_error( "出力先の指定が正しくありません : " + spec );
+  }
+
+private:
+
+  ScreenFrameSink screen_;
+  NullFrameSink null_;
+  ImageSequenceFrameSink images_;
+  SharedMemoryFrameSink shared_;
+};
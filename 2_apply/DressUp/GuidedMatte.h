@@ -0,0 +1,321 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <emmintrin.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// 距離カメラから作った粗いマスクを、RGBカメラの画像の輪郭に合わせた透明度(アルファマット)にする
+//
+// RGBカメラの画像の明るさをガイドにしたガイデッドフィルタで、マスクを滑らかにする。
+//   mean_a * I + mean_b  (a = cov(I, p) / (var(I) + epsilon)、b = mean(p) - a * mean(I))
+// 処理を軽くするために、縦横 1/2 の大きさで係数 a、b を求めてから、元の大きさに拡大して使う。
+// 平均は、列の和と行の和を順に足し引きするボックスフィルタで求める(半径によらず1画素あたり一定の計算量)。
+// 列の和の更新と係数の計算は、SSE2が使える場合は4画素ずつ行う。
+// 縮小と拡大は行の帯ごとに、独立したボックスフィルタはそれぞれ並列に行う。
+class GuidedMatte
+{
+public:
+
+  enum
+  {
+    BAND_ROWS = 16      // 並列に処理する行の帯の行数
+  };
+
+  GuidedMatte()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , radius_( 8 )
+    , epsilon_( 0.002f )
+    , width_( 0 )
+    , height_( 0 )
+  {
+  }
+
+  // 引数から、フィルタの半径を取り出す(-matte <半径>、0は粗いマスクのまま)
+  // 指定がない場合は -1 を返す
+  static int selectRadius( int& argc, char* argv[] )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-matte" ) {
+        int radius = atoi( argv[i + 1] );
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return radius;
+      }
+    }
+
+    return -1;
+  }
+
+  // フィルタの半径(RGBカメラの画素数、0は使わない)
+  void setRadius( int radius )
+  {
+    radius_ = std::max( radius, 0 );
+  }
+
+  bool isEnabled() const
+  {
+    return radius_ > 0;
+  }
+
+  // マスクの外側で、透明度が0でなくなりうる幅(画素数)
+  int getReach() const
+  {
+    return radius_ * 2 + 2;
+  }
+
+  // 粗いマスクから透明度を求める
+  //   color : RGBカメラの画像(CV_8UC4)
+  //   mask  : 粗いマスク(CV_8UC1、プレイヤーは0以外。穴があってもよい)
+  //   alpha : 透明度(CV_8UC1、255がプレイヤー)
+  void refine( const cv::Mat& color, const cv::Mat& mask, cv::Mat& alpha )
+  {
+    resize( color.cols / 2, color.rows / 2 );
+    const int r = std::max( radius_ / 2, 1 );
+
+    // 1/2 に縮小する(マスクは2x2画素のどれかがプレイヤーならプレイヤーにして、穴を埋める)
+    Concurrency::parallel_for( 0, (height_ + BAND_ROWS - 1) / BAND_ROWS, [&]( int band ) {
+      for ( int y = band * BAND_ROWS; y < std::min( (band + 1) * BAND_ROWS, height_ ); ++y ) {
+        shrink( color, mask, y );
+      }
+    } );
+
+    // 画素ごとの平均を求める(窓の中の画素数の逆数は、列ごとに求めておく)
+    for ( int x = 0; x < width_; ++x ) {
+      inverseColumns_[x] = 1.0f / (float)(std::min( x + r, width_ - 1 ) - std::max( x - r, 0 ) + 1);
+    }
+
+    float* sources[] = { &guide_[0], &input_[0], &guideSquare_[0], &guideInput_[0] };
+    float* means[] = { &meanGuide_[0], &meanInput_[0], &meanGuideSquare_[0], &meanGuideInput_[0] };
+    Concurrency::parallel_for( 0, 4, [&]( int k ) {
+      boxFilter( sources[k], means[k], r, &columnSum_[k * width_] );
+    } );
+
+    // 係数 a、b を求めて(使い終わった画像に書き込む)、平均する
+    //   平均した a、b は meanGuide_、meanInput_ に入れる
+    coefficients( &guideSquare_[0], &guideInput_[0] );
+    Concurrency::parallel_for( 0, 2, [&]( int k ) {
+      boxFilter( sources[k + 2], means[k], r, &columnSum_[k * width_] );
+    } );
+
+    // 係数を拡大して、元の大きさのガイドに当てはめる
+    alpha.create( color.rows, color.cols, CV_8UC1 );
+    Concurrency::parallel_for( 0, (color.rows + BAND_ROWS - 1) / BAND_ROWS, [&]( int band ) {
+      for ( int y = band * BAND_ROWS; y < std::min( (band + 1) * BAND_ROWS, color.rows ); ++y ) {
+        apply( color.ptr< BYTE >( y ), y, alpha.ptr< BYTE >( y ), color.cols );
+      }
+    } );
+  }
+
+private:
+
+  void resize( int width, int height )
+  {
+    if ( (width == width_) && (height == height_) ) {
+      return;
+    }
+
+    width_ = width;
+    height_ = height;
+
+    const int count = width * height;
+    guide_.resize( count );
+    input_.resize( count );
+    guideSquare_.resize( count );
+    guideInput_.resize( count );
+    meanGuide_.resize( count );
+    meanInput_.resize( count );
+    meanGuideSquare_.resize( count );
+    meanGuideInput_.resize( count );
+    columnSum_.resize( width * 4 );
+    inverseColumns_.resize( width );
+  }
+
+  // BGRAの明るさ(0〜1)
+  static float luminance( const BYTE* bgra )
+  {
+    return ((bgra[0] * 29 + bgra[1] * 150 + bgra[2] * 77) >> 8) * (1.0f / 255.0f);
+  }
+
+  // 縮小した画像の y 行目を作る(ガイドの2乗、ガイドとマスクの積も求める)
+  void shrink( const cv::Mat& color, const cv::Mat& mask, int y )
+  {
+    const BYTE* c0 = color.ptr< BYTE >( y * 2 );
+    const BYTE* c1 = color.ptr< BYTE >( y * 2 + 1 );
+    const BYTE* m0 = mask.ptr< BYTE >( y * 2 );
+    const BYTE* m1 = mask.ptr< BYTE >( y * 2 + 1 );
+    float* guide = &guide_[y * width_];
+    float* input = &input_[y * width_];
+    float* guideSquare = &guideSquare_[y * width_];
+    float* guideInput = &guideInput_[y * width_];
+    for ( int x = 0; x < width_; ++x ) {
+      float i = (luminance( c0 + x * 8 ) + luminance( c0 + x * 8 + 4 ) +
+        luminance( c1 + x * 8 ) + luminance( c1 + x * 8 + 4 )) * 0.25f;
+      float p = (m0[x * 2] | m0[x * 2 + 1] | m1[x * 2] | m1[x * 2 + 1]) ? 1.0f : 0.0f;
+      guide[x] = i;
+      input[x] = p;
+      guideSquare[x] = i * i;
+      guideInput[x] = i * p;
+    }
+  }
+
+  // 半径 r の正方形の平均(画像の端では、画像の中にある画素だけの平均)
+  //   columnSum : 列の和を入れる作業用の領域(width_ 個)
+  void boxFilter( const float* source, float* destination, int r, float* columnSum ) const
+  {
+    // 最初の行の窓に入る行の和
+    std::fill( columnSum, columnSum + width_, 0.0f );
+    for ( int y = 0; y <= std::min( r, height_ - 1 ); ++y ) {
+      addRow( columnSum, source + y * width_, 1.0f );
+    }
+
+    for ( int y = 0; y < height_; ++y ) {
+      // 窓に入った行を足して、窓から出た行を引く
+      if ( y > 0 ) {
+        if ( y + r < height_ ) {
+          addRow( columnSum, source + (y + r) * width_, 1.0f );
+        }
+        if ( y - r - 1 >= 0 ) {
+          addRow( columnSum, source + (y - r - 1) * width_, -1.0f );
+        }
+      }
+      const float inverseRows = 1.0f / (float)(std::min( y + r, height_ - 1 ) - std::max( y - r, 0 ) + 1);
+
+      // 横方向も同じように足し引きする
+      float sum = 0;
+      for ( int x = 0; x <= std::min( r, width_ - 1 ); ++x ) {
+        sum += columnSum[x];
+      }
+
+      float* row = destination + y * width_;
+      for ( int x = 0; x < width_; ++x ) {
+        if ( x > 0 ) {
+          if ( x + r < width_ ) {
+            sum += columnSum[x + r];
+          }
+          if ( x - r - 1 >= 0 ) {
+            sum -= columnSum[x - r - 1];
+          }
+        }
+        row[x] = sum * inverseRows * inverseColumns_[x];
+      }
+    }
+  }
+
+  // 列の和に、1行分を sign 倍して足す
+  void addRow( float* sum, const float* row, float sign ) const
+  {
+    int x = 0;
+    if ( isSse2_ ) {
+      const __m128 s = _mm_set1_ps( sign );
+      for ( ; x + 4 <= width_; x += 4 ) {
+        __m128 v = _mm_add_ps( _mm_loadu_ps( sum + x ), _mm_mul_ps( _mm_loadu_ps( row + x ), s ) );
+        _mm_storeu_ps( sum + x, v );
+      }
+    }
+
+    for ( ; x < width_; ++x ) {
+      sum[x] += row[x] * sign;
+    }
+  }
+
+  // 係数 a = cov(I, p) / (var(I) + epsilon)、b = mean(p) - a * mean(I)
+  void coefficients( float* a, float* b ) const
+  {
+    const int count = width_ * height_;
+    const float* meanI = &meanGuide_[0];
+    const float* meanP = &meanInput_[0];
+    const float* meanII = &meanGuideSquare_[0];
+    const float* meanIP = &meanGuideInput_[0];
+
+    int i = 0;
+    if ( isSse2_ ) {
+      const __m128 epsilon = _mm_set1_ps( epsilon_ );
+      for ( ; i + 4 <= count; i += 4 ) {
+        __m128 mi = _mm_loadu_ps( meanI + i );
+        __m128 mp = _mm_loadu_ps( meanP + i );
+        __m128 variance = _mm_sub_ps( _mm_loadu_ps( meanII + i ), _mm_mul_ps( mi, mi ) );
+        __m128 covariance = _mm_sub_ps( _mm_loadu_ps( meanIP + i ), _mm_mul_ps( mi, mp ) );
+        __m128 va = _mm_div_ps( covariance, _mm_add_ps( variance, epsilon ) );
+        _mm_storeu_ps( a + i, va );
+        _mm_storeu_ps( b + i, _mm_sub_ps( mp, _mm_mul_ps( va, mi ) ) );
+      }
+    }
+
+    for ( ; i < count; ++i ) {
+      float variance = meanII[i] - meanI[i] * meanI[i];
+      float covariance = meanIP[i] - meanI[i] * meanP[i];
+      a[i] = covariance / (variance + epsilon_);
+      b[i] = meanP[i] - a[i] * meanI[i];
+    }
+  }
+
+  // 元の大きさの y 行目に、平均した係数を(線形補間で拡大して)当てはめる
+  //   縮小した画像での位置は (x - 0.5) / 2 なので、k 列目の係数から 2k 列目と 2k + 1 列目を求める
+  void apply( const BYTE* color, int y, BYTE* alpha, int width ) const
+  {
+    const int y0 = (y == 0) ? 0 : std::min( (y - 1) / 2, height_ - 1 );
+    const float wy = (y == 0) ? 0.0f : ((y & 1) ? 0.25f : 0.75f);
+    const float* a0 = &meanGuide_[y0 * width_];
+    const float* a1 = &meanGuide_[std::min( y0 + 1, height_ - 1 ) * width_];
+    const float* b0 = &meanInput_[y0 * width_];
+    const float* b1 = &meanInput_[std::min( y0 + 1, height_ - 1 ) * width_];
+
+    float aPrevious = a0[0] + (a1[0] - a0[0]) * wy;
+    float bPrevious = b0[0] + (b1[0] - b0[0]) * wy;
+    float aCurrent = aPrevious;
+    float bCurrent = bPrevious;
+    for ( int k = 0; k < width_; ++k ) {
+      const int next = std::min( k + 1, width_ - 1 );
+      const float aNext = a0[next] + (a1[next] - a0[next]) * wy;
+      const float bNext = b0[next] + (b1[next] - b0[next]) * wy;
+
+      const int x = k * 2;
+      alpha[x] = matte( aCurrent + (aPrevious - aCurrent) * 0.25f, bCurrent + (bPrevious - bCurrent) * 0.25f, color + x * 4 );
+      alpha[x + 1] = matte( aCurrent + (aNext - aCurrent) * 0.25f, bCurrent + (bNext - bCurrent) * 0.25f, color + x * 4 + 4 );
+
+      aPrevious = aCurrent;
+      bPrevious = bCurrent;
+      aCurrent = aNext;
+      bCurrent = bNext;
+    }
+
+    // 幅が奇数の場合の最後の列
+    for ( int x = width_ * 2; x < width; ++x ) {
+      alpha[x] = matte( aCurrent, bCurrent, color + x * 4 );
+    }
+  }
+
+  static BYTE matte( float a, float b, const BYTE* bgra )
+  {
+    float q = a * luminance( bgra ) + b;
+    return (BYTE)(std::max( 0.0f, std::min( q, 1.0f ) ) * 255.0f + 0.5f);
+  }
+
+  bool isSse2_;
+  int radius_;
+  float epsilon_;
+
+  // 縮小した画像の大きさ
+  int width_;
+  int height_;
+
+  std::vector< float > guide_;            // ガイド(明るさ)
+  std::vector< float > input_;            // マスク(0か1)
+  std::vector< float > guideSquare_;
+  std::vector< float > guideInput_;
+  std::vector< float > meanGuide_;
+  std::vector< float > meanInput_;
+  std::vector< float > meanGuideSquare_;
+  std::vector< float > meanGuideInput_;
+  std::vector< float > columnSum_;        // ボックスフィルタの作業用(同時に処理する4つの分)
+  std::vector< float > inverseColumns_;   // 列ごとの、窓の中の列数の逆数
+};
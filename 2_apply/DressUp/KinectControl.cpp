@@ -2,162 +2,233 @@
 
 
 KinectControl::KinectControl()
+  : source( 0 )
+  , sink( &screen )
 {
+  // xvi(LatencyStage ̏)
+  latencyMonitor.addStage( "acquire" );
+  latencyMonitor.addStage( "mapping" );
+  latencyMonitor.addStage( "analysis" );
+  latencyMonitor.addStage( "draw" );
+  latencyMonitor.addStage( "present" );
 }
 
 
 KinectControl::~KinectControl()
 {
-  if ( kinect != 0 ) {
-    kinect->NuiShutdown();
-    kinect->Release();
-  }
 }
 
-void KinectControl::initialize()
+void KinectControl::initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
 {
-  createInstance();
+  // Kinect
+  kinect.initialize( colorResolution, depthResolution, 0, true );
 
-  // Kinect̐ݒ
-  ERROR_CHECK( kinect->NuiInitialize( NUI_INITIALIZE_FLAG_USES_COLOR | NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON ) );
+  initialize( &kinect );
+}
 
-  // RGBJ
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR, CAMERA_RESOLUTION, 0, 2, 0, &imageStreamHandle ) );
+void KinectControl::initialize( FrameSource* frameSource )
+{
+  source = frameSource;
 
-  // J
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION, 0, 2, 0, &depthStreamHandle ) );
+  // w肵𑜓x́AʃTCY擾
+  ::NuiImageResolutionToSize( source->getColorResolution(), width, height );
+  ::NuiImageResolutionToSize( source->getDepthResolution(), depthWidth, depthHeight );
 
-  // XPg
-  ERROR_CHECK( kinect->NuiSkeletonTrackingEnable( 0, NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA ) );
+  // JRGBJւ̍Wϊe[u쐬
+  registration.initialize( *source, source->getColorResolution(), source->getDepthResolution() );
+}
 
-  // t[XVCxg̃nh쐬
-  streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
-  ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+// 摜̏o͐w肷(w肵Ȃꍇ͉ʂɕ\)
+void KinectControl::setSink( FrameSink* frameSink )
+{
+  sink = frameSink;
+}
 
-  // w肵𑜓x́AʃTCY擾
-  ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+// [U̗֊s킹tB^̔aw肷(0͋J̃}XN̂܂)
+void KinectControl::setMatteRadius( int radius )
+{
+  matte.setRadius( radius );
 }
 
 void KinectControl::run()
 {
-  // C[v
-  while ( 1 ) {
-    try {
-      // f[^̍XV҂
-      DWORD ret = ::WaitForSingleObject( streamEvent, INFINITE );
-      ::ResetEvent( streamEvent );
-
-      setRgbImage( rgbImage );
-      setDepthImage( depthImage );
-      setSkeleton( depthImage );
-      fitCloth();
-
-      // Î߂̃L[̓`FbNA\̂߂̃EFCg
-      int key = cv::waitKey( 10 );
-      if ( key == 'q' ) {
-        break;
-      }
-    }
-    catch( std::exception &e ) {
-      std::cerr << e.what() << std::endl;
-    }
-  }
+  // 擾Af[^̕ϊÁA\ꂼ̃Xbhōs
+  Pipeline< DressUpFrame > pipeline;
+  pipeline.setSource( "acquire", [this]( DressUpFrame& frame ) { return acquireFrame( frame ); } );
+  pipeline.addStage( "registration", [this]( DressUpFrame& frame ) { return registerFrame( frame ); } );
+  pipeline.addStage( "analysis", [this]( DressUpFrame& frame ) { return analyzeFrame( frame ); } );
+
+  // \xꂽꍇ́AŐṼt[\(摜t@Cւ̕ۑȂǂ͎̂Ăɑ҂)
+  pipeline.run( "present", [this]( DressUpFrame& frame ) { return presentFrame( frame ); },
+    2, sink->isDroppable() ? QUEUE_DROP_OLDEST : QUEUE_BLOCK );
+
+  pipeline.printStatistics( std::cout );
+  latencyMonitor.printStatistics( std::cout );
+  playerStatistics.printStatistics( std::cout );
 }
 
-void KinectControl::createInstance()
+// f[^̕ϊƁAd˂鏈̏Ԃv(\͂Ȃ)
+void KinectControl::benchmark( KernelBenchmark& kernelBenchmark )
 {
-  // ڑĂKinect̐擾
-  int count = 0;
-  ERROR_CHECK( ::NuiGetSensorCount( &count ) );
-  if ( count == 0 ) {
-    throw std::runtime_error( "Kinect ڑĂ" );
+  // vɎgt[Ɏ擾āAf[^ϊĂ
+  std::vector< DressUpFrame > frames;
+  DressUpFrame acquired;
+  while ( (frames.size() < BENCHMARK_FRAME_COUNT) && acquireFrame( acquired ) ) {
+    if ( !acquired.rgbFrame.empty() ) {
+      registerFrame( acquired );
+      frames.push_back( acquired );
+    }
+    acquired = DressUpFrame();
+  }
+  if ( frames.empty() ) {
+    throw std::runtime_error( "vɎgt[܂" );
   }
 
-  // ŏKinect̃CX^X쐬
-  ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
+  kernelBenchmark.printHeader( std::cout, "DressUp" );
 
-  // Kinect̏Ԃ擾
-  HRESULT status = kinect->NuiStatus();
-  if ( status != S_OK ) {
-    throw std::runtime_error( "Kinect p\ł͂܂" );
-  }
+  // f[^𕪂邾̏ꍇƁAvC[Ƃ̓vώZȂ番ꍇׂ
+  double unpackTime = kernelBenchmark.run( "unpack", [&]( int i ) {
+    const FrameHandle& depthFrame = frames[i % frames.size()].depthFrame;
+    if ( !depthFrame.empty() ) {
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight );
+    }
+  } );
+  double statisticsTime = kernelBenchmark.run( "unpack+statistics", [&]( int i ) {
+    const FrameHandle& depthFrame = frames[i % frames.size()].depthFrame;
+    if ( !depthFrame.empty() ) {
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight, playerStatistics );
+    }
+  } );
+  std::cout << "  statistics overhead " << std::fixed << std::setprecision( 0 )
+            << (statisticsTime - unpackTime) << " ns/frame" << std::endl;
+
+  kernelBenchmark.run( "setDepthImage", [&]( int i ) {
+    DressUpFrame& frame = frames[i % frames.size()];
+    setDepthImage( frame.depthFrame, frame.depthImage, frame.userRuns );
+  } );
+
+  // ̈ʒúAXPg狁߂Ȃ(fitCloth Ŋ֐߂̈ʒu邽)
+  kernelBenchmark.run( "fitCloth",
+    [&]( int i ) {
+      DressUpFrame& frame = frames[i % frames.size()];
+      rgbImage = cv::Mat( height, width, CV_8UC4, frame.rgbFrame.bits() );
+      depthImage = frame.depthImage;
+      joints.clear();
+      if ( frame.isSkeleton ) {
+        setSkeleton( frame.skeletonFrame, depthImage );
+      }
+    },
+    [&]( int i ) {
+      fitCloth( frames[i % frames.size()].userRuns, frames[i % frames.size()].userRoi );
+    } );
 }
 
-void KinectControl::setRgbImage( cv::Mat& image )
+bool KinectControl::acquireFrame( DressUpFrame& frame )
 {
-  try {
-    // RGBJ̃t[f[^擾
-    NUI_IMAGE_FRAME imageFrame = { 0 };
-    ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( imageStreamHandle, 0, &imageFrame ) );
-
-    // 摜f[^擾
-    NUI_LOCKED_RECT colorData;
-    imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
+  // f[^̍XV҂
+  if ( !source->waitFrame() ) {
+    return false;
+  }
 
-    // 摜f[^Rs[
-    image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+  latencyMonitor.arrive( frame.latency );
 
-    // t[f[^
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
+  try {
+    // RGBJ̃t[f[^擾
+    ERROR_CHECK( source->acquireColorFrame( frame.rgbFrame ) );
+    frame.latency.sensorTime = frame.rgbFrame.frame().timeStamp;
   }
   catch ( std::exception& ex ) {
-    std::cout << "KinectControl::setRgbImage" << ex.what() << std::endl;
+    std::cout << "KinectControl::acquireFrame" << ex.what() << std::endl;
+    return true;
   }
+
+  // J̃t[f[^擾(擾łȂꍇ͋̂܂)
+  source->acquireDepthFrame( frame.depthFrame );
+
+  // XPg̃t[擾
+  frame.isSkeleton = (source->getSkeletonFrame( frame.skeletonFrame ) == S_OK);
+  latencyMonitor.stamp( frame.latency, LATENCY_ACQUIRE );
+
+  return true;
 }
 
-void KinectControl::setDepthImage( cv::Mat& image )
+bool KinectControl::registerFrame( DressUpFrame& frame )
 {
-  try {
-    userMask = cv::Mat( height, width, CV_8UC1, cv::Scalar( 0 ) );
-    image = cv::Mat( height, width, CV_8UC1, cv::Scalar ( 0 ) );
+  setDepthImage( frame.depthFrame, frame.depthImage, frame.userRuns );
 
-    // J̃t[f[^擾
-    NUI_IMAGE_FRAME depthFrame = { 0 };
-    ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( depthStreamHandle, 0, &depthFrame ) );
+  // [Ü̗ǐՂāAd˂͈͂ɂ(x߂ꍇ́AxL镪܂߂)
+  userTracker.update( frame.userRuns, registeredDistance );
+  frame.userRoi = userTracker.getRoi( 0, USER_ROI_MARGIN + (matte.isEnabled() ? matte.getReach() : 0) );
+  latencyMonitor.stamp( frame.latency, LATENCY_MAPPING );
+  return true;
+}
 
-    // f[^擾
-    NUI_LOCKED_RECT depthData = { 0 };
-    depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
+bool KinectControl::analyzeFrame( DressUpFrame& frame )
+{
+  // RGB摜擾łȂt[͎̂Ă
+  if ( frame.rgbFrame.empty() ) {
+    return false;
+  }
 
-    USHORT* depth = (USHORT*)depthData.pBits;
-    for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
-      USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
-      USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
+  // ́ARGBJ̃t[ɒڏd˂
+  rgbImage = cv::Mat( height, width, CV_8UC4, frame.rgbFrame.bits() );
+  depthImage = frame.depthImage;
 
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX = depthX;
-      LONG colorY = depthY;
+  if ( frame.isSkeleton ) {
+    setSkeleton( frame.skeletonFrame, depthImage );
+  }
+  latencyMonitor.stamp( frame.latency, LATENCY_ANALYSIS );
 
-      // J̍WARGBJ̍Wɕϊ
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, depthX , depthY, 0, &colorX, &colorY );
+  frame.isFitted = fitCloth( frame.userRuns, frame.userRoi );
+  frame.rgbImage = rgbImage;
+  latencyMonitor.stamp( frame.latency, LATENCY_DRAW );
+  return true;
+}
 
-      // [UsNZǂ}XN摜ɋL^
-      if ( player != 0 ) {
-        int index = (colorY * width) + colorX;
-        userMask.data[index] = 255;
-      }
+bool KinectControl::presentFrame( DressUpFrame& frame )
+{
+  // o͐ɓn(Ivꂽꍇfalse)
+  if ( frame.isFitted ) {
+    sink->present( "RGBCamera", frame.rgbImage );
+  }
+  bool isContinue = sink->endFrame();
 
-      // 8bitɂăfvX摜Ɋi[
-      int index = (colorY * width) + colorX;
-        image.data[index] = distance / 8192.0 * 255;
-    }
+  // \܂ł̒xL^āÅԊuŕ\
+  latencyMonitor.stamp( frame.latency, LATENCY_PRESENT );
+  latencyMonitor.complete( frame.latency );
+  latencyMonitor.printStatistics( std::cout, LATENCY_PRINT_INTERVAL );
+  playerStatistics.printStatistics( std::cout, LATENCY_PRINT_INTERVAL );
 
-    // t[f[^
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( depthStreamHandle, &depthFrame ) );
-  }
-  catch ( std::exception& ex ) {
-    std::cout << "KinectControl::setDepthImage" << ex.what() << std::endl;
+  return isContinue;
+}
+
+void KinectControl::setDepthImage( const FrameHandle& depthFrame, cv::Mat& image, PlayerRuns& runs )
+{
+  if ( depthFrame.empty() ) {
+    runs.clear( width, height );
+    image = cv::Mat( height, width, CV_8UC1, cv::Scalar ( 0 ) );
+    return;
   }
+
+  // f[^AƃvC[̉摜ɕ
+  //   vC[Ƃ̋̓vAȂώZ(\̒iǂݏo)
+  depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight, playerStatistics );
+  const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+  const UCHAR* player = depthUnpacker.getPlayer().data;
+
+  // J̍WARGBJ̍Wɍ킹(Ŏ␳A߂قcāAȌ𖄂߂)
+  registeredDepth.map( distance, player, registration, true, registeredDistance, registeredPlayer );
+
+  // ʂ͂ق̒iɓn̂ŁAV摜ɏ
+  //   [Û͈͂sƂɂ܂Ƃ߁A8bitɂăfvX摜Ɋi[
+  runs.build( registeredPlayer );
+  image = cv::Mat();
+  registeredDistance.convertTo( image, CV_8U, 255.0 / 8192.0 );
 }
 
-void KinectControl::setSkeleton( cv::Mat& image )
+void KinectControl::setSkeleton( NUI_SKELETON_FRAME& skeletonFrame, cv::Mat& image )
 { 
   try {
-    // XPg̃t[擾
-    NUI_SKELETON_FRAME skeletonFrame = { 0 };
-    ERROR_CHECK( kinect->NuiSkeletonGetNextFrame( 0, &skeletonFrame ) );
-
     for ( int i = 0; i < NUI_SKELETON_COUNT; ++i ) {
       NUI_SKELETON_DATA& skeletonData = skeletonFrame.SkeletonData[i];
       if ( skeletonData.eTrackingState == NUI_SKELETON_TRACKED ) {
@@ -183,14 +254,12 @@ void KinectControl::setJoint( cv::Mat& image, int joint, Vector4 position )
 {
   try {
     FLOAT depthX = 0, depthY = 0;
-    ::NuiTransformSkeletonToDepthImage( position, &depthX, &depthY, CAMERA_RESOLUTION );
+    ::NuiTransformSkeletonToDepthImage( position, &depthX, &depthY, source->getDepthResolution() );
 
     LONG colorX = 0;
     LONG colorY = 0;
 
-    kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-      CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-      0, (LONG)depthX , (LONG)depthY, 0, &colorX, &colorY );
+    source->getColorPixelCoordinates( (LONG)depthX , (LONG)depthY, 0, colorX, colorY );
 
     // EEEEE
     if( joint == 4 || joint == 8 || joint == 12 || joint == 16 ) {
@@ -213,8 +282,10 @@ void KinectControl::setCloth( cv::Mat _clothImage, std::vector<cv::Point> _point
   points = _points;
 }
 
-void KinectControl::fitCloth()
+bool KinectControl::fitCloth( const PlayerRuns& userRuns, const cv::Rect& userRoi )
 {
+  bool isFitted = false;
+
   try {
     if( joints.size() == 4 ) {
       cv::Point2f src[4];
@@ -226,23 +297,45 @@ void KinectControl::fitCloth()
 
       trans = cv::getPerspectiveTransform( src, dst );
 
-      cv::Mat fitImage;
-      cv::warpPerspective( clothImage, fitImage, trans, rgbImage.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar( 255, 255, 255 ) );
+      // ̉摜́A[UǐՂ͈͂ɕό`(͈͂̍オ_ɂȂ悤ɕϊ炷)
+      if( userRoi.area() > 0 ) {
+        cv::Mat roiTrans = trans.clone();
+        for( int k = 0; k < 3; ++k ) {
+          roiTrans.at<double>( 0, k ) -= userRoi.x * trans.at<double>( 2, k );
+          roiTrans.at<double>( 1, k ) -= userRoi.y * trans.at<double>( 2, k );
+        }
+
+        cv::Mat fitImage;
+        cv::warpPerspective( clothImage, fitImage, roiTrans, userRoi.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar( 255, 255, 255 ) );
 
-      for( int i = 0; i < rgbImage.rows; ++i ) {
-        for( int j = 0; j < rgbImage.cols; ++j ) {
-          // ̉摜̉fl
-          cv::Vec4b rgba = fitImage.at<cv::Vec4b>( i, j );
+        if( matte.isEnabled() ) {
+          blendCloth( fitImage, userRuns, userRoi );
+        }
+        else {
+          // [Û͈͂ǂ
+          const std::vector< PlayerRun >& runs = userRuns.getRuns();
+          for( size_t r = 0; r < runs.size(); ++r ) {
+            const int y = runs[r].y;
+            const int begin = std::max( (int)runs[r].begin, userRoi.x );
+            const int end = std::min( (int)runs[r].end, userRoi.x + userRoi.width );
+            if( (y < userRoi.y) || (y >= userRoi.y + userRoi.height) ) {
+              continue;
+            }
 
-          // wiłȂA[ÜȂ
-          if( rgba[3] != 0 && userMask.at<UCHAR>( i, j ) == 255 ) {
-            for( int k = 0; k < 3; ++k ) {
-              rgbImage.at<cv::Vec4b>( i, j )[k] = rgba[k];
+            const cv::Vec4b* cloth = fitImage.ptr<cv::Vec4b>( y - userRoi.y );
+            cv::Vec4b* rgb = rgbImage.ptr<cv::Vec4b>( y );
+            for( int j = begin; j < end; ++j ) {
+              // ̉摜̔wiłȂ
+              if( cloth[j - userRoi.x][3] != 0 ) {
+                for( int k = 0; k < 3; ++k ) {
+                  rgb[j][k] = cloth[j - userRoi.x][k];
+                }
+              }
             }
           }
         }
       }
-      cv::imshow( "RGBCamera", rgbImage );
+      isFitted = true;
 
       joints.clear();
     }
@@ -250,4 +343,33 @@ void KinectControl::fitCloth()
   catch ( std::exception& ex ) {
     std::cout << "KinectControl::fitCloth" << ex.what() << std::endl;
   }
-}
\ No newline at end of file
+
+  return isFitted;
+}
+
+// [U̗֊sRGBJ̉摜ɍ킹x߂āẢ摜d˂
+//   fitImage ́AuserRoi ͈̔͂ɕό`̉摜
+void KinectControl::blendCloth( const cv::Mat& fitImage, const PlayerRuns& userRuns, const cv::Rect& userRoi )
+{
+  // xA[UǐՂ͈͂ŋ߂
+  cv::Mat roiImage( rgbImage, userRoi );
+  userRuns.toMask( coarseMask, userRoi );
+  matte.refine( roiImage, coarseMask, alpha );
+
+  for ( int i = 0; i < userRoi.height; ++i ) {
+    const cv::Vec4b* cloth = fitImage.ptr<cv::Vec4b>( i );
+    const UCHAR* a = alpha.ptr<UCHAR>( i );
+    cv::Vec4b* rgb = roiImage.ptr<cv::Vec4b>( i );
+    for ( int j = 0; j < userRoi.width; ++j ) {
+      // ̉摜̕sxƁA[U̓x|킹
+      int weight = cloth[j][3] * a[j] / 255;
+      if ( weight == 0 ) {
+        continue;
+      }
+
+      for ( int k = 0; k < 3; ++k ) {
+        rgb[j][k] = (UCHAR)((rgb[j][k] * (255 - weight) + cloth[j][k] * weight + 127) / 255);
+      }
+    }
+  }
+}
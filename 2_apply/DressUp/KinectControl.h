@@ -15,7 +15,60 @@
   throw std::runtime_error(ss.str().c_str());                 \
   }
 
-const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
+#include "DepthColorRegistration.h"
+#include "DepthUnpack.h"
+#include "FrameResolution.h"
+#include "FrameSink.h"
+#include "GuidedMatte.h"
+#include "KernelBenchmark.h"
+#include "KinectFrameSource.h"
+#include "LatencyMonitor.h"
+#include "Pipeline.h"
+#include "PlayerRuns.h"
+#include "PlayerStatistics.h"
+#include "PlayerTracker.h"
+#include "RegisteredDepth.h"
+
+// xvi(LatencyMonitor ɒǉ鏇)
+enum LatencyStage
+{
+  LATENCY_ACQUIRE,
+  LATENCY_MAPPING,
+  LATENCY_ANALYSIS,
+  LATENCY_DRAW,
+  LATENCY_PRESENT
+};
+
+// x̓v\Ԋu(~b)
+const DWORD LATENCY_PRINT_INTERVAL = 5000;
+
+// Ԃ̌vɎgt[
+const int BENCHMARK_FRAME_COUNT = 30;
+
+// d˂͈͂A[U͂ދ`Lf
+const int USER_ROI_MARGIN = 8;
+
+// pCvC̒i̊ԂŎ󂯓n1t[̃f[^
+struct DressUpFrame
+{
+  FrameHandle rgbFrame;               // RGBJ̃t[
+  FrameHandle depthFrame;             // J̃t[
+  NUI_SKELETON_FRAME skeletonFrame;   // XPg̃t[
+  bool isSkeleton;                    // XPg擾łǂ
+  FrameLatency latency;               // ei̎
+
+  cv::Mat rgbImage;                   // d˂RGB摜
+  cv::Mat depthImage;                 // RGBJ̍Wɍ킹摜
+  PlayerRuns userRuns;                // RGBJ̍Wɍ킹[Û͈
+  cv::Rect userRoi;                   // d˂͈([UǐՂ`)
+  bool isFitted;                      // d˂ǂ
+
+  DressUpFrame()
+    : isSkeleton( false )
+    , isFitted( false )
+  {
+  }
+};
 
 class KinectControl
 {
@@ -23,30 +76,56 @@ public:
   KinectControl(void);
   ~KinectControl(void);
 
-  void initialize();
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution );
+  void initialize( FrameSource* frameSource );
   void run();
+  void benchmark( KernelBenchmark& kernelBenchmark );
   void setCloth( cv::Mat _clothImage, std::vector<cv::Point> _points);
+  void setSink( FrameSink* frameSink );
+  void setMatteRadius( int radius );
 
 private:
-  INuiSensor *kinect;
-  HANDLE imageStreamHandle;
-  HANDLE depthStreamHandle;
-  HANDLE streamEvent;
+  KinectFrameSource kinect;
+  FrameSource* source;
+  ScreenFrameSink screen;
+  FrameSink* sink;
 
+  // RGBJ̉ʃTCY
   DWORD width;
   DWORD height;
 
-  void createInstance();
-  void setRgbImage(cv::Mat& image);
-  void setDepthImage(cv::Mat& image);
-  void setSkeleton( cv::Mat& image );
+  // J̉ʃTCY
+  DWORD depthWidth;
+  DWORD depthHeight;
+
+  DepthColorRegistration registration;
+  DepthUnpacker depthUnpacker;
+  RegisteredDepth registeredDepth;
+  cv::Mat registeredDistance;   // RGBJ̍Wɍ킹̉摜(ʒu킹̒iŎg)
+  cv::Mat registeredPlayer;     // RGBJ̍Wɍ킹vC[̉摜(ʒu킹̒iŎg)
+  PlayerTracker userTracker;    // [Ü̗̒ǐ(ʒu킹̒iŎg)
+  PlayerStatistics playerStatistics;  // vC[Ƃ̋̓v(ʒu킹̒iŐώZA\̒iœǂݏo)
+  LatencyMonitor latencyMonitor;
+
+  // pCvC̊ei
+  bool acquireFrame( DressUpFrame& frame );
+  bool registerFrame( DressUpFrame& frame );
+  bool analyzeFrame( DressUpFrame& frame );
+  bool presentFrame( DressUpFrame& frame );
+
+  void setDepthImage( const FrameHandle& depthFrame, cv::Mat& image, PlayerRuns& runs );
+  void setSkeleton( NUI_SKELETON_FRAME& skeletonFrame, cv::Mat& image );
   void setJoint( cv::Mat& image, int joint, Vector4 position );
-  void fitCloth();
+  bool fitCloth( const PlayerRuns& userRuns, const cv::Rect& userRoi );
+  void blendCloth( const cv::Mat& fitImage, const PlayerRuns& userRuns, const cv::Rect& userRoi );
 
+  // ͂̒iŎg摜
   cv::Mat rgbImage;
   cv::Mat depthImage;
   cv::Mat clothImage;
-  cv::Mat userMask;
+  GuidedMatte matte;          // [U̗֊sARGBJ̉摜ɍ킹
+  cv::Mat coarseMask;         // J[Ũ}XN
+  cv::Mat alpha;              // [U̓x
   cv::Mat trans;
   std::vector<cv::Point> joints;
   std::vector<cv::Point> points;
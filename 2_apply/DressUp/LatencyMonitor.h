@@ -0,0 +1,245 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 記録できる段の最大数
+const int LATENCY_MAX_STAGES = 8;
+
+// 1フレーム分の時刻(パイプラインの段の間で、フレームと一緒に受け渡す)
+struct FrameLatency
+{
+  LONGLONG sensorTime;                        // センサーのタイムスタンプ(ミリ秒)
+  LONGLONG arrival;                           // フレームが届いた時刻(QueryPerformanceCounter、0は未計測)
+  LONGLONG stamps[LATENCY_MAX_STAGES];        // 各段が終わった時刻(0は通らなかった段)
+
+  FrameLatency()
+    : sensorTime( 0 )
+    , arrival( 0 )
+  {
+    for ( int i = 0; i < LATENCY_MAX_STAGES; ++i ) {
+      stamps[i] = 0;
+    }
+  }
+};
+
+// 遅延のヒストグラム
+//
+// 0.1ミリ秒ごとの区間に数える(MAXIMUM_TIME を超えた分は最後の区間に数える)。
+// 最大値は区間に関係なく正確な値を保持する。
+class LatencyHistogram
+{
+public:
+
+  // 区間の幅と範囲(ミリ秒)
+  static const int BUCKETS_PER_MILLISECOND = 10;
+  static const int MAXIMUM_TIME = 1000;
+
+  LatencyHistogram()
+    : buckets_( (MAXIMUM_TIME * BUCKETS_PER_MILLISECOND) + 1, 0 )
+    , count_( 0 )
+    , max_( 0 )
+  {
+  }
+
+  void add( double milliseconds )
+  {
+    int bucket = (int)(milliseconds * BUCKETS_PER_MILLISECOND);
+    if ( bucket < 0 ) {
+      bucket = 0;
+    }
+    else if ( bucket >= (int)buckets_.size() ) {
+      bucket = (int)buckets_.size() - 1;
+    }
+
+    ++buckets_[bucket];
+    ++count_;
+    if ( milliseconds > max_ ) {
+      max_ = milliseconds;
+    }
+  }
+
+  // パーセンタイル(ミリ秒、区間の上端)
+  //   percentile : 0〜1
+  double getPercentile( double percentile ) const
+  {
+    if ( count_ == 0 ) {
+      return 0;
+    }
+
+    DWORD target = (DWORD)(percentile * count_ + 0.5);
+    if ( target < 1 ) {
+      target = 1;
+    }
+
+    DWORD total = 0;
+    for ( size_t i = 0; i < buckets_.size(); ++i ) {
+      total += buckets_[i];
+      if ( total >= target ) {
+        return std::min( (double)(i + 1) / BUCKETS_PER_MILLISECOND, max_ );
+      }
+    }
+
+    return max_;
+  }
+
+  double getMax() const
+  {
+    return max_;
+  }
+
+  DWORD getCount() const
+  {
+    return count_;
+  }
+
+private:
+
+  std::vector< DWORD > buckets_;
+  DWORD count_;
+  double max_;
+};
+
+// フレームの遅延の計測
+//
+// フレームが届いた時刻と、各段が終わった時刻を記録し、段ごとの遅延(前の段が
+// 終わってからの時間。キューで待った時間を含む)と、届いてから表示するまでの
+// 遅延をヒストグラムにする。
+//
+// センサーのタイムスタンプとPCの時計は基準が違うため、センサーから届くまでの
+// 遅延は、(届いた時刻 - タイムスタンプ)のこれまでの最小値からの差で推定する。
+//
+// 時刻の記録(arrive、stamp)はどのスレッドからでもよいが、complete と統計の
+// 表示は同じスレッド(最後の段)から呼ぶ。
+class LatencyMonitor
+{
+public:
+
+  LatencyMonitor()
+    : minimumOffset_( 0 )
+    , isOffset_( false )
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+    ::QueryPerformanceCounter( &lastPrint_ );
+  }
+
+  // 段を追加する(段の番号を返す。フレームは追加した順に段を通る)
+  int addStage( const std::string& name )
+  {
+    if ( names_.size() >= LATENCY_MAX_STAGES ) {
+      throw std::runtime_error( "LatencyMonitor の段が多すぎます" );
+    }
+
+    names_.push_back( name );
+    stages_.push_back( LatencyHistogram() );
+    return (int)names_.size() - 1;
+  }
+
+  // フレームが届いた時刻を記録する
+  //   センサーのタイムスタンプ(sensorTime)は、フレームを取得してから設定する
+  void arrive( FrameLatency& latency ) const
+  {
+    latency = FrameLatency();
+    latency.arrival = now();
+  }
+
+  // 段が終わった時刻を記録する
+  void stamp( FrameLatency& latency, int stage ) const
+  {
+    latency.stamps[stage] = now();
+  }
+
+  // フレームの処理が終わった(最後の段から呼ぶ)
+  void complete( const FrameLatency& latency )
+  {
+    if ( latency.arrival == 0 ) {
+      return;
+    }
+
+    // センサーから届くまで
+    double offset = toMilliseconds( latency.arrival ) - latency.sensorTime;
+    if ( !isOffset_ || (offset < minimumOffset_) ) {
+      minimumOffset_ = offset;
+      isOffset_ = true;
+    }
+    sensor_.add( offset - minimumOffset_ );
+
+    // 段ごと
+    LONGLONG previous = latency.arrival;
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      if ( latency.stamps[i] != 0 ) {
+        stages_[i].add( toMilliseconds( latency.stamps[i] - previous ) );
+        previous = latency.stamps[i];
+      }
+    }
+
+    // 届いてから最後の段が終わるまで
+    total_.add( toMilliseconds( previous - latency.arrival ) );
+  }
+
+  // 統計を表示する
+  void printStatistics( std::ostream& out ) const
+  {
+    out << "[latency] (ms)" << std::endl;
+    print( out, "sensor*", sensor_ );
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      print( out, names_[i], stages_[i] );
+    }
+    print( out, "total", total_ );
+    out << "  (* 届くまでの遅延の最小値からの差)" << std::endl;
+  }
+
+  // 前回の表示から interval ミリ秒以上経っていれば、統計を表示する
+  void printStatistics( std::ostream& out, DWORD interval )
+  {
+    LARGE_INTEGER current;
+    ::QueryPerformanceCounter( &current );
+    if ( toMilliseconds( current.QuadPart - lastPrint_.QuadPart ) >= interval ) {
+      printStatistics( out );
+      lastPrint_ = current;
+    }
+  }
+
+private:
+
+  void print( std::ostream& out, const std::string& name, const LatencyHistogram& histogram ) const
+  {
+    out << "  " << std::setw( 12 ) << std::left << name << std::right
+        << std::fixed << std::setprecision( 1 )
+        << " p50 " << std::setw( 6 ) << histogram.getPercentile( 0.5 )
+        << "  p99 " << std::setw( 6 ) << histogram.getPercentile( 0.99 )
+        << "  max " << std::setw( 6 ) << histogram.getMax()
+        << "  frames " << histogram.getCount() << std::endl;
+  }
+
+  LONGLONG now() const
+  {
+    LARGE_INTEGER counter;
+    ::QueryPerformanceCounter( &counter );
+    return counter.QuadPart;
+  }
+
+  double toMilliseconds( LONGLONG counter ) const
+  {
+    return counter * 1000.0 / frequency_.QuadPart;
+  }
+
+private:
+
+  std::vector< std::string > names_;
+  std::vector< LatencyHistogram > stages_;
+  LatencyHistogram sensor_;
+  LatencyHistogram total_;
+
+  double minimumOffset_;
+  bool isOffset_;
+
+  LARGE_INTEGER frequency_;
+  LARGE_INTEGER lastPrint_;
+};
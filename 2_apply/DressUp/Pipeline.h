@@ -0,0 +1,287 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SpscQueue.h"
+
+// 段ごとの統計
+struct StageStatistics
+{
+  std::string name;
+  LONG processed;       // 処理したフレーム数
+  LONG dropped;         // 入力のキューで捨てたフレーム数
+  LONG queueDepth;      // 入力のキューの現在の要素数
+  LONG maxQueueDepth;   // 入力のキューの最大の要素数
+  double averageTime;   // 1フレームの平均処理時間(ミリ秒)
+  double throughput;    // 処理したフレーム数(フレーム/秒)
+};
+
+// フレームを段ごとのスレッドで処理するパイプライン
+//
+// 取得、距離データの変換、解析、表示などを段に分けて、それぞれ専用のスレッドで
+// 動かす。段の間は SpscQueue でつなぎ、前の段が次のフレームの処理を始められる
+// ようにする。最後の段(表示)は、run() を呼び出したスレッドで動く。
+//
+// 段の関数は、フレームを次の段に渡す場合はtrueを返す。
+//   最初の段 : falseでフレームの終わり
+//   途中の段 : falseでそのフレームを捨てる
+//   最後の段 : falseでパイプラインを止める
+template< typename T >
+class Pipeline
+{
+public:
+
+  typedef std::function< bool ( T& ) > StageFunction;
+
+  Pipeline()
+    : stopped_( 0 )
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+  }
+
+  ~Pipeline()
+  {
+    stop();
+
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      delete stages_[i]->input;
+      delete stages_[i];
+    }
+  }
+
+  // 最初の段(フレームの取得)を設定する
+  void setSource( const std::string& name, StageFunction function )
+  {
+    addStage( name, function, 0, QUEUE_BLOCK );
+  }
+
+  // 段を追加する
+  //   capacity : 前の段との間のキューの容量
+  //   policy   : キューがいっぱいの場合の扱い
+  void addStage( const std::string& name, StageFunction function,
+    size_t capacity = 2, QueuePolicy policy = QUEUE_BLOCK )
+  {
+    Stage* stage = new Stage();
+    stage->owner = this;
+    stage->name = name;
+    stage->function = function;
+    stage->input = stages_.empty() ? 0 : new SpscQueue< T >( capacity, policy );
+    stage->output = 0;
+    stage->thread = 0;
+    stage->processed = 0;
+    stage->totalTime = 0;
+
+    if ( !stages_.empty() ) {
+      stages_.back()->output = stage->input;
+    }
+
+    stages_.push_back( stage );
+  }
+
+  // 最後の段を追加して、パイプラインを動かす
+  //   最後の段はこの関数を呼び出したスレッドで動く(画面の表示はメインスレッドで行う)
+  void run( const std::string& name, StageFunction function,
+    size_t capacity = 2, QueuePolicy policy = QUEUE_DROP_OLDEST )
+  {
+    addStage( name, function, capacity, policy );
+
+    ::QueryPerformanceCounter( &start_ );
+    stopped_ = 0;
+
+    // 最後の段以外は、専用のスレッドで動かす
+    for ( size_t i = 0; i < stages_.size() - 1; ++i ) {
+      stages_[i]->thread = ::CreateThread( 0, 0, &Pipeline::threadProc, stages_[i], 0, 0 );
+    }
+
+    Stage* last = stages_.back();
+    while ( stopped_ == 0 ) {
+      T item;
+      if ( !last->input->pop( item, 100 ) ) {
+        if ( last->input->isDone() ) {
+          break;
+        }
+
+        continue;
+      }
+
+      if ( !call( *last, item ) ) {
+        break;
+      }
+    }
+
+    stop();
+  }
+
+  // パイプラインを止める
+  void stop()
+  {
+    ::InterlockedExchange( &stopped_, 1 );
+
+    // 待っているスレッドを起こす
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      if ( stages_[i]->input != 0 ) {
+        stages_[i]->input->close();
+      }
+    }
+
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      if ( stages_[i]->thread != 0 ) {
+        ::WaitForSingleObject( stages_[i]->thread, INFINITE );
+        ::CloseHandle( stages_[i]->thread );
+        stages_[i]->thread = 0;
+      }
+    }
+  }
+
+  // 段ごとの統計を取得する
+  std::vector< StageStatistics > getStatistics() const
+  {
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter( &now );
+    double elapsed = (double)(now.QuadPart - start_.QuadPart) / frequency_.QuadPart;
+
+    std::vector< StageStatistics > statistics;
+    for ( size_t i = 0; i < stages_.size(); ++i ) {
+      const Stage& stage = *stages_[i];
+
+      StageStatistics s = { stage.name, stage.processed, 0, 0, 0, 0, 0 };
+      if ( stage.input != 0 ) {
+        QueueStatistics queue = stage.input->getStatistics();
+        s.dropped = queue.dropped;
+        s.queueDepth = queue.depth;
+        s.maxQueueDepth = queue.maxDepth;
+      }
+
+      if ( stage.processed != 0 ) {
+        s.averageTime = (stage.totalTime * 1000.0 / frequency_.QuadPart) / stage.processed;
+      }
+
+      if ( elapsed > 0 ) {
+        s.throughput = stage.processed / elapsed;
+      }
+
+      statistics.push_back( s );
+    }
+
+    return statistics;
+  }
+
+  // 段ごとの統計を表示する
+  void printStatistics( std::ostream& out ) const
+  {
+    std::vector< StageStatistics > statistics = getStatistics();
+
+    out << "[pipeline]" << std::endl;
+    for ( size_t i = 0; i < statistics.size(); ++i ) {
+      const StageStatistics& s = statistics[i];
+      out << "  " << std::setw( 12 ) << std::left << s.name << std::right
+          << " frames " << std::setw( 6 ) << s.processed
+          << "  " << std::fixed << std::setprecision( 1 ) << std::setw( 6 ) << s.throughput << " fps"
+          << "  " << std::setprecision( 2 ) << std::setw( 7 ) << s.averageTime << " ms/frame"
+          << "  dropped " << s.dropped
+          << "  queue " << s.queueDepth << "/" << s.maxQueueDepth << std::endl;
+    }
+  }
+
+private:
+
+  struct Stage
+  {
+    Pipeline* owner;
+    std::string name;
+    StageFunction function;
+    SpscQueue< T >* input;    // 前の段とのキュー(最初の段は0)
+    SpscQueue< T >* output;   // 次の段とのキュー(最後の段は0)
+    HANDLE thread;
+    volatile LONG processed;
+    LONGLONG totalTime;
+  };
+
+  static DWORD WINAPI threadProc( LPVOID param )
+  {
+    Stage* stage = (Stage*)param;
+    stage->owner->process( *stage );
+    return 0;
+  }
+
+  // 最後の段以外の処理
+  void process( Stage& stage )
+  {
+    while ( stopped_ == 0 ) {
+      T item;
+
+      if ( stage.input == 0 ) {
+        // 最初の段はフレームを作る
+        if ( !call( stage, item ) ) {
+          break;
+        }
+      }
+      else {
+        if ( !stage.input->pop( item, 100 ) ) {
+          if ( stage.input->isDone() ) {
+            break;
+          }
+
+          continue;
+        }
+
+        if ( !call( stage, item ) ) {
+          continue;
+        }
+      }
+
+      stage.output->push( item );
+    }
+
+    // 次の段に終わりを伝える
+    stage.output->close();
+  }
+
+  // 段の関数を呼び出す(例外が発生した場合は、パイプラインを止める)
+  bool call( Stage& stage, T& item )
+  {
+    LARGE_INTEGER begin;
+    ::QueryPerformanceCounter( &begin );
+
+    bool result = false;
+    try {
+      result = stage.function( item );
+    }
+    catch ( std::exception& ex ) {
+      std::cout << stage.name << " : " << ex.what() << std::endl;
+      ::InterlockedExchange( &stopped_, 1 );
+      return false;
+    }
+
+    LARGE_INTEGER end;
+    ::QueryPerformanceCounter( &end );
+    stage.totalTime += end.QuadPart - begin.QuadPart;
+
+    // 最初の段がフレームの終わりを返した場合は数えない
+    if ( result || (stage.input != 0) ) {
+      ::InterlockedIncrement( &stage.processed );
+    }
+
+    return result;
+  }
+
+private:
+
+  // コピーを禁止する
+  Pipeline( const Pipeline& rhs );
+  Pipeline& operator = ( const Pipeline& rhs );
+
+private:
+
+  std::vector< Stage* > stages_;
+  volatile LONG stopped_;
+
+  LARGE_INTEGER frequency_;
+  LARGE_INTEGER start_;
+};
@@ -0,0 +1,363 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+// 1人分の距離の統計(1フレーム分)
+//
+// 積算した値だけを持ち、平均などは読み出す側で求める。
+struct PlayerDepthStatistics
+{
+  enum
+  {
+    HISTOGRAM_SHIFT = 6,    // ヒストグラムの区間の幅(64mm)
+    HISTOGRAM_BINS = ((0xFFFF >> NUI_IMAGE_PLAYER_INDEX_SHIFT) >> HISTOGRAM_SHIFT) + 1
+  };
+
+  DWORD pixels;               // 距離がわかる画素数
+  USHORT nearest;             // 最も近い距離(mm、画素がない場合は0)
+  USHORT farthest;            // 最も遠い距離(mm)
+  ULONGLONG sum;              // 距離の和(mm)
+  ULONGLONG sumOfSquares;     // 距離の2乗の和(mm^2)
+  DWORD histogram[HISTOGRAM_BINS];
+
+  // 距離の平均(mm)
+  double getMean() const
+  {
+    return (pixels == 0) ? 0 : (double)sum / pixels;
+  }
+
+  // 距離の標準偏差(mm)
+  double getDeviation() const
+  {
+    if ( pixels == 0 ) {
+      return 0;
+    }
+
+    double mean = getMean();
+    return std::sqrt( std::max( (double)sumOfSquares / pixels - mean * mean, 0.0 ) );
+  }
+
+  // 距離のパーセンタイル(mm、区間の中央)
+  //   percentile : 0〜1
+  double getPercentile( double percentile ) const
+  {
+    if ( pixels == 0 ) {
+      return 0;
+    }
+
+    DWORD target = std::max( (DWORD)(percentile * pixels + 0.5), (DWORD)1 );
+    DWORD total = 0;
+    for ( int i = 0; i < HISTOGRAM_BINS; ++i ) {
+      total += histogram[i];
+      if ( total >= target ) {
+        double center = (i + 0.5) * (1 << HISTOGRAM_SHIFT);
+        return std::min( std::max( center, (double)nearest ), (double)farthest );
+      }
+    }
+
+    return farthest;
+  }
+};
+
+// 全員分の統計(読み出す側に渡す)
+struct PlayerStatisticsSnapshot
+{
+  enum
+  {
+    PLAYER_INDEX_COUNT = NUI_IMAGE_PLAYER_INDEX_MASK + 1
+  };
+
+  DWORD frameNumber;          // 積算したフレームの番号(1から、0はまだ積算していない)
+  float focalLength;          // 距離カメラの焦点距離(画素)
+  PlayerDepthStatistics players[PLAYER_INDEX_COUNT];    // [0]は全員の合計
+
+  // 見えている面積(m^2)
+  //   距離 z の1画素は、z / 焦点距離 四方の大きさになる
+  double getArea( int player ) const
+  {
+    return (double)players[player].sumOfSquares / (focalLength * focalLength) / 1000000.0;
+  }
+
+  // 体積の推定(m^3)
+  //   見えている面積に、距離の広がり(標準偏差の2倍)を厚みとして掛ける
+  double getVolume( int player ) const
+  {
+    return getArea( player ) * (2 * players[player].getDeviation() / 1000.0);
+  }
+};
+
+// プレイヤーごとの距離の統計
+//
+// 距離データを分けるときに(DepthUnpacker::unpack の accumulator として)、
+// 行ごとに積算する。プレイヤーのいない画素は、SSE2が使える場合は16画素ずつ読み飛ばす。
+//
+// 積算する側(1つのスレッド)は、フレームの終わりに結果を公開する。読み出す側は
+// ロックを使わずに、公開された最新の結果をコピーする(SharedFrameHeader と同じく、
+// sequence が偶数で、コピーの前後で変わっていないことを確認する。奇数は書き込み中)。
+// 読み出す側は、積算する側を待たせない。
+class PlayerStatistics
+{
+public:
+
+  PlayerStatistics()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , sequence_( 0 )
+  {
+    clear( current_ );
+    clear( published_ );
+    ::QueryPerformanceFrequency( &frequency_ );
+    ::QueryPerformanceCounter( &lastPrint_ );
+  }
+
+  // フレームの積算を始める(積算する側から呼ぶ)
+  void begin( int width, int height )
+  {
+    DWORD frameNumber = current_.frameNumber;
+    clear( current_ );
+    current_.frameNumber = frameNumber + 1;
+    current_.focalLength = NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS * width / 320;
+  }
+
+  // count 画素分を積算する(積算する側から呼ぶ)
+  void accumulate( const USHORT* distance, const BYTE* player, int count )
+  {
+    int i = 0;
+    if ( isSse2_ ) {
+      const __m128i zero = _mm_setzero_si128();
+      for ( ; i + 16 <= count; i += 16 ) {
+        __m128i p = _mm_loadu_si128( (const __m128i*)(player + i) );
+        int empty = _mm_movemask_epi8( _mm_cmpeq_epi8( p, zero ) );
+        if ( empty == 0xFFFF ) {
+          continue;
+        }
+
+        // プレイヤーの内側は、16画素をまとめて積算する(輪郭などは1画素ずつ)
+        if ( (empty != 0) || !accumulateSse2( distance + i, player[i], p ) ) {
+          accumulateScalar( distance + i, player + i, 16 );
+        }
+      }
+    }
+
+    accumulateScalar( distance + i, player + i, count - i );
+  }
+
+  // フレームの積算を終えて、結果を公開する(積算する側から呼ぶ)
+  void end()
+  {
+    // 全員の合計
+    PlayerDepthStatistics& all = current_.players[0];
+    for ( int p = 1; p < PlayerStatisticsSnapshot::PLAYER_INDEX_COUNT; ++p ) {
+      const PlayerDepthStatistics& s = current_.players[p];
+      if ( s.pixels == 0 ) {
+        continue;
+      }
+
+      all.pixels += s.pixels;
+      all.nearest = std::min( all.nearest, s.nearest );
+      all.farthest = std::max( all.farthest, s.farthest );
+      all.sum += s.sum;
+      all.sumOfSquares += s.sumOfSquares;
+      for ( int i = 0; i < PlayerDepthStatistics::HISTOGRAM_BINS; ++i ) {
+        all.histogram[i] += s.histogram[i];
+      }
+    }
+
+    // 画素がない場合の最も近い距離は0にする
+    for ( int p = 0; p < PlayerStatisticsSnapshot::PLAYER_INDEX_COUNT; ++p ) {
+      if ( current_.players[p].pixels == 0 ) {
+        current_.players[p].nearest = 0;
+      }
+    }
+
+    ::InterlockedIncrement( &sequence_ );
+    published_ = current_;
+    ::InterlockedIncrement( &sequence_ );
+  }
+
+  // 公開された最新の結果をコピーする(どのスレッドからでもよい)
+  //   まだ結果がない場合はfalseを返す
+  bool read( PlayerStatisticsSnapshot& snapshot ) const
+  {
+    for ( ;; ) {
+      LONG before = sequence_;
+      if ( (before & 1) == 0 ) {
+        snapshot = published_;
+        ::MemoryBarrier();
+        if ( sequence_ == before ) {
+          return snapshot.frameNumber != 0;
+        }
+      }
+
+      // 書き込み中なので、少し待ってから読み直す
+      YieldProcessor();
+    }
+  }
+
+  // 統計を表示する(プレイヤーのいない番号は表示しない)
+  void printStatistics( std::ostream& out ) const
+  {
+    PlayerStatisticsSnapshot snapshot;
+    if ( !read( snapshot ) ) {
+      return;
+    }
+
+    out << "[players] (mm)" << std::endl;
+    for ( int p = 1; p < PlayerStatisticsSnapshot::PLAYER_INDEX_COUNT; ++p ) {
+      const PlayerDepthStatistics& s = snapshot.players[p];
+      if ( s.pixels == 0 ) {
+        continue;
+      }
+
+      out << "  player " << p
+          << std::fixed << std::setprecision( 0 )
+          << "  nearest " << std::setw( 5 ) << s.nearest
+          << "  p50 " << std::setw( 5 ) << s.getPercentile( 0.5 )
+          << "  mean " << std::setw( 5 ) << s.getMean()
+          << "  sd " << std::setw( 4 ) << s.getDeviation()
+          << std::setprecision( 2 )
+          << "  area " << snapshot.getArea( p ) << "m2"
+          << std::setprecision( 3 )
+          << "  volume " << snapshot.getVolume( p ) << "m3"
+          << "  pixels " << s.pixels << std::endl;
+    }
+  }
+
+  // 前回の表示から interval ミリ秒以上経っていれば、統計を表示する(表示は1つのスレッドから呼ぶ)
+  void printStatistics( std::ostream& out, DWORD interval )
+  {
+    LARGE_INTEGER current;
+    ::QueryPerformanceCounter( &current );
+    if ( (current.QuadPart - lastPrint_.QuadPart) * 1000 / frequency_.QuadPart >= interval ) {
+      printStatistics( out );
+      lastPrint_ = current;
+    }
+  }
+
+private:
+
+  // 16画素がすべて同じプレイヤーで、距離がわかる場合に、SSE2でまとめて積算する(積算した場合はtrue)
+  //   距離は13ビットなので、符号付きの16ビットとして扱ってよい
+  //   16画素の2乗の和も、32ビットに収まる
+  bool accumulateSse2( const USHORT* distance, BYTE playerIndex, __m128i p )
+  {
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( p, _mm_set1_epi8( playerIndex ) ) ) != 0xFFFF ) {
+      return false;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i d0 = _mm_loadu_si128( (const __m128i*)distance );
+    __m128i d1 = _mm_loadu_si128( (const __m128i*)(distance + 8) );
+    if ( _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi16( d0, zero ), _mm_cmpeq_epi16( d1, zero ) ) ) != 0 ) {
+      return false;
+    }
+
+    const __m128i one = _mm_set1_epi16( 1 );
+    __m128i sum = _mm_add_epi32( _mm_madd_epi16( d0, one ), _mm_madd_epi16( d1, one ) );
+    __m128i sumOfSquares = _mm_add_epi32( _mm_madd_epi16( d0, d0 ), _mm_madd_epi16( d1, d1 ) );
+    __m128i nearest = _mm_min_epi16( d0, d1 );
+    __m128i farthest = _mm_max_epi16( d0, d1 );
+
+    // 横方向にまとめる
+    sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    sumOfSquares = _mm_add_epi32( sumOfSquares, _mm_shuffle_epi32( sumOfSquares, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    sumOfSquares = _mm_add_epi32( sumOfSquares, _mm_shuffle_epi32( sumOfSquares, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    nearest = _mm_min_epi16( nearest, _mm_shuffle_epi32( nearest, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    nearest = _mm_min_epi16( nearest, _mm_shuffle_epi32( nearest, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    nearest = _mm_min_epi16( nearest, _mm_srli_epi32( nearest, 16 ) );
+    farthest = _mm_max_epi16( farthest, _mm_shuffle_epi32( farthest, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    farthest = _mm_max_epi16( farthest, _mm_shuffle_epi32( farthest, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    farthest = _mm_max_epi16( farthest, _mm_srli_epi32( farthest, 16 ) );
+
+    PlayerDepthStatistics& s = current_.players[playerIndex];
+    const USHORT blockNearest = (USHORT)_mm_cvtsi128_si32( nearest );
+    const USHORT blockFarthest = (USHORT)_mm_cvtsi128_si32( farthest );
+    s.pixels += 16;
+    s.sum += (DWORD)_mm_cvtsi128_si32( sum );
+    s.sumOfSquares += (DWORD)_mm_cvtsi128_si32( sumOfSquares );
+    s.nearest = std::min( s.nearest, blockNearest );
+    s.farthest = std::max( s.farthest, blockFarthest );
+
+    // 距離はなめらかに変わるので、16画素が同じ区間に入ることが多い
+    const int bin = blockNearest >> PlayerDepthStatistics::HISTOGRAM_SHIFT;
+    if ( bin == (blockFarthest >> PlayerDepthStatistics::HISTOGRAM_SHIFT) ) {
+      s.histogram[bin] += 16;
+    }
+    else {
+      for ( int i = 0; i < 16; ++i ) {
+        ++s.histogram[distance[i] >> PlayerDepthStatistics::HISTOGRAM_SHIFT];
+      }
+    }
+
+    return true;
+  }
+
+  // 1画素ずつ積算する(距離がわからない画素は数えない)
+  //   同じプレイヤーが続く間は、ローカル変数に積算する
+  void accumulateScalar( const USHORT* distance, const BYTE* player, int count )
+  {
+    int i = 0;
+    while ( i < count ) {
+      const BYTE p = player[i];
+      if ( p == 0 ) {
+        ++i;
+        continue;
+      }
+
+      PlayerDepthStatistics& s = current_.players[p];
+      DWORD pixels = 0;
+      ULONGLONG sum = 0;
+      ULONGLONG sumOfSquares = 0;
+      USHORT nearest = s.nearest;
+      USHORT farthest = s.farthest;
+      for ( ; (i < count) && (player[i] == p); ++i ) {
+        const USHORT d = distance[i];
+        if ( d == 0 ) {
+          continue;
+        }
+
+        ++pixels;
+        sum += d;
+        sumOfSquares += (DWORD)d * d;
+        nearest = std::min( nearest, d );
+        farthest = std::max( farthest, d );
+
+        ++s.histogram[d >> PlayerDepthStatistics::HISTOGRAM_SHIFT];
+      }
+
+      s.pixels += pixels;
+      s.sum += sum;
+      s.sumOfSquares += sumOfSquares;
+      s.nearest = nearest;
+      s.farthest = farthest;
+    }
+  }
+
+  static void clear( PlayerStatisticsSnapshot& snapshot )
+  {
+    memset( &snapshot, 0, sizeof(snapshot) );
+    for ( int p = 0; p < PlayerStatisticsSnapshot::PLAYER_INDEX_COUNT; ++p ) {
+      snapshot.players[p].nearest = 0xFFFF;
+    }
+  }
+
+private:
+
+  bool isSse2_;
+
+  PlayerStatisticsSnapshot current_;      // 積算中の結果(積算する側だけが使う)
+  PlayerStatisticsSnapshot published_;    // 公開した結果
+  volatile LONG sequence_;                // 公開するたびに2ずつ増える
+
+  // 表示の間隔
+  LARGE_INTEGER frequency_;
+  LARGE_INTEGER lastPrint_;
+};
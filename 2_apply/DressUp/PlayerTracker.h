@@ -0,0 +1,188 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/opencv.hpp>
+
+#include "PlayerRuns.h"
+
+// プレイヤーごとの領域
+struct PlayerRegion
+{
+  int pixels;               // 画素数(0はこのフレームにいない)
+  PlayerBounds bounds;      // このフレームでプレイヤーを囲む矩形
+  float centroidX;          // 重心
+  float centroidY;
+  USHORT minDistance;       // 最も近い距離(mm、距離がない場合は0)
+  USHORT maxDistance;       // 最も遠い距離(mm)
+
+  // 時間方向に滑らかにした矩形(広がるときはすぐに追従し、狭まるときは少しずつ追従する)
+  float left;
+  float top;
+  float right;
+  float bottom;
+  int lostFrames;           // 見えなくなってからのフレーム数
+};
+
+// プレイヤーのいる範囲から、プレイヤーごとの領域を求めて、フレーム間で追跡する
+//
+// 画素ごとの処理は、getRoi で取得した矩形(周りを広げて画像の中に収めたもの)の中だけで行えばよい。
+// 矩形は、プレイヤーが広がった場合はすぐに広げ、狭まった場合は smoothing の割合で少しずつ狭めるので、
+// 毎フレームの矩形の揺れで処理する範囲が欠けることはない。
+// 一時的に見えなくなった場合は、HOLD_FRAMES フレームの間は前の矩形を残す。
+class PlayerTracker
+{
+public:
+
+  enum
+  {
+    HOLD_FRAMES = 5
+  };
+
+  PlayerTracker()
+    : smoothing_( 0.2f )
+    , width_( 0 )
+    , height_( 0 )
+  {
+    reset();
+  }
+
+  // 矩形が狭まるときに、1フレームで近づける割合(0〜1)
+  void setSmoothing( float smoothing )
+  {
+    smoothing_ = std::max( 0.0f, std::min( smoothing, 1.0f ) );
+  }
+
+  // 追跡をやめて、すべてのプレイヤーを見えない状態にする
+  void reset()
+  {
+    for ( int p = 0; p < PlayerRuns::PLAYER_INDEX_COUNT; ++p ) {
+      PlayerRegion& region = regions_[p];
+      region.pixels = 0;
+      region.centroidX = region.centroidY = 0;
+      region.minDistance = region.maxDistance = 0;
+      region.left = region.top = region.right = region.bottom = 0;
+      region.lostFrames = HOLD_FRAMES + 1;
+    }
+  }
+
+  // 1フレーム分のプレイヤーのいる範囲で更新する
+  //   distance : runs と同じ座標の距離の画像(CV_16UC1、mm)。空の場合は距離を求めない
+  void update( const PlayerRuns& runs, const cv::Mat& distance )
+  {
+    width_ = runs.getWidth();
+    height_ = runs.getHeight();
+
+    // 範囲をたどって、重心と距離の範囲を求める
+    LONGLONG sumX[PlayerRuns::PLAYER_INDEX_COUNT] = { 0 };
+    LONGLONG sumY[PlayerRuns::PLAYER_INDEX_COUNT] = { 0 };
+    USHORT minDistance[PlayerRuns::PLAYER_INDEX_COUNT];
+    USHORT maxDistance[PlayerRuns::PLAYER_INDEX_COUNT] = { 0 };
+    std::fill( minDistance, minDistance + PlayerRuns::PLAYER_INDEX_COUNT, (USHORT)0xFFFF );
+
+    const std::vector< PlayerRun >& list = runs.getRuns();
+    for ( size_t r = 0; r < list.size(); ++r ) {
+      const PlayerRun& run = list[r];
+      const int length = run.end - run.begin;
+      sumX[run.player] += (LONGLONG)(run.begin + run.end - 1) * length / 2;
+      sumY[run.player] += (LONGLONG)run.y * length;
+
+      if ( !distance.empty() ) {
+        const USHORT* row = distance.ptr< USHORT >( run.y );
+        for ( int x = run.begin; x < run.end; ++x ) {
+          if ( row[x] != 0 ) {
+            minDistance[run.player] = std::min( minDistance[run.player], row[x] );
+            maxDistance[run.player] = std::max( maxDistance[run.player], row[x] );
+          }
+        }
+      }
+    }
+
+    // すべてのプレイヤーを合わせたもの
+    for ( int p = 1; p < PlayerRuns::PLAYER_INDEX_COUNT; ++p ) {
+      sumX[0] += sumX[p];
+      sumY[0] += sumY[p];
+      minDistance[0] = std::min( minDistance[0], minDistance[p] );
+      maxDistance[0] = std::max( maxDistance[0], maxDistance[p] );
+    }
+
+    for ( int p = 0; p < PlayerRuns::PLAYER_INDEX_COUNT; ++p ) {
+      PlayerRegion& region = regions_[p];
+      region.bounds = runs.getBounds( p );
+      region.pixels = region.bounds.pixels;
+      if ( region.pixels == 0 ) {
+        ++region.lostFrames;
+        continue;
+      }
+
+      region.centroidX = (float)sumX[p] / region.pixels;
+      region.centroidY = (float)sumY[p] / region.pixels;
+      region.minDistance = (maxDistance[p] != 0) ? minDistance[p] : 0;
+      region.maxDistance = maxDistance[p];
+      smooth( region );
+    }
+  }
+
+  // プレイヤーの領域(0はすべてのプレイヤー)
+  const PlayerRegion& getRegion( int player = 0 ) const
+  {
+    return regions_[player];
+  }
+
+  // プレイヤーを追跡しているか(見えなくなってから HOLD_FRAMES フレームまでは追跡を続ける)
+  bool isTracked( int player = 0 ) const
+  {
+    return regions_[player].lostFrames <= HOLD_FRAMES;
+  }
+
+  // 処理する範囲(滑らかにした矩形の周りを margin 画素広げて、画像の中に収めたもの)
+  // 追跡していない場合は空の矩形を返す
+  cv::Rect getRoi( int player = 0, int margin = 0 ) const
+  {
+    if ( !isTracked( player ) ) {
+      return cv::Rect();
+    }
+
+    const PlayerRegion& region = regions_[player];
+    int left = std::max( (int)std::floor( region.left ) - margin, 0 );
+    int top = std::max( (int)std::floor( region.top ) - margin, 0 );
+    int right = std::min( (int)std::ceil( region.right ) + margin, width_ );
+    int bottom = std::min( (int)std::ceil( region.bottom ) + margin, height_ );
+    if ( (right <= left) || (bottom <= top) ) {
+      return cv::Rect();
+    }
+
+    return cv::Rect( left, top, right - left, bottom - top );
+  }
+
+private:
+
+  // 矩形を滑らかにする(追跡していなかった場合は、このフレームの矩形から始める)
+  void smooth( PlayerRegion& region ) const
+  {
+    const PlayerBounds& bounds = region.bounds;
+    if ( region.lostFrames > HOLD_FRAMES ) {
+      region.left = (float)bounds.left;
+      region.top = (float)bounds.top;
+      region.right = (float)bounds.right;
+      region.bottom = (float)bounds.bottom;
+    }
+    else {
+      region.left = (bounds.left < region.left) ? bounds.left : region.left + (bounds.left - region.left) * smoothing_;
+      region.top = (bounds.top < region.top) ? bounds.top : region.top + (bounds.top - region.top) * smoothing_;
+      region.right = (bounds.right > region.right) ? bounds.right : region.right + (bounds.right - region.right) * smoothing_;
+      region.bottom = (bounds.bottom > region.bottom) ? bounds.bottom : region.bottom + (bounds.bottom - region.bottom) * smoothing_;
+    }
+    region.lostFrames = 0;
+  }
+
+  float smoothing_;
+
+  int width_;
+  int height_;
+
+  PlayerRegion regions_[PlayerRuns::PLAYER_INDEX_COUNT];
+};
@@ -1,9 +1,63 @@
 #include "ClothSetting.h"
+#include "SyntheticFrameSource.h"
 
-void main()
+// t[ŏԂv
+//   ̉摜̌ƍ̈ʒúA摜̑傫猈߂
+void benchmark( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, int matteRadius )
+{
+  // t[QƂ KinectControl ɍ쐬
+  SyntheticFrameSource synthetic( colorResolution, depthResolution );
+  KinectControl kinect;
+
+  cv::Mat cloth = cv::imread( "tshirts.png", CV_LOAD_IMAGE_UNCHANGED );
+  if ( cloth.empty() ) {
+    throw std::runtime_error( "̉摜ǂݍ߂܂ : tshirts.png" );
+  }
+
+  // AEAAE
+  std::vector<cv::Point> points;
+  points.push_back( cv::Point( cloth.cols * 3 / 10, cloth.rows / 5 ) );
+  points.push_back( cv::Point( cloth.cols * 7 / 10, cloth.rows / 5 ) );
+  points.push_back( cv::Point( cloth.cols * 3 / 10, cloth.rows * 9 / 10 ) );
+  points.push_back( cv::Point( cloth.cols * 7 / 10, cloth.rows * 9 / 10 ) );
+
+  kinect.setCloth( cloth, points );
+  if ( matteRadius >= 0 ) {
+    kinect.setMatteRadius( matteRadius );
+  }
+  kinect.initialize( &synthetic );
+
+  KernelBenchmark kernelBenchmark;
+  kinect.benchmark( kernelBenchmark );
+}
+
+// 
+//   (Ȃ)           ̉摜Ɍƍ̈ʒuw肵āAKinect̃t[ɕd˂
+//   benchmark        t[ŏԂv
+//
+//   -color <𑜓x>  RGBJ̉𑜓x(640x480A1280x960BResolutionSelector Q)
+//   -depth <𑜓x>  J̉𑜓x(80x60A320x240A640x480)
+//   -sink <o͐>   d˂摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+//   -matte <a>    [U̗֊sRGBJ̉摜ɍ킹tB^̔a(8A0͋J̃}XN̂܂)
+void main( int argc, char* argv[] )
 {
   try {
+    FrameSinkSelector sinks;
+    FrameSink* sink = sinks.select( argc, argv );
+
+    ResolutionSelector resolutions;
+    resolutions.select( argc, argv );
+    int matteRadius = GuidedMatte::selectRadius( argc, argv );
+
+    if ( (argc > 1) && (std::string( argv[1] ) == "benchmark") ) {
+      benchmark( resolutions.getColorResolution(), resolutions.getDepthResolution(), matteRadius );
+      return;
+    }
+
     ClothSetting cloth;
+    cloth.setSink( sink );
+    cloth.setResolution( resolutions.getColorResolution(), resolutions.getDepthResolution() );
+    cloth.setMatteRadius( matteRadius );
     cloth.setClothImage( "tshirts.png" );
   }
   catch ( std::exception& ex ) {
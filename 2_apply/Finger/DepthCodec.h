@@ -0,0 +1,365 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// 圧縮したデータの先頭
+struct DepthCodecHeader
+{
+  DWORD magic;          // DepthCodec::MAGIC
+  DWORD width;
+  DWORD height;
+  DWORD playerSize;     // プレイヤーの部分のバイト数
+  DWORD depthSize;      // 距離の部分のバイト数
+};
+
+// 距離データ(プレイヤー付き)の可逆圧縮
+//
+// NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX の画素(上位13ビットが距離、下位3ビットが
+// プレイヤー)を、距離とプレイヤーに分けて圧縮する。
+//   プレイヤー : 同じ値が続く長さ(ランレングス)で符号化する
+//   距離       : 1行上の画素との差分を符号化する。差分が0の並び(平らな面や、
+//                距離が取れない0の領域)は、続く長さで符号化する
+// 差分の計算と復元、同じ値の並びの検出は、SSE2が使える場合は8画素ずつ行う。
+//
+// 圧縮したデータの形式
+//   DepthCodecHeader
+//   プレイヤー : 値(1バイト) + 長さ(7ビットずつ、下位から。最上位ビットが1なら続きがある)
+//   距離       : 差分の並び
+//     0xxxxxxx          差分(0〜127)
+//     10xxxxxx          差分0がx+1個続く(1〜64)
+//     110xxxxx xxxxxxxx 差分0がx+1個続く(1〜8192)
+//     111xxxxx xxxxxxxx 差分(0〜8191)
+//   差分は13ビットで折り返し、0,-1,1,-2,2...の順に0,1,2,3,4...となるように符号を
+//   最下位ビットに移した値にする(小さい差分が1バイトで表せる)
+class DepthCodec
+{
+public:
+
+  // "DPC1"
+  static const DWORD MAGIC = 0x31435044;
+
+  DepthCodec()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+  {
+  }
+
+  // 圧縮後の最大のバイト数
+  static size_t getMaxEncodedSize( int width, int height )
+  {
+    return sizeof(DepthCodecHeader) + (width * height * 4);
+  }
+
+  // 圧縮する(圧縮後のバイト数を返す)
+  size_t encode( const USHORT* depth, int width, int height, std::vector< BYTE >& encoded )
+  {
+    encoded.resize( getMaxEncodedSize( width, height ) );
+    BYTE* begin = &encoded[0];
+    BYTE* out = begin + sizeof(DepthCodecHeader);
+
+    // プレイヤー
+    BYTE* player = out;
+    out = encodePlayer( depth, width * height, out );
+    DWORD playerSize = (DWORD)(out - player);
+
+    // 距離(最初の行は、0の行との差分にする)
+    BYTE* distance = out;
+    zeroRow_.assign( width, 0 );
+    residual_.resize( width );
+    DWORD zeroRun = 0;
+    for ( int y = 0; y < height; ++y ) {
+      const USHORT* row = depth + (y * width);
+      const USHORT* up = (y == 0) ? &zeroRow_[0] : row - width;
+      computeResidual( row, up, &residual_[0], width );
+      out = encodeResidual( &residual_[0], width, out, zeroRun );
+    }
+    out = flushZeroRun( out, zeroRun );
+
+    DepthCodecHeader header;
+    header.magic = MAGIC;
+    header.width = width;
+    header.height = height;
+    header.playerSize = playerSize;
+    header.depthSize = (DWORD)(out - distance);
+    memcpy( begin, &header, sizeof(header) );
+
+    size_t size = out - begin;
+    encoded.resize( size );
+    return size;
+  }
+
+  // 展開する(データが壊れている場合は例外を投げる)
+  void decode( const BYTE* data, size_t size, USHORT* depth, int width, int height )
+  {
+    DepthCodecHeader header;
+    if ( size < sizeof(header) ) {
+      throw std::runtime_error( "圧縮したデータが壊れています" );
+    }
+
+    memcpy( &header, data, sizeof(header) );
+    if ( (header.magic != MAGIC) || (header.width != width) || (header.height != height) ||
+         (sizeof(header) + header.playerSize + header.depthSize != size) ) {
+      throw std::runtime_error( "圧縮したデータが壊れています" );
+    }
+
+    // プレイヤーを展開して、距離の下位3ビットに入れておく
+    const BYTE* player = data + sizeof(header);
+    decodePlayer( player, player + header.playerSize, depth, width * height );
+
+    // 距離
+    const BYTE* in = player + header.playerSize;
+    const BYTE* end = in + header.depthSize;
+    zeroRow_.assign( width, 0 );
+    residual_.resize( width );
+    DWORD zeroRun = 0;
+    for ( int y = 0; y < height; ++y ) {
+      USHORT* row = depth + (y * width);
+      const USHORT* up = (y == 0) ? &zeroRow_[0] : row - width;
+      in = decodeResidual( in, end, &residual_[0], width, zeroRun );
+      restoreRow( &residual_[0], up, row, width );
+    }
+
+    if ( (in != end) || (zeroRun != 0) ) {
+      throw std::runtime_error( "圧縮したデータが壊れています" );
+    }
+  }
+
+private:
+
+  // プレイヤーを符号化する
+  BYTE* encodePlayer( const USHORT* depth, int count, BYTE* out ) const
+  {
+    int i = 0;
+    while ( i < count ) {
+      USHORT value = depth[i] & NUI_IMAGE_PLAYER_INDEX_MASK;
+      int start = i++;
+
+      // 同じ値が続く間は、8画素ずつ進める
+      if ( isSse2_ ) {
+        const __m128i playerMask = _mm_set1_epi16( NUI_IMAGE_PLAYER_INDEX_MASK );
+        const __m128i current = _mm_set1_epi16( value );
+        while ( i + 8 <= count ) {
+          __m128i v = _mm_and_si128( _mm_loadu_si128( (const __m128i*)(depth + i) ), playerMask );
+          if ( _mm_movemask_epi8( _mm_cmpeq_epi16( v, current ) ) != 0xFFFF ) {
+            break;
+          }
+
+          i += 8;
+        }
+      }
+
+      while ( (i < count) && ((depth[i] & NUI_IMAGE_PLAYER_INDEX_MASK) == value) ) {
+        ++i;
+      }
+
+      *out++ = (BYTE)value;
+      out = writeLength( out, i - start );
+    }
+
+    return out;
+  }
+
+  // プレイヤーを展開する
+  static void decodePlayer( const BYTE* in, const BYTE* end, USHORT* depth, int count )
+  {
+    int i = 0;
+    while ( in < end ) {
+      USHORT value = *in++;
+      DWORD length = 0;
+      in = readLength( in, end, length );
+      if ( (value > NUI_IMAGE_PLAYER_INDEX_MASK) || (length == 0) || (length > (DWORD)(count - i)) ) {
+        throw std::runtime_error( "圧縮したデータが壊れています" );
+      }
+
+      std::fill( depth + i, depth + i + length, value );
+      i += length;
+    }
+
+    if ( i != count ) {
+      throw std::runtime_error( "圧縮したデータが壊れています" );
+    }
+  }
+
+  static BYTE* writeLength( BYTE* out, DWORD length )
+  {
+    while ( length >= 0x80 ) {
+      *out++ = (BYTE)(0x80 | (length & 0x7F));
+      length >>= 7;
+    }
+
+    *out++ = (BYTE)length;
+    return out;
+  }
+
+  static const BYTE* readLength( const BYTE* in, const BYTE* end, DWORD& length )
+  {
+    length = 0;
+    for ( int shift = 0; shift < 32; shift += 7 ) {
+      if ( in >= end ) {
+        break;
+      }
+
+      BYTE b = *in++;
+      length |= (DWORD)(b & 0x7F) << shift;
+      if ( (b & 0x80) == 0 ) {
+        return in;
+      }
+    }
+
+    throw std::runtime_error( "圧縮したデータが壊れています" );
+  }
+
+  // 1行上との距離の差分を計算する
+  void computeResidual( const USHORT* row, const USHORT* up, USHORT* residual, int width ) const
+  {
+    int x = 0;
+    if ( isSse2_ ) {
+      const __m128i mask = _mm_set1_epi16( 0x1FFF );
+      for ( ; x + 8 <= width; x += 8 ) {
+        __m128i c = _mm_srli_epi16( _mm_loadu_si128( (const __m128i*)(row + x) ), NUI_IMAGE_PLAYER_INDEX_SHIFT );
+        __m128i u = _mm_srli_epi16( _mm_loadu_si128( (const __m128i*)(up + x) ), NUI_IMAGE_PLAYER_INDEX_SHIFT );
+
+        // 13ビットで折り返した差分を符号付きにして、符号を最下位ビットに移す
+        __m128i s = _mm_srai_epi16( _mm_slli_epi16( _mm_sub_epi16( c, u ), 3 ), 3 );
+        __m128i z = _mm_xor_si128( _mm_slli_epi16( s, 1 ), _mm_srai_epi16( s, 15 ) );
+        _mm_storeu_si128( (__m128i*)(residual + x), _mm_and_si128( z, mask ) );
+      }
+    }
+
+    for ( ; x < width; ++x ) {
+      SHORT s = (SHORT)(((row[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT) - (up[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT)) << 3) >> 3;
+      residual[x] = (USHORT)((s << 1) ^ (s >> 15)) & 0x1FFF;
+    }
+  }
+
+  // 差分から距離を復元する(row の下位3ビットには、展開したプレイヤーが入っている)
+  void restoreRow( const USHORT* residual, const USHORT* up, USHORT* row, int width ) const
+  {
+    int x = 0;
+    if ( isSse2_ ) {
+      const __m128i mask = _mm_set1_epi16( 0x1FFF );
+      const __m128i one = _mm_set1_epi16( 1 );
+      const __m128i zero = _mm_setzero_si128();
+      for ( ; x + 8 <= width; x += 8 ) {
+        __m128i z = _mm_loadu_si128( (const __m128i*)(residual + x) );
+        __m128i s = _mm_xor_si128( _mm_srli_epi16( z, 1 ), _mm_sub_epi16( zero, _mm_and_si128( z, one ) ) );
+        __m128i u = _mm_srli_epi16( _mm_loadu_si128( (const __m128i*)(up + x) ), NUI_IMAGE_PLAYER_INDEX_SHIFT );
+        __m128i d = _mm_and_si128( _mm_add_epi16( u, s ), mask );
+
+        __m128i* p = (__m128i*)(row + x);
+        _mm_storeu_si128( p, _mm_or_si128( _mm_slli_epi16( d, NUI_IMAGE_PLAYER_INDEX_SHIFT ), _mm_loadu_si128( p ) ) );
+      }
+    }
+
+    for ( ; x < width; ++x ) {
+      USHORT s = (residual[x] >> 1) ^ (USHORT)-(SHORT)(residual[x] & 1);
+      USHORT d = ((up[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT) + s) & 0x1FFF;
+      row[x] |= d << NUI_IMAGE_PLAYER_INDEX_SHIFT;
+    }
+  }
+
+  // 差分を符号化する(差分0の並びは zeroRun に数えておき、次の差分の前に書き込む)
+  BYTE* encodeResidual( const USHORT* residual, int width, BYTE* out, DWORD& zeroRun ) const
+  {
+    int x = 0;
+    while ( x < width ) {
+      // 0が続く間は、8画素ずつ進める
+      if ( isSse2_ && (x + 8 <= width) &&
+           (_mm_movemask_epi8( _mm_cmpeq_epi16( _mm_loadu_si128( (const __m128i*)(residual + x) ), _mm_setzero_si128() ) ) == 0xFFFF) ) {
+        zeroRun += 8;
+        x += 8;
+        continue;
+      }
+
+      USHORT z = residual[x++];
+      if ( z == 0 ) {
+        ++zeroRun;
+        continue;
+      }
+
+      out = flushZeroRun( out, zeroRun );
+      if ( z < 0x80 ) {
+        *out++ = (BYTE)z;
+      }
+      else {
+        *out++ = (BYTE)(0xE0 | (z >> 8));
+        *out++ = (BYTE)(z & 0xFF);
+      }
+    }
+
+    return out;
+  }
+
+  static BYTE* flushZeroRun( BYTE* out, DWORD& zeroRun )
+  {
+    while ( zeroRun > 0 ) {
+      DWORD length = std::min( zeroRun, (DWORD)8192 );
+      if ( length <= 64 ) {
+        *out++ = (BYTE)(0x80 | (length - 1));
+      }
+      else {
+        *out++ = (BYTE)(0xC0 | ((length - 1) >> 8));
+        *out++ = (BYTE)((length - 1) & 0xFF);
+      }
+
+      zeroRun -= length;
+    }
+
+    return out;
+  }
+
+  // 1行分の差分を展開する(行をまたぐ差分0の並びは zeroRun に残す)
+  static const BYTE* decodeResidual( const BYTE* in, const BYTE* end, USHORT* residual, int width, DWORD& zeroRun )
+  {
+    int x = 0;
+    while ( x < width ) {
+      if ( zeroRun > 0 ) {
+        int length = (int)std::min( zeroRun, (DWORD)(width - x) );
+        memset( residual + x, 0, length * sizeof(USHORT) );
+        x += length;
+        zeroRun -= length;
+        continue;
+      }
+
+      if ( in >= end ) {
+        throw std::runtime_error( "圧縮したデータが壊れています" );
+      }
+
+      BYTE b = *in++;
+      if ( b < 0x80 ) {
+        residual[x++] = b;
+      }
+      else if ( b < 0xC0 ) {
+        zeroRun = (b & 0x3F) + 1;
+      }
+      else {
+        if ( in >= end ) {
+          throw std::runtime_error( "圧縮したデータが壊れています" );
+        }
+
+        DWORD value = ((b & 0x1F) << 8) | *in++;
+        if ( b < 0xE0 ) {
+          zeroRun = value + 1;
+        }
+        else {
+          residual[x++] = (USHORT)value;
+        }
+      }
+    }
+
+    return in;
+  }
+
+private:
+
+  bool isSse2_;
+
+  // 作業用のバッファ(フレームごとに確保しない)
+  std::vector< USHORT > zeroRow_;
+  std::vector< USHORT > residual_;
+};
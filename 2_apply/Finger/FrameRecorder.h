@@ -0,0 +1,302 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DepthCodec.h"
+#include "DepthColorRegistration.h"
+#include "FramePool.h"
+#include "RecordingFormat.h"
+#include "SpscQueue.h"
+
+// フレームをファイルに記録する
+//
+// record() はフレームの参照をキューに入れるだけで、ファイルへの書き込みは
+// 専用のスレッドで行う。書き込みが追いつかずキューがいっぱいになった場合は、
+// 取得側を止めないようにフレームを捨てる(getDroppedCount() で確認できる)。
+// 距離データは、書き込みのスレッドで DepthCodec を使って圧縮する。
+class FrameRecorder
+{
+public:
+
+  // 書き込みを待つフレームの最大数
+  static const int QUEUE_CAPACITY = 60;
+
+  FrameRecorder()
+    : file_( INVALID_HANDLE_VALUE )
+    , thread_( 0 )
+    , queue_( 0 )
+    , depthEncoding_( ENCODING_DEPTH_CODEC )
+    , offset_( 0 )
+    , frameCount_( 0 )
+    , droppedCount_( 0 )
+  {
+  }
+
+  ~FrameRecorder()
+  {
+    close();
+  }
+
+  // 記録を始める
+  //   registration  : 再生時に使う座標変換テーブル(0の場合は保存しない)
+  //   depthEncoding : 距離データの形式(ENCODING_RAW の場合は圧縮しない)
+  void open( const std::string& fileName,
+    NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+    const DepthColorRegistration* registration = 0, DWORD depthEncoding = ENCODING_DEPTH_CODEC )
+  {
+    close();
+
+    file_ = ::CreateFileA( fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0,
+      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+    if ( file_ == INVALID_HANDLE_VALUE ) {
+      throw std::runtime_error( "記録ファイルを作成できません : " + fileName );
+    }
+
+    depthEncoding_ = depthEncoding;
+    offset_ = 0;
+    index_.clear();
+    frameCount_ = 0;
+    droppedCount_ = 0;
+
+    RecordingHeader header = { 0 };
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.colorResolution = colorResolution;
+    header.depthResolution = depthResolution;
+    write( &header, sizeof(header) );
+
+    if ( (registration != 0) && registration->isInitialized() ) {
+      const std::vector< DepthColorRegistration::ColorPoint >& table = registration->getTable();
+      writeChunk( CHUNK_REGISTRATION, ENCODING_RAW, 0, 0, &table[0],
+        (DWORD)(table.size() * sizeof(DepthColorRegistration::ColorPoint)) );
+    }
+
+    queue_ = new SpscQueue< Item >( QUEUE_CAPACITY, QUEUE_DROP_NEWEST );
+    thread_ = ::CreateThread( 0, 0, &FrameRecorder::threadProc, this, 0, 0 );
+  }
+
+  // 記録を終える(キューに残っているフレームを書き込んでから、索引を書き込む)
+  void close()
+  {
+    if ( file_ == INVALID_HANDLE_VALUE ) {
+      return;
+    }
+
+    queue_->close();
+    ::WaitForSingleObject( thread_, INFINITE );
+    ::CloseHandle( thread_ );
+    thread_ = 0;
+
+    droppedCount_ = queue_->getStatistics().dropped;
+    delete queue_;
+    queue_ = 0;
+
+    // 索引を書き込む
+    try {
+      LONGLONG indexOffset = offset_;
+      if ( !index_.empty() ) {
+        write( &index_[0], (DWORD)(index_.size() * sizeof(RecordingIndexEntry)) );
+      }
+
+      // ヘッダーにフレーム数と索引の位置を書き込む(間に詰め物が入るので、それぞれの位置に書き込む)
+      LARGE_INTEGER position = { 0 };
+      position.QuadPart = offsetof( RecordingHeader, frameCount );
+      ::SetFilePointerEx( file_, position, 0, FILE_BEGIN );
+
+      DWORD frameCount = (DWORD)index_.size();
+      write( &frameCount, sizeof(frameCount) );
+
+      position.QuadPart = offsetof( RecordingHeader, indexOffset );
+      ::SetFilePointerEx( file_, position, 0, FILE_BEGIN );
+      write( &indexOffset, sizeof(indexOffset) );
+    }
+    catch ( std::exception& ex ) {
+      std::cout << "FrameRecorder::close " << ex.what() << std::endl;
+    }
+
+    ::CloseHandle( file_ );
+    file_ = INVALID_HANDLE_VALUE;
+  }
+
+  bool isOpen() const
+  {
+    return file_ != INVALID_HANDLE_VALUE;
+  }
+
+  // 1フレーム分を記録する(データはコピーせず、書き込むまで参照を保持する)
+  //   skeletonFrame : スケルトンがない場合は0
+  bool record( const FrameHandle& colorFrame, const FrameHandle& depthFrame,
+    const NUI_SKELETON_FRAME* skeletonFrame = 0 )
+  {
+    if ( !isOpen() ) {
+      return false;
+    }
+
+    Item item;
+    item.colorFrame = colorFrame;
+    item.depthFrame = depthFrame;
+    item.isSkeleton = (skeletonFrame != 0);
+    if ( item.isSkeleton ) {
+      item.skeletonFrame = *skeletonFrame;
+    }
+
+    return queue_->push( item );
+  }
+
+  // 書き込んだフレーム数
+  LONG getFrameCount() const
+  {
+    return frameCount_;
+  }
+
+  // 書き込みが追いつかずに捨てたフレーム数
+  LONG getDroppedCount() const
+  {
+    return (queue_ != 0) ? queue_->getStatistics().dropped : droppedCount_;
+  }
+
+private:
+
+  struct Item
+  {
+    FrameHandle colorFrame;
+    FrameHandle depthFrame;
+    NUI_SKELETON_FRAME skeletonFrame;
+    bool isSkeleton;
+
+    Item()
+      : isSkeleton( false )
+    {
+    }
+  };
+
+  static DWORD WINAPI threadProc( LPVOID param )
+  {
+    ((FrameRecorder*)param)->writeFrames();
+    return 0;
+  }
+
+  // キューからフレームを取り出して書き込む
+  void writeFrames()
+  {
+    try {
+      Item item;
+      while ( queue_->pop( item ) ) {
+        writeFrame( item );
+        item = Item();
+      }
+    }
+    catch ( std::exception& ex ) {
+      // 書き込めなくなった場合は、以降のフレームを捨てる
+      std::cout << "FrameRecorder::writeFrames " << ex.what() << std::endl;
+      queue_->close();
+
+      Item item;
+      while ( queue_->pop( item ) ) {
+      }
+    }
+  }
+
+  void writeFrame( const Item& item )
+  {
+    RecordingIndexEntry entry = { 0 };
+    if ( !item.colorFrame.empty() ) {
+      entry.timeStamp = item.colorFrame.frame().timeStamp;
+    }
+    else if ( !item.depthFrame.empty() ) {
+      entry.timeStamp = item.depthFrame.frame().timeStamp;
+    }
+    else if ( item.isSkeleton ) {
+      entry.timeStamp = item.skeletonFrame.liTimeStamp.QuadPart;
+    }
+
+    writeChunk( CHUNK_FRAME, ENCODING_RAW, (DWORD)index_.size(), entry.timeStamp, 0, 0 );
+
+    if ( !item.colorFrame.empty() ) {
+      const ImageFrame& frame = item.colorFrame.frame();
+      entry.colorOffset = writeChunk( CHUNK_COLOR, ENCODING_RAW, frame.frameNumber, frame.timeStamp,
+        frame.bits, frame.size );
+    }
+
+    if ( !item.depthFrame.empty() ) {
+      const ImageFrame& frame = item.depthFrame.frame();
+      if ( depthEncoding_ == ENCODING_DEPTH_CODEC ) {
+        size_t size = codec_.encode( (const USHORT*)frame.bits, frame.width, frame.height, encoded_ );
+        entry.depthOffset = writeChunk( CHUNK_DEPTH, ENCODING_DEPTH_CODEC, frame.frameNumber, frame.timeStamp,
+          &encoded_[0], (DWORD)size );
+      }
+      else {
+        entry.depthOffset = writeChunk( CHUNK_DEPTH, ENCODING_RAW, frame.frameNumber, frame.timeStamp,
+          frame.bits, frame.size );
+      }
+    }
+
+    if ( item.isSkeleton ) {
+      const NUI_SKELETON_FRAME& frame = item.skeletonFrame;
+      entry.skeletonOffset = writeChunk( CHUNK_SKELETON, ENCODING_RAW, frame.dwFrameNumber,
+        frame.liTimeStamp.QuadPart, &frame, sizeof(frame) );
+    }
+
+    index_.push_back( entry );
+    ::InterlockedIncrement( &frameCount_ );
+  }
+
+  // チャンクを書き込んで、チャンクの位置を返す
+  LONGLONG writeChunk( DWORD type, DWORD encoding, DWORD frameNumber, LONGLONG timeStamp,
+    const void* data, DWORD size )
+  {
+    LONGLONG offset = offset_;
+
+    RecordingChunk chunk = { 0 };
+    chunk.type = type;
+    chunk.encoding = encoding;
+    chunk.size = size;
+    chunk.frameNumber = frameNumber;
+    chunk.timeStamp = timeStamp;
+    write( &chunk, sizeof(chunk) );
+
+    if ( size != 0 ) {
+      write( data, size );
+    }
+
+    return offset;
+  }
+
+  void write( const void* data, DWORD size )
+  {
+    DWORD written = 0;
+    if ( !::WriteFile( file_, data, size, &written, 0 ) || (written != size) ) {
+      throw std::runtime_error( "記録ファイルに書き込めません" );
+    }
+
+    offset_ += size;
+  }
+
+private:
+
+  // コピーを禁止する
+  FrameRecorder( const FrameRecorder& rhs );
+  FrameRecorder& operator = ( const FrameRecorder& rhs );
+
+private:
+
+  HANDLE file_;
+  HANDLE thread_;
+  SpscQueue< Item >* queue_;
+
+  DWORD depthEncoding_;
+  DepthCodec codec_;                            // 書き込みのスレッドだけが使う
+  std::vector< BYTE > encoded_;
+
+  LONGLONG offset_;
+  std::vector< RecordingIndexEntry > index_;    // 書き込みのスレッドだけが使う
+  volatile LONG frameCount_;
+  LONG droppedCount_;
+};
@@ -1,167 +1,263 @@
-
 #include "KinectControl.h"
 
 
 KinectControl::KinectControl()
+  : source( 0 )
+  , recorder( 0 )
+  , sink( &screen )
 {
+  // xvi(LatencyStage ̏)
+  latencyMonitor.addStage( "acquire" );
+  latencyMonitor.addStage( "mapping" );
+  latencyMonitor.addStage( "analysis" );
+  latencyMonitor.addStage( "present" );
 }
 
 KinectControl::~KinectControl()
 {
-  if ( kinect != 0 ) {
-    kinect->NuiShutdown();
-    kinect->Release();
-  }
 }
 
-void KinectControl::initialize()
+void KinectControl::initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
 {
-  createInstance();
+  // Kinect
+  // Near[hł̃XPggbLOсASeated[hɂ
+  kinect.initialize( colorResolution, depthResolution, NUI_IMAGE_FRAME_FLAG_NEAR_MODE_ENABLED, true,
+    NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA |
+    NUI_SKELETON_TRACKING_FLAG_ENABLE_IN_NEAR_RANGE |
+    NUI_SKELETON_TRACKING_FLAG_ENABLE_SEATED_SUPPORT );
+  //kinect.initialize( colorResolution, depthResolution, 0, true );
 
-  // Kinect̐ݒ
-  ERROR_CHECK( kinect->NuiInitialize( NUI_INITIALIZE_FLAG_USES_COLOR | NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON ) );
+  initialize( &kinect );
+}
 
-  // RGBJ
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR, CAMERA_RESOLUTION, 0, 2, 0, &imageStreamHandle ) );
+void KinectControl::initialize( FrameSource* frameSource )
+{
+  source = frameSource;
 
-  // J
-  // Near[hɂ
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION,
-    NUI_IMAGE_FRAME_FLAG_NEAR_MODE_ENABLED, 2, 0, &depthStreamHandle ) );
-  //ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION, 0, 2, 0, &depthStreamHandle ) );
+  // w肵𑜓x́AʃTCY擾
+  ::NuiImageResolutionToSize( source->getColorResolution(), width, height );
+  ::NuiImageResolutionToSize( source->getDepthResolution(), depthWidth, depthHeight );
 
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION, 0, 2, 0, &depthStreamHandle ) );
+  // JRGBJւ̍Wϊe[u쐬
+  registration.initialize( *source, source->getColorResolution(), source->getDepthResolution() );
+}
 
-  // XPg
-  // Near[hł̃XPggbLOсASeated[hɂ
-  ERROR_CHECK( kinect->NuiSkeletonTrackingEnable( 0, 
-    NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA |
-	  NUI_SKELETON_TRACKING_FLAG_ENABLE_IN_NEAR_RANGE | 
-	  NUI_SKELETON_TRACKING_FLAG_ENABLE_SEATED_SUPPORT ) );
-  //ERROR_CHECK( kinect->NuiSkeletonTrackingEnable( 0, NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA ) );
+// JRGBJւ̍Wϊe[u
+const DepthColorRegistration* KinectControl::getRegistration() const
+{
+  return &registration;
+}
 
-  // t[XVCxg̃nh쐬
-  streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
-  ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+// 擾t[L^(0̏ꍇ͋L^Ȃ)
+void KinectControl::setRecorder( FrameRecorder* frameRecorder )
+{
+  recorder = frameRecorder;
+}
 
-  // w肵𑜓x́AʃTCY擾
-  ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+// 摜̏o͐w肷(w肵Ȃꍇ͉ʂɕ\)
+void KinectControl::setSink( FrameSink* frameSink )
+{
+  sink = frameSink;
 }
 
 void KinectControl::run()
 {
-  // C[v
-  while ( 1 ) {
-    // f[^̍XV҂
-    DWORD ret = ::WaitForSingleObject( streamEvent, INFINITE );
-    ::ResetEvent( streamEvent );
-
-    setRgbImage( rgbImage );
-    setDepthImage( depthImage );
-    setSkeleton( depthImage );
-
-    cv::imshow( "RGB Image", rgbImage );
-
-    // Î߂̃L[̓`FbNA\̂߂̃EFCg
-    int key = cv::waitKey( 10 );
-    if ( key == 'q' ) {
-      break;
-    }
-  }
+  // 擾Af[^̕ϊÁA\ꂼ̃Xbhōs
+  Pipeline< FingerFrame > pipeline;
+  pipeline.setSource( "acquire", [this]( FingerFrame& frame ) { return acquireFrame( frame ); } );
+  pipeline.addStage( "registration", [this]( FingerFrame& frame ) { return registerFrame( frame ); } );
+  pipeline.addStage( "analysis", [this]( FingerFrame& frame ) { return analyzeFrame( frame ); } );
+
+  // \xꂽꍇ́AŐṼt[\(摜t@Cւ̕ۑȂǂ͎̂Ăɑ҂)
+  pipeline.run( "present", [this]( FingerFrame& frame ) { return presentFrame( frame ); },
+    2, sink->isDroppable() ? QUEUE_DROP_OLDEST : QUEUE_BLOCK );
+
+  pipeline.printStatistics( std::cout );
+  latencyMonitor.printStatistics( std::cout );
+  playerStatistics.printStatistics( std::cout );
 }
 
-void KinectControl::createInstance()
+// f[^̕ϊƁẢ͂̏Ԃv(\͂Ȃ)
+void KinectControl::benchmark( KernelBenchmark& kernelBenchmark )
 {
-  // ڑĂKinect̐擾
-  int count = 0;
-  ERROR_CHECK( ::NuiGetSensorCount( &count ) );
-  if ( count == 0 ) {
-    throw std::runtime_error( "Kinect ڑĂ" );
+  // vɎgt[Ɏ擾āAf[^ϊĂ
+  std::vector< FingerFrame > frames;
+  FingerFrame acquired;
+  while ( (frames.size() < BENCHMARK_FRAME_COUNT) && acquireFrame( acquired ) ) {
+    registerFrame( acquired );
+    frames.push_back( acquired );
+    acquired = FingerFrame();
+  }
+  if ( frames.empty() ) {
+    throw std::runtime_error( "vɎgt[܂" );
   }
 
-  // ŏKinect̃CX^X쐬
-  ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
+  kernelBenchmark.printHeader( std::cout, "Finger" );
 
-  // Kinect̏Ԃ擾
-  HRESULT status = kinect->NuiStatus();
-  if ( status != S_OK ) {
-    throw std::runtime_error( "Kinect p\ł͂܂" );
-  }
+  // f[^𕪂邾̏ꍇƁAvC[Ƃ̓vώZȂ番ꍇׂ
+  double unpackTime = kernelBenchmark.run( "unpack", [&]( int i ) {
+    const FrameHandle& depthFrame = frames[i % frames.size()].depthFrame;
+    if ( !depthFrame.empty() ) {
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight );
+    }
+  } );
+  double statisticsTime = kernelBenchmark.run( "unpack+statistics", [&]( int i ) {
+    const FrameHandle& depthFrame = frames[i % frames.size()].depthFrame;
+    if ( !depthFrame.empty() ) {
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight, playerStatistics );
+    }
+  } );
+  std::cout << "  statistics overhead " << std::fixed << std::setprecision( 0 )
+            << (statisticsTime - unpackTime) << " ns/frame" << std::endl;
+
+  kernelBenchmark.run( "setDepthImage", [&]( int i ) {
+    FingerFrame& frame = frames[i % frames.size()];
+    setDepthImage( frame.depthFrame, frame.depthBuffer, frame.depthImage );
+  } );
+
+  // ̉͂́At[ɒڕ`悷(vɕ`悪dȂĂ͂ɂ͉eȂ)
+  kernelBenchmark.run( "setHandImage",
+    [&]( int i ) {
+      FingerFrame& frame = frames[i % frames.size()];
+      rgbImage = cv::Mat( height, width, CV_8UC4, frame.rgbFrame.bits() );
+      depthImage = frame.depthImage;
+      playerRoi = frame.playerRoi;
+    },
+    [&]( int i ) {
+      FingerFrame& frame = frames[i % frames.size()];
+      if ( !frame.isSkeleton ) {
+        return;
+      }
+
+      for ( int j = 0; j < NUI_SKELETON_COUNT; ++j ) {
+        const NUI_SKELETON_DATA& skeletonData = frame.skeletonFrame.SkeletonData[j];
+        if ( skeletonData.eTrackingState == NUI_SKELETON_TRACKED ) {
+          setHandImage( skeletonData.SkeletonPositions[NUI_SKELETON_POSITION_HAND_LEFT],
+            skeletonData.SkeletonPositions[NUI_SKELETON_POSITION_WRIST_LEFT], rgbImage, "LeftHand" );
+          setHandImage( skeletonData.SkeletonPositions[NUI_SKELETON_POSITION_HAND_RIGHT],
+            skeletonData.SkeletonPositions[NUI_SKELETON_POSITION_WRIST_RIGHT], rgbImage, "RightHand" );
+        }
+      }
+    } );
 }
 
-void KinectControl::setRgbImage( cv::Mat& image )
+bool KinectControl::acquireFrame( FingerFrame& frame )
 {
+  // f[^̍XV҂
+  if ( !source->waitFrame() ) {
+    return false;
+  }
+
+  latencyMonitor.arrive( frame.latency );
+
   // RGBJ̃t[f[^擾
-  NUI_IMAGE_FRAME imageFrame = { 0 };
-  ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( imageStreamHandle, 0, &imageFrame ) );
+  ERROR_CHECK( source->acquireColorFrame( frame.rgbFrame ) );
+  frame.latency.sensorTime = frame.rgbFrame.frame().timeStamp;
 
-  // 摜f[^擾
-  NUI_LOCKED_RECT colorData;
-  imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
+  // J̃t[f[^擾(擾łȂꍇ͋̂܂)
+  source->acquireDepthFrame( frame.depthFrame );
 
-  // 摜f[^Rs[
-  image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+  // XPg̃t[擾
+  frame.isSkeleton = (source->getSkeletonFrame( frame.skeletonFrame ) == S_OK);
+  latencyMonitor.stamp( frame.latency, LATENCY_ACQUIRE );
 
-  // t[f[^
-  ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
+  // L^(݂͋L^p̃Xbhōs)
+  if ( recorder != 0 ) {
+    recorder->record( frame.rgbFrame, frame.depthFrame, frame.isSkeleton ? &frame.skeletonFrame : 0 );
+  }
+
+  return true;
 }
 
-void KinectControl::setDepthImage( cv::Mat& image )
+bool KinectControl::registerFrame( FingerFrame& frame )
 {
-  image = cv::Mat( height, width, CV_16UC1, cv::Scalar ( 0 ) );
+  setDepthImage( frame.depthFrame, frame.depthBuffer, frame.depthImage );
 
-  // J̃t[f[^擾
-  NUI_IMAGE_FRAME depthFrame = { 0 };
-  HRESULT ret = kinect->NuiImageStreamGetNextFrame( depthStreamHandle, 0, &depthFrame );
+  // vC[̗̈ǐՂāAT͈͂ɂ
+  if ( frame.depthFrame.empty() ) {
+    playerTracker.reset();
+  }
+  else {
+    playerRuns.build( registeredPlayer );
+    playerTracker.update( playerRuns, frame.depthImage );
+  }
+  frame.playerRoi = playerTracker.getRoi( 0, PLAYER_ROI_MARGIN );
+  latencyMonitor.stamp( frame.latency, LATENCY_MAPPING );
+  return true;
+}
+
+bool KinectControl::analyzeFrame( FingerFrame& frame )
+{
+  // ͌ʂ́ARGBJ̃t[ɒڕ`悷
+  // (L^ȂǂŁAقɂt[QƂĂꍇ̓Rs[Ă`悷)
+  rgbImage = cv::Mat( height, width, CV_8UC4, frame.rgbFrame.bits() );
+  if ( frame.rgbFrame.useCount() > 1 ) {
+    rgbImage = rgbImage.clone();
+  }
+  depthImage = frame.depthImage;
+  playerRoi = frame.playerRoi;
 
-  if( ret == S_OK ) {
-    // f[^擾
-    NUI_LOCKED_RECT depthData = { 0 };
-    depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
+  if ( frame.isSkeleton ) {
+    setSkeleton( frame.skeletonFrame, depthImage );
+  }
 
-    USHORT* depth = (USHORT*)depthData.pBits;
-    for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
-      USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
+  frame.rgbImage = rgbImage;
+  latencyMonitor.stamp( frame.latency, LATENCY_ANALYSIS );
+  return true;
+}
 
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX;
-      LONG colorY;
+bool KinectControl::presentFrame( FingerFrame& frame )
+{
+  // o͐ɓn(Ivꂽꍇfalse)
+  sink->present( "RGB Image", frame.rgbImage );
+  bool isContinue = sink->endFrame();
 
-      // J̍WARGBJ̍Wɕϊ
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, depthX , depthY, 0, &colorX, &colorY );
+  // \܂ł̒xL^āÅԊuŕ\
+  latencyMonitor.stamp( frame.latency, LATENCY_PRESENT );
+  latencyMonitor.complete( frame.latency );
+  latencyMonitor.printStatistics( std::cout, LATENCY_PRINT_INTERVAL );
+  playerStatistics.printStatistics( std::cout, LATENCY_PRINT_INTERVAL );
 
-      // fvX摜Ɋi[
-      image.at<USHORT>( colorY, colorX ) = distance;
-    }
+  return isContinue;
+}
 
-    // t[f[^
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( depthStreamHandle, &depthFrame ) );
+void KinectControl::setDepthImage( const FrameHandle& depthFrame, FrameHandle& depthBuffer, cv::Mat& image )
+{
+  if( depthFrame.empty() ) {
+    depthBuffer.reset();
+    image = cv::Mat( height, width, CV_16UC1, cv::Scalar ( 0 ) );
+    return;
   }
+
+  // f[^AƃvC[̉摜ɕ
+  //   vC[Ƃ̋̓vAȂώZ(\̒iǂݏo)
+  depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight, playerStatistics );
+  const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+  const BYTE* player = depthUnpacker.getPlayer().data;
+
+  // J̍WARGBJ̍Wɍ킹(Ŏ␳A߂قcāAȌ𖄂߂)
+  //   ʂ͂ق̒iɓn̂ŁAv[̃obt@ɏ(ǂ̒igIobt@ėp)
+  depthBuffer = source->getPool().acquire( width * height * sizeof(USHORT) );
+  image = cv::Mat( height, width, CV_16UC1, depthBuffer.bits() );
+  registeredDepth.map( distance, player, registration, true, image, registeredPlayer );
 }
 
-void KinectControl::setSkeleton( cv::Mat& image )
+void KinectControl::setSkeleton( NUI_SKELETON_FRAME& skeletonFrame, cv::Mat& image )
 { 
   try { 
-    // XPg̃t[擾
-    NUI_SKELETON_FRAME skeletonFrame = { 0 };
-    HRESULT ret = kinect->NuiSkeletonGetNextFrame( 0, &skeletonFrame );
-
-    if( ret == S_OK ) {
-      for ( int i = 0; i < NUI_SKELETON_COUNT; ++i ) {
-        NUI_SKELETON_DATA& skeletonData = skeletonFrame.SkeletonData[i];
-        if ( skeletonData.eTrackingState == NUI_SKELETON_TRACKED ) {
-
-          // eWCgƂ
-          for ( int j = 0; j < NUI_SKELETON_POSITION_COUNT; ++j ) {
-            if ( skeletonData.eSkeletonPositionTrackingState[j] != NUI_SKELETON_POSITION_NOT_TRACKED ) {
-              setJoint( image, j, skeletonData.SkeletonPositions[j] );
-            }
+    for ( int i = 0; i < NUI_SKELETON_COUNT; ++i ) {
+      NUI_SKELETON_DATA& skeletonData = skeletonFrame.SkeletonData[i];
+      if ( skeletonData.eTrackingState == NUI_SKELETON_TRACKED ) {
+
+        // eWCgƂ
+        for ( int j = 0; j < NUI_SKELETON_POSITION_COUNT; ++j ) {
+          if ( skeletonData.eSkeletonPositionTrackingState[j] != NUI_SKELETON_POSITION_NOT_TRACKED ) {
+            setJoint( image, j, skeletonData.SkeletonPositions[j] );
           }
         }
-        else if ( skeletonData.eTrackingState == NUI_SKELETON_POSITION_ONLY ) {
-          setJoint( image, -1, skeletonData.Position );
-        }
+      }
+      else if ( skeletonData.eTrackingState == NUI_SKELETON_POSITION_ONLY ) {
+        setJoint( image, -1, skeletonData.Position );
       }
     }
   }
@@ -206,7 +302,7 @@ void KinectControl::setHandImage( Vector4 handPos, Vector4 wristPos, cv::Mat &im
   cv::Point2f ltPos;
 
   // fvX摜n֕ϊ
-  ::NuiTransformSkeletonToDepthImage( handPos, &ltPos.x, &ltPos.y, CAMERA_RESOLUTION );
+  ::NuiTransformSkeletonToDepthImage( handPos, &ltPos.x, &ltPos.y, source->getDepthResolution() );
 
   // ̒Sc18cmE
   handPos.x += 0.36;  // 0.18Ă̂Ŕ{
@@ -214,17 +310,17 @@ void KinectControl::setHandImage( Vector4 handPos, Vector4 wristPos, cv::Mat &im
   cv::Point2f rbPos;
 
   // fvX摜n֕ϊ
-  ::NuiTransformSkeletonToDepthImage( handPos, &rbPos.x, &rbPos.y, CAMERA_RESOLUTION );
+  ::NuiTransformSkeletonToDepthImage( handPos, &rbPos.x, &rbPos.y, source->getDepthResolution() );
 
   // ̈ʒu
   cv::Point2f wrPos;
-  ::NuiTransformSkeletonToDepthImage( wristPos, &wrPos.x, &wrPos.y, CAMERA_RESOLUTION );
+  ::NuiTransformSkeletonToDepthImage( wristPos, &wrPos.x, &wrPos.y, source->getDepthResolution() );
 
   // RGBJ̍Wɕϊ
   LONG ltPosCX, ltPosCY, rbPosCX, rbPosCY, wrPosCX, wrPosCY;
-  kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, (LONG)ltPos.x , (LONG)ltPos.y, 0, &ltPosCX, &ltPosCY );
-  kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, (LONG)rbPos.x , (LONG)rbPos.y, 0, &rbPosCX, &rbPosCY );
-  kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, (LONG)wrPos.x , (LONG)wrPos.y, 0, &wrPosCX, &wrPosCY );
+  source->getColorPixelCoordinates( (LONG)ltPos.x, (LONG)ltPos.y, 0, ltPosCX, ltPosCY );
+  source->getColorPixelCoordinates( (LONG)rbPos.x, (LONG)rbPos.y, 0, rbPosCX, rbPosCY );
+  source->getColorPixelCoordinates( (LONG)wrPos.x, (LONG)wrPos.y, 0, wrPosCX, wrPosCY );
 
   // 摜TCYȂ
   if( rbPosCX < width && rbPosCY < height && ltPosCX > 0 && ltPosCY > 0 ) {
@@ -232,20 +328,25 @@ void KinectControl::setHandImage( Vector4 handPos, Vector4 wristPos, cv::Mat &im
     // ̈̋`
     cv::Rect handRect( ltPosCX, ltPosCY, abs( rbPosCX - ltPosCX ), abs( rbPosCY - ltPosCY ) );
 
+    // vC[ǐՂ͈͂̊OȂAł͂Ȃ
+    if( (handRect & playerRoi).area() == 0 ) {
+      return;
+    }
+
     // 蒆S̋limmj
     handPos.x -= 0.18;
     handPos.y += 0.18;
     cv::Point2f cPos;
-    ::NuiTransformSkeletonToDepthImage( handPos, &cPos.x, &cPos.y, CAMERA_RESOLUTION );
+    ::NuiTransformSkeletonToDepthImage( handPos, &cPos.x, &cPos.y, source->getDepthResolution() );
     LONG cPosX, cPosY;
-    kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, (LONG)cPos.x , (LONG)cPos.y, 0, &cPosX, &cPosY );
+    source->getColorPixelCoordinates( (LONG)cPos.x, (LONG)cPos.y, 0, cPosX, cPosY );
     cPos.x = cPosX;
     cPos.y = cPosY;
     USHORT handDist = depthImage.at<USHORT>( cPos.y, cPos.x );
 
     // G[li0j8192ɕύX
-    cv::Mat depth = depthImage.clone();
-    cv::Mat handMask( depth, handRect );
+    //   ͎̂̈悾Ȃ̂ŁÄ悾Rs[
+    cv::Mat handMask = cv::Mat( depthImage, handRect ).clone();
     for( int i = 0; i < handMask.rows; ++i ) {
       for( int j = 0; j < handMask.cols; ++j ) {
         if( handMask.at<USHORT>( i, j ) == 0 )
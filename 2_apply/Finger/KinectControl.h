@@ -18,7 +18,57 @@
   throw std::runtime_error(ss.str().c_str());                 \
   }
 
-const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
+#include "DepthColorRegistration.h"
+#include "DepthUnpack.h"
+#include "FrameRecorder.h"
+#include "FrameResolution.h"
+#include "FrameSink.h"
+#include "KernelBenchmark.h"
+#include "KinectFrameSource.h"
+#include "LatencyMonitor.h"
+#include "Pipeline.h"
+#include "PlayerRuns.h"
+#include "PlayerStatistics.h"
+#include "PlayerTracker.h"
+#include "RegisteredDepth.h"
+
+// xvi(LatencyMonitor ɒǉ鏇)
+enum LatencyStage
+{
+  LATENCY_ACQUIRE,
+  LATENCY_MAPPING,
+  LATENCY_ANALYSIS,
+  LATENCY_PRESENT
+};
+
+// x̓v\Ԋu(~b)
+const DWORD LATENCY_PRINT_INTERVAL = 5000;
+
+// Ԃ̌vɎgt[
+const int BENCHMARK_FRAME_COUNT = 30;
+
+// T͈͂AvC[͂ދ`Lf
+const int PLAYER_ROI_MARGIN = 16;
+
+// pCvC̒i̊ԂŎ󂯓n1t[̃f[^
+struct FingerFrame
+{
+  FrameHandle rgbFrame;               // RGBJ̃t[
+  FrameHandle depthFrame;             // J̃t[
+  NUI_SKELETON_FRAME skeletonFrame;   // XPg̃t[
+  bool isSkeleton;                    // XPg擾łǂ
+  FrameLatency latency;               // ei̎
+
+  cv::Mat rgbImage;                   // ͌ʂ`悵RGB摜
+  FrameHandle depthBuffer;            // depthImage ̃obt@(擾̃v[擾)
+  cv::Mat depthImage;                 // RGBJ̍Wɍ킹摜
+  cv::Rect playerRoi;                 // vC[ǐՂ`(RGBJ̍W)
+
+  FingerFrame()
+    : isSkeleton( false )
+  {
+  }
+};
 
 class KinectControl
 {
@@ -26,27 +76,53 @@ public:
   KinectControl(void);
   ~KinectControl(void);
 
-  void initialize();
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution );
+  void initialize( FrameSource* frameSource );
+  void setRecorder( FrameRecorder* frameRecorder );
+  void setSink( FrameSink* frameSink );
+  const DepthColorRegistration* getRegistration() const;
   void run();
+  void benchmark( KernelBenchmark& kernelBenchmark );
 
 private:
-  INuiSensor *kinect;
-  HANDLE imageStreamHandle;
-  HANDLE depthStreamHandle;
-  HANDLE streamEvent;
+  KinectFrameSource kinect;
+  FrameSource* source;
+  FrameRecorder* recorder;
+  ScreenFrameSink screen;
+  FrameSink* sink;
 
+  // RGBJ̉ʃTCY
   DWORD width;
   DWORD height;
 
-  void createInstance();
-  void setRgbImage(cv::Mat& image);
-  void setDepthImage(cv::Mat& image);
-  void setSkeleton( cv::Mat& image );
+  // J̉ʃTCY
+  DWORD depthWidth;
+  DWORD depthHeight;
+
+  DepthColorRegistration registration;
+  DepthUnpacker depthUnpacker;
+  RegisteredDepth registeredDepth;
+  cv::Mat registeredPlayer;   // RGBJ̍Wɍ킹vC[̉摜(ʒu킹̒iŎg)
+  PlayerRuns playerRuns;      // vC[͈̂(ʒu킹̒iŎg)
+  PlayerTracker playerTracker;  // vC[̗̈̒ǐ(ʒu킹̒iŎg)
+  PlayerStatistics playerStatistics;  // vC[Ƃ̋̓v(ʒu킹̒iŐώZA\̒iœǂݏo)
+  LatencyMonitor latencyMonitor;
+
+  // pCvC̊ei
+  bool acquireFrame( FingerFrame& frame );
+  bool registerFrame( FingerFrame& frame );
+  bool analyzeFrame( FingerFrame& frame );
+  bool presentFrame( FingerFrame& frame );
+
+  void setDepthImage( const FrameHandle& depthFrame, FrameHandle& depthBuffer, cv::Mat& image );
+  void setSkeleton( NUI_SKELETON_FRAME& skeletonFrame, cv::Mat& image );
   void setJoint( cv::Mat& image, int joint, Vector4 position );
   void setHandImage( Vector4 handPos, Vector4 wristPos, cv::Mat &image, std::string handName = "hand" );
 
+  // ͂̒iŎg摜
   cv::Mat rgbImage;
   cv::Mat depthImage;
+  cv::Rect playerRoi;
   cv::Mat lhImage;
   cv::Mat rhImage;
 
@@ -0,0 +1,220 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// プレイヤーの画素が続く範囲(1行の中の [begin, end))
+struct PlayerRun
+{
+  USHORT y;
+  USHORT begin;
+  USHORT end;
+  BYTE player;    // プレイヤー番号(1〜7)
+};
+
+// プレイヤーを囲む矩形(pixels が0の場合は空)
+struct PlayerBounds
+{
+  int left;
+  int top;
+  int right;      // 含まない
+  int bottom;     // 含まない
+  int pixels;     // 画素数
+};
+
+// プレイヤーの画像を、行ごとの連続した範囲(ランレングス)と矩形にまとめる
+//
+// 1フレームに1回 build して、合成やマスクの処理はプレイヤーのいる範囲だけをたどる。
+// プレイヤーがいない画素は、SSE2が使える場合は16画素ずつ読み飛ばす。
+//   範囲は行の順に並び、同じ行の中では左から並ぶ
+//   矩形は、プレイヤー番号ごと(0はすべてのプレイヤーを合わせたもの)
+class PlayerRuns
+{
+public:
+
+  enum
+  {
+    PLAYER_INDEX_COUNT = NUI_IMAGE_PLAYER_INDEX_MASK + 1
+  };
+
+  PlayerRuns()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , width_( 0 )
+    , height_( 0 )
+  {
+    clear( 0, 0 );
+  }
+
+  // プレイヤーの画像(CV_8UC1)からまとめる
+  void build( const cv::Mat& player )
+  {
+    build( player.data, player.cols, player.rows, (int)player.step );
+  }
+
+  // プレイヤー番号の並び(0はプレイヤーなし)からまとめる
+  void build( const BYTE* player, int width, int height, int stride )
+  {
+    clear( width, height );
+
+    for ( int y = 0; y < height; ++y ) {
+      const BYTE* row = player + y * stride;
+      int x = 0;
+      while ( x < width ) {
+        x = skipEmpty( row, x, width );
+        if ( x >= width ) {
+          break;
+        }
+
+        // 同じプレイヤーが続く範囲を1つにまとめる
+        BYTE index = row[x];
+        int begin = x;
+        x = skipSame( row, x, width, index );
+        addRun( y, begin, x, index );
+      }
+      rowEnd_[y] = (int)runs_.size();
+    }
+  }
+
+  // プレイヤーがいない状態にする(大きさだけ設定する)
+  void clear( int width, int height )
+  {
+    width_ = width;
+    height_ = height;
+    runs_.clear();
+    rowEnd_.assign( height, 0 );
+
+    PlayerBounds empty = { width, height, 0, 0, 0 };
+    std::fill( bounds_, bounds_ + PLAYER_INDEX_COUNT, empty );
+  }
+
+  // すべての範囲
+  const std::vector< PlayerRun >& getRuns() const
+  {
+    return runs_;
+  }
+
+  // y 行目の範囲は getRuns() の [getRowBegin( y ), getRowEnd( y ))
+  int getRowBegin( int y ) const
+  {
+    return (y == 0) ? 0 : rowEnd_[y - 1];
+  }
+
+  int getRowEnd( int y ) const
+  {
+    return rowEnd_[y];
+  }
+
+  // プレイヤーを囲む矩形(0はすべてのプレイヤー)
+  const PlayerBounds& getBounds( int player = 0 ) const
+  {
+    return bounds_[player];
+  }
+
+  // プレイヤーの画素数
+  int getPixelCount() const
+  {
+    return bounds_[0].pixels;
+  }
+
+  int getWidth() const
+  {
+    return width_;
+  }
+
+  int getHeight() const
+  {
+    return height_;
+  }
+
+  // roi の範囲のマスク画像(CV_8UC1、roi の大きさ、プレイヤーの画素を value、それ以外を0)を作る
+  void toMask( cv::Mat& mask, const cv::Rect& roi, UCHAR value = 255 ) const
+  {
+    mask.create( roi.height, roi.width, CV_8UC1 );
+    mask.setTo( cv::Scalar( 0 ) );
+    for ( size_t r = 0; r < runs_.size(); ++r ) {
+      const PlayerRun& run = runs_[r];
+      const int begin = std::max( (int)run.begin, roi.x );
+      const int end = std::min( (int)run.end, roi.x + roi.width );
+      if ( (run.y < roi.y) || (run.y >= roi.y + roi.height) || (begin >= end) ) {
+        continue;
+      }
+
+      UCHAR* row = mask.ptr< UCHAR >( run.y - roi.y );
+      std::fill( row + begin - roi.x, row + end - roi.x, value );
+    }
+  }
+
+private:
+
+  // プレイヤーがいない画素を読み飛ばす(次にプレイヤーがいる位置を返す)
+  int skipEmpty( const BYTE* row, int x, int width ) const
+  {
+    if ( isSse2_ ) {
+      const __m128i zero = _mm_setzero_si128();
+      for ( ; x + 16 <= width; x += 16 ) {
+        __m128i p = _mm_loadu_si128( (const __m128i*)(row + x) );
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( p, zero ) ) != 0xFFFF ) {
+          break;
+        }
+      }
+    }
+
+    while ( (x < width) && (row[x] == 0) ) {
+      ++x;
+    }
+    return x;
+  }
+
+  // 同じプレイヤーが続く画素を読み飛ばす(範囲の終わりを返す)
+  int skipSame( const BYTE* row, int x, int width, BYTE index ) const
+  {
+    if ( isSse2_ ) {
+      const __m128i same = _mm_set1_epi8( (char)index );
+      for ( ; x + 16 <= width; x += 16 ) {
+        __m128i p = _mm_loadu_si128( (const __m128i*)(row + x) );
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( p, same ) ) != 0xFFFF ) {
+          break;
+        }
+      }
+    }
+
+    while ( (x < width) && (row[x] == index) ) {
+      ++x;
+    }
+    return x;
+  }
+
+  void addRun( int y, int begin, int end, BYTE index )
+  {
+    PlayerRun run = { (USHORT)y, (USHORT)begin, (USHORT)end, index };
+    runs_.push_back( run );
+
+    addBounds( bounds_[index], y, begin, end );
+    addBounds( bounds_[0], y, begin, end );
+  }
+
+  static void addBounds( PlayerBounds& bounds, int y, int begin, int end )
+  {
+    bounds.left = std::min( bounds.left, begin );
+    bounds.right = std::max( bounds.right, end );
+    bounds.top = std::min( bounds.top, y );
+    bounds.bottom = y + 1;
+    bounds.pixels += end - begin;
+  }
+
+  bool isSse2_;
+
+  int width_;
+  int height_;
+
+  // 範囲は使いまわす(確保しなおすのは、前のフレームより増えたときだけ)
+  std::vector< PlayerRun > runs_;
+  std::vector< int > rowEnd_;
+  PlayerBounds bounds_[PLAYER_INDEX_COUNT];
+};
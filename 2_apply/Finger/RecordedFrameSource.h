@@ -0,0 +1,453 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DepthCodec.h"
+#include "DepthColorRegistration.h"
+#include "FrameSource.h"
+#include "RecordingFormat.h"
+
+// 記録したファイルからフレームを取得する
+//
+// ファイルはメモリにマップし、取得したチャンクの部分だけを参照する(コピーしない)。
+// 圧縮した距離データは、プールのバッファに展開する。
+// 索引を使って、任意のフレームに移動できる(seek)。
+// 記録したときのタイムスタンプの間隔で再生するか、待たずに最大速度で再生するかを選べる。
+class RecordedFrameSource : public FrameSource
+{
+public:
+
+  RecordedFrameSource()
+    : file_( INVALID_HANDLE_VALUE )
+    , mapping_( 0 )
+    , fileSize_( 0 )
+    , colorResolution_( NUI_IMAGE_RESOLUTION_640x480 )
+    , depthResolution_( NUI_IMAGE_RESOLUTION_640x480 )
+    , colorWidth_( 0 )
+    , colorHeight_( 0 )
+    , depthWidth_( 0 )
+    , depthHeight_( 0 )
+    , isRealTime_( true )
+    , position_( 0 )
+    , current_( 0 )
+    , baseTimeStamp_( 0 )
+  {
+    SYSTEM_INFO info;
+    ::GetSystemInfo( &info );
+    granularity_ = info.dwAllocationGranularity;
+
+    ::QueryPerformanceFrequency( &frequency_ );
+    baseCounter_.QuadPart = 0;
+  }
+
+  ~RecordedFrameSource()
+  {
+    close();
+  }
+
+  // ファイルを開く
+  //   isRealTime : trueの場合は記録したときの間隔で、falseの場合は最大速度で再生する
+  void open( const std::string& fileName, bool isRealTime = true )
+  {
+    close();
+
+    file_ = ::CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+    if ( file_ == INVALID_HANDLE_VALUE ) {
+      throw std::runtime_error( "記録ファイルを開けません : " + fileName );
+    }
+
+    LARGE_INTEGER size;
+    ::GetFileSizeEx( file_, &size );
+    fileSize_ = size.QuadPart;
+
+    mapping_ = ::CreateFileMappingA( file_, 0, PAGE_READONLY, 0, 0, 0 );
+    if ( mapping_ == 0 ) {
+      throw std::runtime_error( "記録ファイルをマップできません : " + fileName );
+    }
+
+    // ヘッダーを読み込む
+    RecordingHeader header;
+    read( 0, &header, sizeof(header) );
+    if ( (header.magic != RECORDING_MAGIC) || (header.version != RECORDING_VERSION) ) {
+      throw std::runtime_error( "記録ファイルの形式が違います : " + fileName );
+    }
+
+    colorResolution_ = (NUI_IMAGE_RESOLUTION)header.colorResolution;
+    depthResolution_ = (NUI_IMAGE_RESOLUTION)header.depthResolution;
+    ::NuiImageResolutionToSize( colorResolution_, colorWidth_, colorHeight_ );
+    ::NuiImageResolutionToSize( depthResolution_, depthWidth_, depthHeight_ );
+
+    // 変換テーブルを読み込む(先頭のチャンク)
+    loadRegistration();
+
+    // 索引を読み込む(書き込まれていない場合は、チャンクをたどって作る)
+    index_.clear();
+    if ( header.indexOffset != 0 ) {
+      index_.resize( header.frameCount );
+      if ( !index_.empty() ) {
+        read( header.indexOffset, &index_[0], header.frameCount * sizeof(RecordingIndexEntry) );
+      }
+    }
+    else {
+      buildIndex();
+    }
+
+    isRealTime_ = isRealTime;
+    seek( 0 );
+  }
+
+  void close()
+  {
+    colorView_.unmap();
+    depthView_.unmap();
+    decodedDepth_.reset();
+
+    if ( mapping_ != 0 ) {
+      ::CloseHandle( mapping_ );
+      mapping_ = 0;
+    }
+
+    if ( file_ != INVALID_HANDLE_VALUE ) {
+      ::CloseHandle( file_ );
+      file_ = INVALID_HANDLE_VALUE;
+    }
+
+    index_.clear();
+  }
+
+  // フレーム数
+  DWORD getFrameCount() const
+  {
+    return (DWORD)index_.size();
+  }
+
+  // 次に取得するフレームの番号
+  DWORD getPosition() const
+  {
+    return position_;
+  }
+
+  // 指定したフレームに移動する(次の waitFrame() でそのフレームになる)
+  void seek( DWORD frameIndex )
+  {
+    position_ = std::min( frameIndex, (DWORD)index_.size() );
+    baseCounter_.QuadPart = 0;
+  }
+
+  // 次のフレームに進む(最後まで再生した場合はfalseを返す)
+  bool waitFrame()
+  {
+    if ( position_ >= index_.size() ) {
+      return false;
+    }
+
+    current_ = &index_[position_++];
+
+    if ( isRealTime_ ) {
+      waitTimeStamp( current_->timeStamp );
+    }
+
+    return true;
+  }
+
+  HRESULT getColorFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    return getFrame( current_ ? current_->colorOffset : 0, colorView_, colorWidth_, colorHeight_, frame );
+  }
+
+  HRESULT releaseColorFrame( ImageFrame& frame )
+  {
+    colorView_.unmap();
+    return S_OK;
+  }
+
+  HRESULT getDepthFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    decodedDepth_.reset();
+
+    LONGLONG offset = current_ ? current_->depthOffset : 0;
+    if ( offset == 0 ) {
+      return E_NUI_FRAME_NO_DATA;
+    }
+
+    RecordingChunk chunk;
+    read( offset, &chunk, sizeof(chunk) );
+    if ( chunk.encoding != ENCODING_DEPTH_CODEC ) {
+      return getFrame( offset, depthView_, depthWidth_, depthHeight_, frame );
+    }
+
+    // 圧縮したデータをマップして、プールのバッファに展開する
+    map( offset + sizeof(chunk), chunk.size, depthView_ );
+    decodedDepth_ = pool_.acquire( depthWidth_ * depthHeight_ * sizeof(USHORT) );
+    codec_.decode( depthView_.data, chunk.size, (USHORT*)decodedDepth_.bits(), depthWidth_, depthHeight_ );
+    depthView_.unmap();
+
+    frame = decodedDepth_.frame();
+    frame.timeStamp = chunk.timeStamp;
+    frame.frameNumber = chunk.frameNumber;
+    frame.width = depthWidth_;
+    frame.height = depthHeight_;
+    frame.pitch = depthWidth_ * sizeof(USHORT);
+    decodedDepth_.frame() = frame;
+    return S_OK;
+  }
+
+  HRESULT releaseDepthFrame( ImageFrame& frame )
+  {
+    depthView_.unmap();
+    decodedDepth_.reset();
+    return S_OK;
+  }
+
+  // 圧縮した距離データは、展開したバッファをそのまま渡す(もう一度コピーしない)
+  HRESULT acquireDepthFrame( FrameHandle& handle, DWORD timeout = 0 )
+  {
+    ImageFrame frame = { 0 };
+    HRESULT ret = getDepthFrame( frame, timeout );
+    if ( ret != S_OK ) {
+      return ret;
+    }
+
+    handle = decodedDepth_.empty() ? pool_.copy( frame ) : decodedDepth_;
+    return releaseDepthFrame( frame );
+  }
+
+  HRESULT getSkeletonFrame( NUI_SKELETON_FRAME& frame )
+  {
+    if ( (current_ == 0) || (current_->skeletonOffset == 0) ) {
+      return E_NUI_FRAME_NO_DATA;
+    }
+
+    RecordingChunk chunk;
+    read( current_->skeletonOffset, &chunk, sizeof(chunk) );
+    if ( chunk.size != sizeof(frame) ) {
+      return E_FAIL;
+    }
+
+    read( current_->skeletonOffset + sizeof(chunk), &frame, sizeof(frame) );
+    return S_OK;
+  }
+
+  // 記録した変換テーブルで変換する(変換テーブルがない場合は解像度の比で拡大するだけ)
+  void getColorPixelCoordinates( LONG depthX, LONG depthY, USHORT depth, LONG& colorX, LONG& colorY )
+  {
+    if ( !registration_.isInitialized() ) {
+      colorX = depthX * colorWidth_ / depthWidth_;
+      colorY = depthY * colorHeight_ / depthHeight_;
+      return;
+    }
+
+    depthX = std::max( 0L, std::min( depthX, (LONG)depthWidth_ - 1 ) );
+    depthY = std::max( 0L, std::min( depthY, (LONG)depthHeight_ - 1 ) );
+    registration_.getColorPixel( depthX, depthY, depth, colorX, colorY );
+  }
+
+  NUI_IMAGE_RESOLUTION getColorResolution() const
+  {
+    return colorResolution_;
+  }
+
+  NUI_IMAGE_RESOLUTION getDepthResolution() const
+  {
+    return depthResolution_;
+  }
+
+private:
+
+  // ファイルの一部をマップした領域
+  struct View
+  {
+    void* base;
+    BYTE* data;
+
+    View()
+      : base( 0 )
+      , data( 0 )
+    {
+    }
+
+    void unmap()
+    {
+      if ( base != 0 ) {
+        ::UnmapViewOfFile( base );
+        base = 0;
+        data = 0;
+      }
+    }
+  };
+
+  // ファイルの一部をマップする(開始位置は割り当ての単位に合わせる)
+  void map( LONGLONG offset, DWORD size, View& view )
+  {
+    view.unmap();
+
+    LONGLONG aligned = offset - (offset % granularity_);
+    DWORD extra = (DWORD)(offset - aligned);
+    view.base = ::MapViewOfFile( mapping_, FILE_MAP_READ,
+      (DWORD)(aligned >> 32), (DWORD)(aligned & 0xFFFFFFFF), extra + size );
+    if ( view.base == 0 ) {
+      throw std::runtime_error( "記録ファイルをマップできません" );
+    }
+
+    view.data = (BYTE*)view.base + extra;
+  }
+
+  // ファイルの一部をコピーする
+  void read( LONGLONG offset, void* data, DWORD size )
+  {
+    if ( offset + size > fileSize_ ) {
+      throw std::runtime_error( "記録ファイルが壊れています" );
+    }
+
+    View view;
+    map( offset, size, view );
+    memcpy( data, view.data, size );
+    view.unmap();
+  }
+
+  // チャンクのデータをマップして、フレームの情報を設定する
+  HRESULT getFrame( LONGLONG offset, View& view, DWORD width, DWORD height, ImageFrame& frame )
+  {
+    if ( offset == 0 ) {
+      return E_NUI_FRAME_NO_DATA;
+    }
+
+    RecordingChunk chunk;
+    read( offset, &chunk, sizeof(chunk) );
+    if ( chunk.encoding != ENCODING_RAW ) {
+      return E_FAIL;
+    }
+
+    map( offset + sizeof(chunk), chunk.size, view );
+
+    frame.timeStamp = chunk.timeStamp;
+    frame.frameNumber = chunk.frameNumber;
+    frame.width = width;
+    frame.height = height;
+    frame.pitch = chunk.size / height;
+    frame.size = chunk.size;
+    frame.bits = view.data;
+    return S_OK;
+  }
+
+  // チャンクをたどって索引を作る
+  void buildIndex()
+  {
+    LONGLONG offset = sizeof(RecordingHeader);
+    while ( offset + (LONGLONG)sizeof(RecordingChunk) <= fileSize_ ) {
+      RecordingChunk chunk;
+      read( offset, &chunk, sizeof(chunk) );
+
+      // 途中で書き込みが止まったチャンクは使わない
+      if ( offset + (LONGLONG)sizeof(chunk) + chunk.size > fileSize_ ) {
+        break;
+      }
+
+      if ( chunk.type == CHUNK_FRAME ) {
+        RecordingIndexEntry entry = { 0 };
+        entry.timeStamp = chunk.timeStamp;
+        index_.push_back( entry );
+      }
+      else if ( !index_.empty() ) {
+        if ( chunk.type == CHUNK_COLOR ) {
+          index_.back().colorOffset = offset;
+        }
+        else if ( chunk.type == CHUNK_DEPTH ) {
+          index_.back().depthOffset = offset;
+        }
+        else if ( chunk.type == CHUNK_SKELETON ) {
+          index_.back().skeletonOffset = offset;
+        }
+      }
+
+      offset += sizeof(chunk) + chunk.size;
+    }
+  }
+
+  // 変換テーブルを読み込む
+  void loadRegistration()
+  {
+    LONGLONG offset = sizeof(RecordingHeader);
+    if ( offset + (LONGLONG)sizeof(RecordingChunk) > fileSize_ ) {
+      return;
+    }
+
+    RecordingChunk chunk;
+    read( offset, &chunk, sizeof(chunk) );
+
+    const DWORD tableSize = depthWidth_ * depthHeight_ * DepthColorRegistration::BIN_COUNT *
+      sizeof(DepthColorRegistration::ColorPoint);
+    if ( (chunk.type != CHUNK_REGISTRATION) || (chunk.size != tableSize) ) {
+      return;
+    }
+
+    View view;
+    map( offset + sizeof(chunk), chunk.size, view );
+    registration_.initialize( (const DepthColorRegistration::ColorPoint*)view.data,
+      colorResolution_, depthResolution_ );
+    view.unmap();
+  }
+
+  // 記録したときの間隔になるまで待つ
+  void waitTimeStamp( LONGLONG timeStamp )
+  {
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter( &now );
+
+    // 再生を始めたフレーム(または移動した直後のフレーム)を基準にする
+    if ( baseCounter_.QuadPart == 0 ) {
+      baseCounter_ = now;
+      baseTimeStamp_ = timeStamp;
+      return;
+    }
+
+    LONGLONG elapsed = (now.QuadPart - baseCounter_.QuadPart) * 1000 / frequency_.QuadPart;
+    LONGLONG wait = (timeStamp - baseTimeStamp_) - elapsed;
+    if ( wait > 0 ) {
+      ::Sleep( (DWORD)wait );
+    }
+  }
+
+private:
+
+  // コピーを禁止する
+  RecordedFrameSource( const RecordedFrameSource& rhs );
+  RecordedFrameSource& operator = ( const RecordedFrameSource& rhs );
+
+private:
+
+  HANDLE file_;
+  HANDLE mapping_;
+  LONGLONG fileSize_;
+  DWORD granularity_;
+
+  NUI_IMAGE_RESOLUTION colorResolution_;
+  NUI_IMAGE_RESOLUTION depthResolution_;
+  DWORD colorWidth_;
+  DWORD colorHeight_;
+  DWORD depthWidth_;
+  DWORD depthHeight_;
+  DepthColorRegistration registration_;
+
+  std::vector< RecordingIndexEntry > index_;
+  bool isRealTime_;
+  DWORD position_;
+  const RecordingIndexEntry* current_;
+
+  LARGE_INTEGER frequency_;
+  LARGE_INTEGER baseCounter_;
+  LONGLONG baseTimeStamp_;
+
+  View colorView_;
+  View depthView_;
+
+  DepthCodec codec_;
+  FrameHandle decodedDepth_;    // 展開した距離データ
+};
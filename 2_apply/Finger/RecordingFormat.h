@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+// 記録ファイルの形式
+//
+//   RecordingHeader
+//   チャンク(RecordingChunk + データ)の並び
+//     CHUNK_REGISTRATION : 距離カメラからRGBカメラへの変換テーブル(先頭に1つ)
+//     CHUNK_FRAME        : 1フレームの始まり(データなし)
+//     CHUNK_COLOR        : RGBカメラの画像(BGRA)
+//     CHUNK_DEPTH        : 距離カメラの画像(NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX、DepthCodec で圧縮できる)
+//     CHUNK_SKELETON     : NUI_SKELETON_FRAME
+//   RecordingIndexEntry の並び(フレームの索引、終了時に書き込む)
+//
+// 索引があれば、ファイルをメモリにマップして、任意のフレームに直接移動できる。
+// 終了時に書き込めなかった場合(索引の位置が0の場合)は、チャンクをたどって索引を作る。
+
+#define RECORDING_FOURCC( a, b, c, d ) \
+  ((DWORD)(a) | ((DWORD)(b) << 8) | ((DWORD)(c) << 16) | ((DWORD)(d) << 24))
+
+const DWORD RECORDING_MAGIC = RECORDING_FOURCC( 'K', 'R', 'E', 'C' );
+const DWORD RECORDING_VERSION = 2;
+
+// チャンクの種類
+const DWORD CHUNK_REGISTRATION = RECORDING_FOURCC( 'R', 'E', 'G', 'S' );
+const DWORD CHUNK_FRAME = RECORDING_FOURCC( 'F', 'R', 'A', 'M' );
+const DWORD CHUNK_COLOR = RECORDING_FOURCC( 'C', 'O', 'L', 'R' );
+const DWORD CHUNK_DEPTH = RECORDING_FOURCC( 'D', 'P', 'T', 'H' );
+const DWORD CHUNK_SKELETON = RECORDING_FOURCC( 'S', 'K', 'E', 'L' );
+
+// チャンクのデータの形式
+const DWORD ENCODING_RAW = 0;           // そのまま
+const DWORD ENCODING_DEPTH_CODEC = 1;   // DepthCodec で圧縮した距離データ
+
+// ファイルの先頭
+struct RecordingHeader
+{
+  DWORD magic;              // RECORDING_MAGIC
+  DWORD version;            // RECORDING_VERSION
+  DWORD colorResolution;    // RGBカメラの NUI_IMAGE_RESOLUTION
+  DWORD depthResolution;    // 距離カメラの NUI_IMAGE_RESOLUTION
+  DWORD frameCount;         // フレーム数(終了時に書き込む)
+  LONGLONG indexOffset;     // 索引の位置(終了時に書き込む)
+};
+
+// チャンクの先頭
+struct RecordingChunk
+{
+  DWORD type;               // チャンクの種類
+  DWORD encoding;           // データの形式
+  DWORD size;               // データのバイト数
+  DWORD frameNumber;        // フレーム番号
+  LONGLONG timeStamp;       // タイムスタンプ(ミリ秒)
+};
+
+// フレームの索引(チャンクの位置、ない場合は0)
+struct RecordingIndexEntry
+{
+  LONGLONG timeStamp;
+  LONGLONG colorOffset;
+  LONGLONG depthOffset;
+  LONGLONG skeletonOffset;
+};
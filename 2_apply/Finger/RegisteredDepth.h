@@ -0,0 +1,328 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "DepthColorRegistration.h"
+#include "FrameResolution.h"
+
+// 距離画像をRGBカメラの座標に合わせる
+//
+// 距離カメラの各画素をRGBカメラの座標に書き込む(前方への投影)とき、同じ画素に
+// 複数の画素が重なった場合は近いほうを残し(Zバッファ)、どこからも書き込まれ
+// なかった1〜2画素の穴は、両側の画素の遠いほうで埋める(前景が太らないように)。
+// 距離カメラのほうが解像度が低い場合は、投影した画素の間隔(大きさの比)の分だけ、
+// 埋める穴を大きくする(HoleSize)。
+//
+// 処理は行のタイルごとに並列に行う。投影先の行の範囲が重ならないタイル同士
+// (1つおきのタイル)を同時に処理するので、Zバッファの更新に排他は要らない。
+// 重なる場合(変換テーブルの縦のずれが大きい場合)は、1つのスレッドで処理する。
+//
+// 画像の大きさは定数にして(FrameResolution.h)、解像度の組み合わせごとに実体化する。
+// 結果の距離は CV_16UC1 (mm、0はデータなし)、プレイヤーは CV_8UC1 (0はプレイヤーなし)。
+class RegisteredDepth
+{
+public:
+
+  // 1つのタイルの行数
+  static const int TILE_ROWS = 32;
+
+  // 埋める穴の最大の幅(画素、大きさが同じ場合)
+  static const int MAX_HOLE_SIZE = 2;
+
+  // 解像度の組み合わせごとの、埋める穴の最大の幅と高さ(画素)
+  //   距離カメラの隣り合う画素は、RGBカメラでは大きさの比だけ離れて投影される
+  template< typename DepthSize, typename ColorSize >
+  struct HoleSize
+  {
+    static const int WIDTH = MAX_HOLE_SIZE + ((ColorSize::WIDTH + DepthSize::WIDTH - 1) / DepthSize::WIDTH) - 1;
+    static const int HEIGHT = MAX_HOLE_SIZE + ((ColorSize::HEIGHT + DepthSize::HEIGHT - 1) / DepthSize::HEIGHT) - 1;
+  };
+
+  // 1フレーム分を変換する
+  //   registration の解像度の組み合わせに合わせて、画像の大きさを定数にした処理を選ぶ
+  //   distance、player   : DepthUnpacker で分けた距離とプレイヤーの画像のデータ(player は0でもよい)
+  //   isParallax         : falseの場合は、距離0として座標を変換する(視差を考えない)
+  //   registeredDistance : 結果の距離の画像(大きさが違う場合は作成しなおす)
+  //   registeredPlayer   : 結果のプレイヤーの画像(大きさが違う場合は作成しなおす)
+  void map( const USHORT* distance, const BYTE* player, const DepthColorRegistration& registration,
+    bool isParallax, cv::Mat& registeredDistance, cv::Mat& registeredPlayer )
+  {
+    dispatchFrameSize( registration.getDepthResolution(), registration.getColorResolution(),
+      Kernel( *this, distance, player, registration, isParallax, registeredDistance, registeredPlayer ) );
+  }
+
+  // 距離カメラとRGBカメラの大きさ(FrameSize)を指定して、1フレーム分を変換する
+  template< typename DepthSize, typename ColorSize >
+  void map( DepthSize depthSize, ColorSize colorSize,
+    const USHORT* distance, const BYTE* player, const DepthColorRegistration& registration,
+    bool isParallax, cv::Mat& registeredDistance, cv::Mat& registeredPlayer )
+  {
+    const int tileCount = (DepthSize::HEIGHT + TILE_ROWS - 1) / TILE_ROWS;
+    const int colorTileCount = (ColorSize::HEIGHT + TILE_ROWS - 1) / TILE_ROWS;
+
+    zBuffer_.resize( ColorSize::PIXELS );
+    targets_.resize( DepthSize::PIXELS );
+    tiles_.resize( tileCount );
+
+    // 投影先を求めて、タイルごとの投影先の行の範囲を記録する
+    Concurrency::parallel_for( 0, tileCount, [&]( int tile ) {
+      project( depthSize, colorSize, distance, registration, isParallax, tile );
+    } );
+
+    // Zバッファに書き込む(投影先が重ならない1つおきのタイルを同時に処理する)
+    if ( isTileParallel() ) {
+      for ( int parity = 0; parity < 2; ++parity ) {
+        Concurrency::parallel_for( parity, tileCount, 2, [&]( int tile ) {
+          splat( depthSize, distance, player, tile );
+        } );
+      }
+    }
+    else {
+      for ( int tile = 0; tile < tileCount; ++tile ) {
+        splat( depthSize, distance, player, tile );
+      }
+    }
+
+    // 横方向の穴を埋めてから、縦方向の穴を埋めて、距離とプレイヤーに分ける
+    const int holeWidth = HoleSize< DepthSize, ColorSize >::WIDTH;
+    const int holeHeight = HoleSize< DepthSize, ColorSize >::HEIGHT;
+    registeredDistance.create( ColorSize::HEIGHT, ColorSize::WIDTH, CV_16UC1 );
+    registeredPlayer.create( ColorSize::HEIGHT, ColorSize::WIDTH, CV_8UC1 );
+
+    Concurrency::parallel_for( 0, colorTileCount, [&]( int tile ) {
+      for ( int y = tile * TILE_ROWS; y < std::min( (tile + 1) * TILE_ROWS, (int)ColorSize::HEIGHT ); ++y ) {
+        fillRow( colorSize, &zBuffer_[y * ColorSize::WIDTH], holeWidth );
+      }
+    } );
+
+    Concurrency::parallel_for( 0, colorTileCount, [&]( int tile ) {
+      for ( int y = tile * TILE_ROWS; y < std::min( (tile + 1) * TILE_ROWS, (int)ColorSize::HEIGHT ); ++y ) {
+        fillColumnsAndSplit( colorSize, y, (USHORT*)registeredDistance.ptr( y ), registeredPlayer.ptr( y ), holeHeight );
+      }
+    } );
+  }
+
+private:
+
+  // Zバッファの空き(どの距離よりも遠い値)
+  static const USHORT EMPTY = 0xFFFF;
+
+  // タイルの投影先の行の範囲
+  struct TileRange
+  {
+    int top;
+    int bottom;   // 投影先がない場合は top > bottom
+  };
+
+  // 解像度の組み合わせが決まったら、その大きさで map を呼び出す
+  class Kernel
+  {
+  public:
+
+    Kernel( RegisteredDepth& owner, const USHORT* distance, const BYTE* player,
+      const DepthColorRegistration& registration, bool isParallax,
+      cv::Mat& registeredDistance, cv::Mat& registeredPlayer )
+      : owner_( owner )
+      , distance_( distance )
+      , player_( player )
+      , registration_( registration )
+      , isParallax_( isParallax )
+      , registeredDistance_( registeredDistance )
+      , registeredPlayer_( registeredPlayer )
+    {
+    }
+
+    template< typename DepthSize, typename ColorSize >
+    void operator()( DepthSize depthSize, ColorSize colorSize )
+    {
+      owner_.map( depthSize, colorSize, distance_, player_, registration_, isParallax_,
+        registeredDistance_, registeredPlayer_ );
+    }
+
+  private:
+
+    RegisteredDepth& owner_;
+    const USHORT* distance_;
+    const BYTE* player_;
+    const DepthColorRegistration& registration_;
+    bool isParallax_;
+    cv::Mat& registeredDistance_;
+    cv::Mat& registeredPlayer_;
+  };
+
+  // タイルの各画素の投影先(RGB画像の画素番号、-1は書き込まない)を求める
+  //   同じタイルの行に当たるZバッファも、ここで空にしておく
+  template< typename DepthSize, typename ColorSize >
+  void project( DepthSize, ColorSize, const USHORT* distance, const DepthColorRegistration& registration,
+    bool isParallax, int tile )
+  {
+    const int top = tile * TILE_ROWS;
+    const int bottom = std::min( top + TILE_ROWS, (int)DepthSize::HEIGHT );
+
+    TileRange& range = tiles_[tile];
+    range.top = ColorSize::HEIGHT;
+    range.bottom = -1;
+
+    for ( int y = top; y < bottom; ++y ) {
+      for ( int x = 0; x < DepthSize::WIDTH; ++x ) {
+        int index = (y * DepthSize::WIDTH) + x;
+        targets_[index] = -1;
+
+        // 距離が取れていない画素は書き込まない
+        if ( distance[index] == 0 ) {
+          continue;
+        }
+
+        LONG colorX = 0;
+        LONG colorY = 0;
+        registration.getColorPixelFromDistance( index, isParallax ? distance[index] : 0, colorX, colorY );
+        if ( (colorX < 0) || (colorX >= ColorSize::WIDTH) || (colorY < 0) || (colorY >= ColorSize::HEIGHT) ) {
+          continue;
+        }
+
+        targets_[index] = (colorY * ColorSize::WIDTH) + colorX;
+        range.top = std::min( range.top, (int)colorY );
+        range.bottom = std::max( range.bottom, (int)colorY );
+      }
+    }
+
+    // RGB画像の行のうち、このタイルと同じ番号の範囲を空にする
+    const int colorTop = std::min( tile * TILE_ROWS, (int)ColorSize::HEIGHT );
+    const int colorBottom = std::min( colorTop + TILE_ROWS, (int)ColorSize::HEIGHT );
+    std::fill( zBuffer_.begin() + (colorTop * ColorSize::WIDTH), zBuffer_.begin() + (colorBottom * ColorSize::WIDTH), EMPTY );
+
+    // RGB画像のほうが行数が多い場合は、最後のタイルで残りの行を空にする
+    if ( tile == (int)tiles_.size() - 1 ) {
+      std::fill( zBuffer_.begin() + (colorBottom * ColorSize::WIDTH), zBuffer_.end(), EMPTY );
+    }
+  }
+
+  // 投影先の行の範囲が、1つおきのタイル同士で重ならないかどうか
+  bool isTileParallel() const
+  {
+    for ( size_t i = 0; i < tiles_.size(); ++i ) {
+      for ( size_t j = i + 2; j < tiles_.size(); j += 2 ) {
+        const TileRange& a = tiles_[i];
+        const TileRange& b = tiles_[j];
+        if ( (a.top <= a.bottom) && (b.top <= b.bottom) && (a.top <= b.bottom) && (b.top <= a.bottom) ) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // タイルの画素をZバッファに書き込む(近いほうを残す)
+  template< typename DepthSize >
+  void splat( DepthSize, const USHORT* distance, const BYTE* player, int tile )
+  {
+    const int begin = tile * TILE_ROWS * DepthSize::WIDTH;
+    const int end = std::min( begin + (TILE_ROWS * DepthSize::WIDTH), (int)DepthSize::PIXELS );
+    for ( int i = begin; i < end; ++i ) {
+      int target = targets_[i];
+      if ( target < 0 ) {
+        continue;
+      }
+
+      // 距離を上位、プレイヤーを下位に詰めるので、小さいほうが近い
+      USHORT value = (USHORT)((distance[i] << NUI_IMAGE_PLAYER_INDEX_SHIFT) | ((player != 0) ? player[i] : 0));
+      if ( value < zBuffer_[target] ) {
+        zBuffer_[target] = value;
+      }
+    }
+  }
+
+  // 1行の中の、holeWidth 画素以下の横方向の穴を埋める
+  template< typename ColorSize >
+  static void fillRow( ColorSize, USHORT* row, int holeWidth )
+  {
+    int x = 0;
+    while ( x < ColorSize::WIDTH ) {
+      if ( row[x] != EMPTY ) {
+        ++x;
+        continue;
+      }
+
+      // 穴の終わりを探す
+      int end = x;
+      while ( (end < ColorSize::WIDTH) && (row[end] == EMPTY) ) {
+        ++end;
+      }
+
+      // 両側に画素がある小さな穴だけを、遠いほうの値で埋める
+      if ( (x > 0) && (end < ColorSize::WIDTH) && ((end - x) <= holeWidth) ) {
+        USHORT value = std::max( row[x - 1], row[end] );
+        std::fill( row + x, row + end, value );
+      }
+
+      x = end;
+    }
+  }
+
+  // 1行分の縦方向の穴を埋めて、距離とプレイヤーに分ける
+  //   Zバッファは読むだけなので、ほかの行と同時に処理できる
+  template< typename ColorSize >
+  void fillColumnsAndSplit( ColorSize colorSize, int y, USHORT* distance, BYTE* player, int holeHeight ) const
+  {
+    const USHORT* row = &zBuffer_[y * ColorSize::WIDTH];
+    for ( int x = 0; x < ColorSize::WIDTH; ++x ) {
+      USHORT value = row[x];
+
+      // 上下を画素に挟まれた、holeHeight 画素以下の穴は、遠いほうの値で埋める
+      if ( value == EMPTY ) {
+        int aboveOffset = 0;
+        int belowOffset = 0;
+        USHORT above = findVertical( colorSize, x, y, -1, holeHeight, aboveOffset );
+        USHORT below = findVertical( colorSize, x, y, ColorSize::HEIGHT, holeHeight, belowOffset );
+        if ( (above != EMPTY) && (below != EMPTY) && ((aboveOffset + belowOffset - 1) <= holeHeight) ) {
+          value = std::max( above, below );
+        }
+      }
+
+      if ( value == EMPTY ) {
+        distance[x] = 0;
+        player[x] = 0;
+      }
+      else {
+        distance[x] = value >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+        player[x] = (BYTE)(value & NUI_IMAGE_PLAYER_INDEX_MASK);
+      }
+    }
+  }
+
+  // 縦方向に、holeHeight 画素以内で一番近い画素を探す
+  //   limit  : 探す方向の範囲外の行(-1 または高さ)
+  //   offset : 見つかった画素までの行数
+  template< typename ColorSize >
+  USHORT findVertical( ColorSize, int x, int y, int limit, int holeHeight, int& offset ) const
+  {
+    int step = (limit < y) ? -1 : 1;
+    for ( offset = 1; offset <= holeHeight; ++offset ) {
+      int row = y + (step * offset);
+      if ( row == limit ) {
+        break;
+      }
+
+      USHORT value = zBuffer_[(row * ColorSize::WIDTH) + x];
+      if ( value != EMPTY ) {
+        return value;
+      }
+    }
+
+    return EMPTY;
+  }
+
+private:
+
+  std::vector< USHORT > zBuffer_;     // RGB画像の画素ごとの、一番近い画素の値(距離 << 3 | プレイヤー)
+  std::vector< int > targets_;        // 距離画像の画素ごとの投影先
+  std::vector< TileRange > tiles_;    // タイルごとの投影先の行の範囲
+};
@@ -0,0 +1,264 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <vector>
+
+// キューがいっぱいの場合の扱い
+enum QueuePolicy
+{
+  QUEUE_BLOCK,        // 空きができるまで待つ(フレームを落とさない)
+  QUEUE_DROP_NEWEST,  // 追加しようとしたフレームを捨てる
+  QUEUE_DROP_OLDEST   // 古いフレームを捨てて、最新のフレームを取り出す(遅延を小さくする)
+};
+
+// キューの統計
+struct QueueStatistics
+{
+  LONG pushed;    // 追加した数
+  LONG popped;    // 取り出した数
+  LONG dropped;   // 捨てた数
+  LONG depth;     // 現在の要素数
+  LONG maxDepth;  // 最大の要素数
+};
+
+// 容量が固定の、1対1(追加するスレッドと取り出すスレッドが1つずつ)のキュー
+//
+// 要素の受け渡しはロックを使わず、読み出し位置と書き込み位置の更新だけで行う。
+// 空やいっぱいで待つ場合のみ、イベントで相手のスレッドを待つ。
+//
+// QUEUE_DROP_OLDEST でいっぱいの場合は、キューとは別の「最新」の場所に書き込む。
+// 最新の場所は3つの要素を追加する側、取り出す側、受け渡し中で入れ替えて使い、
+// 受け渡し中の番号(pending_)の交換だけで受け渡す。受け渡し中の要素がある間は、
+// 追加する側はキューに追加しないので、受け渡し中の要素はキューのどの要素よりも新しい。
+template< typename T >
+class SpscQueue
+{
+public:
+
+  SpscQueue( size_t capacity, QueuePolicy policy = QUEUE_BLOCK )
+    : slots_( capacity + 1 )
+    , policy_( policy )
+    , head_( 0 )
+    , tail_( 0 )
+    , closed_( 0 )
+    , pushed_( 0 )
+    , popped_( 0 )
+    , dropped_( 0 )
+    , maxDepth_( 0 )
+    , latestWrite_( 0 )
+    , latestRead_( 2 )
+    , pending_( 1 )
+  {
+    notEmpty_ = ::CreateEvent( 0, FALSE, FALSE, 0 );
+    notFull_ = ::CreateEvent( 0, FALSE, FALSE, 0 );
+  }
+
+  ~SpscQueue()
+  {
+    ::CloseHandle( notEmpty_ );
+    ::CloseHandle( notFull_ );
+  }
+
+  // 追加する(追加するスレッドから呼ぶ)
+  //   捨てた場合、閉じている場合はfalseを返す
+  bool push( const T& item )
+  {
+    for ( ;; ) {
+      // 受け渡し中の要素があれば、キューには追加せずに最新の場所を書き換える
+      if ( (policy_ == QUEUE_DROP_OLDEST) && ((pending_ & LATEST_FULL) != 0) && (closed_ == 0) ) {
+        pushLatest( item );
+        return true;
+      }
+
+      LONG tail = tail_;
+      LONG next = increment( tail );
+      if ( next != head_ ) {
+        slots_[tail] = item;
+        ::InterlockedExchange( &tail_, next );
+        ::InterlockedIncrement( &pushed_ );
+
+        LONG depth = getDepth();
+        if ( depth > maxDepth_ ) {
+          maxDepth_ = depth;
+        }
+
+        ::SetEvent( notEmpty_ );
+        return true;
+      }
+
+      // いっぱいの場合(最新のフレームを優先する場合は、最新の場所に書き込む)
+      if ( (policy_ == QUEUE_DROP_OLDEST) && (closed_ == 0) ) {
+        pushLatest( item );
+        return true;
+      }
+
+      if ( (policy_ != QUEUE_BLOCK) || (closed_ != 0) ) {
+        ::InterlockedIncrement( &dropped_ );
+        return false;
+      }
+
+      ::WaitForSingleObject( notFull_, INFINITE );
+    }
+  }
+
+  // 取り出す(取り出すスレッドから呼ぶ)
+  //   タイムアウトした場合、閉じていて空の場合はfalseを返す
+  bool pop( T& item, DWORD timeout = INFINITE )
+  {
+    for ( ;; ) {
+      // 受け渡し中の要素があれば、キューの要素はすべてそれより古いので捨てる
+      //   受け渡し中の間はキューに追加されないので、交換する前にキューの範囲を読む
+      if ( (pending_ & LATEST_FULL) != 0 ) {
+        LONG head = head_;
+        LONG tail = tail_;
+        latestRead_ = ::InterlockedExchange( &pending_, latestRead_ ) & ~LATEST_FULL;
+
+        while ( head != tail ) {
+          slots_[head] = T();
+          head = increment( head );
+          ::InterlockedIncrement( &dropped_ );
+        }
+        ::InterlockedExchange( &head_, head );
+
+        item = latest_[latestRead_];
+        latest_[latestRead_] = T();
+        ::InterlockedIncrement( &popped_ );
+
+        ::SetEvent( notFull_ );
+        return true;
+      }
+
+      LONG head = head_;
+      LONG tail = tail_;
+      if ( head != tail ) {
+        // 最新のフレーム以外を捨てる
+        if ( policy_ == QUEUE_DROP_OLDEST ) {
+          LONG last = decrement( tail );
+          while ( head != last ) {
+            slots_[head] = T();
+            head = increment( head );
+            ::InterlockedIncrement( &dropped_ );
+          }
+        }
+
+        item = slots_[head];
+        slots_[head] = T();
+        ::InterlockedExchange( &head_, increment( head ) );
+        ::InterlockedIncrement( &popped_ );
+
+        ::SetEvent( notFull_ );
+        return true;
+      }
+
+      if ( closed_ != 0 ) {
+        return false;
+      }
+
+      if ( ::WaitForSingleObject( notEmpty_, timeout ) != WAIT_OBJECT_0 ) {
+        return false;
+      }
+    }
+  }
+
+  // 閉じる(以降の追加は捨てられ、待っているスレッドは戻る)
+  void close()
+  {
+    ::InterlockedExchange( &closed_, 1 );
+    ::SetEvent( notEmpty_ );
+    ::SetEvent( notFull_ );
+  }
+
+  // 閉じていて、空かどうか
+  bool isDone() const
+  {
+    return (closed_ != 0) && (head_ == tail_) && ((pending_ & LATEST_FULL) == 0);
+  }
+
+  // 現在の要素数
+  LONG getDepth() const
+  {
+    LONG count = (LONG)slots_.size();
+    return ((tail_ - head_ + count) % count) + (((pending_ & LATEST_FULL) != 0) ? 1 : 0);
+  }
+
+  size_t getCapacity() const
+  {
+    return slots_.size() - 1;
+  }
+
+  QueueStatistics getStatistics() const
+  {
+    QueueStatistics statistics;
+    statistics.pushed = pushed_;
+    statistics.popped = popped_;
+    statistics.dropped = dropped_;
+    statistics.depth = getDepth();
+    statistics.maxDepth = maxDepth_;
+    return statistics;
+  }
+
+private:
+
+  // 受け渡し中の番号に付ける、要素があることを表すビット
+  enum { LATEST_FULL = 4 };
+
+  // 最新の場所に書き込んで、受け渡す(取り出されていない要素は捨てる)
+  void pushLatest( const T& item )
+  {
+    latest_[latestWrite_] = item;
+    LONG previous = ::InterlockedExchange( &pending_, latestWrite_ | LATEST_FULL );
+    latestWrite_ = previous & ~LATEST_FULL;
+    if ( (previous & LATEST_FULL) != 0 ) {
+      latest_[latestWrite_] = T();
+      ::InterlockedIncrement( &dropped_ );
+    }
+    ::InterlockedIncrement( &pushed_ );
+
+    LONG depth = getDepth();
+    if ( depth > maxDepth_ ) {
+      maxDepth_ = depth;
+    }
+
+    ::SetEvent( notEmpty_ );
+  }
+
+  LONG increment( LONG index ) const
+  {
+    return (index + 1) % (LONG)slots_.size();
+  }
+
+  LONG decrement( LONG index ) const
+  {
+    return (index + (LONG)slots_.size() - 1) % (LONG)slots_.size();
+  }
+
+private:
+
+  // コピーを禁止する
+  SpscQueue( const SpscQueue& rhs );
+  SpscQueue& operator = ( const SpscQueue& rhs );
+
+private:
+
+  std::vector< T > slots_;
+  QueuePolicy policy_;
+
+  volatile LONG head_;    // 次に取り出す位置(取り出すスレッドだけが更新する)
+  volatile LONG tail_;    // 次に書き込む位置(追加するスレッドだけが更新する)
+  volatile LONG closed_;
+
+  volatile LONG pushed_;
+  volatile LONG popped_;
+  volatile LONG dropped_;
+  volatile LONG maxDepth_;
+
+  // いっぱいの場合の最新の要素(QUEUE_DROP_OLDEST のみ)
+  T latest_[3];
+  LONG latestWrite_;      // 追加する側の場所(追加するスレッドだけが使う)
+  LONG latestRead_;       // 取り出す側の場所(取り出すスレッドだけが使う)
+  volatile LONG pending_; // 受け渡し中の場所(要素がある場合は LATEST_FULL が付く)
+
+  HANDLE notEmpty_;
+  HANDLE notFull_;
+};
@@ -0,0 +1,235 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <opencv2/opencv.hpp>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "FrameSource.h"
+
+// 合成したフレームを取得する
+//
+// Kinectを接続せずに、各サンプルのメインループを最大速度で動かすための取得元。
+// 左右に移動しながら手を振るプレイヤーを1人、壁の前に描画する。
+// 距離カメラとRGBカメラは同じ位置にあるものとして、座標変換は解像度の比での拡大だけになる。
+// 画像はプールのバッファに直接描画するので、参照カウント付きの取得ではコピーしない。
+class SyntheticFrameSource : public FrameSource
+{
+public:
+
+  // プレイヤーの距離(mm)
+  static const int PLAYER_DISTANCE = 2000;
+
+  // 背景の距離(mm)
+  static const int BACKGROUND_DISTANCE = 3500;
+
+  // コンストラクタ
+  //   frameCount : 生成するフレーム数(0の場合は終了しない)
+  SyntheticFrameSource( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+    DWORD frameCount = 0 )
+    : colorResolution_( colorResolution )
+    , depthResolution_( depthResolution )
+    , frameCount_( frameCount )
+    , frameNumber_( 0 )
+    , timeStamp_( 0 )
+  {
+    ::NuiImageResolutionToSize( colorResolution_, colorWidth_, colorHeight_ );
+    ::NuiImageResolutionToSize( depthResolution_, depthWidth_, depthHeight_ );
+    memset( &skeletonFrame_, 0, sizeof(skeletonFrame_) );
+  }
+
+  // 次のフレームを生成する
+  bool waitFrame()
+  {
+    if ( (frameCount_ != 0) && (frameNumber_ >= frameCount_) ) {
+      return false;
+    }
+
+    ++frameNumber_;
+    timeStamp_ += 33;
+
+    // 前のフレームを手放してから取得する
+    // (ほかに参照がなければ同じバッファを、参照中であれば別のバッファを使う)
+    colorHandle_.reset();
+    depthHandle_.reset();
+    colorHandle_ = createFrame( colorWidth_, colorHeight_, 4 );
+    depthHandle_ = createFrame( depthWidth_, depthHeight_, 2 );
+    colorImage_ = cv::Mat( colorHeight_, colorWidth_, CV_8UC4, colorHandle_.bits() );
+    depthImage_ = cv::Mat( depthHeight_, depthWidth_, CV_16UC1, depthHandle_.bits() );
+
+    generate();
+    return true;
+  }
+
+  HRESULT getColorFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    frame = colorHandle_.frame();
+    return S_OK;
+  }
+
+  HRESULT releaseColorFrame( ImageFrame& frame )
+  {
+    return S_OK;
+  }
+
+  HRESULT getDepthFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    frame = depthHandle_.frame();
+    return S_OK;
+  }
+
+  HRESULT releaseDepthFrame( ImageFrame& frame )
+  {
+    return S_OK;
+  }
+
+  HRESULT acquireColorFrame( FrameHandle& handle, DWORD timeout = 0 )
+  {
+    handle = colorHandle_;
+    return S_OK;
+  }
+
+  HRESULT acquireDepthFrame( FrameHandle& handle, DWORD timeout = 0 )
+  {
+    handle = depthHandle_;
+    return S_OK;
+  }
+
+  HRESULT getSkeletonFrame( NUI_SKELETON_FRAME& frame )
+  {
+    frame = skeletonFrame_;
+    return S_OK;
+  }
+
+  void getColorPixelCoordinates( LONG depthX, LONG depthY, USHORT depth, LONG& colorX, LONG& colorY )
+  {
+    colorX = depthX * colorWidth_ / depthWidth_;
+    colorY = depthY * colorHeight_ / depthHeight_;
+  }
+
+  NUI_IMAGE_RESOLUTION getColorResolution() const
+  {
+    return colorResolution_;
+  }
+
+  NUI_IMAGE_RESOLUTION getDepthResolution() const
+  {
+    return depthResolution_;
+  }
+
+private:
+
+  // プールからフレームを取得する
+  FrameHandle createFrame( DWORD width, DWORD height, int bytesPerPixel )
+  {
+    FrameHandle handle = pool_.acquire( width * height * bytesPerPixel );
+    ImageFrame& frame = handle.frame();
+    frame.timeStamp = timeStamp_;
+    frame.frameNumber = frameNumber_;
+    frame.width = width;
+    frame.height = height;
+    frame.pitch = width * bytesPerPixel;
+    return handle;
+  }
+
+  // 1フレーム分の画像とスケルトンを生成する
+  void generate()
+  {
+    // 640x480を基準にした関節の位置(体の中心からの相対位置)
+    static const int jointOffsets[NUI_SKELETON_POSITION_COUNT][2] = {
+      {   0,  40 }, {   0,   0 }, {   0, -60 }, {   0, -100 },  // 腰、背骨、肩の中心、頭
+      { -40, -55 }, { -70, -10 }, { -90,  30 }, { -95,  45 },   // 左肩、左肘、左手首、左手
+      {  40, -55 }, {  70, -10 }, {  90,  30 }, {  95,  45 },   // 右肩、右肘、右手首、右手
+      { -20,  45 }, { -22, 110 }, { -24, 170 }, { -30, 180 },   // 左腰、左膝、左足首、左足
+      {  20,  45 }, {  22, 110 }, {  24, 170 }, {  30, 180 },   // 右腰、右膝、右足首、右足
+    };
+
+    // 骨格(関節のつながり)
+    static const int bones[][2] = {
+      { 3, 2 }, { 2, 1 }, { 1, 0 },
+      { 2, 4 }, { 4, 5 }, { 5, 6 }, { 6, 7 },
+      { 2, 8 }, { 8, 9 }, { 9, 10 }, { 10, 11 },
+      { 0, 12 }, { 12, 13 }, { 13, 14 }, { 14, 15 },
+      { 0, 16 }, { 16, 17 }, { 17, 18 }, { 18, 19 },
+    };
+
+    // 関節の位置は距離画像の座標で求める
+    double scale = depthWidth_ / 640.0;
+    double t = frameNumber_ / 30.0;
+
+    // 体の中心は左右に移動し、右手を上下に振る
+    cv::Point center( (int)((depthWidth_ / 2) + (depthWidth_ / 4) * sin( t )), (int)(depthHeight_ / 2) );
+    int wave = (int)(60 * sin( t * 4 ));
+
+    cv::Point joints[NUI_SKELETON_POSITION_COUNT];
+    for ( int i = 0; i < NUI_SKELETON_POSITION_COUNT; ++i ) {
+      int dy = jointOffsets[i][1];
+      if ( (i == NUI_SKELETON_POSITION_WRIST_RIGHT) || (i == NUI_SKELETON_POSITION_HAND_RIGHT) ) {
+        dy -= wave + 60;
+      }
+
+      joints[i] = cv::Point( center.x + (int)(jointOffsets[i][0] * scale),
+                             center.y + (int)(dy * scale) );
+    }
+
+    // 背景(左端の8画素は距離が取れない領域)
+    colorImage_.setTo( cv::Scalar( 160, 150, 140, 255 ) );
+    depthImage_.setTo( cv::Scalar( BACKGROUND_DISTANCE << NUI_IMAGE_PLAYER_INDEX_SHIFT ) );
+    depthImage_.colRange( 0, std::max( 1, (int)(8 * scale) ) ).setTo( cv::Scalar( 0 ) );
+
+    // プレイヤー(プレイヤー番号は1)
+    //   RGB画像には、距離画像との解像度の比で拡大して描画する
+    cv::Scalar playerDepth( (PLAYER_DISTANCE << NUI_IMAGE_PLAYER_INDEX_SHIFT) | 1 );
+    cv::Scalar playerColor( 80, 120, 200, 255 );
+    int colorScale = colorWidth_ / depthWidth_;
+    int thickness = std::max( 1, (int)(24 * scale) );
+    for ( int i = 0; i < sizeof(bones) / sizeof(bones[0]); ++i ) {
+      const cv::Point& p1 = joints[bones[i][0]];
+      const cv::Point& p2 = joints[bones[i][1]];
+      cv::line( depthImage_, p1, p2, playerDepth, thickness );
+      cv::line( colorImage_, p1 * colorScale, p2 * colorScale, playerColor, thickness * colorScale );
+    }
+
+    int headRadius = std::max( 1, (int)(22 * scale) );
+    const cv::Point& head = joints[NUI_SKELETON_POSITION_HEAD];
+    cv::circle( depthImage_, head, headRadius, playerDepth, -1 );
+    cv::circle( colorImage_, head * colorScale, headRadius * colorScale, playerColor, -1 );
+
+    // スケルトン
+    memset( &skeletonFrame_, 0, sizeof(skeletonFrame_) );
+    skeletonFrame_.liTimeStamp.QuadPart = timeStamp_;
+    skeletonFrame_.dwFrameNumber = frameNumber_;
+
+    NUI_SKELETON_DATA& skeletonData = skeletonFrame_.SkeletonData[0];
+    skeletonData.eTrackingState = NUI_SKELETON_TRACKED;
+    skeletonData.dwTrackingID = 1;
+    for ( int i = 0; i < NUI_SKELETON_POSITION_COUNT; ++i ) {
+      skeletonData.SkeletonPositions[i] = ::NuiTransformDepthImageToSkeleton(
+        joints[i].x, joints[i].y, PLAYER_DISTANCE << NUI_IMAGE_PLAYER_INDEX_SHIFT, depthResolution_ );
+      skeletonData.eSkeletonPositionTrackingState[i] = NUI_SKELETON_POSITION_TRACKED;
+    }
+    skeletonData.Position = skeletonData.SkeletonPositions[NUI_SKELETON_POSITION_HIP_CENTER];
+  }
+
+private:
+
+  NUI_IMAGE_RESOLUTION colorResolution_;
+  NUI_IMAGE_RESOLUTION depthResolution_;
+  DWORD colorWidth_;
+  DWORD colorHeight_;
+  DWORD depthWidth_;
+  DWORD depthHeight_;
+
+  DWORD frameCount_;
+  DWORD frameNumber_;
+  LONGLONG timeStamp_;
+
+  FrameHandle colorHandle_;
+  FrameHandle depthHandle_;
+  cv::Mat colorImage_;
+  cv::Mat depthImage_;
+  NUI_SKELETON_FRAME skeletonFrame_;
+};
@@ -1,11 +1,74 @@
 #include "KinectControl.h"
+#include "RecordedFrameSource.h"
+#include "SyntheticFrameSource.h"
 
-void main()
+// 
+//   (Ȃ)                   Kinect̃t[g
+//   synthetic                Kinect̑ɍt[g
+//   record <t@C>      Kinect̃t[gAt@CɋL^
+//   play <t@C> [fast] L^t@CĐ(fast w肷ƍő呬xōĐ)
+//   benchmark [t@C]   t[(t@Cw肵ꍇ͋L^t@C)ŏԂv
+//
+//   -color <𑜓x>          RGBJ̉𑜓x(640x480A1280x960BResolutionSelector Q)
+//   -depth <𑜓x>          J̉𑜓x(80x60A320x240A640x480)
+//   -sink <o͐>           摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+//                            null w肷ƁAʂɕ\A\̂߂̃EFCgȂŏ
+void main( int argc, char* argv[] )
 {
   try {
+    // o͐́Ao͂ KinectControl ɍ쐬
+    FrameSinkSelector sinks;
+    FrameSink* sink = sinks.select( argc, argv );
+
+    ResolutionSelector resolutions;
+    resolutions.select( argc, argv );
+    NUI_IMAGE_RESOLUTION colorResolution = resolutions.getColorResolution();
+    NUI_IMAGE_RESOLUTION depthResolution = resolutions.getDepthResolution();
+
+    // t[QƂ鑤(KinectControlAFrameRecorder)́A擾ɍ쐬
+    SyntheticFrameSource synthetic( colorResolution, depthResolution );
+    RecordedFrameSource recorded;
     KinectControl kinect;
-    kinect.initialize();
+    FrameRecorder recorder;
+
+    std::string mode = (argc > 1) ? argv[1] : "";
+    if ( mode == "synthetic" ) {
+      kinect.initialize( &synthetic );
+    }
+    else if ( mode == "benchmark" ) {
+      if ( argc > 2 ) {
+        recorded.open( argv[2], false );
+        kinect.initialize( &recorded );
+      }
+      else {
+        kinect.initialize( &synthetic );
+      }
+
+      KernelBenchmark kernelBenchmark;
+      kinect.benchmark( kernelBenchmark );
+      return;
+    }
+    else if ( (mode == "play") && (argc > 2) ) {
+      recorded.open( argv[2], !((argc > 3) && (std::string( argv[3] ) == "fast")) );
+      kinect.initialize( &recorded );
+    }
+    else {
+      kinect.initialize( colorResolution, depthResolution );
+
+      if ( (mode == "record") && (argc > 2) ) {
+        recorder.open( argv[2], colorResolution, depthResolution, kinect.getRegistration() );
+        kinect.setRecorder( &recorder );
+      }
+    }
+
+    kinect.setSink( sink );
     kinect.run();
+
+    if ( recorder.isOpen() ) {
+      recorder.close();
+      std::cout << "recorded " << recorder.getFrameCount() << " frames"
+                << " (dropped " << recorder.getDroppedCount() << ")" << std::endl;
+    }
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
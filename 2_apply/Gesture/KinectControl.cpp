@@ -2,40 +2,36 @@
 
 
 KinectControl::KinectControl()
+  : source( 0 )
+  , sink( &screen )
 {
 }
 
 
 KinectControl::~KinectControl()
 {
-  if ( kinect != 0 ) {
-    kinect->NuiShutdown();
-    kinect->Release();
-  }
 }
 
 void KinectControl::initialize()
 {
-  createInstance();
-
-  // Kinect̐ݒ
-  ERROR_CHECK( kinect->NuiInitialize( NUI_INITIALIZE_FLAG_USES_COLOR | NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON ) );
-
-  // RGBJ
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR, CAMERA_RESOLUTION, 0, 2, 0, &imageStreamHandle ) );
+  // Kinect(XPgg)
+  kinect.initialize( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, true );
 
-  // J
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION, 0, 2, 0, &depthStreamHandle ) );
-
-  // XPg
-  ERROR_CHECK( kinect->NuiSkeletonTrackingEnable( 0, NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA ) );
+  initialize( &kinect );
+}
 
-  // t[XVCxg̃nh쐬
-  streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
-  ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+void KinectControl::initialize( FrameSource* frameSource )
+{
+  source = frameSource;
 
   // w肵𑜓x́AʃTCY擾
-  ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+  ::NuiImageResolutionToSize( source->getColorResolution(), width, height );
+}
+
+// 摜̏o͐w肷(w肵Ȃꍇ͉ʂɕ\)
+void KinectControl::setSink( FrameSink* frameSink )
+{
+  sink = frameSink;
 }
 
 void KinectControl::run()
@@ -43,58 +39,36 @@ void KinectControl::run()
   // C[v
   while ( 1 ) {
     // f[^̍XV҂
-    DWORD ret = ::WaitForSingleObject( streamEvent, INFINITE );
-    ::ResetEvent( streamEvent );
+    if ( !source->waitFrame() ) {
+      break;
+    }
 
     setRgbImage( rgbImage );
     setSkeleton( rgbImage );
 
-    // 摜\
-    cv::imshow( "RGBCamera", rgbImage );
+    // 摜o͂
+    sink->present( "RGBCamera", rgbImage );
 
-    // Î߂̃L[̓`FbNA\̂߂̃EFCg
-    int key = cv::waitKey( 10 );
-    if ( key == 'q' ) {
+    // Ivꂽꍇ͏I
+    if ( !sink->endFrame() ) {
       break;
     }
   }
 }
 
-void KinectControl::createInstance()
-{
-  // ڑĂKinect̐擾
-  int count = 0;
-  ERROR_CHECK( ::NuiGetSensorCount( &count ) );
-  if ( count == 0 ) {
-    throw std::runtime_error( "Kinect ڑĂ" );
-  }
-
-  // ŏKinect̃CX^X쐬
-  ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
-
-  // Kinect̏Ԃ擾
-  HRESULT status = kinect->NuiStatus();
-  if ( status != S_OK ) {
-    throw std::runtime_error( "Kinect p\ł͂܂" );
-  }
-}
-
 void KinectControl::setRgbImage( cv::Mat& image )
 {
   try {
     // RGBJ̃t[f[^擾
-    NUI_IMAGE_FRAME imageFrame = { 0 };
-    ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( imageStreamHandle, 0, &imageFrame ) );
-
-    // 摜f[^擾
-    NUI_LOCKED_RECT colorData;
-    imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
+    ImageFrame imageFrame = { 0 };
+    ERROR_CHECK( source->getColorFrame( imageFrame ) );
 
-    // 摜f[^Rs[
-    image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+    // 摜f[^Rs[(t[̃obt@͎擾ėp̂ŁAQƂɃRs[)
+    //   傫ȂAÕt[ image ̃obt@g܂킷
+    cv::Mat( height, width, CV_8UC4, imageFrame.bits, imageFrame.pitch ).copyTo( image );
 
     // t[f[^
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
+    ERROR_CHECK( source->releaseColorFrame( imageFrame ) );
   }
   catch ( std::exception& ex ) {
     std::cout << "KinectControl::setRgbImage" << ex.what() << std::endl;
@@ -106,7 +80,7 @@ void KinectControl::setSkeleton( cv::Mat& image )
   try {
     // XPg̃t[擾
     NUI_SKELETON_FRAME skeletonFrame = { 0 };
-    ERROR_CHECK( kinect->NuiSkeletonGetNextFrame( 0, &skeletonFrame ) );
+    ERROR_CHECK( source->getSkeletonFrame( skeletonFrame ) );
 
     for ( int i = 0; i < NUI_SKELETON_COUNT; ++i ) {
       NUI_SKELETON_DATA& skeletonData = skeletonFrame.SkeletonData[i];
@@ -133,12 +107,12 @@ void KinectControl::setJoint( cv::Mat& image, int joint, Vector4 position )
 {
   try {
     FLOAT depthX = 0, depthY = 0;
-    ::NuiTransformSkeletonToDepthImage( position, &depthX, &depthY, CAMERA_RESOLUTION );
+    ::NuiTransformSkeletonToDepthImage( position, &depthX, &depthY, source->getDepthResolution() );
 
     LONG colorX = 0;
     LONG colorY = 0;
 
-    kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, (LONG)depthX , (LONG)depthY, 0, &colorX, &colorY );
+    source->getColorPixelCoordinates( (LONG)depthX , (LONG)depthY, 0, colorX, colorY );
 
     cv::circle( image, cv::Point( colorX, colorY ), 5, cv::Scalar( 0, 255, 0 ), 2 );
     std::stringstream ss;
@@ -15,6 +15,9 @@
   throw std::runtime_error(ss.str().c_str());                 \
   }
 
+#include "FrameSink.h"
+#include "KinectFrameSource.h"
+
 const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
 
 class KinectControl
@@ -24,18 +27,19 @@ public:
   ~KinectControl(void);
 
   void initialize();
+  void initialize( FrameSource* frameSource );
+  void setSink( FrameSink* frameSink );
   void run();
 
 private:
-  INuiSensor *kinect;
-  HANDLE imageStreamHandle;
-  HANDLE depthStreamHandle;
-  HANDLE streamEvent;
+  KinectFrameSource kinect;
+  FrameSource* source;
+  ScreenFrameSink screen;
+  FrameSink* sink;
 
   DWORD width;
   DWORD height;
 
-  void createInstance();
   void setRgbImage(cv::Mat& image);
   void setSkeleton( cv::Mat& image );
   void setJoint( cv::Mat& image, int joint, Vector4 position );
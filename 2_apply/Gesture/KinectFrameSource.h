@@ -0,0 +1,235 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include "FrameSource.h"
+
+// Kinectからフレームを取得する
+//
+// SDKのバッファは NuiImageStreamOpen で指定した数(2フレーム分)しかなく、
+// 保持し続けると次のフレームが取得できなくなる。そのため参照カウント付きの
+// 取得(acquireColorFrame など)では、プールのバッファにコピーしてすぐに解放する。
+class KinectFrameSource : public FrameSource
+{
+public:
+
+  // コンストラクタ
+  KinectFrameSource()
+    : kinect_( 0 )
+    , imageStreamHandle_( 0 )
+    , depthStreamHandle_( 0 )
+    , streamEvent_( 0 )
+    , colorResolution_( NUI_IMAGE_RESOLUTION_640x480 )
+    , depthResolution_( NUI_IMAGE_RESOLUTION_640x480 )
+    , colorWidth_( 0 )
+    , colorHeight_( 0 )
+    , depthWidth_( 0 )
+    , depthHeight_( 0 )
+    , useSkeleton_( false )
+  {
+  }
+
+  // デストラクタ
+  ~KinectFrameSource()
+  {
+    close();
+  }
+
+  // 初期化する
+  //   colorResolution  : RGBカメラの解像度
+  //   depthResolution  : 距離カメラの解像度
+  //   depthStreamFlags : 距離カメラのフラグ(Nearモードなど)
+  //   useSkeleton      : スケルトンを使うかどうか
+  //   skeletonFlags    : スケルトンのフラグ(Seatedモードなど)
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution,
+    DWORD depthStreamFlags = 0, bool useSkeleton = false,
+    DWORD skeletonFlags = NUI_SKELETON_TRACKING_FLAG_SUPPRESS_NO_FRAME_DATA )
+  {
+    close();
+    createInstance();
+
+    colorResolution_ = colorResolution;
+    depthResolution_ = depthResolution;
+    useSkeleton_ = useSkeleton;
+
+    // Kinectの設定を初期化する
+    DWORD flags = NUI_INITIALIZE_FLAG_USES_COLOR | NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX;
+    if ( useSkeleton_ ) {
+      flags |= NUI_INITIALIZE_FLAG_USES_SKELETON;
+    }
+    ERROR_CHECK( kinect_->NuiInitialize( flags ) );
+
+    // RGBカメラを初期化する
+    ERROR_CHECK( kinect_->NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR, colorResolution_,
+      0, 2, 0, &imageStreamHandle_ ) );
+
+    // 距離カメラを初期化する
+    ERROR_CHECK( kinect_->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, depthResolution_,
+      depthStreamFlags, 2, 0, &depthStreamHandle_ ) );
+
+    // スケルトンを初期化する
+    if ( useSkeleton_ ) {
+      ERROR_CHECK( kinect_->NuiSkeletonTrackingEnable( 0, skeletonFlags ) );
+    }
+
+    // フレーム更新イベントのハンドルを作成する
+    streamEvent_ = ::CreateEvent( 0, TRUE, FALSE, 0 );
+    ERROR_CHECK( kinect_->NuiSetFrameEndEvent( streamEvent_, 0 ) );
+
+    // 指定した解像度の、画面サイズを取得する
+    ::NuiImageResolutionToSize( colorResolution_, colorWidth_, colorHeight_ );
+    ::NuiImageResolutionToSize( depthResolution_, depthWidth_, depthHeight_ );
+  }
+
+  // 終了する
+  void close()
+  {
+    if ( kinect_ != 0 ) {
+      kinect_->NuiShutdown();
+      kinect_->Release();
+      kinect_ = 0;
+    }
+
+    if ( streamEvent_ != 0 ) {
+      ::CloseHandle( streamEvent_ );
+      streamEvent_ = 0;
+    }
+  }
+
+  // Kinectのインスタンスを取得する
+  INuiSensor* getSensor() const
+  {
+    return kinect_;
+  }
+
+  // データの更新を待つ
+  bool waitFrame()
+  {
+    ::WaitForSingleObject( streamEvent_, INFINITE );
+    ::ResetEvent( streamEvent_ );
+    return true;
+  }
+
+  HRESULT getColorFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    return getFrame( imageStreamHandle_, colorFrame_, colorWidth_, colorHeight_, frame, timeout );
+  }
+
+  HRESULT releaseColorFrame( ImageFrame& frame )
+  {
+    return releaseFrame( imageStreamHandle_, colorFrame_ );
+  }
+
+  HRESULT getDepthFrame( ImageFrame& frame, DWORD timeout = 0 )
+  {
+    return getFrame( depthStreamHandle_, depthFrame_, depthWidth_, depthHeight_, frame, timeout );
+  }
+
+  HRESULT releaseDepthFrame( ImageFrame& frame )
+  {
+    return releaseFrame( depthStreamHandle_, depthFrame_ );
+  }
+
+  HRESULT getSkeletonFrame( NUI_SKELETON_FRAME& frame )
+  {
+    if ( !useSkeleton_ ) {
+      return E_NUI_FRAME_NO_DATA;
+    }
+
+    return kinect_->NuiSkeletonGetNextFrame( 0, &frame );
+  }
+
+  void getColorPixelCoordinates( LONG depthX, LONG depthY, USHORT depth, LONG& colorX, LONG& colorY )
+  {
+    kinect_->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+      colorResolution_, depthResolution_, 0, depthX, depthY, depth, &colorX, &colorY );
+  }
+
+  NUI_IMAGE_RESOLUTION getColorResolution() const
+  {
+    return colorResolution_;
+  }
+
+  NUI_IMAGE_RESOLUTION getDepthResolution() const
+  {
+    return depthResolution_;
+  }
+
+private:
+
+  void createInstance()
+  {
+    // 接続されているKinectの数を取得する
+    int count = 0;
+    ERROR_CHECK( ::NuiGetSensorCount( &count ) );
+    if ( count == 0 ) {
+      throw std::runtime_error( "Kinect を接続してください" );
+    }
+
+    // 最初のKinectのインスタンスを作成する
+    ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect_ ) );
+
+    // Kinectの状態を取得する
+    HRESULT status = kinect_->NuiStatus();
+    if ( status != S_OK ) {
+      throw std::runtime_error( "Kinect が利用可能ではありません" );
+    }
+  }
+
+  // フレームを取得して、データをロックする
+  HRESULT getFrame( HANDLE streamHandle, NUI_IMAGE_FRAME& nuiFrame, DWORD width, DWORD height,
+    ImageFrame& frame, DWORD timeout )
+  {
+    NUI_IMAGE_FRAME imageFrame = { 0 };
+    HRESULT ret = kinect_->NuiImageStreamGetNextFrame( streamHandle, timeout, &imageFrame );
+    if ( ret != S_OK ) {
+      return ret;
+    }
+
+    NUI_LOCKED_RECT lockedRect = { 0 };
+    imageFrame.pFrameTexture->LockRect( 0, &lockedRect, 0, 0 );
+
+    nuiFrame = imageFrame;
+    frame.timeStamp = imageFrame.liTimeStamp.QuadPart;
+    frame.frameNumber = imageFrame.dwFrameNumber;
+    frame.width = width;
+    frame.height = height;
+    frame.pitch = lockedRect.Pitch;
+    frame.size = lockedRect.size;
+    frame.bits = lockedRect.pBits;
+
+    return S_OK;
+  }
+
+  // データのロックを解除して、フレームを解放する
+  HRESULT releaseFrame( HANDLE streamHandle, NUI_IMAGE_FRAME& nuiFrame )
+  {
+    nuiFrame.pFrameTexture->UnlockRect( 0 );
+    return kinect_->NuiImageStreamReleaseFrame( streamHandle, &nuiFrame );
+  }
+
+private:
+
+  // コピーを禁止する
+  KinectFrameSource( const KinectFrameSource& rhs );
+  KinectFrameSource& operator = ( const KinectFrameSource& rhs );
+
+private:
+
+  INuiSensor* kinect_;
+  HANDLE imageStreamHandle_;
+  HANDLE depthStreamHandle_;
+  HANDLE streamEvent_;
+
+  NUI_IMAGE_RESOLUTION colorResolution_;
+  NUI_IMAGE_RESOLUTION depthResolution_;
+  DWORD colorWidth_;
+  DWORD colorHeight_;
+  DWORD depthWidth_;
+  DWORD depthHeight_;
+  bool useSkeleton_;
+
+  NUI_IMAGE_FRAME colorFrame_;
+  NUI_IMAGE_FRAME depthFrame_;
+};
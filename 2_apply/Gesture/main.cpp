@@ -1,10 +1,35 @@
 #include "KinectControl.h"
+#include "SyntheticFrameSource.h"
 
-void main()
+// 
+//   (Ȃ)           Kinect̃t[g
+//   synthetic        Kinect̑ɍt[g
+//
+//   -sink <o͐>   摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+void main( int argc, char* argv[] )
 {
   try {
+    // ʂւ̕\͕ʂ̃XbhōsAC[v҂Ȃ
+    FrameSinkSelector sinks;
+    AsyncFrameSink async;
+    FrameSink* sink = sinks.select( argc, argv );
+    if ( sink->isVisible() ) {
+      async.open( sink );
+      sink = &async;
+    }
+
+    // t[QƂ KinectControl ɍ쐬
+    SyntheticFrameSource synthetic( CAMERA_RESOLUTION, CAMERA_RESOLUTION );
     KinectControl kinect;
-    kinect.initialize();
+    kinect.setSink( sink );
+
+    if ( (argc > 1) && (std::string( argv[1] ) == "synthetic") ) {
+      kinect.initialize( &synthetic );
+    }
+    else {
+      kinect.initialize();
+    }
+
     kinect.run();
   }
   catch ( std::exception& ex ) {
@@ -14,6 +14,8 @@
     throw std::runtime_error( ss.str().c_str() );			\
   }
 
+#include "FrameSink.h"
+
 const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
 
 // }EX͂𑗐M
@@ -60,12 +62,16 @@ private:
   HANDLE depthStreamHandle;
   HANDLE streamEvent;
 
+  ScreenFrameSink screenSink;
+  FrameSink* sink;
+
   DWORD width;
   DWORD height;
 
 public:
 
   KinectSample()
+    : sink( &screenSink )
   {
   }
 
@@ -103,6 +109,12 @@ public:
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
   }
 
+  // 摜̏o͐w肷(w肵Ȃꍇ͉ʂɕ\)
+  void setSink( FrameSink* frameSink )
+  {
+    sink = frameSink;
+  }
+
   void run()
   {
     cv::Mat image;
@@ -116,12 +128,11 @@ public:
       drawRgbImage( image );
       skeletonMouse();
 
-      // 摜\
-      cv::imshow( "RGBCamera", image );
+      // 摜o͂
+      sink->present( "RGBCamera", image );
 
-      // Î߂̃L[̓`FbNA\̂߂̃EFCg
-      int key = cv::waitKey( 10 );
-      if ( key == 'q' ) {
+      // Ivꂽꍇ͏I
+      if ( !sink->endFrame() ) {
         break;
       }
     }
@@ -159,8 +170,9 @@ private:
       NUI_LOCKED_RECT colorData;
       imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-      // 摜f[^Rs[
-      image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+      // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+      //   傫ȂAÕt[ image ̃obt@g܂킷
+      cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
       // t[f[^
       ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
@@ -261,10 +273,22 @@ private:
   }
 };
 
-void main()
+// 
+//   -sink <o͐>   摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+void main( int argc, char* argv[] )
 {
   try {
+    // ʂւ̕\͕ʂ̃XbhōsAC[v҂Ȃ
+    FrameSinkSelector sinks;
+    AsyncFrameSink async;
+    FrameSink* sink = sinks.select( argc, argv );
+    if ( sink->isVisible() ) {
+      async.open( sink );
+      sink = &async;
+    }
+
     KinectSample kinect;
+    kinect.setSink( sink );
     kinect.initialize();
     kinect.run();
   }
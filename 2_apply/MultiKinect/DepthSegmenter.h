@@ -0,0 +1,409 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// プレイヤー番号のない距離データから、人物の領域を切り出す
+//
+// スケルトンエンジンを使えない Kinect(NUI_IMAGE_TYPE_DEPTH)でも、プレイヤーを塗り分けられるようにする。
+//   1. 画素ごとに背景(床や壁)の距離を覚え、それより手前にある画素を前景にする
+//      背景より遠い距離が続けて見えたときだけ、背景を遠くへ更新する(1フレームだけの外れ値では更新しない)
+//   2. 前景の画素を、距離の差が小さい隣どうしでつないだ行ごとの範囲(ラン)にまとめる
+//   3. 上下の行で重なるランを、Union-Find でつなげて連結成分にする
+//      行の帯ごとに並列につなげてから、帯の境目の行だけをつなげる
+//   4. 大きい順に NUI_SKELETON_COUNT 個までの連結成分に、左から順にプレイヤー番号をつける
+// 結果は、距離データの下位ビットにプレイヤー番号を入れたもの(NuiDepthPixelToPlayerIndex で取り出せる)。
+//
+// 背景が決まるまでの最初の数フレームは、プレイヤーを見つけない。
+// また、起動したときに写っている人物は背景として覚えるので、その人物が動いて後ろの背景が
+// 見えるまでは前景にならない(起動するときは人物が写らないようにするか、あとで resetBackground を呼ぶ)。
+class DepthSegmenter
+{
+public:
+
+  enum
+  {
+    BAND_ROWS = 32,                           // 並列に処理する行の帯の行数
+    MAX_PLAYERS = NUI_SKELETON_COUNT
+  };
+
+  DepthSegmenter()
+    : nearDistance_( 800 )
+    , farDistance_( 4000 )
+    , backgroundMargin_( 150 )
+    , joinDistance_( 50 )
+    , minPixels_( 1000 )
+    , backgroundFrames_( 15 )
+    , width_( 0 )
+    , height_( 0 )
+    , playerCount_( 0 )
+  {
+  }
+
+  // 人物として扱う距離の範囲(mm)
+  void setDistanceRange( int nearDistance, int farDistance )
+  {
+    nearDistance_ = nearDistance;
+    farDistance_ = farDistance;
+  }
+
+  // 人物として扱う、連結成分の最小の画素数
+  void setMinPixels( int minPixels )
+  {
+    minPixels_ = minPixels;
+  }
+
+  // 背景を遠くへ更新するのに、続けて見えなければならないフレーム数
+  void setBackgroundFrames( int backgroundFrames )
+  {
+    backgroundFrames_ = std::max( backgroundFrames, 1 );
+  }
+
+  // 覚えた背景を忘れる
+  void resetBackground()
+  {
+    std::fill( background_.begin(), background_.end(), 0 );
+    std::fill( candidateCount_.begin(), candidateCount_.end(), 0 );
+  }
+
+  // 距離データ(NUI_IMAGE_TYPE_DEPTH)を切り出して、プレイヤー番号を入れた距離データを返す
+  // (返した距離データは、次に呼び出すまで有効)
+  const USHORT* segment( const USHORT* depth, int width, int height )
+  {
+    resize( width, height );
+
+    // 帯ごとに、ランを作って帯の中でつなげる
+    const int bandCount = (int)bands_.size();
+    Concurrency::parallel_for( 0, bandCount, [&]( int band ) {
+      labelBand( depth, band );
+    } );
+
+    // 帯のランを1つの Union-Find にまとめて、帯の境目をつなげる
+    mergeBands( depth );
+
+    // 大きい連結成分にプレイヤー番号をつける
+    assignPlayers();
+
+    // 距離データにプレイヤー番号を書き込む
+    Concurrency::parallel_for( 0, bandCount, [&]( int band ) {
+      writeBand( depth, band );
+    } );
+
+    return &labeled_[0];
+  }
+
+  // 直前の segment で見つけたプレイヤーの数
+  int getPlayerCount() const
+  {
+    return playerCount_;
+  }
+
+private:
+
+  // 1行の中で、前景の画素が続く範囲 [begin, end)
+  struct Run
+  {
+    int y;
+    int begin;
+    int end;
+  };
+
+  // 行の帯ごとのラン(parent は帯の中での番号、offset は全体の番号の先頭)
+  struct Band
+  {
+    int top;
+    int bottom;
+    std::vector< Run > runs;
+    std::vector< int > parent;
+    std::vector< int > rowBegin;    // 行ごとのランの先頭(bottom - top + 1 個)
+    std::vector< BYTE > foreground; // 処理中の行の画素が前景かどうか
+    int offset;
+  };
+
+  void resize( int width, int height )
+  {
+    if ( (width == width_) && (height == height_) ) {
+      return;
+    }
+
+    width_ = width;
+    height_ = height;
+    background_.assign( width * height, 0 );
+    candidate_.assign( width * height, 0 );
+    candidateCount_.assign( width * height, 0 );
+    labeled_.resize( width * height );
+
+    bands_.resize( (height + BAND_ROWS - 1) / BAND_ROWS );
+    for ( size_t b = 0; b < bands_.size(); ++b ) {
+      bands_[b].top = (int)b * BAND_ROWS;
+      bands_[b].bottom = std::min( bands_[b].top + BAND_ROWS, height );
+      bands_[b].foreground.resize( width );
+    }
+  }
+
+  // 1行の背景の距離を更新して、画素ごとに前景かどうかを調べる
+  //   背景より遠い距離は背景の候補にして、同じくらいの距離が backgroundFrames_ フレーム続いたら背景にする
+  //   (画素ごとに1フレームに1回だけ更新するので、ランを作る前に行ごとにまとめて調べる)
+  void updateBackground( const USHORT* row, int y, BYTE* foreground )
+  {
+    const int offset = y * width_;
+    for ( int x = 0; x < width_; ++x ) {
+      foreground[x] = 0;
+
+      int distance = distanceOf( row[x] );
+      if ( distance == 0 ) {
+        continue;
+      }
+
+      const int i = offset + x;
+      if ( distance > background_[i] + backgroundMargin_ ) {
+        if ( (candidateCount_[i] != 0) && (abs( distance - candidate_[i] ) <= backgroundMargin_) ) {
+          candidate_[i] = std::max( candidate_[i], (USHORT)distance );
+          ++candidateCount_[i];
+        }
+        else {
+          candidate_[i] = (USHORT)distance;
+          candidateCount_[i] = 1;
+        }
+
+        if ( candidateCount_[i] >= backgroundFrames_ ) {
+          background_[i] = candidate_[i];
+          candidateCount_[i] = 0;
+        }
+        continue;
+      }
+
+      candidateCount_[i] = 0;
+      foreground[x] = (distance >= nearDistance_) && (distance <= farDistance_) &&
+        (distance + backgroundMargin_ < background_[i]);
+    }
+  }
+
+  static int distanceOf( USHORT pixel )
+  {
+    return pixel >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+  }
+
+  // 帯の中でランを作り、上の行と重なるランをつなげる
+  void labelBand( const USHORT* depth, int b )
+  {
+    Band& band = bands_[b];
+    band.runs.clear();
+    band.parent.clear();
+    band.rowBegin.clear();
+
+    for ( int y = band.top; y < band.bottom; ++y ) {
+      band.rowBegin.push_back( (int)band.runs.size() );
+
+      const USHORT* row = depth + y * width_;
+      BYTE* foreground = &band.foreground[0];
+      updateBackground( row, y, foreground );
+
+      int x = 0;
+      while ( x < width_ ) {
+        if ( !foreground[x] ) {
+          ++x;
+          continue;
+        }
+
+        // 距離が大きく変わるところで、ランを分ける
+        Run run = { y, x, x + 1 };
+        for ( x = x + 1; x < width_; ++x ) {
+          if ( !foreground[x] ||
+            (abs( distanceOf( row[x] ) - distanceOf( row[x - 1] ) ) >= joinDistance_) ) {
+            break;
+          }
+          run.end = x + 1;
+        }
+
+        int index = (int)band.runs.size();
+        band.runs.push_back( run );
+        band.parent.push_back( index );
+
+        if ( y > band.top ) {
+          joinAbove( depth, band.runs, band.parent, band.rowBegin[y - band.top - 1], band.rowBegin[y - band.top], index );
+        }
+      }
+    }
+
+    band.rowBegin.push_back( (int)band.runs.size() );
+  }
+
+  // runs[index] と、上の行のランのうち [aboveBegin, aboveEnd) で重なってつながるものをつなげる
+  void joinAbove( const USHORT* depth, const std::vector< Run >& runs, std::vector< int >& parent,
+    int aboveBegin, int aboveEnd, int index )
+  {
+    const Run& run = runs[index];
+    for ( int j = aboveBegin; j < aboveEnd; ++j ) {
+      const Run& above = runs[j];
+      if ( above.end <= run.begin ) {
+        continue;
+      }
+      if ( above.begin >= run.end ) {
+        break;
+      }
+
+      if ( isConnected( depth, run, above ) ) {
+        unite( parent, index, j );
+      }
+    }
+  }
+
+  // 上下に重なる列のどこかで、距離の差が小さければつながっている
+  bool isConnected( const USHORT* depth, const Run& run, const Run& above ) const
+  {
+    const USHORT* row = depth + run.y * width_;
+    const USHORT* rowAbove = depth + above.y * width_;
+    for ( int x = std::max( run.begin, above.begin ); x < std::min( run.end, above.end ); ++x ) {
+      if ( abs( distanceOf( row[x] ) - distanceOf( rowAbove[x] ) ) < joinDistance_ ) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static int find( std::vector< int >& parent, int i )
+  {
+    while ( parent[i] != i ) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // 番号の小さいほうを根にする
+  static void unite( std::vector< int >& parent, int a, int b )
+  {
+    a = find( parent, a );
+    b = find( parent, b );
+    if ( a < b ) {
+      parent[b] = a;
+    }
+    else if ( b < a ) {
+      parent[a] = b;
+    }
+  }
+
+  // 帯ごとの Union-Find を1つにまとめて、帯の境目の行をつなげる
+  void mergeBands( const USHORT* depth )
+  {
+    int total = 0;
+    for ( size_t b = 0; b < bands_.size(); ++b ) {
+      bands_[b].offset = total;
+      total += (int)bands_[b].runs.size();
+    }
+
+    runs_.resize( total );
+    parent_.resize( total );
+    for ( size_t b = 0; b < bands_.size(); ++b ) {
+      const Band& band = bands_[b];
+      for ( size_t k = 0; k < band.runs.size(); ++k ) {
+        runs_[band.offset + k] = band.runs[k];
+        parent_[band.offset + k] = band.offset + band.parent[k];
+      }
+    }
+
+    for ( size_t b = 1; b < bands_.size(); ++b ) {
+      const Band& above = bands_[b - 1];
+      const Band& band = bands_[b];
+      int aboveBegin = above.offset + above.rowBegin[above.bottom - above.top - 1];
+      int aboveEnd = above.offset + above.rowBegin[above.bottom - above.top];
+      for ( int i = band.offset + band.rowBegin[0]; i < band.offset + band.rowBegin[1]; ++i ) {
+        joinAbove( depth, runs_, parent_, aboveBegin, aboveEnd, i );
+      }
+    }
+  }
+
+  // 連結成分の大きさを数えて、プレイヤー番号をつける
+  void assignPlayers()
+  {
+    const int total = (int)runs_.size();
+    pixels_.assign( total, 0 );
+    sumX_.assign( total, 0 );
+    for ( int i = 0; i < total; ++i ) {
+      int root = find( parent_, i );
+      int length = runs_[i].end - runs_[i].begin;
+      pixels_[root] += length;
+      sumX_[root] += (LONGLONG)(runs_[i].begin + runs_[i].end - 1) * length / 2;
+    }
+
+    // 大きい順に MAX_PLAYERS 個までを選ぶ
+    components_.clear();
+    for ( int i = 0; i < total; ++i ) {
+      if ( (parent_[i] == i) && (pixels_[i] >= minPixels_) ) {
+        components_.push_back( i );
+      }
+    }
+    std::sort( components_.begin(), components_.end(), [&]( int a, int b ) { return pixels_[a] > pixels_[b]; } );
+    if ( components_.size() > MAX_PLAYERS ) {
+      components_.resize( MAX_PLAYERS );
+    }
+
+    // フレーム間で番号が入れ替わりにくいように、重心の左から順に番号をつける
+    std::sort( components_.begin(), components_.end(), [&]( int a, int b ) {
+      return sumX_[a] * pixels_[b] < sumX_[b] * pixels_[a];
+    } );
+
+    playerOf_.assign( total, 0 );
+    for ( size_t c = 0; c < components_.size(); ++c ) {
+      playerOf_[components_[c]] = (BYTE)(c + 1);
+    }
+    for ( int i = 0; i < total; ++i ) {
+      playerOf_[i] = playerOf_[find( parent_, i )];
+    }
+    playerCount_ = (int)components_.size();
+  }
+
+  // 帯の距離データを写して、プレイヤーのいるランにプレイヤー番号を書き込む
+  void writeBand( const USHORT* depth, int b )
+  {
+    const Band& band = bands_[b];
+    const USHORT mask = (USHORT)~NUI_IMAGE_PLAYER_INDEX_MASK;
+    for ( int i = band.top * width_; i < band.bottom * width_; ++i ) {
+      labeled_[i] = depth[i] & mask;
+    }
+
+    for ( size_t k = 0; k < band.runs.size(); ++k ) {
+      BYTE player = playerOf_[band.offset + k];
+      if ( player == 0 ) {
+        continue;
+      }
+
+      const Run& run = band.runs[k];
+      USHORT* row = &labeled_[run.y * width_];
+      for ( int x = run.begin; x < run.end; ++x ) {
+        row[x] |= player;
+      }
+    }
+  }
+
+  int nearDistance_;
+  int farDistance_;
+  int backgroundMargin_;
+  int joinDistance_;
+  int minPixels_;
+  int backgroundFrames_;
+
+  int width_;
+  int height_;
+  int playerCount_;
+
+  std::vector< USHORT > background_;    // 画素ごとの背景の距離
+  std::vector< USHORT > candidate_;     // 背景より遠くに見えている距離(背景の候補)
+  std::vector< int > candidateCount_;   // 背景の候補が続けて見えたフレーム数
+  std::vector< USHORT > labeled_;       // プレイヤー番号を入れた距離データ
+
+  std::vector< Band > bands_;
+  std::vector< Run > runs_;
+  std::vector< int > parent_;
+  std::vector< int > pixels_;
+  std::vector< LONGLONG > sumX_;
+  std::vector< int > components_;
+  std::vector< BYTE > playerOf_;
+};
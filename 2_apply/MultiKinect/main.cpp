@@ -16,6 +16,9 @@
   throw std::runtime_error( ss.str().c_str() );			\
   }
 
+#include "DepthSegmenter.h"
+#include "FrameSink.h"
+
 const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
 
 class KinectSample
@@ -32,11 +35,18 @@ private:
   DWORD width;
   DWORD height;
 
+  // vC[ԍ擾łȂꍇɁAl؂o
+  DepthSegmenter segmenter;
+
+  // 摜̏o͐(KinectƂ̃XbhĝŁAKinectƂɕʂ̏o͐ɂ)
+  FrameSink* sink;
+
 public:
 
   KinectSample()
     : kinect( 0 )
     , hasSkeletonEngine( false )
+    , sink( 0 )
   {
   }
 
@@ -106,6 +116,12 @@ public:
     ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
   }
 
+  // 摜̏o͐w肷(run ̑OɎw肷)
+  void setSink( FrameSink* frameSink )
+  {
+    sink = frameSink;
+  }
+
   void run()
   {
     cv::Mat image;
@@ -130,16 +146,15 @@ public:
           drawSkeleton( image );
         }
 
-        // 摜\
-        cv::imshow( ss.str(), image );
+        // 摜o͂
+        sink->present( ss.str(), image );
       }
       catch ( std::exception& ex ) {
         std::cout << ex.what() << std::endl;
       }
 
-      // Î߂̃L[̓`FbNA\̂߂̃EFCg
-      int key = cv::waitKey( 10 );
-      if ( key == 'q' ) {
+      // Ivꂽꍇ͏I
+      if ( !sink->endFrame() ) {
         break;
       }
     }
@@ -188,8 +203,9 @@ private:
     NUI_LOCKED_RECT colorData;
     imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
 
-    // 摜f[^Rs[
-    image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+    // 摜f[^Rs[(t[̃obt@SDKėp̂ŁAQƂɃRs[)
+    //   傫ȂAÕt[ image ̃obt@g܂킷
+    cv::Mat( height, width, CV_8UC4, colorData.pBits ).copyTo( image );
 
     // t[f[^
     ERROR_CHECK( kinect->NuiImageStreamReleaseFrame(
@@ -207,7 +223,11 @@ private:
     NUI_LOCKED_RECT depthData = { 0 };
     depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
 
-    USHORT* depth = (USHORT*)depthData.pBits;
+    // XPgGWpłȂꍇ́Al؂oăvC[ԍ
+    const USHORT* depth = (const USHORT*)depthData.pBits;
+    if ( !hasSkeletonEngine ) {
+      depth = segmenter.segment( depth, width, height );
+    }
     for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
       USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
       USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
@@ -301,7 +321,10 @@ DWORD WINAPI ThreadEntry( LPVOID lpThreadParameter )
   return 0;
 }
 
-void main()
+// 
+//   -sink <o͐>   摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+//                    摜̎ނ̖O Kinect ̔ԍ̂ŁAKinectƂɕʂ̃t@C⋤LɂȂ
+void main( int argc, char* argv[] )
 {
   try {
     int count = 0;
@@ -310,10 +333,17 @@ void main()
       throw std::runtime_error( "Kinect ڑĂ" );
     }
 
+    // o͐́AKinectƂ̃XbhŎĝŁAKinectƂɍ쐬
+    std::vector< FrameSinkSelector > sinks( count );
     std::vector< KinectSample > kinects( count );
     std::vector< HANDLE > hThread( count );
 
     for ( int i = 0; i < kinects.size(); ++i )  {
+      // o͐̎w argv 菜̂ŁAKinectƂɈRs[ēn
+      int sinkArgc = argc;
+      std::vector< char* > sinkArgv( argv, argv + argc );
+      kinects[i].setSink( sinks[i].select( sinkArgc, &sinkArgv[0] ) );
+
       DWORD id = 0;
       kinects[i].initialize( i );
       hThread[i] = ::CreateThread( 0, 0, ThreadEntry, &kinects[i], 0, &id );
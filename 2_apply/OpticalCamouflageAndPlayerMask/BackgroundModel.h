@@ -0,0 +1,182 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// 光学迷彩の背景画像を、少しずつ現在のフレームに近づける(移動中央値による背景モデル)
+//
+// 画素の各チャンネルを、フレームごとに現在の値へ最大 step だけ近づける。
+// 値の大小だけで動かすので、ときどき前を横切るものには引きずられず、照明の変化や動かした物には追従する。
+// プレイヤーのいる部分は更新しないように、RGBカメラの画像を 8x8 画素のブロックに分けて、
+// プレイヤーの画素が入ったブロックとその周り(位置合わせの誤差の分)を飛ばす。
+// 更新は、SSE2が使える場合は16バイト(4画素)ずつ行う。
+class BackgroundModel
+{
+public:
+
+  enum
+  {
+    BLOCK_SHIFT = 3,
+    BLOCK_SIZE = 1 << BLOCK_SHIFT
+  };
+
+  BackgroundModel()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , step_( 1 )
+    , blockCols_( 0 )
+    , blockRows_( 0 )
+  {
+  }
+
+  // 引数から、1フレームで背景を近づける量を取り出す(-adapt <量>、0は最初のフレームのまま)
+  // 指定がない場合は -1 を返す
+  static int selectStep( int& argc, char* argv[] )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-adapt" ) {
+        int step = atoi( argv[i + 1] );
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return step;
+      }
+    }
+
+    return -1;
+  }
+
+  // 1フレームで背景を近づける量(0〜255、0は更新しない)
+  void setStep( int step )
+  {
+    step_ = std::max( 0, std::min( step, 255 ) );
+  }
+
+  int getStep() const
+  {
+    return step_;
+  }
+
+  bool empty() const
+  {
+    return image_.empty();
+  }
+
+  // 最初のフレーム(CV_8UC4)を背景にする
+  void initialize( const cv::Mat& frame )
+  {
+    frame.copyTo( image_ );
+
+    blockCols_ = (frame.cols + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+    blockRows_ = (frame.rows + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+    covered_.assign( blockCols_ * blockRows_, 0 );
+    skipped_.assign( blockCols_ * blockRows_, 0 );
+  }
+
+  // 背景画像(CV_8UC4)
+  const cv::Mat& getImage() const
+  {
+    return image_;
+  }
+
+  // プレイヤーのいる部分の記録を消す(フレームの最初に呼ぶ)
+  void clearCoverage()
+  {
+    std::fill( covered_.begin(), covered_.end(), 0 );
+  }
+
+  // プレイヤーのいるRGBカメラの画素を記録する(1を書き込むだけなので、複数のスレッドから呼んでもよい)
+  void cover( int x, int y )
+  {
+    covered_[(y >> BLOCK_SHIFT) * blockCols_ + (x >> BLOCK_SHIFT)] = 1;
+  }
+
+  // プレイヤーのいない部分の背景を、現在のフレーム(CV_8UC4)に近づける
+  void update( const cv::Mat& frame )
+  {
+    if ( (step_ == 0) || empty() ) {
+      return;
+    }
+
+    // プレイヤーのいるブロックを、周りの1ブロック分広げる
+    for ( int by = 0; by < blockRows_; ++by ) {
+      for ( int bx = 0; bx < blockCols_; ++bx ) {
+        BYTE skip = 0;
+        for ( int y = std::max( by - 1, 0 ); y <= std::min( by + 1, blockRows_ - 1 ); ++y ) {
+          for ( int x = std::max( bx - 1, 0 ); x <= std::min( bx + 1, blockCols_ - 1 ); ++x ) {
+            skip |= covered_[y * blockCols_ + x];
+          }
+        }
+        skipped_[by * blockCols_ + bx] = skip;
+      }
+    }
+
+    // 飛ばさないブロックが続く範囲ごとに、まとめて近づける
+    for ( int y = 0; y < image_.rows; ++y ) {
+      const BYTE* skip = &skipped_[(y >> BLOCK_SHIFT) * blockCols_];
+      const BYTE* current = frame.ptr< BYTE >( y );
+      BYTE* background = image_.ptr< BYTE >( y );
+
+      int bx = 0;
+      while ( bx < blockCols_ ) {
+        if ( skip[bx] ) {
+          ++bx;
+          continue;
+        }
+
+        int begin = bx;
+        while ( (bx < blockCols_) && !skip[bx] ) {
+          ++bx;
+        }
+
+        int left = (begin << BLOCK_SHIFT) * 4;
+        int right = std::min( bx << BLOCK_SHIFT, image_.cols ) * 4;
+        approach( current + left, background + left, right - left );
+      }
+    }
+  }
+
+private:
+
+  // count バイトを、current に最大 step_ だけ近づける
+  void approach( const BYTE* current, BYTE* background, int count ) const
+  {
+    int i = 0;
+    if ( isSse2_ ) {
+      const __m128i step = _mm_set1_epi8( (char)step_ );
+      for ( ; i + 16 <= count; i += 16 ) {
+        __m128i c = _mm_loadu_si128( (const __m128i*)(current + i) );
+        __m128i b = _mm_loadu_si128( (const __m128i*)(background + i) );
+
+        // 飽和減算で差を求めるので、up と down のどちらかは0になる
+        __m128i up = _mm_min_epu8( _mm_subs_epu8( c, b ), step );
+        __m128i down = _mm_min_epu8( _mm_subs_epu8( b, c ), step );
+        b = _mm_subs_epu8( _mm_adds_epu8( b, up ), down );
+        _mm_storeu_si128( (__m128i*)(background + i), b );
+      }
+    }
+
+    for ( ; i < count; ++i ) {
+      int difference = current[i] - background[i];
+      background[i] = (BYTE)(background[i] + std::max( -step_, std::min( difference, step_ ) ));
+    }
+  }
+
+  bool isSse2_;
+  int step_;
+
+  cv::Mat image_;
+
+  // ブロックごとの、プレイヤーがいるかどうか(covered_)と、更新を飛ばすかどうか(skipped_)
+  int blockCols_;
+  int blockRows_;
+  std::vector< BYTE > covered_;
+  std::vector< BYTE > skipped_;
+};
@@ -1,14 +1,14 @@
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
 // NuiApi.h̑OWindows.hCN[h
 #include <Windows.h>
 #include <NuiApi.h>
+#include <ppl.h>
 
 #include <opencv2/opencv.hpp>
 
-
-
 #define ERROR_CHECK( ret )  \
   if ( ret != S_OK ) {    \
     std::stringstream ss;	\
@@ -16,239 +16,448 @@
     throw std::runtime_error( ss.str().c_str() );			\
   }
 
-const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
+#include "BackgroundModel.h"
+#include "DepthColorRegistration.h"
+#include "DepthUnpack.h"
+#include "FrameResolution.h"
+#include "FrameSink.h"
+#include "GuidedMatte.h"
+#include "KernelBenchmark.h"
+#include "KinectFrameSource.h"
+#include "PlayerRuns.h"
+#include "SyntheticFrameSource.h"
+
+// ɏAJ̍s̑т̍s
+const int BAND_ROWS = 16;
 
 class KinectSample
 {
 private:
 
-  INuiSensor* kinect;
-  HANDLE imageStreamHandle;
-  HANDLE depthStreamHandle;
-  HANDLE streamEvent;
+  KinectFrameSource kinect;
+  FrameSource* source;
+  ScreenFrameSink screen;
+  FrameSink* sink;
+
+  // J̉ʃTCY
+  DWORD depthWidth;
+  DWORD depthHeight;
+
+  DepthColorRegistration registration;
+  DepthUnpacker depthUnpacker;
+  PlayerRuns playerRuns;
 
-  DWORD width;
-  DWORD height;
+  // 𑜓xɍ킹đI񂾉H̏
+  void (KinectSample::*compositeKernel)( const FrameHandle& imageFrame );
 
-  cv::Mat background;
-  bool isBackground;
+  BackgroundModel backgroundModel;
+  cv::Mat camouflageImage;
+  cv::Mat maskImage;
+
+  // }XN̗֊sARGBJ̉摜ɍ킹
+  GuidedMatte matte;
+  cv::Mat coarseMask;     // Je}XN
+  cv::Mat alpha;          // x(playerRoi ̑傫)
+
+  // vC[ʂĂRGBJ͈̔(x߂ꍇ́AxL镪܂߂)
+  std::vector< PlayerBounds > bandBounds;   // тƂ͈̔
+  cv::Rect playerRoi;
+  cv::Rect previousRoi;   // Õt[ŁA}XNɏ񂾔͈
 
 public:
 
   KinectSample()
-    :isBackground( false )
+    : source( 0 )
+    , sink( &screen )
+    , compositeKernel( 0 )
   {
   }
 
-  ~KinectSample()
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
   {
-    // I
-    if ( kinect != 0 ) {
-      kinect->NuiShutdown();
-      kinect->Release();
-    }
+    // Kinect̐ݒ
+    kinect.initialize( colorResolution, depthResolution );
+
+    initialize( &kinect );
   }
 
-  void initialize()
+  // t[̎擾w肵ď
+  void initialize( FrameSource* frameSource )
   {
-    createInstance();
-
-    // Kinect̐ݒ
-    ERROR_CHECK( kinect->NuiInitialize(
-      NUI_INITIALIZE_FLAG_USES_COLOR |
-      NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX ) );
+    source = frameSource;
 
-    // RGBJ
-    ERROR_CHECK( kinect->NuiImageStreamOpen(
-      NUI_IMAGE_TYPE_COLOR, CAMERA_RESOLUTION,
-      0, 2, 0, &imageStreamHandle ) );
-
-    // J
-    ERROR_CHECK( kinect->NuiImageStreamOpen(
-      NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION,
-      0, 2, 0, &depthStreamHandle ) );
+    // w肵𑜓x́AʃTCY擾
+    ::NuiImageResolutionToSize( source->getDepthResolution(), depthWidth, depthHeight );
 
-	  // t[XVCxg̃nh쐬
-    streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
-    ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+    // JRGBJւ̍Wϊe[u쐬
+    registration.initialize( *source, source->getColorResolution(), source->getDepthResolution() );
 
-    // w肵𑜓x́AʃTCY擾
-    ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+    // 𑜓x̑gݍ킹ɍ킹H̏I
+    KernelSelector selector = { this };
+    dispatchFrameSize( source->getDepthResolution(), source->getColorResolution(), selector );
   }
 
-  void run()
+  // 摜̏o͐w肷(w肵Ȃꍇ͉ʂɕ\)
+  void setSink( FrameSink* frameSink )
   {
-    // C[v
-    while ( 1 ) {
-      // f[^̍XV҂
-      DWORD ret = ::WaitForSingleObject( streamEvent, INFINITE );
-      ::ResetEvent( streamEvent );
-
-      // RGBJ̃t[f[^擾
-      NUI_IMAGE_FRAME imageFrame = { 0 };
-      ERROR_CHECK( kinect->NuiImageStreamGetNextFrame(
-        imageStreamHandle, INFINITE, &imageFrame ) );
-
-      NUI_IMAGE_FRAME depthFrame = { 0 };
-      ERROR_CHECK( kinect->NuiImageStreamGetNextFrame(
-        depthStreamHandle, 0, &depthFrame ) );
-
-      // ꂼ̉Hs
-      cv::Mat image1 = opticalCamouflage( imageFrame, depthFrame );
-      cv::Mat image2 = playerMask( imageFrame, depthFrame );
-
-      // 摜\
-      cv::imshow( "OpticalCamouflage", image1 );
-      cv::imshow( "PlayerMask", image2 );
-
-      // t[f[^
-      ERROR_CHECK( kinect->NuiImageStreamReleaseFrame(
-        depthStreamHandle, &depthFrame ) );
-      ERROR_CHECK( kinect->NuiImageStreamReleaseFrame(
-        imageStreamHandle, &imageFrame ) );
-
-      // Î߂̃L[̓`FbNA\̂߂̃EFCg
-      int key = cv::waitKey( 10 );
-      if ( key == 'q' ) {
-        break;
-      }
-    }
+    sink = frameSink;
   }
 
-private:
-
-  // w
-  cv::Mat opticalCamouflage( NUI_IMAGE_FRAME& imageFrame, NUI_IMAGE_FRAME& depthFrame )
+  // 1t[Ŕwi߂Â(0͍ŏ̃t[̂܂)
+  void setBackgroundStep( int step )
   {
-    // 摜f[^擾
-    NUI_LOCKED_RECT colorData;
-    imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
-
-    // 摜f[^Rs[
-    cv::Mat image = cv::Mat( height, width, CV_8UC4, colorData.pBits ).clone();
-
-    // wi擾ĂȂꍇAwi摜ɂ
-    if ( !isBackground ) {
-      isBackground = true;
-      background = image.clone();
-    }
+    backgroundModel.setStep( step );
+  }
 
-    // 摜f[^
-    imageFrame.pFrameTexture->UnlockRect( 0 );
+  // }XN̗֊s킹tB^̔a(0͑e}XN̂܂)
+  void setMatteRadius( int radius )
+  {
+    matte.setRadius( radius );
+  }
 
+  void run()
+  {
+    // C[v
+    while ( source->waitFrame() ) {
+      // RGBJ̃t[f[^擾
+      FrameHandle imageFrame;
+      ERROR_CHECK( source->acquireColorFrame( imageFrame, INFINITE ) );
 
-    // f[^擾
-    NUI_LOCKED_RECT depthData = { 0 };
-    depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
+      FrameHandle depthFrame;
+      ERROR_CHECK( source->acquireDepthFrame( depthFrame ) );
 
-    USHORT* depth = (USHORT*)depthData.pBits;
-    for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
-      USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
+      // f[^AƃvC[̉摜ɕāAvC[͈̂͂܂Ƃ߂(̉HŎg)
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight );
+      playerRuns.build( depthUnpacker.getPlayer() );
 
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX = depthX;
-      LONG colorY = depthY;
+      // wʂƃvC[̃}XNA܂Ƃ߂č
+      (this->*compositeKernel)( imageFrame );
 
-      // J̍WARGBJ̍Wɕϊ
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-        CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-        0, depthX , depthY, depth[i], &colorX, &colorY );
+      // 摜o͂
+      sink->present( "OpticalCamouflage", camouflageImage );
+      sink->present( "PlayerMask", maskImage );
 
-      // ϊꂽW𗘗pāA\摜̃sNZf[^擾
-      int index = ((colorY * width) + colorX) * 4;
-      UCHAR* data = &image.data[index];
-      UCHAR* back = &background.data[index];
+      // t[f[^́AŌ̎QƂȂȂ_ŉ
 
-      // vC[镔`悷
-      if ( player != 0 ) {
-        data[0] = back[0];
-        data[1] = back[1];
-        data[2] = back[2];
+      // Ivꂽꍇ͏I
+      if ( !sink->endFrame() ) {
+        break;
       }
     }
-
-    return image;
   }
 
-  // vC[̃}XN
-  cv::Mat playerMask( NUI_IMAGE_FRAME& imageFrame, NUI_IMAGE_FRAME& depthFrame )
+  // ꂼ̉H̏Ԃv(\͂Ȃ)
+  void benchmark( KernelBenchmark& kernelBenchmark )
   {
-    // \pobt@쐬
-    cv::Mat image = cv::Mat( height, width, CV_8UC4, cv::Scalar( 255, 255, 255, 0 ) );
+    FrameHandle imageFrame;
+    FrameHandle depthFrame;
 
-    // 摜f[^擾
-    NUI_LOCKED_RECT colorData;
-    imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
+    // 񎟂̃t[擾(擾̎Ԃ͊܂߂Ȃ)
+    auto nextFrame = [&]( int i ) {
+      if ( !source->waitFrame() ) {
+        throw std::runtime_error( "vɎgt[܂" );
+      }
 
-    // 摜f[^Rs[
-    cv::Mat frame( height, width, CV_8UC4, colorData.pBits );
+      ERROR_CHECK( source->acquireColorFrame( imageFrame, INFINITE ) );
+      ERROR_CHECK( source->acquireDepthFrame( depthFrame ) );
+    };
+
+    kernelBenchmark.printHeader( std::cout, "OpticalCamouflageAndPlayerMask" );
+
+    kernelBenchmark.run( "unpack", nextFrame, [&]( int i ) {
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight );
+    } );
+
+    // H́AƃvC[̉摜g
+    auto nextUnpackedFrame = [&]( int i ) {
+      nextFrame( i );
+      depthUnpacker.unpack( (USHORT*)depthFrame.bits(), depthWidth, depthHeight );
+    };
+
+    kernelBenchmark.run( "playerRuns", nextUnpackedFrame, [&]( int i ) {
+      playerRuns.build( depthUnpacker.getPlayer() );
+    } );
+
+    // H́AvC[͈̂͂ǂ
+    auto nextRunsFrame = [&]( int i ) {
+      nextUnpackedFrame( i );
+      playerRuns.build( depthUnpacker.getPlayer() );
+    };
+
+    kernelBenchmark.run( "composite", nextRunsFrame, [&]( int i ) {
+      (this->*compositeKernel)( imageFrame );
+    } );
+
+    // wi̍XV́AHŃvC[̂镔L^Ăs
+    kernelBenchmark.run( "backgroundModel",
+      [&]( int i ) {
+        nextRunsFrame( i );
+        (this->*compositeKernel)( imageFrame );
+      },
+      [&]( int i ) {
+        backgroundModel.update( cv::Mat( camouflageImage.size(), CV_8UC4, imageFrame.bits() ) );
+      } );
+
+    // x́AHōe}XN狁߂
+    if ( matte.isEnabled() ) {
+      kernelBenchmark.run( "matte",
+        [&]( int i ) {
+          nextRunsFrame( i );
+          (this->*compositeKernel)( imageFrame );
+        },
+        [&]( int i ) {
+          if ( playerRoi.area() > 0 ) {
+            cv::Mat frame( camouflageImage.size(), CV_8UC4, imageFrame.bits() );
+            matte.refine( cv::Mat( frame, playerRoi ), cv::Mat( coarseMask, playerRoi ), alpha );
+          }
+        } );
+    }
+  }
 
-    // 摜f[^
-    imageFrame.pFrameTexture->UnlockRect( 0 );
+private:
 
+  // 𑜓x̑gݍ킹܂Ȃ傫̏I
+  struct KernelSelector
+  {
+    KinectSample* owner;
 
-    // f[^擾
-    NUI_LOCKED_RECT depthData = { 0 };
-    depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
+    template< typename DepthSize, typename ColorSize >
+    void operator()( DepthSize, ColorSize )
+    {
+      owner->compositeKernel = &KinectSample::composite< DepthSize, ColorSize >;
+    }
+  };
+
+  // wʂƃvC[̃}XNA1̑ō(ʂ camouflageImage  maskImage)
+  template< typename DepthSize, typename ColorSize >
+  void composite( const FrameHandle& imageFrame )
+  {
+    // 摜f[^Rs[(̂ŁA\p̃obt@g܂킷)
+    cv::Mat frame( ColorSize::HEIGHT, ColorSize::WIDTH, CV_8UC4, imageFrame.bits() );
+    frame.copyTo( camouflageImage );
+
+    // }XN̕\pobt@g܂킷(vC[̂Ȃ͔̓ɂ)
+    //   ̂́AÕt[ŏ񂾔͈͂ł悢
+    if ( (maskImage.cols != ColorSize::WIDTH) || (maskImage.rows != ColorSize::HEIGHT) ) {
+      maskImage.create( ColorSize::HEIGHT, ColorSize::WIDTH, CV_8UC4 );
+      maskImage.setTo( cv::Scalar( 255, 255, 255, 0 ) );
+      coarseMask.release();
+      previousRoi = cv::Rect();
+    }
+    else if ( previousRoi.area() > 0 ) {
+      cv::Mat( maskImage, previousRoi ).setTo( cv::Scalar( 255, 255, 255, 0 ) );
+    }
 
-    USHORT* depth = (USHORT*)depthData.pBits;
-    for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
-      USHORT player = ::NuiDepthPixelToPlayerIndex( depth[i] );
+    // wi擾ĂȂꍇAŏ̃t[wiɂ
+    if ( backgroundModel.empty() ) {
+      backgroundModel.initialize( frame );
+    }
+    backgroundModel.clearCoverage();
 
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX = depthX;
-      LONG colorY = depthY;
+    // x߂ꍇ́AvC[̂镔e}XNɋL^
+    if ( matte.isEnabled() ) {
+      if ( coarseMask.empty() ) {
+        coarseMask.create( ColorSize::HEIGHT, ColorSize::WIDTH, CV_8UC1 );
+        coarseMask.setTo( cv::Scalar( 0 ) );
+      }
+      else if ( previousRoi.area() > 0 ) {
+        cv::Mat( coarseMask, previousRoi ).setTo( cv::Scalar( 0 ) );
+      }
+    }
 
-      // J̍WARGBJ̍Wɕϊ
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
-        CAMERA_RESOLUTION, CAMERA_RESOLUTION,
-        0, depthX , depthY, depth[i], &colorX, &colorY );
+    // J̍s̑тƂɁAɏ
+    const int bandCount = (DepthSize::HEIGHT + BAND_ROWS - 1) / BAND_ROWS;
+    bandBounds.resize( bandCount );
+    Concurrency::parallel_for( 0, bandCount, [&]( int band ) {
+      compositeBand< DepthSize, ColorSize >( frame, band );
+    } );
+
+    // тƂ͈̔͂܂Ƃ߂
+    PlayerBounds bounds = { ColorSize::WIDTH, ColorSize::HEIGHT, 0, 0, 0 };
+    for ( int band = 0; band < bandCount; ++band ) {
+      bounds.left = std::min( bounds.left, bandBounds[band].left );
+      bounds.top = std::min( bounds.top, bandBounds[band].top );
+      bounds.right = std::max( bounds.right, bandBounds[band].right );
+      bounds.bottom = std::max( bounds.bottom, bandBounds[band].bottom );
+      bounds.pixels += bandBounds[band].pixels;
+    }
 
-      // ϊꂽW𗘗pāA\摜̃sNZf[^擾
-      int index = ((colorY * width) + colorX) * 4;
-      UCHAR* data = &image.data[index];
-      UCHAR* rgb = &frame.data[index];
+    playerRoi = cv::Rect();
+    if ( bounds.pixels > 0 ) {
+      const int reach = matte.isEnabled() ? matte.getReach() : 0;
+      const int left = std::max( bounds.left - reach, 0 );
+      const int top = std::max( bounds.top - reach, 0 );
+      const int right = std::min( bounds.right + reach, (int)ColorSize::WIDTH );
+      const int bottom = std::min( bounds.bottom + reach, (int)ColorSize::HEIGHT );
+      playerRoi = cv::Rect( left, top, right - left, bottom - top );
+    }
+    previousRoi = playerRoi;
 
-      // vC[镔̂݁A`悷
-      if ( player != 0 ) {
-          data[0] = rgb[0];
-          data[1] = rgb[1];
-          data[2] = rgb[2];
-      }
+    // e}XN𓧖xɂāAxɍ킹ĕ`悷(vC[͈̂͂)
+    if ( matte.isEnabled() && (playerRoi.area() > 0) ) {
+      matte.refine( cv::Mat( frame, playerRoi ), cv::Mat( coarseMask, playerRoi ), alpha );
+      blendMatte( frame );
     }
 
-    return image;
+    // vC[̂Ȃ̔wiÃ݂t[ɋ߂Â
+    backgroundModel.update( frame );
   }
 
-  void createInstance()
+  // J band Ԗڂ̑тɂAvC[͈̂͂
+  //   ʂ̑т瓯RGBJ̉fɏނƂ邪Aޒl͓ɂȂ
+  //   RGBJ͈̔͂ bandBounds[band] ɋL^
+  template< typename DepthSize, typename ColorSize >
+  void compositeBand( const cv::Mat& frame, int band )
   {
-    // ڑĂKinect̐擾
-    int count = 0;
-    ERROR_CHECK( ::NuiGetSensorCount( &count ) );
-    if ( count == 0 ) {
-      throw std::runtime_error( "Kinect ڑĂ" );
+    const int firstRow = band * BAND_ROWS;
+    const int lastRow = std::min( firstRow + BAND_ROWS, (int)DepthSize::HEIGHT ) - 1;
+
+    // Ẳ摜ƁAvC[͈̂͂g
+    const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+    const UCHAR* background = backgroundModel.getImage().data;
+    const std::vector< PlayerRun >& runs = playerRuns.getRuns();
+    const bool isMatte = matte.isEnabled();
+    PlayerBounds bounds = { ColorSize::WIDTH, ColorSize::HEIGHT, 0, 0, 0 };
+    for ( int r = playerRuns.getRowBegin( firstRow ); r < playerRuns.getRowEnd( lastRow ); ++r ) {
+      int i = runs[r].y * DepthSize::WIDTH + runs[r].begin;
+      int end = runs[r].y * DepthSize::WIDTH + runs[r].end;
+      for ( ; i < end; ++i ) {
+        LONG colorX = 0;
+        LONG colorY = 0;
+
+        // J̍WARGBJ̍Wɕϊ(ϊe[uQƂ)
+        registration.getColorPixelFromDistance( i, distance[i], colorX, colorY );
+        if ( (colorX < 0) || (colorX >= ColorSize::WIDTH) || (colorY < 0) || (colorY >= ColorSize::HEIGHT) ) {
+          continue;
+        }
+
+        // vC[̂镔́AwiXVȂ
+        backgroundModel.cover( colorX, colorY );
+
+        bounds.left = std::min( bounds.left, (int)colorX );
+        bounds.top = std::min( bounds.top, (int)colorY );
+        bounds.right = std::max( bounds.right, (int)colorX + 1 );
+        bounds.bottom = std::max( bounds.bottom, (int)colorY + 1 );
+        ++bounds.pixels;
+
+        // x߂ꍇ́AƂœxɍ킹ĕ`悷
+        if ( isMatte ) {
+          coarseMask.data[(colorY * ColorSize::WIDTH) + colorX] = 255;
+          continue;
+        }
+
+        // ϊꂽW𗘗pāAe摜̃sNZf[^擾
+        int index = ((colorY * ColorSize::WIDTH) + colorX) * 4;
+        const UCHAR* rgb = &frame.data[index];
+        const UCHAR* back = &background[index];
+        UCHAR* camouflage = &camouflageImage.data[index];
+        UCHAR* mask = &maskImage.data[index];
+
+        // wʂ͔wiA}XNRGBJ̉摜`悷
+        camouflage[0] = back[0];
+        camouflage[1] = back[1];
+        camouflage[2] = back[2];
+        mask[0] = rgb[0];
+        mask[1] = rgb[1];
+        mask[2] = rgb[2];
+      }
     }
 
-    // ŏKinect̃CX^X쐬
-    ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
+    bandBounds[band] = bounds;
+  }
 
-    // Kinect̏Ԃ擾
-    HRESULT status = kinect->NuiStatus();
-    if ( status != S_OK ) {
-      throw std::runtime_error( "Kinect p\ł͂܂" );
-    }
+  // xɍ킹āAwʂ͔wiA}XNRGBJ̉摜d˂(}XN̓x)
+  //   playerRoi ͈̔͂
+  void blendMatte( const cv::Mat& frame )
+  {
+    const cv::Mat& background = backgroundModel.getImage();
+    const int bandCount = (playerRoi.height + BAND_ROWS - 1) / BAND_ROWS;
+    Concurrency::parallel_for( 0, bandCount, [&]( int band ) {
+      for ( int i = band * BAND_ROWS; i < std::min( (band + 1) * BAND_ROWS, playerRoi.height ); ++i ) {
+        const int y = playerRoi.y + i;
+        const int offset = playerRoi.x * 4;
+        const UCHAR* a = alpha.ptr< UCHAR >( i );
+        const UCHAR* rgb = frame.ptr< UCHAR >( y ) + offset;
+        const UCHAR* back = background.ptr< UCHAR >( y ) + offset;
+        UCHAR* camouflage = camouflageImage.ptr< UCHAR >( y ) + offset;
+        UCHAR* mask = maskImage.ptr< UCHAR >( y ) + offset;
+        for ( int x = 0; x < playerRoi.width; ++x ) {
+          if ( a[x] == 0 ) {
+            continue;
+          }
+
+          const int i = x * 4;
+          for ( int c = 0; c < 3; ++c ) {
+            camouflage[i + c] = blend( rgb[i + c], back[i + c], a[x] );
+            mask[i + c] = blend( 255, rgb[i + c], a[x] );
+          }
+          mask[i + 3] = a[x];
+        }
+      }
+    } );
+  }
+
+  // from  to ցAalpha / 255 ̊ŋ߂Â
+  static UCHAR blend( int from, int to, int alpha )
+  {
+    return (UCHAR)((from * (255 - alpha) + to * alpha + 127) / 255);
   }
 };
 
-void main()
+// 
+//   (Ȃ)           Kinect̃t[g
+//   synthetic        Kinect̑ɍt[g
+//   benchmark        t[ŏԂv
+//
+//   -color <𑜓x>  RGBJ̉𑜓x(640x480A1280x960BResolutionSelector Q)
+//   -depth <𑜓x>  J̉𑜓x(80x60A320x240A640x480)
+//   -sink <o͐>   摜̏o͐(screenAnullAimages:<ړ>Ashm:<O>BFrameSinkSelector Q)
+//   -adapt <>      1t[Ōwʂ̔wi߂Â(1A0͍ŏ̃t[̂܂)
+//   -matte <a>    }XN̗֊sRGBJ̉摜ɍ킹tB^̔a(8A0͑e}XN̂܂)
+void main( int argc, char* argv[] )
 {
 
   try {
+    // ʂւ̕\͕ʂ̃XbhōsAC[v҂Ȃ
+    FrameSinkSelector sinks;
+    AsyncFrameSink async;
+    FrameSink* sink = sinks.select( argc, argv );
+    if ( sink->isVisible() ) {
+      async.open( sink );
+      sink = &async;
+    }
+
+    ResolutionSelector resolutions;
+    resolutions.select( argc, argv );
+    int backgroundStep = BackgroundModel::selectStep( argc, argv );
+    int matteRadius = GuidedMatte::selectRadius( argc, argv );
+
+    // t[QƂ KinectSample ɍ쐬
+    SyntheticFrameSource synthetic( resolutions.getColorResolution(), resolutions.getDepthResolution() );
     KinectSample kinect;
-    kinect.initialize();
-    kinect.run();
+    kinect.setSink( sink );
+    if ( backgroundStep >= 0 ) {
+      kinect.setBackgroundStep( backgroundStep );
+    }
+    if ( matteRadius >= 0 ) {
+      kinect.setMatteRadius( matteRadius );
+    }
+
+    std::string mode = (argc > 1) ? argv[1] : "";
+    if ( (mode == "synthetic") || (mode == "benchmark") ) {
+      kinect.initialize( &synthetic );
+    }
+    else {
+      kinect.initialize( resolutions.getColorResolution(), resolutions.getDepthResolution() );
+    }
+
+    if ( mode == "benchmark" ) {
+      KernelBenchmark kernelBenchmark;
+      kinect.benchmark( kernelBenchmark );
+    }
+    else {
+      kinect.run();
+    }
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
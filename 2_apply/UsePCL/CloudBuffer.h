@@ -0,0 +1,128 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <pcl\point_types.h>
+
+// 作成済みのポイントクラウドを、書き込むスレッドから利用するスレッドへ渡すバッファ
+//
+// 書き込み用(back)、受け渡し用(middle)、利用中(front)の3つのクラウドの番号を
+// InterlockedExchange で入れ替えるだけで受け渡す(ロックもフレームごとのメモリ確保もしない)。
+// 利用側は、いつでも最後に書き終わったクラウドを受け取る(途中のフレームは捨てる)。
+//
+// CloudViewer のように、受け取ったクラウドを次のクラウドを渡すまで保持する利用側のために、
+// 書き込み側は予備のクラウドを1つ持ち、まだ参照されているクラウドには書き込まない。
+template< typename PointT >
+class CloudBuffer
+{
+public:
+
+  typedef pcl::PointCloud< PointT > Cloud;
+  typedef typename Cloud::Ptr CloudPtr;
+  typedef typename Cloud::ConstPtr CloudConstPtr;
+
+  CloudBuffer()
+    : back_( 0 )
+    , spare_( 1 )
+    , middle_( 2 )
+    , front_( 3 )
+    , published_( 0 )
+    , consumed_( 0 )
+  {
+  }
+
+  // クラウドを作成する(書き込み、利用を始める前に一度だけ呼ぶ)
+  void initialize( DWORD width, DWORD height )
+  {
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+    for ( int i = 0; i < SLOT_COUNT; ++i ) {
+      slots_[i].reset( new Cloud( width, height ) );
+      slots_[i]->is_dense = false;
+
+      // まだ書き込んでいないクラウドは、すべての点を NaN にしておく
+      for ( size_t j = 0; j < slots_[i]->points.size(); ++j ) {
+        PointT& point = slots_[i]->points[j];
+        point.x = point.y = point.z = nan;
+      }
+    }
+
+    back_ = 0;
+    spare_ = 1;
+    middle_ = 2;
+    front_ = 3;
+    published_ = 0;
+    consumed_ = 0;
+  }
+
+  // 書き込み用のクラウドを取得する(書き込むスレッドから呼ぶ)
+  Cloud& back()
+  {
+    // 利用側がまだ前のクラウドを参照している場合は、予備のクラウドに書き込む
+    if ( !slots_[back_].unique() && slots_[spare_].unique() ) {
+      std::swap( back_, spare_ );
+    }
+
+    return *slots_[back_];
+  }
+
+  // 書き込み用のクラウドを書き終わったので、利用側へ渡す(書き込むスレッドから呼ぶ)
+  void publish()
+  {
+    LONG previous = ::InterlockedExchange( &middle_, back_ | FRESH );
+    back_ = previous & INDEX_MASK;
+    ::InterlockedIncrement( &published_ );
+  }
+
+  // 最後に書き終わったクラウドを取得する(利用するスレッドから呼ぶ)
+  //   返したクラウドは、次に latest を呼ぶまで書き換えられない
+  CloudConstPtr latest()
+  {
+    if ( (middle_ & FRESH) != 0 ) {
+      LONG previous = ::InterlockedExchange( &middle_, front_ );
+      front_ = previous & INDEX_MASK;
+      ::InterlockedIncrement( &consumed_ );
+    }
+
+    return slots_[front_];
+  }
+
+  // 書き込んだクラウドの数
+  LONG getPublishedCount() const
+  {
+    return published_;
+  }
+
+  // 利用側が受け取ったクラウドの数(書き込んだ数との差は、捨てたフレームの数)
+  LONG getConsumedCount() const
+  {
+    return consumed_;
+  }
+
+private:
+
+  // コピーを禁止する
+  CloudBuffer( const CloudBuffer& rhs );
+  CloudBuffer& operator = ( const CloudBuffer& rhs );
+
+private:
+
+  enum
+  {
+    SLOT_COUNT = 4,     // back、予備、middle、front
+    INDEX_MASK = 0xff,
+    FRESH = 0x100,      // middle が、まだ受け取られていない新しいクラウドであること
+  };
+
+  CloudPtr slots_[SLOT_COUNT];
+
+  LONG back_;               // 書き込むスレッドだけが使う
+  LONG spare_;              // 書き込むスレッドだけが使う
+  volatile LONG middle_;    // 両方のスレッドが使う(番号 | FRESH)
+  LONG front_;              // 利用するスレッドだけが使う
+
+  volatile LONG published_;
+  volatile LONG consumed_;
+};
@@ -0,0 +1,635 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pcl\point_types.h>
+
+#include "SpscQueue.h"
+
+// ポイントクラウドの保存形式
+enum CloudFormat
+{
+  CLOUD_FORMAT_PCD,       // フレームごとのバイナリのPCDファイル(接頭辞_000000.pcd)
+  CLOUD_FORMAT_PLY,       // フレームごとのバイナリのPLYファイル(接頭辞_000000.ply、NaN の点は除く)
+  CLOUD_FORMAT_ARCHIVE    // 1つのファイルに、PCDのフレームを追加していく(終了時に索引を書き込む)
+};
+
+// CLOUD_FORMAT_ARCHIVE のファイルの形式
+//
+//   CloudArchiveHeader
+//   フレーム(バイナリのPCDファイルと同じ内容)の並び
+//   CloudArchiveIndexEntry の並び(フレームの索引、終了時に書き込む)
+const DWORD CLOUD_ARCHIVE_MAGIC = (DWORD)'K' | ((DWORD)'P' << 8) | ((DWORD)'C' << 16) | ((DWORD)'A' << 24);
+const DWORD CLOUD_ARCHIVE_VERSION = 1;
+
+struct CloudArchiveHeader
+{
+  DWORD magic;              // CLOUD_ARCHIVE_MAGIC
+  DWORD version;            // CLOUD_ARCHIVE_VERSION
+  DWORD frameCount;         // フレーム数(終了時に書き込む)
+  DWORD reserved;
+  LONGLONG indexOffset;     // 索引の位置(終了時に書き込む)
+};
+
+struct CloudArchiveIndexEntry
+{
+  LONGLONG timeStamp;       // タイムスタンプ(ミリ秒)
+  LONGLONG offset;          // フレームの位置
+  LONGLONG size;            // フレームのバイト数
+};
+
+// ポイントクラウドをファイルに書き出す
+//
+// 書き出す先のファイルの領域は、書き込みのスレッドがあらかじめメモリにマップしておく。
+// write() はマップ済みの領域に書き込むだけで、ディスクへの書き込み(フラッシュ)と
+// 次の領域の準備は書き込みのスレッドで行う。準備済みの領域が足りない場合は、
+// 呼び出し側を止めないようにフレームを捨てる(getDroppedCount() で確認できる)。
+// open、write、close は同じスレッドから呼ぶ。
+class CloudExporter
+{
+public:
+
+  typedef pcl::PointXYZRGBA PointT;
+
+  // 準備しておく領域の数
+  static const int REGION_COUNT = 4;
+
+  // CLOUD_FORMAT_ARCHIVE の1つの領域の大きさ(マップの単位の倍数)
+  static const DWORD ARCHIVE_REGION_SIZE = 32 * 1024 * 1024;
+
+  CloudExporter()
+    : format_( CLOUD_FORMAT_PCD )
+    , file_( INVALID_HANDLE_VALUE )
+    , thread_( 0 )
+    , ready_( 0 )
+    , filled_( 0 )
+    , current_( 0 )
+    , frameCapacity_( 0 )
+    , nextOffset_( 0 )
+    , nextFileNumber_( 0 )
+    , writeOffset_( 0 )
+    , frameCount_( 0 )
+    , droppedCount_( 0 )
+    , writtenBytes_( 0 )
+    , flushedBytes_( 0 )
+    , flushTime_( 0 )
+    , elapsedTime_( 0 )
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+    startTime_.QuadPart = 0;
+  }
+
+  ~CloudExporter()
+  {
+    close();
+  }
+
+  // 引数から書き出し先を取り出す(指定されていない場合は false を返す)
+  //   -export pcd:<接頭辞>        フレームごとのPCDファイル
+  //   -export ply:<接頭辞>        フレームごとのPLYファイル
+  //   -export archive:<ファイル名> 1つのファイル
+  //   取り出した引数は argv から取り除き、argc を減らす
+  static bool select( int& argc, char* argv[], CloudFormat& format, std::string& path )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-export" ) {
+        std::string value = argv[i + 1];
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+
+        std::string::size_type colon = value.find( ':' );
+        std::string type = value.substr( 0, colon );
+        path = (colon != std::string::npos) ? value.substr( colon + 1 ) : "";
+        if ( path.empty() ) {
+          throw std::runtime_error( "書き出し先がありません : " + value );
+        }
+
+        if ( type == "pcd" ) {
+          format = CLOUD_FORMAT_PCD;
+        }
+        else if ( type == "ply" ) {
+          format = CLOUD_FORMAT_PLY;
+        }
+        else if ( type == "archive" ) {
+          format = CLOUD_FORMAT_ARCHIVE;
+        }
+        else {
+          throw std::runtime_error( "書き出しの形式が正しくありません : " + value );
+        }
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // 書き出しを始める
+  //   path      : CLOUD_FORMAT_ARCHIVE はファイル名、それ以外はファイル名の接頭辞
+  //   maxPoints : 1フレームの点の最大数(フレームごとのファイルの大きさに使う)
+  void open( CloudFormat format, const std::string& path, DWORD maxPoints )
+  {
+    close();
+
+    format_ = format;
+    path_ = path;
+    frameCapacity_ = HEADER_CAPACITY + maxPoints * POINT_SIZE;
+    nextOffset_ = 0;
+    nextFileNumber_ = 0;
+    writeOffset_ = 0;
+    index_.clear();
+    frameCount_ = 0;
+    droppedCount_ = 0;
+    writtenBytes_ = 0;
+    flushedBytes_ = 0;
+    flushTime_ = 0;
+    elapsedTime_ = 0;
+
+    if ( format_ == CLOUD_FORMAT_ARCHIVE ) {
+      file_ = ::CreateFileA( path_.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+      if ( file_ == INVALID_HANDLE_VALUE ) {
+        throw std::runtime_error( "書き出すファイルを作成できません : " + path_ );
+      }
+    }
+
+    // 領域を準備する
+    regions_.assign( REGION_COUNT, Region() );
+    ready_ = new SpscQueue< Region* >( REGION_COUNT );
+    filled_ = new SpscQueue< Region* >( REGION_COUNT );
+    for ( int i = 0; i < REGION_COUNT; ++i ) {
+      prepareRegion( regions_[i] );
+      ready_->push( &regions_[i] );
+    }
+
+    // ヘッダー(フレーム数と索引の位置は終了時に書き込む)
+    if ( format_ == CLOUD_FORMAT_ARCHIVE ) {
+      CloudArchiveHeader header = { 0 };
+      header.magic = CLOUD_ARCHIVE_MAGIC;
+      header.version = CLOUD_ARCHIVE_VERSION;
+      put( &header, sizeof(header) );
+    }
+
+    ::QueryPerformanceCounter( &startTime_ );
+    thread_ = ::CreateThread( 0, 0, &CloudExporter::threadProc, this, 0, 0 );
+  }
+
+  // 書き出しを終える(残りをフラッシュしてから、索引を書き込む)
+  void close()
+  {
+    if ( thread_ == 0 ) {
+      return;
+    }
+
+    // 書き込み中の領域を渡して、書き込みのスレッドを終わらせる
+    if ( current_ != 0 ) {
+      filled_->push( current_ );
+      current_ = 0;
+    }
+
+    filled_->close();
+    ::WaitForSingleObject( thread_, INFINITE );
+    ::CloseHandle( thread_ );
+    thread_ = 0;
+
+    LARGE_INTEGER end;
+    ::QueryPerformanceCounter( &end );
+    elapsedTime_ = end.QuadPart - startTime_.QuadPart;
+
+    // 使わなかった領域を片付ける
+    Region* region = 0;
+    while ( ready_->pop( region, 0 ) ) {
+      region->used = 0;
+      finishRegion( *region );
+    }
+
+    delete ready_;
+    ready_ = 0;
+    delete filled_;
+    filled_ = 0;
+
+    if ( format_ == CLOUD_FORMAT_ARCHIVE ) {
+      try {
+        // 準備して使わなかった部分を切り詰めてから、索引を書き込む
+        LARGE_INTEGER position;
+        position.QuadPart = writeOffset_;
+        ::SetFilePointerEx( file_, position, 0, FILE_BEGIN );
+        ::SetEndOfFile( file_ );
+
+        if ( !index_.empty() ) {
+          writeFile( &index_[0], (DWORD)(index_.size() * sizeof(CloudArchiveIndexEntry)) );
+        }
+
+        // ヘッダーにフレーム数と索引の位置を書き込む
+        position.QuadPart = offsetof( CloudArchiveHeader, frameCount );
+        ::SetFilePointerEx( file_, position, 0, FILE_BEGIN );
+
+        DWORD frameCount = (DWORD)index_.size();
+        writeFile( &frameCount, sizeof(frameCount) );
+
+        position.QuadPart = offsetof( CloudArchiveHeader, indexOffset );
+        ::SetFilePointerEx( file_, position, 0, FILE_BEGIN );
+        writeFile( &writeOffset_, sizeof(writeOffset_) );
+      }
+      catch ( std::exception& ex ) {
+        std::cout << "CloudExporter::close " << ex.what() << std::endl;
+      }
+
+      ::CloseHandle( file_ );
+      file_ = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  bool isOpen() const
+  {
+    return thread_ != 0;
+  }
+
+  // 1フレーム分を書き出す(領域が足りない場合は捨てて false を返す)
+  bool write( const pcl::PointCloud< PointT >& cloud, LONGLONG timeStamp )
+  {
+    if ( !isOpen() ) {
+      return false;
+    }
+
+    // PLY は NaN の点を除くので、先に数える
+    DWORD count = (DWORD)cloud.points.size();
+    if ( format_ == CLOUD_FORMAT_PLY ) {
+      count = 0;
+      for ( size_t i = 0; i < cloud.points.size(); ++i ) {
+        if ( isFinite( cloud.points[i] ) ) {
+          ++count;
+        }
+      }
+    }
+
+    const int headerSize = formatHeader( cloud, count, timeStamp );
+    const DWORD size = headerSize + count * POINT_SIZE;
+
+    if ( format_ == CLOUD_FORMAT_ARCHIVE ) {
+      if ( getAvailable() < size ) {
+        ++droppedCount_;
+        return false;
+      }
+
+      CloudArchiveIndexEntry entry = { 0 };
+      entry.timeStamp = timeStamp;
+      entry.offset = writeOffset_;
+      entry.size = size;
+
+      put( header_, headerSize );
+      putPoints( cloud );
+      index_.push_back( entry );
+    }
+    else {
+      if ( !ready_->pop( current_, 0 ) ) {
+        current_ = 0;
+        ++droppedCount_;
+        return false;
+      }
+
+      // 準備したファイルより大きいフレームは捨てる(ファイルは書き込みのスレッドで消す)
+      if ( current_->capacity < size ) {
+        filled_->push( current_ );
+        current_ = 0;
+        ++droppedCount_;
+        return false;
+      }
+
+      put( header_, headerSize );
+      putPoints( cloud );
+      filled_->push( current_ );
+      current_ = 0;
+    }
+
+    ++frameCount_;
+    writtenBytes_ += size;
+    return true;
+  }
+
+  // 書き出したフレーム数
+  LONG getFrameCount() const
+  {
+    return frameCount_;
+  }
+
+  // 領域が足りずに捨てたフレーム数
+  LONG getDroppedCount() const
+  {
+    return droppedCount_;
+  }
+
+  // 書き出した量と速度を表示する(close の後に呼ぶ)
+  void printStatistics( std::ostream& out ) const
+  {
+    const double megaBytes = flushedBytes_ / (1024.0 * 1024.0);
+    out << "exported " << frameCount_ << " frames (dropped " << droppedCount_ << "), "
+        << std::fixed << std::setprecision( 1 ) << megaBytes << " MB";
+    if ( elapsedTime_ > 0 ) {
+      out << ", " << megaBytes * frequency_.QuadPart / elapsedTime_ << " MB/s sustained";
+    }
+    if ( flushTime_ > 0 ) {
+      out << ", " << megaBytes * frequency_.QuadPart / flushTime_ << " MB/s flush";
+    }
+    out << std::endl;
+    out.unsetf( std::ios::floatfield );
+  }
+
+private:
+
+  enum
+  {
+    HEADER_CAPACITY = 512,  // ヘッダーの最大のバイト数
+    POINT_SIZE = 16,        // 1点のバイト数(x、y、z、色)
+    BATCH_POINTS = 1024     // まとめて書き込む点の数
+  };
+
+  // ファイルにマップした領域
+  struct Region
+  {
+    HANDLE file;            // フレームごとのファイル(CLOUD_FORMAT_ARCHIVE では使わない)
+    HANDLE mapping;
+    BYTE* view;
+    LONGLONG offset;        // ファイルでの位置
+    DWORD capacity;
+    DWORD used;
+    char fileName[MAX_PATH];
+
+    Region()
+      : file( INVALID_HANDLE_VALUE )
+      , mapping( 0 )
+      , view( 0 )
+      , offset( 0 )
+      , capacity( 0 )
+      , used( 0 )
+    {
+      fileName[0] = '\0';
+    }
+  };
+
+  static DWORD WINAPI threadProc( LPVOID param )
+  {
+    ((CloudExporter*)param)->flushRegions();
+    return 0;
+  }
+
+  // 書き終わった領域をフラッシュして、次の領域を準備する
+  void flushRegions()
+  {
+    Region* region = 0;
+    while ( filled_->pop( region ) ) {
+      try {
+        LARGE_INTEGER start;
+        ::QueryPerformanceCounter( &start );
+
+        flushedBytes_ += region->used;
+        finishRegion( *region );
+
+        LARGE_INTEGER end;
+        ::QueryPerformanceCounter( &end );
+        flushTime_ += end.QuadPart - start.QuadPart;
+
+        prepareRegion( *region );
+        ready_->push( region );
+      }
+      catch ( std::exception& ex ) {
+        // 準備できなかった領域は使わない(準備済みの領域がなくなると、以降のフレームは捨てられる)
+        std::cout << "CloudExporter::flushRegions " << ex.what() << std::endl;
+      }
+    }
+  }
+
+  // ファイルの領域をマップする
+  void prepareRegion( Region& region )
+  {
+    HANDLE file = file_;
+    if ( format_ == CLOUD_FORMAT_ARCHIVE ) {
+      region.offset = nextOffset_;
+      region.capacity = ARCHIVE_REGION_SIZE;
+      nextOffset_ += ARCHIVE_REGION_SIZE;
+    }
+    else {
+      sprintf_s( region.fileName, "%s_%06d.%s", path_.c_str(), nextFileNumber_++,
+        (format_ == CLOUD_FORMAT_PLY) ? "ply" : "pcd" );
+      region.file = ::CreateFileA( region.fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+      if ( region.file == INVALID_HANDLE_VALUE ) {
+        throw std::runtime_error( std::string( "書き出すファイルを作成できません : " ) + region.fileName );
+      }
+
+      region.offset = 0;
+      region.capacity = frameCapacity_;
+      file = region.file;
+    }
+
+    // マップする大きさまで、ファイルを大きくする
+    const LONGLONG end = region.offset + region.capacity;
+    region.mapping = ::CreateFileMapping( file, 0, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)(end & 0xFFFFFFFF), 0 );
+    if ( region.mapping == 0 ) {
+      throw std::runtime_error( "書き出すファイルをマップできません" );
+    }
+
+    region.view = (BYTE*)::MapViewOfFile( region.mapping, FILE_MAP_WRITE,
+      (DWORD)(region.offset >> 32), (DWORD)(region.offset & 0xFFFFFFFF), region.capacity );
+    if ( region.view == 0 ) {
+      throw std::runtime_error( "書き出すファイルをマップできません" );
+    }
+
+    region.used = 0;
+  }
+
+  // 領域をフラッシュして、マップをやめる
+  // フレームごとのファイルは、書き込んだ大きさに切り詰めて閉じる(何も書き込んでいない場合は消す)
+  void finishRegion( Region& region )
+  {
+    if ( region.used != 0 ) {
+      ::FlushViewOfFile( region.view, region.used );
+    }
+
+    ::UnmapViewOfFile( region.view );
+    ::CloseHandle( region.mapping );
+    region.view = 0;
+    region.mapping = 0;
+
+    if ( region.file != INVALID_HANDLE_VALUE ) {
+      if ( region.used != 0 ) {
+        LARGE_INTEGER position;
+        position.QuadPart = region.used;
+        ::SetFilePointerEx( region.file, position, 0, FILE_BEGIN );
+        ::SetEndOfFile( region.file );
+        ::CloseHandle( region.file );
+      }
+      else {
+        ::CloseHandle( region.file );
+        ::DeleteFileA( region.fileName );
+      }
+
+      region.file = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  // すぐに書き込める残りのバイト数(書き込み中の領域と、準備済みの領域)
+  LONGLONG getAvailable() const
+  {
+    LONGLONG available = (current_ != 0) ? (current_->capacity - current_->used) : 0;
+    return available + (LONGLONG)ready_->getDepth() * ARCHIVE_REGION_SIZE;
+  }
+
+  // 領域に書き込む(CLOUD_FORMAT_ARCHIVE では、いっぱいになったら次の領域に続けて書き込む)
+  void put( const void* data, DWORD size )
+  {
+    const BYTE* bytes = (const BYTE*)data;
+    while ( size != 0 ) {
+      if ( (current_ == 0) || (current_->used == current_->capacity) ) {
+        if ( current_ != 0 ) {
+          filled_->push( current_ );
+        }
+
+        // getAvailable で確認しているので、準備済みの領域がある
+        if ( !ready_->pop( current_, 0 ) ) {
+          current_ = 0;
+          throw std::runtime_error( "書き出す領域がありません" );
+        }
+      }
+
+      const DWORD length = std::min( size, current_->capacity - current_->used );
+      memcpy( current_->view + current_->used, bytes, length );
+      current_->used += length;
+      writeOffset_ += length;
+      bytes += length;
+      size -= length;
+    }
+  }
+
+  // 点を、x、y、z(float)と色(PCD は PCL と同じ BGRA、PLY は RGBA)の16バイトずつ書き込む
+  void putPoints( const pcl::PointCloud< PointT >& cloud )
+  {
+    const bool isPly = (format_ == CLOUD_FORMAT_PLY);
+    int count = 0;
+    for ( size_t i = 0; i < cloud.points.size(); ++i ) {
+      const PointT& point = cloud.points[i];
+      if ( isPly && !isFinite( point ) ) {
+        continue;
+      }
+
+      BYTE* out = batch_ + (count * POINT_SIZE);
+      memcpy( out, &point.x, sizeof(float) * 3 );
+      if ( isPly ) {
+        out[12] = point.r;
+        out[13] = point.g;
+        out[14] = point.b;
+        out[15] = point.a;
+      }
+      else {
+        memcpy( out + 12, &point.rgba, 4 );
+      }
+
+      if ( ++count == BATCH_POINTS ) {
+        put( batch_, count * POINT_SIZE );
+        count = 0;
+      }
+    }
+
+    put( batch_, count * POINT_SIZE );
+  }
+
+  // ヘッダーを作成する(バイト数を返す)
+  int formatHeader( const pcl::PointCloud< PointT >& cloud, DWORD count, LONGLONG timeStamp )
+  {
+    if ( format_ == CLOUD_FORMAT_PLY ) {
+      return sprintf_s( header_,
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "comment timestamp %lld\n"
+        "element vertex %u\n"
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "property uchar red\n"
+        "property uchar green\n"
+        "property uchar blue\n"
+        "property uchar alpha\n"
+        "end_header\n",
+        timeStamp, count );
+    }
+
+    return sprintf_s( header_,
+      "# .PCD v0.7 - Point Cloud Data file format\n"
+      "# timestamp %lld\n"
+      "VERSION 0.7\n"
+      "FIELDS x y z rgba\n"
+      "SIZE 4 4 4 4\n"
+      "TYPE F F F U\n"
+      "COUNT 1 1 1 1\n"
+      "WIDTH %u\n"
+      "HEIGHT %u\n"
+      "VIEWPOINT 0 0 0 1 0 0 0\n"
+      "POINTS %u\n"
+      "DATA binary\n",
+      timeStamp, cloud.width, cloud.height, count );
+  }
+
+  static bool isFinite( const PointT& point )
+  {
+    // NaN は自分自身と等しくない
+    return point.z == point.z;
+  }
+
+  void writeFile( const void* data, DWORD size )
+  {
+    DWORD written = 0;
+    if ( !::WriteFile( file_, data, size, &written, 0 ) || (written != size) ) {
+      throw std::runtime_error( "書き出すファイルに書き込めません" );
+    }
+  }
+
+private:
+
+  // コピーを禁止する
+  CloudExporter( const CloudExporter& rhs );
+  CloudExporter& operator = ( const CloudExporter& rhs );
+
+private:
+
+  CloudFormat format_;
+  std::string path_;
+  HANDLE file_;             // CLOUD_FORMAT_ARCHIVE のファイル
+  HANDLE thread_;
+
+  std::vector< Region > regions_;
+  SpscQueue< Region* >* ready_;     // 準備済みの領域(書き込みのスレッド -> write)
+  SpscQueue< Region* >* filled_;    // 書き終わった領域(write -> 書き込みのスレッド)
+  Region* current_;                 // 書き込み中の領域(write を呼ぶスレッドだけが使う)
+  DWORD frameCapacity_;
+
+  LONGLONG nextOffset_;             // 書き込みのスレッドだけが使う
+  int nextFileNumber_;              // 書き込みのスレッドだけが使う
+
+  LONGLONG writeOffset_;            // 以下は write を呼ぶスレッドだけが使う
+  std::vector< CloudArchiveIndexEntry > index_;
+  char header_[HEADER_CAPACITY];
+  BYTE batch_[BATCH_POINTS * POINT_SIZE];
+  LONG frameCount_;
+  LONG droppedCount_;
+  LONGLONG writtenBytes_;
+
+  // 書き込みのスレッドが更新する(close の後に参照する)
+  LONGLONG flushedBytes_;
+  LONGLONG flushTime_;
+
+  LARGE_INTEGER frequency_;
+  LARGE_INTEGER startTime_;
+  LONGLONG elapsedTime_;
+};
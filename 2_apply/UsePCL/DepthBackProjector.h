@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+#include <limits>
+#include <vector>
+
+#include <pcl\point_types.h>
+
+// 距離画像から3次元の点への変換(逆投影)
+//
+// NuiTransformDepthImageToSkeleton を1画素ごとに呼び出す代わりに、距離1mでの
+// 各画素の光線(X/Z、Y/Z)を解像度ごとに一度だけ求めておき、フレームごとの変換は
+// 光線に距離を掛けるだけで行う(SSE2が使える場合は4画素ずつ)。
+//
+// 結果は作成済みの整列したポイントクラウド(幅 x 高さ)に直接書き込み、
+// 距離が取れていない画素は NaN にする。座標はm、PCLのビューワに合わせてYは下向き。
+class DepthBackProjector
+{
+public:
+
+  DepthBackProjector()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , width_( 0 )
+    , height_( 0 )
+  {
+  }
+
+  // 光線のテーブルを作成する
+  void initialize( NUI_IMAGE_RESOLUTION depthResolution )
+  {
+    ::NuiImageResolutionToSize( depthResolution, width_, height_ );
+
+    rayX_.resize( width_ * height_ );
+    rayY_.resize( width_ * height_ );
+    for ( DWORD y = 0; y < height_; ++y ) {
+      for ( DWORD x = 0; x < width_; ++x ) {
+        // 距離1mの点を、SDKの変換で求める
+        Vector4 point = ::NuiTransformDepthImageToSkeleton( x, y,
+          (USHORT)(1000 << NUI_IMAGE_PLAYER_INDEX_SHIFT), depthResolution );
+
+        int index = (y * width_) + x;
+        rayX_[index] = point.x / point.z;
+        rayY_[index] = -point.y / point.z;
+      }
+    }
+  }
+
+  // 1フレーム分を変換する
+  //   distance : DepthUnpacker で分けた距離の画像のデータ(mm)
+  //   cloud    : 書き込むポイントクラウド(大きさが違う場合だけ作成しなおす)
+  //   PointT は、x、y、z の後ろに1つ空きのある PCL の点(PointXYZ、PointXYZRGBA など)
+  template< typename PointT >
+  void project( const USHORT* distance, pcl::PointCloud< PointT >& cloud ) const
+  {
+    const int count = width_ * height_;
+    if ( (cloud.width != width_) || (cloud.height != height_) || ((int)cloud.points.size() != count) ) {
+      cloud.points.resize( count );
+      cloud.width = width_;
+      cloud.height = height_;
+    }
+    cloud.is_dense = false;
+
+    float* xyz = cloud.points[0].data;
+    const int stride = sizeof(PointT) / sizeof(float);
+
+    int i = 0;
+    if ( isSse2_ ) {
+      i = projectSse2( distance, count, &rayX_[0], &rayY_[0], xyz, stride );
+    }
+
+    projectScalar( distance + i, count - i, &rayX_[i], &rayY_[i], xyz + (i * stride), stride );
+  }
+
+  DWORD getWidth() const
+  {
+    return width_;
+  }
+
+  DWORD getHeight() const
+  {
+    return height_;
+  }
+
+  // 1画素ずつ変換する
+  //   xyz    : 最初の点の x の位置
+  //   stride : 点の間隔(floatの数)
+  static void projectScalar( const USHORT* distance, int count, const float* rayX, const float* rayY,
+    float* xyz, int stride )
+  {
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+    for ( int i = 0; i < count; ++i, xyz += stride ) {
+      if ( distance[i] == 0 ) {
+        xyz[0] = xyz[1] = xyz[2] = nan;
+        continue;
+      }
+
+      float z = distance[i] * 0.001f;
+      xyz[0] = rayX[i] * z;
+      xyz[1] = rayY[i] * z;
+      xyz[2] = z;
+    }
+  }
+
+  // SSE2で4画素ずつ変換する(変換した画素数を返す。残りは projectScalar で変換する)
+  //   4画素分の x、y、z を並べ替えて、1点ずつ(x, y, z, 1)の16バイトで書き込む
+  static int projectSse2( const USHORT* distance, int count, const float* rayX, const float* rayY,
+    float* xyz, int stride )
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps( 0.001f );
+    const __m128 nan = _mm_set1_ps( std::numeric_limits< float >::quiet_NaN() );
+    const __m128 one = _mm_set1_ps( 1.0f );
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4, xyz += stride * 4 ) {
+      __m128i d = _mm_unpacklo_epi16( _mm_loadl_epi64( (const __m128i*)(distance + i) ), zero );
+      __m128 invalid = _mm_castsi128_ps( _mm_cmpeq_epi32( d, zero ) );
+
+      __m128 z = _mm_mul_ps( _mm_cvtepi32_ps( d ), scale );
+      __m128 x = _mm_mul_ps( _mm_loadu_ps( rayX + i ), z );
+      __m128 y = _mm_mul_ps( _mm_loadu_ps( rayY + i ), z );
+      __m128 w = one;
+
+      // 距離が取れていない画素は NaN にする
+      x = _mm_or_ps( _mm_andnot_ps( invalid, x ), _mm_and_ps( invalid, nan ) );
+      y = _mm_or_ps( _mm_andnot_ps( invalid, y ), _mm_and_ps( invalid, nan ) );
+      z = _mm_or_ps( _mm_andnot_ps( invalid, z ), _mm_and_ps( invalid, nan ) );
+
+      _MM_TRANSPOSE4_PS( x, y, z, w );
+      _mm_storeu_ps( xyz, x );
+      _mm_storeu_ps( xyz + stride, y );
+      _mm_storeu_ps( xyz + (stride * 2), z );
+      _mm_storeu_ps( xyz + (stride * 3), w );
+    }
+
+    return i;
+  }
+
+private:
+
+  bool isSse2_;
+
+  DWORD width_;
+  DWORD height_;
+
+  std::vector< float > rayX_;   // 距離1mでのX(画素ごと)
+  std::vector< float > rayY_;   // 距離1mでのY(画素ごと、下向き)
+};
@@ -0,0 +1,263 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include <vector>
+
+// 距離カメラの座標からRGBカメラの座標への変換テーブル
+//
+// NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution を1画素ごとに
+// 呼び出すと、640x480では1フレームあたり307,200回の呼び出しになる。
+// 解像度の組み合わせごとに、(depthX, depthY, 量子化した距離) の変換結果を
+// 一度だけ求めておき、フレームごとの変換はテーブルの参照だけで行う。
+class DepthColorRegistration
+{
+public:
+
+  // 変換結果(RGBカメラの座標)
+  struct ColorPoint
+  {
+    SHORT x;
+    SHORT y;
+  };
+
+  // 距離の量子化の段数(0番目は距離0用)
+  static const int BIN_COUNT = 16;
+
+  // 距離の量子化の範囲(mm)
+  static const int MINIMUM_DISTANCE = 400;
+  static const int MAXIMUM_DISTANCE = 8000;
+
+  // コンストラクタ
+  DepthColorRegistration()
+    : colorResolution_( NUI_IMAGE_RESOLUTION_INVALID )
+    , depthResolution_( NUI_IMAGE_RESOLUTION_INVALID )
+    , width_( 0 )
+    , height_( 0 )
+  {
+  }
+
+  // 変換テーブルを作成する(Kinectの変換を使う)
+  void initialize( INuiSensor* kinect,
+    NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
+  {
+    SensorMapper mapper( kinect, colorResolution, depthResolution );
+    initialize( mapper, colorResolution, depthResolution );
+  }
+
+  // 変換テーブルを作成する
+  //   mapper.getColorPixelCoordinates( depthX, depthY, depth, colorX, colorY ) で1画素を変換する
+  //   同じ解像度の組み合わせで作成済みの場合は何もしない
+  template< typename Mapper >
+  void initialize( Mapper& mapper,
+    NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
+  {
+    if ( isInitialized() && (colorResolution_ == colorResolution) &&
+         (depthResolution_ == depthResolution) ) {
+      return;
+    }
+
+    colorResolution_ = colorResolution;
+    depthResolution_ = depthResolution;
+    ::NuiImageResolutionToSize( depthResolution_, width_, height_ );
+
+    createDepthBins();
+
+    // テーブルを作成する(1画素の全段数が連続するように並べる)
+    table_.resize( width_ * height_ * BIN_COUNT );
+    for ( DWORD y = 0; y < height_; ++y ) {
+      for ( DWORD x = 0; x < width_; ++x ) {
+        ColorPoint* entry = &table_[((y * width_) + x) * BIN_COUNT];
+        for ( int bin = 0; bin < BIN_COUNT; ++bin ) {
+          LONG colorX = x;
+          LONG colorY = y;
+          mapper.getColorPixelCoordinates( x, y, binDepth_[bin], colorX, colorY );
+          entry[bin].x = (SHORT)colorX;
+          entry[bin].y = (SHORT)colorY;
+        }
+      }
+    }
+  }
+
+  // 保存しておいた変換テーブルから作成する
+  //   table には getTable() で取得した内容(画素数 x BIN_COUNT 個)を渡す
+  void initialize( const ColorPoint* table,
+    NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
+  {
+    colorResolution_ = colorResolution;
+    depthResolution_ = depthResolution;
+    ::NuiImageResolutionToSize( depthResolution_, width_, height_ );
+
+    createDepthBins();
+    table_.assign( table, table + (width_ * height_ * BIN_COUNT) );
+  }
+
+  // 変換テーブルを取得する(記録したデータと一緒に保存する場合など)
+  const std::vector< ColorPoint >& getTable() const
+  {
+    return table_;
+  }
+
+  // 変換テーブルを破棄する(次の initialize で必ず作成しなおす)
+  //   別のKinectが接続された場合など、解像度が同じでも変換が変わる場合に呼ぶ
+  void reset()
+  {
+    colorResolution_ = NUI_IMAGE_RESOLUTION_INVALID;
+    depthResolution_ = NUI_IMAGE_RESOLUTION_INVALID;
+    width_ = 0;
+    height_ = 0;
+    table_.clear();
+  }
+
+  // 変換テーブルが作成済みかどうか
+  bool isInitialized() const
+  {
+    return !table_.empty();
+  }
+
+  // 距離カメラの座標を、RGBカメラの座標に変換する
+  //   index は距離画像の画素番号(depthY * width + depthX)
+  //   depth は NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX の値
+  void getColorPixel( int index, USHORT depth, LONG& colorX, LONG& colorY ) const
+  {
+    getColorPixelFromDistance( index, depth >> NUI_IMAGE_PLAYER_INDEX_SHIFT, colorX, colorY );
+  }
+
+  // 距離カメラの座標を、RGBカメラの座標に変換する
+  //   distance は距離(mm、DepthUnpacker で分けた距離の画像の値)
+  void getColorPixelFromDistance( int index, USHORT distance, LONG& colorX, LONG& colorY ) const
+  {
+    const ColorPoint* entry = &table_[index * BIN_COUNT];
+    const DepthBin& bin = depthToBin_[distance];
+    const ColorPoint& p0 = entry[bin.index];
+    const ColorPoint& p1 = entry[bin.index + 1];
+
+    // 隣り合う段の間を線形補間する(重みは256で1)
+    colorX = ((p0.x << 8) + ((p1.x - p0.x) * bin.weight) + 128) >> 8;
+    colorY = ((p0.y << 8) + ((p1.y - p0.y) * bin.weight) + 128) >> 8;
+  }
+
+  // 距離カメラの座標を、RGBカメラの座標に変換する
+  void getColorPixel( LONG depthX, LONG depthY, USHORT depth, LONG& colorX, LONG& colorY ) const
+  {
+    getColorPixel( (depthY * width_) + depthX, depth, colorX, colorY );
+  }
+
+  // 1フレーム分の座標を変換する
+  //   colorCoordinates には (colorX, colorY) の組が画素数分格納される
+  void mapFrame( const USHORT* depth, LONG* colorCoordinates ) const
+  {
+    const int count = width_ * height_;
+    for ( int i = 0; i < count; ++i ) {
+      getColorPixel( i, depth[i], colorCoordinates[0], colorCoordinates[1] );
+      colorCoordinates += 2;
+    }
+  }
+
+  NUI_IMAGE_RESOLUTION getColorResolution() const
+  {
+    return colorResolution_;
+  }
+
+  NUI_IMAGE_RESOLUTION getDepthResolution() const
+  {
+    return depthResolution_;
+  }
+
+  DWORD getWidth() const
+  {
+    return width_;
+  }
+
+  DWORD getHeight() const
+  {
+    return height_;
+  }
+
+private:
+
+  // Kinectによる1画素の変換
+  class SensorMapper
+  {
+  public:
+
+    SensorMapper( INuiSensor* kinect,
+      NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
+      : kinect_( kinect )
+      , colorResolution_( colorResolution )
+      , depthResolution_( depthResolution )
+    {
+    }
+
+    void getColorPixelCoordinates( LONG depthX, LONG depthY, USHORT depth, LONG& colorX, LONG& colorY )
+    {
+      kinect_->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(
+        colorResolution_, depthResolution_,
+        0, depthX, depthY, depth, &colorX, &colorY );
+    }
+
+  private:
+
+    INuiSensor* kinect_;
+    NUI_IMAGE_RESOLUTION colorResolution_;
+    NUI_IMAGE_RESOLUTION depthResolution_;
+  };
+
+  // 距離(mm)から参照する段と補間の重み
+  struct DepthBin
+  {
+    USHORT index;
+    USHORT weight;
+  };
+
+  // 段ごとの距離と、距離から段への対応表を作成する
+  //   視差は距離の逆数に比例するので、距離の逆数で等間隔に区切る
+  void createDepthBins()
+  {
+    const int sampleCount = BIN_COUNT - 1;
+    const double nearInverse = 1.0 / MINIMUM_DISTANCE;
+    const double farInverse = 1.0 / MAXIMUM_DISTANCE;
+    const double step = (nearInverse - farInverse) / (sampleCount - 1);
+
+    // 0番目は距離0(SDKに0を渡した場合と同じ変換結果)
+    binDepth_[0] = 0;
+    for ( int i = 0; i < sampleCount; ++i ) {
+      USHORT distance = (USHORT)(1.0 / (nearInverse - (step * i)) + 0.5);
+      binDepth_[i + 1] = distance << NUI_IMAGE_PLAYER_INDEX_SHIFT;
+    }
+
+    // 13bitの距離のすべての値について、参照する段を求めておく
+    depthToBin_.resize( 1 << (16 - NUI_IMAGE_PLAYER_INDEX_SHIFT) );
+    depthToBin_[0].index = 0;
+    depthToBin_[0].weight = 0;
+    for ( size_t distance = 1; distance < depthToBin_.size(); ++distance ) {
+      double position = (nearInverse - (1.0 / distance)) / step;
+      if ( position < 0 ) {
+        position = 0;
+      }
+      else if ( position > sampleCount - 1 ) {
+        position = sampleCount - 1;
+      }
+
+      int sample = (int)position;
+      if ( sample >= sampleCount - 1 ) {
+        sample = sampleCount - 2;
+      }
+
+      depthToBin_[distance].index = (USHORT)(sample + 1);
+      depthToBin_[distance].weight = (USHORT)((position - sample) * 256 + 0.5);
+    }
+  }
+
+private:
+
+  NUI_IMAGE_RESOLUTION colorResolution_;
+  NUI_IMAGE_RESOLUTION depthResolution_;
+  DWORD width_;
+  DWORD height_;
+
+  USHORT binDepth_[BIN_COUNT];
+  std::vector< DepthBin > depthToBin_;
+  std::vector< ColorPoint > table_;
+};
@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+
+#include <opencv2/opencv.hpp>
+
+// 距離データ(プレイヤー付き)を、距離とプレイヤーの画像に分ける
+//
+// NuiDepthPixelToDepth、NuiDepthPixelToPlayerIndex を1画素ごとに呼び出す代わりに、
+// 1フレーム分をまとめて分ける(SSE2が使える場合は16画素ずつ)。
+//   距離       : CV_16UC1 (mm)
+//   プレイヤー : CV_8UC1 (0はプレイヤーなし、1〜7はプレイヤー番号)
+class DepthUnpacker
+{
+public:
+
+  DepthUnpacker()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+  {
+  }
+
+  // 1フレーム分を分ける(画像は大きさが変わったときだけ確保しなおす)
+  void unpack( const USHORT* depth, int width, int height )
+  {
+    distance_.create( height, width, CV_16UC1 );
+    player_.create( height, width, CV_8UC1 );
+    unpack( depth, width * height, (USHORT*)distance_.data, player_.data, isSse2_ );
+  }
+
+  // 1フレーム分を分けながら、行ごとに積算する(分けた行がキャッシュに残っているうちに渡す)
+  //   accumulator : begin( width, height )、accumulate( distance, player, count )、end() を持つもの
+  template< typename Accumulator >
+  void unpack( const USHORT* depth, int width, int height, Accumulator& accumulator )
+  {
+    distance_.create( height, width, CV_16UC1 );
+    player_.create( height, width, CV_8UC1 );
+
+    accumulator.begin( width, height );
+    for ( int y = 0; y < height; ++y ) {
+      USHORT* distance = distance_.ptr< USHORT >( y );
+      BYTE* player = player_.ptr< BYTE >( y );
+      unpack( depth + (y * width), width, distance, player, isSse2_ );
+      accumulator.accumulate( distance, player, width );
+    }
+    accumulator.end();
+  }
+
+  // 距離の画像
+  const cv::Mat& getDistance() const
+  {
+    return distance_;
+  }
+
+  // プレイヤーの画像
+  const cv::Mat& getPlayer() const
+  {
+    return player_;
+  }
+
+  // count 画素分を分ける
+  static void unpack( const USHORT* depth, int count, USHORT* distance, BYTE* player, bool isSse2 = true )
+  {
+    int i = 0;
+    if ( isSse2 ) {
+      i = unpackSse2( depth, count, distance, player );
+    }
+
+    unpackScalar( depth + i, count - i, distance + i, player + i );
+  }
+
+  // 1画素ずつ分ける
+  static void unpackScalar( const USHORT* depth, int count, USHORT* distance, BYTE* player )
+  {
+    for ( int i = 0; i < count; ++i ) {
+      distance[i] = depth[i] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+      player[i] = (BYTE)(depth[i] & NUI_IMAGE_PLAYER_INDEX_MASK);
+    }
+  }
+
+  // SSE2で16画素ずつ分ける(分けた画素数を返す。残りは unpackScalar で分ける)
+  static int unpackSse2( const USHORT* depth, int count, USHORT* distance, BYTE* player )
+  {
+    const __m128i playerMask = _mm_set1_epi16( NUI_IMAGE_PLAYER_INDEX_MASK );
+
+    int i = 0;
+    for ( ; i + 16 <= count; i += 16 ) {
+      __m128i d0 = _mm_loadu_si128( (const __m128i*)(depth + i) );
+      __m128i d1 = _mm_loadu_si128( (const __m128i*)(depth + i + 8) );
+
+      _mm_storeu_si128( (__m128i*)(distance + i), _mm_srli_epi16( d0, NUI_IMAGE_PLAYER_INDEX_SHIFT ) );
+      _mm_storeu_si128( (__m128i*)(distance + i + 8), _mm_srli_epi16( d1, NUI_IMAGE_PLAYER_INDEX_SHIFT ) );
+
+      // プレイヤー番号は0〜7なので、8ビットに詰めても値は変わらない
+      __m128i p = _mm_packus_epi16( _mm_and_si128( d0, playerMask ), _mm_and_si128( d1, playerMask ) );
+      _mm_storeu_si128( (__m128i*)(player + i), p );
+    }
+
+    return i;
+  }
+
+private:
+
+  bool isSse2_;
+
+  cv::Mat distance_;
+  cv::Mat player_;
+};
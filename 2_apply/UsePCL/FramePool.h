@@ -0,0 +1,224 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <vector>
+
+// 画像フレーム(RGBカメラまたは距離カメラ)
+struct ImageFrame
+{
+  LONGLONG timeStamp;   // タイムスタンプ(ミリ秒)
+  DWORD frameNumber;    // フレーム番号
+  DWORD width;          // 幅
+  DWORD height;         // 高さ
+  INT pitch;            // 1行のバイト数
+  INT size;             // データのバイト数
+  BYTE* bits;           // データ(RGBはBGRA、距離は NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX)
+};
+
+class FramePool;
+
+// プールされたフレームのバッファ
+struct FrameBuffer
+{
+  ImageFrame frame;
+  std::vector< BYTE > data;
+  volatile LONG refCount;
+  FramePool* pool;
+};
+
+// フレームの参照(参照カウント付き)
+//
+// コピーしてもデータはコピーせず、同じバッファを参照する。
+// 最後の参照がなくなった時点で、バッファはプールに戻される。
+class FrameHandle
+{
+public:
+
+  FrameHandle()
+    : buffer_( 0 )
+  {
+  }
+
+  explicit FrameHandle( FrameBuffer* buffer )
+    : buffer_( buffer )
+  {
+    addRef();
+  }
+
+  FrameHandle( const FrameHandle& rhs )
+    : buffer_( rhs.buffer_ )
+  {
+    addRef();
+  }
+
+  ~FrameHandle()
+  {
+    release();
+  }
+
+  FrameHandle& operator = ( const FrameHandle& rhs )
+  {
+    FrameHandle temp( rhs );
+    swap( temp );
+    return *this;
+  }
+
+  void swap( FrameHandle& rhs )
+  {
+    std::swap( buffer_, rhs.buffer_ );
+  }
+
+  // 参照をやめる
+  void reset()
+  {
+    release();
+    buffer_ = 0;
+  }
+
+  bool empty() const
+  {
+    return buffer_ == 0;
+  }
+
+  // フレームの情報(bits はプールのバッファを指す)
+  ImageFrame& frame() const
+  {
+    return buffer_->frame;
+  }
+
+  BYTE* bits() const
+  {
+    return buffer_->frame.bits;
+  }
+
+  // 同じバッファを参照している数
+  LONG useCount() const
+  {
+    return (buffer_ != 0) ? buffer_->refCount : 0;
+  }
+
+private:
+
+  void addRef()
+  {
+    if ( buffer_ != 0 ) {
+      ::InterlockedIncrement( &buffer_->refCount );
+    }
+  }
+
+  void release();
+
+private:
+
+  FrameBuffer* buffer_;
+};
+
+// フレームのバッファのプール
+//
+// 使い終わったバッファを再利用して、フレームごとのメモリ確保をなくす。
+// プールは、プールから取得したすべての FrameHandle より長く存在する必要がある。
+class FramePool
+{
+public:
+
+  FramePool()
+  {
+    ::InitializeCriticalSection( &lock_ );
+  }
+
+  ~FramePool()
+  {
+    for ( size_t i = 0; i < buffers_.size(); ++i ) {
+      delete buffers_[i];
+    }
+
+    ::DeleteCriticalSection( &lock_ );
+  }
+
+  // 指定したサイズ以上のバッファを取得する
+  FrameHandle acquire( INT size )
+  {
+    FrameBuffer* buffer = 0;
+
+    ::EnterCriticalSection( &lock_ );
+    for ( size_t i = 0; i < free_.size(); ++i ) {
+      if ( (INT)free_[i]->data.size() >= size ) {
+        buffer = free_[i];
+        free_.erase( free_.begin() + i );
+        break;
+      }
+    }
+
+    // 再利用できるバッファがない場合は、新しく作成する
+    if ( buffer == 0 ) {
+      buffer = new FrameBuffer();
+      buffer->pool = this;
+      buffers_.push_back( buffer );
+    }
+    ::LeaveCriticalSection( &lock_ );
+
+    buffer->data.resize( std::max( (INT)buffer->data.size(), size ) );
+    buffer->refCount = 0;
+    memset( &buffer->frame, 0, sizeof(buffer->frame) );
+    buffer->frame.size = size;
+    buffer->frame.bits = &buffer->data[0];
+
+    return FrameHandle( buffer );
+  }
+
+  // フレームをプールのバッファにコピーする
+  FrameHandle copy( const ImageFrame& frame )
+  {
+    FrameHandle handle = acquire( frame.size );
+    BYTE* bits = handle.bits();
+    handle.frame() = frame;
+    handle.frame().bits = bits;
+    memcpy( bits, frame.bits, frame.size );
+    return handle;
+  }
+
+  // 作成したバッファの数
+  size_t getBufferCount() const
+  {
+    return buffers_.size();
+  }
+
+  // 使われていないバッファの数
+  size_t getFreeCount() const
+  {
+    return free_.size();
+  }
+
+private:
+
+  friend class FrameHandle;
+
+  // バッファをプールに戻す
+  void recycle( FrameBuffer* buffer )
+  {
+    ::EnterCriticalSection( &lock_ );
+    free_.push_back( buffer );
+    ::LeaveCriticalSection( &lock_ );
+  }
+
+private:
+
+  // コピーを禁止する
+  FramePool( const FramePool& rhs );
+  FramePool& operator = ( const FramePool& rhs );
+
+private:
+
+  CRITICAL_SECTION lock_;
+  std::vector< FrameBuffer* > buffers_;
+  std::vector< FrameBuffer* > free_;
+};
+
+inline void FrameHandle::release()
+{
+  if ( (buffer_ != 0) && (::InterlockedDecrement( &buffer_->refCount ) == 0) ) {
+    buffer_->pool->recycle( buffer_ );
+  }
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+
+#include "FramePool.h"
+
+// フレームの取得元
+//
+// RGBカメラ、距離カメラ(プレイヤー付き)、スケルトンのフレームを取得する。
+// Kinect以外(合成データや記録したデータ)からも同じ手順で取得できるように、
+// 各サンプルのメインループはこのインタフェースを通してフレームを取得する。
+class FrameSource
+{
+public:
+
+  virtual ~FrameSource()
+  {
+  }
+
+  // 次のフレームを待つ(終了した場合はfalseを返す)
+  virtual bool waitFrame() = 0;
+
+  // RGBカメラのフレームを取得する(releaseColorFrame を呼ぶまで有効)
+  virtual HRESULT getColorFrame( ImageFrame& frame, DWORD timeout = 0 ) = 0;
+
+  // RGBカメラのフレームを解放する
+  virtual HRESULT releaseColorFrame( ImageFrame& frame ) = 0;
+
+  // 距離カメラのフレームを取得する(releaseDepthFrame を呼ぶまで有効)
+  virtual HRESULT getDepthFrame( ImageFrame& frame, DWORD timeout = 0 ) = 0;
+
+  // 距離カメラのフレームを解放する
+  virtual HRESULT releaseDepthFrame( ImageFrame& frame ) = 0;
+
+  // RGBカメラのフレームを参照カウント付きで取得する
+  //   取得元のバッファをそのまま渡せない場合は、プールのバッファに1回だけコピーする
+  virtual HRESULT acquireColorFrame( FrameHandle& handle, DWORD timeout = 0 )
+  {
+    ImageFrame frame = { 0 };
+    HRESULT ret = getColorFrame( frame, timeout );
+    if ( ret != S_OK ) {
+      return ret;
+    }
+
+    handle = pool_.copy( frame );
+    return releaseColorFrame( frame );
+  }
+
+  // 距離カメラのフレームを参照カウント付きで取得する
+  virtual HRESULT acquireDepthFrame( FrameHandle& handle, DWORD timeout = 0 )
+  {
+    ImageFrame frame = { 0 };
+    HRESULT ret = getDepthFrame( frame, timeout );
+    if ( ret != S_OK ) {
+      return ret;
+    }
+
+    handle = pool_.copy( frame );
+    return releaseDepthFrame( frame );
+  }
+
+  // スケルトンのフレームを取得する
+  virtual HRESULT getSkeletonFrame( NUI_SKELETON_FRAME& frame ) = 0;
+
+  // 距離カメラの座標を、RGBカメラの座標に変換する
+  virtual void getColorPixelCoordinates( LONG depthX, LONG depthY, USHORT depth,
+    LONG& colorX, LONG& colorY ) = 0;
+
+  // RGBカメラの解像度を取得する
+  virtual NUI_IMAGE_RESOLUTION getColorResolution() const = 0;
+
+  // 距離カメラの解像度を取得する
+  virtual NUI_IMAGE_RESOLUTION getDepthResolution() const = 0;
+
+  // フレームのバッファのプール
+  FramePool& getPool()
+  {
+    return pool_;
+  }
+
+protected:
+
+  FramePool pool_;
+};
@@ -0,0 +1,349 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <emmintrin.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pcl\point_types.h>
+
+// 積分画像による、整列したポイントクラウドの法線の推定
+//
+// 点の数、座標(x、y、z)、座標の積(xx、xy、xz、yy、yz、zz)の10個の値の積分画像を作り、
+// 各画素の周りの窓の中の合計を4回の参照で求めて、共分散行列の一番小さい固有値の
+// 固有ベクトルを法線とする(窓の大きさによらず、1画素あたりの計算量は同じ)。
+//
+// 積分画像は、行ごとの累積を行ごとに、列方向の累積を列の区間ごとに並列に行い、
+// 10個の値はSSE2で2つずつ足す。法線はカメラ(原点)の方を向け、求められない画素は NaN にする。
+// 窓が物体の境界をまたぐ画素では、手前と奥の点が混ざった法線になる。
+class IntegralNormalEstimator
+{
+public:
+
+  IntegralNormalEstimator()
+    : radius_( 0 )
+    , width_( 0 )
+    , height_( 0 )
+    , frameCount_( 0 )
+    , totalTime_( 0 )
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+  }
+
+  // 平滑化の窓の半径(画素、窓は 2 * radius + 1 の正方形。0の場合は求めない)
+  void setSmoothingRadius( int radius )
+  {
+    radius_ = std::max( radius, 0 );
+    resetStatistics();
+  }
+
+  int getSmoothingRadius() const
+  {
+    return radius_;
+  }
+
+  bool isEnabled() const
+  {
+    return radius_ > 0;
+  }
+
+  // 引数から窓の半径を取り出す
+  //   -normals <画素>  平滑化の窓の半径(指定しない場合は0、法線を求めない)
+  //   取り出した引数は argv から取り除き、argc を減らす
+  static int selectRadius( int& argc, char* argv[] )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-normals" ) {
+        int radius = atoi( argv[i + 1] );
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return radius;
+      }
+    }
+
+    return 0;
+  }
+
+  // 法線を求める
+  //   cloud   : 整列したポイントクラウド(NaN の点は使わない)
+  //   normals : 書き込む法線(cloud と同じ大きさ、大きさが違う場合だけ作成しなおす)
+  template< typename PointT >
+  void compute( const pcl::PointCloud< PointT >& cloud, pcl::PointCloud< pcl::Normal >& normals )
+  {
+    if ( cloud.height <= 1 ) {
+      throw std::runtime_error( "法線を求めるポイントクラウドが整列していません" );
+    }
+
+    LARGE_INTEGER start;
+    ::QueryPerformanceCounter( &start );
+
+    buildIntegral( cloud );
+
+    const int count = width_ * height_;
+    if ( (normals.width != (UINT)width_) || (normals.height != (UINT)height_) || ((int)normals.points.size() != count) ) {
+      normals.points.resize( count );
+      normals.width = width_;
+      normals.height = height_;
+    }
+    normals.is_dense = false;
+
+    Concurrency::parallel_for( 0, height_, [&]( int y ) {
+      for ( int x = 0; x < width_; ++x ) {
+        const int i = (y * width_) + x;
+        computeNormal( x, y, cloud.points[i], normals.points[i] );
+      }
+    } );
+
+    LARGE_INTEGER end;
+    ::QueryPerformanceCounter( &end );
+    frameCount_ += 1;
+    totalTime_ += end.QuadPart - start.QuadPart;
+  }
+
+  // 1フレームあたりの処理時間を表示する
+  void printStatistics( std::ostream& out ) const
+  {
+    if ( frameCount_ == 0 ) {
+      return;
+    }
+
+    out << "normals (radius " << radius_ << ") : "
+        << std::fixed << std::setprecision( 3 )
+        << (totalTime_ * 1000.0 / frequency_.QuadPart / frameCount_) << " ms/frame ("
+        << frameCount_ << " frames)" << std::endl;
+    out.unsetf( std::ios::floatfield );
+  }
+
+  void resetStatistics()
+  {
+    frameCount_ = 0;
+    totalTime_ = 0;
+  }
+
+private:
+
+  enum
+  {
+    CHANNELS = 10,      // 点の数、x、y、z、xx、xy、xz、yy、yz、zz
+    COLUMN_BLOCK = 320, // 列方向の累積を並列に行う単位(CHANNELS の倍数)
+    MIN_POINTS = 3      // 法線を求めるのに必要な、窓の中の点の数
+  };
+
+  // 積分画像を作る((height + 1) x (width + 1) 個、1行目と1列目は0)
+  template< typename PointT >
+  void buildIntegral( const pcl::PointCloud< PointT >& cloud )
+  {
+    width_ = cloud.width;
+    height_ = cloud.height;
+
+    const int stride = (width_ + 1) * CHANNELS;
+    integral_.resize( (height_ + 1) * stride );
+    std::fill( integral_.begin(), integral_.begin() + stride, 0.0 );
+
+    // 行ごとの累積
+    Concurrency::parallel_for( 0, height_, [&]( int y ) {
+      double* cell = &integral_[(y + 1) * stride];
+      std::fill( cell, cell + CHANNELS, 0.0 );
+
+      const PointT* point = &cloud.points[y * width_];
+      double value[CHANNELS];
+      for ( int x = 0; x < width_; ++x, ++point ) {
+        cell += CHANNELS;
+
+        // NaN は自分自身と等しくない
+        if ( point->z == point->z ) {
+          const double px = point->x;
+          const double py = point->y;
+          const double pz = point->z;
+          value[0] = 1;
+          value[1] = px;
+          value[2] = py;
+          value[3] = pz;
+          value[4] = px * px;
+          value[5] = px * py;
+          value[6] = px * pz;
+          value[7] = py * py;
+          value[8] = py * pz;
+          value[9] = pz * pz;
+          for ( int c = 0; c < CHANNELS; c += 2 ) {
+            _mm_storeu_pd( cell + c, _mm_add_pd( _mm_loadu_pd( cell - CHANNELS + c ), _mm_loadu_pd( value + c ) ) );
+          }
+        }
+        else {
+          for ( int c = 0; c < CHANNELS; c += 2 ) {
+            _mm_storeu_pd( cell + c, _mm_loadu_pd( cell - CHANNELS + c ) );
+          }
+        }
+      }
+    } );
+
+    // 列方向の累積(上の行を足す)
+    const int blockCount = (stride + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+    Concurrency::parallel_for( 0, blockCount, [&]( int block ) {
+      const int begin = block * COLUMN_BLOCK;
+      const int end = std::min( begin + COLUMN_BLOCK, stride );
+      for ( int y = 2; y <= height_; ++y ) {
+        double* row = &integral_[y * stride];
+        const double* above = row - stride;
+        for ( int i = begin; i < end; i += 2 ) {
+          _mm_storeu_pd( row + i, _mm_add_pd( _mm_loadu_pd( row + i ), _mm_loadu_pd( above + i ) ) );
+        }
+      }
+    } );
+  }
+
+  // 1画素の法線を求める
+  template< typename PointT >
+  void computeNormal( int x, int y, const PointT& point, pcl::Normal& normal ) const
+  {
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+    normal.normal_x = normal.normal_y = normal.normal_z = normal.curvature = nan;
+    if ( point.z != point.z ) {
+      return;
+    }
+
+    // 窓の中の合計(画像の端では窓を縮める)
+    const int x0 = std::max( x - radius_, 0 );
+    const int x1 = std::min( x + radius_ + 1, width_ );
+    const int y0 = std::max( y - radius_, 0 );
+    const int y1 = std::min( y + radius_ + 1, height_ );
+    const int stride = (width_ + 1) * CHANNELS;
+    const double* a = &integral_[(y0 * stride) + (x0 * CHANNELS)];
+    const double* b = &integral_[(y0 * stride) + (x1 * CHANNELS)];
+    const double* c = &integral_[(y1 * stride) + (x0 * CHANNELS)];
+    const double* d = &integral_[(y1 * stride) + (x1 * CHANNELS)];
+
+    double sum[CHANNELS];
+    for ( int k = 0; k < CHANNELS; k += 2 ) {
+      __m128d value = _mm_sub_pd( _mm_add_pd( _mm_loadu_pd( d + k ), _mm_loadu_pd( a + k ) ),
+                                  _mm_add_pd( _mm_loadu_pd( b + k ), _mm_loadu_pd( c + k ) ) );
+      _mm_storeu_pd( sum + k, value );
+    }
+
+    const double n = sum[0];
+    if ( n < MIN_POINTS ) {
+      return;
+    }
+
+    // 共分散行列
+    const double mx = sum[1] / n;
+    const double my = sum[2] / n;
+    const double mz = sum[3] / n;
+    double covariance[3][3];
+    covariance[0][0] = sum[4] / n - mx * mx;
+    covariance[0][1] = covariance[1][0] = sum[5] / n - mx * my;
+    covariance[0][2] = covariance[2][0] = sum[6] / n - mx * mz;
+    covariance[1][1] = sum[7] / n - my * my;
+    covariance[1][2] = covariance[2][1] = sum[8] / n - my * mz;
+    covariance[2][2] = sum[9] / n - mz * mz;
+
+    double vector[3];
+    double curvature;
+    if ( !smallestEigenVector( covariance, vector, curvature ) ) {
+      return;
+    }
+
+    // カメラ(原点)の方を向ける
+    if ( vector[0] * point.x + vector[1] * point.y + vector[2] * point.z > 0 ) {
+      vector[0] = -vector[0];
+      vector[1] = -vector[1];
+      vector[2] = -vector[2];
+    }
+
+    normal.normal_x = (float)vector[0];
+    normal.normal_y = (float)vector[1];
+    normal.normal_z = (float)vector[2];
+    normal.curvature = (float)curvature;
+  }
+
+  // 対称な3x3行列の一番小さい固有値の固有ベクトルを求める(求められない場合はfalse)
+  //   curvature : 一番小さい固有値 / 固有値の合計
+  static bool smallestEigenVector( const double m[3][3], double vector[3], double& curvature )
+  {
+    const double q = (m[0][0] + m[1][1] + m[2][2]) / 3;
+    const double p1 = m[0][1] * m[0][1] + m[0][2] * m[0][2] + m[1][2] * m[1][2];
+    const double p2 = (m[0][0] - q) * (m[0][0] - q) + (m[1][1] - q) * (m[1][1] - q) + (m[2][2] - q) * (m[2][2] - q) + 2 * p1;
+    const double p = std::sqrt( p2 / 6 );
+    if ( p <= 0 ) {
+      return false;
+    }
+
+    // B = (m - qI) / p の行列式から、固有値を三角関数で求める
+    double b[3][3];
+    for ( int i = 0; i < 3; ++i ) {
+      for ( int j = 0; j < 3; ++j ) {
+        b[i][j] = (m[i][j] - ((i == j) ? q : 0)) / p;
+      }
+    }
+
+    double r = (b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1]) -
+                b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0]) +
+                b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0])) / 2;
+    r = std::min( std::max( r, -1.0 ), 1.0 );
+
+    const double phi = std::acos( r ) / 3;
+    const double smallest = q + 2 * p * std::cos( phi + (2 * 3.14159265358979323846 / 3) );
+    const double sum = 3 * q;
+    curvature = (sum > 0) ? (smallest / sum) : 0;
+
+    // (m - smallest * I) の行どうしの外積のうち、一番長いものが固有ベクトル
+    double row[3][3];
+    for ( int i = 0; i < 3; ++i ) {
+      for ( int j = 0; j < 3; ++j ) {
+        row[i][j] = m[i][j] - ((i == j) ? smallest : 0);
+      }
+    }
+
+    const int pairs[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+    double bestLength = 0;
+    for ( int k = 0; k < 3; ++k ) {
+      const double* u = row[pairs[k][0]];
+      const double* v = row[pairs[k][1]];
+      const double cross[3] = {
+        u[1] * v[2] - u[2] * v[1],
+        u[2] * v[0] - u[0] * v[2],
+        u[0] * v[1] - u[1] * v[0],
+      };
+      const double length = cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2];
+      if ( length > bestLength ) {
+        bestLength = length;
+        vector[0] = cross[0];
+        vector[1] = cross[1];
+        vector[2] = cross[2];
+      }
+    }
+
+    if ( bestLength <= 0 ) {
+      return false;
+    }
+
+    const double scale = 1 / std::sqrt( bestLength );
+    vector[0] *= scale;
+    vector[1] *= scale;
+    vector[2] *= scale;
+    return true;
+  }
+
+private:
+
+  int radius_;
+  int width_;
+  int height_;
+  std::vector< double > integral_;
+
+  // 統計
+  LARGE_INTEGER frequency_;
+  LONGLONG frameCount_;
+  LONGLONG totalTime_;
+};
@@ -0,0 +1,171 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <crtdbg.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// 1フレーム分の処理(カーネル)の計測
+//
+// 準備として数回実行してから、指定した回数だけ実行し、1フレームあたりの
+// 処理時間(ナノ秒)と、メモリを確保した回数を表示する。
+//
+// メモリを確保した回数は、CRTの割り当てフック(_CrtSetAllocHook)で数えるため、
+// Debugビルドでのみ数える(同じCRTのDLLを使う OpenCV などの確保も含む)。
+// Releaseビルドでは数えずに "-" を表示する。
+// フックはプロセス全体に掛かるので、計測中にほかのスレッドが確保した回数も含まれる。
+class KernelBenchmark
+{
+public:
+
+  // コンストラクタ
+  //   iterations : 計測する回数
+  //   warmUp     : 計測の前に実行する回数
+  KernelBenchmark( int iterations = 100, int warmUp = 10 )
+    : iterations_( iterations )
+    , warmUp_( warmUp )
+#ifdef _DEBUG
+    , previousHook_( 0 )
+#endif
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+  }
+
+  // 結果の見出しを表示する
+  void printHeader( std::ostream& out, const std::string& title ) const
+  {
+    out << "[" << title << "] (ns/frame, allocations/frame)" << std::endl;
+  }
+
+  // 計測する(1フレームあたりの平均の処理時間(ナノ秒)を返す)
+  //   kernel : 計測する処理(引数は実行した回数)
+  template< typename Kernel >
+  double run( const std::string& name, Kernel kernel )
+  {
+    return run( name, []( int ) {}, kernel );
+  }
+
+  // 毎回準備をしてから計測する(準備の時間と確保した回数は含めない)
+  //   prepare : 次のフレームを用意する処理(引数は実行した回数)
+  //   kernel  : 計測する処理(引数は実行した回数)
+  template< typename Prepare, typename Kernel >
+  double run( const std::string& name, Prepare prepare, Kernel kernel )
+  {
+    for ( int i = 0; i < warmUp_; ++i ) {
+      prepare( i );
+      kernel( i );
+    }
+
+    LONGLONG total = 0;
+    LONGLONG best = 0;
+    LONG allocations = 0;
+    for ( int i = 0; i < iterations_; ++i ) {
+      prepare( warmUp_ + i );
+
+      LONG count = beginCount();
+      LARGE_INTEGER start;
+      ::QueryPerformanceCounter( &start );
+
+      kernel( warmUp_ + i );
+
+      LARGE_INTEGER end;
+      ::QueryPerformanceCounter( &end );
+      LONG allocated = endCount( count );
+      allocations = (allocated < 0) ? -1 : (allocations + allocated);
+
+      LONGLONG elapsed = end.QuadPart - start.QuadPart;
+      total += elapsed;
+      best = (i == 0) ? elapsed : std::min( best, elapsed );
+    }
+
+    print( std::cout, name, total, best, allocations );
+    return toNanoseconds( total ) / iterations_;
+  }
+
+private:
+
+  void print( std::ostream& out, const std::string& name, LONGLONG total, LONGLONG best, LONG allocations ) const
+  {
+    out << "  " << std::setw( 20 ) << std::left << name << std::right
+        << std::fixed << std::setprecision( 0 )
+        << " mean " << std::setw( 10 ) << toNanoseconds( total ) / iterations_
+        << "  min " << std::setw( 10 ) << toNanoseconds( best )
+        << "  alloc ";
+    if ( allocations >= 0 ) {
+      out << std::setprecision( 1 ) << std::setw( 8 ) << (double)allocations / iterations_;
+    }
+    else {
+      out << std::setw( 8 ) << "-";
+    }
+    out << std::endl;
+  }
+
+  double toNanoseconds( LONGLONG counter ) const
+  {
+    return counter * 1000000000.0 / frequency_.QuadPart;
+  }
+
+#ifdef _DEBUG
+  // 確保した回数を数え始める(数え始めたときの回数を返す)
+  LONG beginCount()
+  {
+    previousHook_ = _CrtSetAllocHook( &allocHook );
+    return allocationCount();
+  }
+
+  // 数え始めてから確保した回数(-1は数えていない)
+  LONG endCount( LONG count )
+  {
+    LONG current = allocationCount();
+    _CrtSetAllocHook( previousHook_ );
+    return current - count;
+  }
+
+  static volatile LONG& allocationCounter()
+  {
+    static volatile LONG counter = 0;
+    return counter;
+  }
+
+  static LONG allocationCount()
+  {
+    return ::InterlockedCompareExchange( &allocationCounter(), 0, 0 );
+  }
+
+  static int __cdecl allocHook( int allocType, void* userData, size_t size, int blockType,
+    long requestNumber, const unsigned char* fileName, int lineNumber )
+  {
+    // CRT内部の確保は数えない
+    if ( (blockType != _CRT_BLOCK) && ((allocType == _HOOK_ALLOC) || (allocType == _HOOK_REALLOC)) ) {
+      ::InterlockedIncrement( &allocationCounter() );
+    }
+
+    return TRUE;
+  }
+#else
+  // Releaseビルドでは数えない
+  LONG beginCount()
+  {
+    return 0;
+  }
+
+  LONG endCount( LONG count )
+  {
+    return -1;
+  }
+#endif
+
+private:
+
+  int iterations_;
+  int warmUp_;
+
+#ifdef _DEBUG
+  _CRT_ALLOC_HOOK previousHook_;
+#endif
+
+  LARGE_INTEGER frequency_;
+};
@@ -1,162 +1,360 @@
 ﻿#include "KinectControl.h"
 
 KinectControl::KinectControl()
+  : source( 0 )
+  , sink( &screen )
+  , viewer( 0 )
+  , depthImageKernel( 0 )
+  , volumeResolution( 0 )
+  , cameraPose( RigidTransform::identity() )
+  , exportFormat( CLOUD_FORMAT_PCD )
 {
 }
 
 KinectControl::~KinectControl()
 {
-  if ( kinect != 0 ) {
-    kinect->NuiShutdown();
-    kinect->Release();
-  }
 }
 
-void KinectControl::initialize()
+void KinectControl::initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution )
 {
-  createInstance();
+  // Kinectを初期化する
+  kinect.initialize( colorResolution, depthResolution );
+
+  initialize( &kinect );
+}
 
-  // Kinectの設定を初期化する
-  ERROR_CHECK( kinect->NuiInitialize( NUI_INITIALIZE_FLAG_USES_COLOR | NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON ) );
+void KinectControl::initialize( FrameSource* frameSource )
+{
+  source = frameSource;
 
-  // RGBカメラを初期化する
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR, CAMERA_RESOLUTION, 0, 2, 0, &imageStreamHandle ) );
+  // 指定した解像度の、画面サイズを取得する
+  ::NuiImageResolutionToSize( source->getColorResolution(), width, height );
 
-  // 距離カメラを初期化する
-  ERROR_CHECK( kinect->NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, CAMERA_RESOLUTION, 0, 2, 0, &depthStreamHandle ) );
+  // 距離カメラからRGBカメラへの座標変換テーブルを作成する
+  registration.initialize( *source, source->getColorResolution(), source->getDepthResolution() );
 
-  // フレーム更新イベントのハンドルを作成する
-  streamEvent = ::CreateEvent( 0, TRUE, FALSE, 0 );
-  ERROR_CHECK( kinect->NuiSetFrameEndEvent( streamEvent, 0 ) );
+  // 距離画像から3次元の点への変換テーブルを作成する
+  backProjector.initialize( source->getDepthResolution() );
+  clouds.initialize( backProjector.getWidth(), backProjector.getHeight() );
 
-  // 指定した解像度の、画面サイズを取得する
-  ::NuiImageResolutionToSize(CAMERA_RESOLUTION, width, height );
+  // 距離画像を統合するボリュームを作成する
+  if ( volumeResolution > 0 ) {
+    volume.initialize( source->getDepthResolution(), volumeResolution );
+  }
 
-  // PointCloudビューワを初期化
-  viewer = new pcl::visualization::CloudViewer("Kinect Point Cloud");
+  // ポイントクラウドの書き出しを始める
+  if ( !exportPath.empty() ) {
+    exporter.open( exportFormat, exportPath, backProjector.getWidth() * backProjector.getHeight() );
+  }
+
+  // 解像度の組み合わせに合わせた処理を選ぶ
+  KernelSelector selector = { this };
+  dispatchFrameSize( source->getDepthResolution(), source->getColorResolution(), selector );
 }
 
-void KinectControl::createInstance()
+// 画像の出力先を指定する(指定しない場合は画面に表示する)
+void KinectControl::setSink( FrameSink* frameSink )
 {
-  // 接続されているKinectの数を取得する
-  int count = 0;
-  ERROR_CHECK( ::NuiGetSensorCount( &count ) );
-  if ( count == 0 ) {
-    throw std::runtime_error( "Kinect を接続してください" );
-  }
+  sink = frameSink;
+}
 
-  // 最初のKinectのインスタンスを作成する
-  ERROR_CHECK( ::NuiCreateSensorByIndex( 0, &kinect ) );
+// ポイントクラウドを間引くボクセルの大きさを指定する(m、0の場合は間引かない)
+void KinectControl::setLeafSize( float leafSize )
+{
+  downsampler.setLeafSize( leafSize );
+}
 
-  // Kinectの状態を取得する
-  HRESULT status = kinect->NuiStatus();
-  if ( status != S_OK ) {
-    throw std::runtime_error( "Kinect が利用可能ではありません" );
-  }
+// 距離画像を統合するボリュームの、1辺のボクセルの数を指定する(0の場合は統合しない)
+// initialize より前に呼ぶ
+void KinectControl::setVolumeResolution( int resolution )
+{
+  volumeResolution = resolution;
+}
+
+// ポイントクラウドをファイルに書き出す(initialize より前に呼ぶ)
+void KinectControl::setExport( CloudFormat format, const std::string& path )
+{
+  exportFormat = format;
+  exportPath = path;
+}
+
+// 法線を求める窓の半径を指定する(画素、0の場合は求めない)
+void KinectControl::setNormalRadius( int radius )
+{
+  normalEstimator.setSmoothingRadius( radius );
 }
 
 void KinectControl::run()
 {
-  // メインループ
-  while ( 1 ) {
-    // データの更新を待つ
-    DWORD ret = ::WaitForSingleObject( streamEvent, INFINITE );
-    ::ResetEvent( streamEvent );
+  // PointCloudビューワを初期化(画面に表示しない場合は作成しない)
+  if ( sink->isVisible() ) {
+    viewer = new pcl::visualization::CloudViewer("Kinect Point Cloud");
+  }
 
+  // メインループ
+  // データの更新を待つ
+  while ( source->waitFrame() ) {
     setRgbImage( rgbImage );
     setDepthImage( depthImage );
 
-    // 画像を表示する
-    cv::imshow( "RGBCamera", rgbImage );
-    cv::imshow( "DepthCamera", depthImage );
+    // 画像を出力する
+    sink->present( "RGBCamera", rgbImage );
+    sink->present( "DepthCamera", depthImage );
 
-    // ポイントクラウドを表示する
-    viewer->showCloud(cloud);
+    // 最後に作成したポイントクラウドを表示する
+    if ( viewer != 0 ) {
+      viewer->showCloud( clouds.latest() );
+    }
 
-    // 終了のためのキー入力チェック兼、表示のためのウェイト
-    int key = cv::waitKey( 10 );
-    if ( key == 'q' ) {
+    // 終了を要求された場合は終わる
+    if ( !sink->endFrame() ) {
       break;
     }
   }
+
+  downsampler.printStatistics( std::cout );
+  normalEstimator.printStatistics( std::cout );
+
+  if ( exporter.isOpen() ) {
+    exporter.close();
+    exporter.printStatistics( std::cout );
+  }
+}
+
+// ポイントクラウドの作成の処理時間を計測する(表示はしない)
+void KinectControl::benchmark( KernelBenchmark& kernelBenchmark )
+{
+  kernelBenchmark.printHeader( std::cout, "UsePCL" );
+
+  // 毎回次のフレームを取得する(取得の時間は含めない)
+  kernelBenchmark.run( "setDepthImage",
+    [&]( int i ) {
+      if ( !source->waitFrame() ) {
+        throw std::runtime_error( "計測に使うフレームがありません" );
+      }
+
+      setRgbImage( rgbImage );
+    },
+    [&]( int i ) {
+      setDepthImage( depthImage );
+    } );
+
+  // 3次元の点への変換だけを、1画素ごとにSDKを呼び出して追加する方法と比較する
+  FrameHandle depthFrame;
+  auto nextDepthFrame = [&]( int i ) {
+    if ( !source->waitFrame() ) {
+      throw std::runtime_error( "計測に使うフレームがありません" );
+    }
+
+    ERROR_CHECK( source->acquireDepthFrame( depthFrame ) );
+    depthUnpacker.unpack( (USHORT*)depthFrame.bits(), backProjector.getWidth(), backProjector.getHeight() );
+  };
+
+  const NUI_IMAGE_RESOLUTION depthResolution = source->getDepthResolution();
+  pcl::PointCloud<pcl::PointXYZRGBA>::Ptr sdkCloud;
+  auto projectSdk = [&]( int i ) {
+    const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+    sdkCloud.reset( new pcl::PointCloud<pcl::PointXYZRGBA> );
+    for ( LONG y = 0; y < (LONG)backProjector.getHeight(); ++y ) {
+      for ( LONG x = 0; x < (LONG)backProjector.getWidth(); ++x ) {
+        USHORT depth = distance[(y * backProjector.getWidth()) + x] << NUI_IMAGE_PLAYER_INDEX_SHIFT;
+        Vector4 real = NuiTransformDepthImageToSkeleton( x, y, depth, depthResolution );
+        pcl::PointXYZRGBA point;
+        point.x = real.x;
+        point.y = -real.y;
+        point.z = real.z;
+        sdkCloud->push_back( point );
+      }
+    }
+  };
+
+  pcl::PointCloud<pcl::PointXYZRGBA> rayCloud;
+  auto projectRay = [&]( int i ) {
+    backProjector.project( (const USHORT*)depthUnpacker.getDistance().data, rayCloud );
+  };
+
+  kernelBenchmark.run( "backProject(sdk)", nextDepthFrame, projectSdk );
+  kernelBenchmark.run( "backProject(ray)", nextDepthFrame, projectRay );
+
+  // 同じフレームで、変換結果の誤差を確認する(距離が取れている画素だけ)
+  nextDepthFrame( 0 );
+  projectSdk( 0 );
+  projectRay( 0 );
+  float maxError = 0;
+  const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+  for ( size_t i = 0; i < rayCloud.points.size(); ++i ) {
+    if ( distance[i] != 0 ) {
+      const pcl::PointXYZRGBA& p = rayCloud.points[i];
+      const pcl::PointXYZRGBA& q = sdkCloud->points[i];
+      maxError = std::max( maxError, std::max( std::abs( p.x - q.x ), std::max( std::abs( p.y - q.y ), std::abs( p.z - q.z ) ) ) );
+    }
+  }
+
+  std::cout << "  max error : " << maxError * 1000 << " mm" << std::endl;
+
+  // ボクセルの大きさごとに、間引く処理を計測する
+  const float leafSizes[] = { 0.01f, 0.02f, 0.05f };
+  for ( int n = 0; n < (int)(sizeof(leafSizes) / sizeof(leafSizes[0])); ++n ) {
+    VoxelDownsampler voxel;
+    voxel.setLeafSize( leafSizes[n] );
+
+    pcl::PointCloud<pcl::PointXYZRGBA> downsampled;
+    std::stringstream name;
+    name << "downsample(" << leafSizes[n] << ")";
+    kernelBenchmark.run( name.str(),
+      [&]( int i ) {
+        nextDepthFrame( i );
+        projectRay( i );
+      },
+      [&]( int i ) {
+        voxel.filter( rayCloud, downsampled );
+      } );
+
+    voxel.printStatistics( std::cout );
+  }
+
+  // 窓の大きさごとに、法線の推定を計測する
+  const int normalRadii[] = { 2, 5, 10 };
+  for ( int n = 0; n < (int)(sizeof(normalRadii) / sizeof(normalRadii[0])); ++n ) {
+    IntegralNormalEstimator estimator;
+    estimator.setSmoothingRadius( normalRadii[n] );
+
+    pcl::PointCloud<pcl::Normal> estimated;
+    std::stringstream name;
+    name << "normals(" << normalRadii[n] << ")";
+    kernelBenchmark.run( name.str(),
+      [&]( int i ) {
+        nextDepthFrame( i );
+        projectRay( i );
+      },
+      [&]( int i ) {
+        estimator.compute( rayCloud, estimated );
+      } );
+  }
+
+  // ボリュームの大きさごとに、距離画像の統合とポイントクラウドの作成を計測する
+  const int volumeResolutions[] = { 128, 256 };
+  for ( int n = 0; n < (int)(sizeof(volumeResolutions) / sizeof(volumeResolutions[0])); ++n ) {
+    TsdfVolume fusion;
+    fusion.initialize( source->getDepthResolution(), volumeResolutions[n] );
+
+    std::stringstream name;
+    name << "tsdf" << volumeResolutions[n];
+    double integrateTime = kernelBenchmark.run( name.str() + "(integrate)", nextDepthFrame,
+      [&]( int i ) {
+        fusion.integrate( (const USHORT*)depthUnpacker.getDistance().data, cameraPose );
+      } );
+    double raycastTime = kernelBenchmark.run( name.str() + "(raycast)",
+      [&]( int i ) {
+        fusion.raycast( cameraPose, rayCloud );
+      } );
+
+    std::cout << "  " << volumeResolutions[n] << "^3 : "
+              << std::fixed << std::setprecision( 1 ) << (1000000000.0 / (integrateTime + raycastTime)) << " frames/s, "
+              << (fusion.getMemoryUsage() / (1024 * 1024)) << " MB" << std::endl;
+    std::cout.unsetf( std::ios::floatfield );
+  }
 }
 
 void KinectControl::setRgbImage( cv::Mat& image )
 {
   try {
     // RGBカメラのフレームデータを取得する
-    NUI_IMAGE_FRAME imageFrame = { 0 };
-    ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( imageStreamHandle, 0, &imageFrame ) );
-
-    // 画像データを取得する
-    NUI_LOCKED_RECT colorData;
-    imageFrame.pFrameTexture->LockRect( 0, &colorData, 0, 0 );
-
-    // 画像データをコピーする
-    image = cv::Mat( height, width, CV_8UC4, colorData.pBits );
+    // (次のフレームを取得するまで rgbFrame がバッファを保持する)
+    ERROR_CHECK( source->acquireColorFrame( rgbFrame ) );
 
-    // フレームデータを解放する
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( imageStreamHandle, &imageFrame ) );
+    // 画像データをコピーせずに参照する
+    image = cv::Mat( height, width, CV_8UC4, rgbFrame.bits() );
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
   }
 }
 
+void KinectControl::setDepthImage( cv::Mat& image )
+{
+  (this->*depthImageKernel)( image );
+}
+
+template< typename DepthSize, typename ColorSize >
 void KinectControl::setDepthImage( cv::Mat& image )
 {
   try {
-    // ポイントクラウド準備
-    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr points(new pcl::PointCloud<pcl::PointXYZRGBA>);
-    points->width = width;
-    points->height = height;
+    // ポイントクラウド準備(作成済みのクラウドに書き込む。間引く場合は、間引く前のクラウドに書き込む)
+    pcl::PointCloud<pcl::PointXYZRGBA>& cloud = downsampler.isEnabled() ? fullCloud : clouds.back();
 
-    // 距離画像準備
-    image = cv::Mat( height, width, CV_8UC1, cv::Scalar( 0 ) );
+    // 距離画像準備(RGBカメラの座標に合わせる)
+    image = cv::Mat( ColorSize::HEIGHT, ColorSize::WIDTH, CV_8UC1, cv::Scalar( 0 ) );
 
     // 距離カメラのフレームデータを取得する
-    NUI_IMAGE_FRAME depthFrame = { 0 };
-    ERROR_CHECK( kinect->NuiImageStreamGetNextFrame( depthStreamHandle, 0, &depthFrame ) );
-
-    // 距離データを取得する
-    NUI_LOCKED_RECT depthData = { 0 };
-    depthFrame.pFrameTexture->LockRect( 0, &depthData, 0, 0 );
-
-    USHORT* depth = (USHORT*)depthData.pBits;
-    for ( int i = 0; i < (depthData.size / sizeof(USHORT)); ++i ) {
-      USHORT distance = ::NuiDepthPixelToDepth( depth[i] );
-
-      LONG depthX = i % width;
-      LONG depthY = i / width;
-      LONG colorX = depthX;
-      LONG colorY = depthY;
-
-      // 距離カメラの座標を、RGBカメラの座標に変換する
-      kinect->NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution( CAMERA_RESOLUTION, CAMERA_RESOLUTION, 0, depthX , depthY, 0, &colorX, &colorY );
-
-      // 距離画像作成
-      image.at<UCHAR>( colorY, colorX ) = distance / 8192.0 * 255.0;
-
-      // ポイントクラウド
-      Vector4 real = NuiTransformDepthImageToSkeleton(depthX, depthY, distance, CAMERA_RESOLUTION);
-      pcl::PointXYZRGBA point;
-      point.x = real.x;
-      point.y = -real.y;
-      point.z = real.z;
-
-      // テクスチャ
-      cv::Vec4b color = rgbImage.at<cv::Vec4b>(colorY, colorX);
-      point.r = color[2];
-      point.g = color[1];
-      point.b = color[0];
-      points->push_back(point);
+    ImageFrame depthFrame = { 0 };
+    ERROR_CHECK( source->getDepthFrame( depthFrame ) );
+
+    // 距離データを、距離とプレイヤーの画像に分ける
+    depthUnpacker.unpack( (USHORT*)depthFrame.bits, DepthSize::WIDTH, DepthSize::HEIGHT );
+    const USHORT* distance = (const USHORT*)depthUnpacker.getDistance().data;
+
+    if ( volumeResolution > 0 ) {
+      // 距離画像をボリュームに統合し、統合したモデルを同じ視点から見たポイントクラウドにする
+      // (Kinectは動かさないので、カメラの位置は原点のまま)
+      volume.integrate( distance, cameraPose );
+      volume.raycast( cameraPose, cloud );
+    }
+    else {
+      // ポイントクラウド(距離が取れていない点は NaN)
+      backProjector.project( distance, cloud );
+    }
+
+    for ( LONG depthY = 0; depthY < DepthSize::HEIGHT; ++depthY ) {
+      for ( LONG depthX = 0; depthX < DepthSize::WIDTH; ++depthX ) {
+        int i = (depthY * DepthSize::WIDTH) + depthX;
+        LONG colorX = depthX;
+        LONG colorY = depthY;
+
+        // 距離カメラの座標を、RGBカメラの座標に変換する(変換テーブルを参照する)
+        registration.getColorPixel( i, 0, colorX, colorY );
+
+        // 距離画像作成
+        image.at<UCHAR>( colorY, colorX ) = distance[i] / 8192.0 * 255.0;
+
+        // テクスチャ
+        cv::Vec4b color = rgbImage.at<cv::Vec4b>(colorY, colorX);
+        pcl::PointXYZRGBA& point = cloud.points[i];
+        point.r = color[2];
+        point.g = color[1];
+        point.b = color[0];
+      }
+    }
+
+    // 法線を求めて、法線の向きで色を付ける(-1～1 を 0～255 に)
+    if ( normalEstimator.isEnabled() ) {
+      normalEstimator.compute( cloud, normals );
+      for ( size_t i = 0; i < normals.points.size(); ++i ) {
+        const pcl::Normal& normal = normals.points[i];
+        if ( normal.normal_z == normal.normal_z ) {
+          pcl::PointXYZRGBA& point = cloud.points[i];
+          point.r = (UCHAR)((normal.normal_x + 1) * 127.5f);
+          point.g = (UCHAR)((normal.normal_y + 1) * 127.5f);
+          point.b = (UCHAR)((normal.normal_z + 1) * 127.5f);
+        }
+      }
+    }
+
+    // 間引く場合は、間引いたクラウドを作成する
+    if ( downsampler.isEnabled() ) {
+      downsampler.filter( fullCloud, clouds.back() );
+    }
+
+    // ファイルに書き出す(マップ済みの領域に書き込むだけで、ディスクへの書き込みは待たない)
+    if ( exporter.isOpen() ) {
+      exporter.write( downsampler.isEnabled() ? clouds.back() : cloud, depthFrame.timeStamp );
     }
 
-    // ポイントクラウドをコピー
-    cloud = points;
+    // 書き終わったポイントクラウドを渡す
+    clouds.publish();
 
     // フレームデータを解放する
-    ERROR_CHECK( kinect->NuiImageStreamReleaseFrame( depthStreamHandle, &depthFrame ) );
+    ERROR_CHECK( source->releaseDepthFrame( depthFrame ) );
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;
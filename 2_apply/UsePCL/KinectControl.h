@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <sstream>
 
@@ -18,7 +20,18 @@
   throw std::runtime_error(ss.str().c_str());                     \
   }
 
-const NUI_IMAGE_RESOLUTION CAMERA_RESOLUTION = NUI_IMAGE_RESOLUTION_640x480;
+#include "CloudBuffer.h"
+#include "CloudExporter.h"
+#include "DepthBackProjector.h"
+#include "DepthColorRegistration.h"
+#include "DepthUnpack.h"
+#include "FrameResolution.h"
+#include "FrameSink.h"
+#include "IntegralNormalEstimator.h"
+#include "KernelBenchmark.h"
+#include "KinectFrameSource.h"
+#include "TsdfVolume.h"
+#include "VoxelDownsampler.h"
 
 class KinectControl
 {
@@ -26,24 +39,75 @@ public:
   KinectControl(void);
   ~KinectControl(void);
 
-  void initialize();
+  void initialize( NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution );
+  void initialize( FrameSource* frameSource );
+  void setSink( FrameSink* frameSink );
+  void setLeafSize( float leafSize );
+  void setVolumeResolution( int resolution );
+  void setExport( CloudFormat format, const std::string& path );
+  void setNormalRadius( int radius );
   void run();
+  void benchmark( KernelBenchmark& kernelBenchmark );
 
 private:
-  INuiSensor *kinect;
-  HANDLE imageStreamHandle;
-  HANDLE depthStreamHandle;
-  HANDLE streamEvent;
+  KinectFrameSource kinect;
+  FrameSource* source;
+  ScreenFrameSink screen;
+  FrameSink* sink;
 
+  // RGBカメラの画面サイズ
   DWORD width;
   DWORD height;
 
-  void createInstance();
+  DepthColorRegistration registration;
+  DepthUnpacker depthUnpacker;
+  DepthBackProjector backProjector;
+  VoxelDownsampler downsampler;
+
+  // 距離画像を統合するボリューム(1辺のボクセルの数が0の場合は統合しない)
+  int volumeResolution;
+  TsdfVolume volume;
+  RigidTransform cameraPose;
+
+  // 法線の推定(窓の半径が0の場合は求めない)
+  IntegralNormalEstimator normalEstimator;
+  pcl::PointCloud<pcl::Normal> normals;
+
+  // ポイントクラウドの書き出し(書き出し先が空の場合は書き出さない)
+  CloudFormat exportFormat;
+  std::string exportPath;
+  CloudExporter exporter;
+
   void setRgbImage(cv::Mat &image);
   void setDepthImage(cv::Mat &image);
 
+  // 画像の大きさを定数にした setDepthImage(解像度の組み合わせごとに実体化する)
+  template< typename DepthSize, typename ColorSize >
+  void setDepthImage( cv::Mat& image );
+
+  // 解像度に合わせて選んだ setDepthImage
+  void (KinectControl::*depthImageKernel)( cv::Mat& image );
+
+  // 解像度の組み合わせが決まったら、その大きさの処理を選ぶ
+  struct KernelSelector
+  {
+    KinectControl* owner;
+
+    template< typename DepthSize, typename ColorSize >
+    void operator()( DepthSize, ColorSize )
+    {
+      owner->depthImageKernel = &KinectControl::setDepthImage< DepthSize, ColorSize >;
+    }
+  };
+
+  FrameHandle rgbFrame;
   cv::Mat rgbImage;
   cv::Mat depthImage;
-  pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloud;
+
+  // 作成したポイントクラウドの受け渡し(作成済みのクラウドを使いまわす)
+  CloudBuffer<pcl::PointXYZRGBA> clouds;
+
+  // 間引く前のポイントクラウド(間引く場合だけ使う)
+  pcl::PointCloud<pcl::PointXYZRGBA> fullCloud;
   pcl::visualization::CloudViewer *viewer;
 };
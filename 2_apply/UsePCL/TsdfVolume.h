@@ -0,0 +1,479 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <pcl\point_types.h>
+
+// 剛体変換(回転と平行移動)
+struct RigidTransform
+{
+  float rotation[3][3];
+  float translation[3];
+
+  // 何もしない変換
+  static RigidTransform identity()
+  {
+    RigidTransform result;
+    for ( int i = 0; i < 3; ++i ) {
+      for ( int j = 0; j < 3; ++j ) {
+        result.rotation[i][j] = (i == j) ? 1.0f : 0.0f;
+      }
+      result.translation[i] = 0;
+    }
+
+    return result;
+  }
+
+  // 逆変換
+  RigidTransform inverse() const
+  {
+    RigidTransform result;
+    for ( int i = 0; i < 3; ++i ) {
+      for ( int j = 0; j < 3; ++j ) {
+        result.rotation[i][j] = rotation[j][i];
+      }
+    }
+
+    for ( int i = 0; i < 3; ++i ) {
+      result.translation[i] = -(result.rotation[i][0] * translation[0] +
+                                result.rotation[i][1] * translation[1] +
+                                result.rotation[i][2] * translation[2]);
+    }
+
+    return result;
+  }
+
+  // 向きを変換する(平行移動しない)
+  void rotate( const float in[3], float out[3] ) const
+  {
+    for ( int i = 0; i < 3; ++i ) {
+      out[i] = rotation[i][0] * in[0] + rotation[i][1] * in[1] + rotation[i][2] * in[2];
+    }
+  }
+
+  // 点を変換する
+  void transform( const float in[3], float out[3] ) const
+  {
+    rotate( in, out );
+    for ( int i = 0; i < 3; ++i ) {
+      out[i] += translation[i];
+    }
+  }
+};
+
+// 距離画像を統合する、切り捨て符号付き距離(TSDF)のボリューム
+//
+// カメラの前に置いた立方体をボクセルに分け、各ボクセルに表面までの距離(切り捨て距離で
+// -1～1に正規化、表面の手前が正)と重みを持つ。フレームごとに、各ボクセルを距離画像に
+// 投影して距離の差を求め、重み付きの平均で統合する。統合したモデルは、光線を飛ばして
+// 距離が正から負に変わる位置を求めることで、ポイントクラウドとして取り出す。
+//
+// 統合はZのスライスごと、取り出しは行ごとに Concurrency::parallel_for で並列に行い、
+// 統合の投影はSSE2で4ボクセルずつ行う。座標は DepthBackProjector と同じ(m、Yは下向き)。
+// メモリはボクセルあたり3バイト(128^3 で 6MB、256^3 で 48MB)。
+class TsdfVolume
+{
+public:
+
+  TsdfVolume()
+    : isSse2_( ::IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE )
+    , width_( 0 )
+    , height_( 0 )
+    , resolution_( 0 )
+    , voxelSize_( 0 )
+    , truncation_( 0 )
+  {
+  }
+
+  // ボリュームを作成する
+  //   depthResolution  : 距離カメラの解像度
+  //   volumeResolution : 1辺のボクセルの数
+  //   volumeSize       : 1辺の長さ(m)
+  //   nearDistance     : カメラからボリュームの手前の面までの距離(m)
+  void initialize( NUI_IMAGE_RESOLUTION depthResolution, int volumeResolution,
+    float volumeSize = 2.0f, float nearDistance = 0.8f )
+  {
+    ::NuiImageResolutionToSize( depthResolution, width_, height_ );
+
+    // 距離1mの左上と右下の画素の光線から、距離カメラの焦点距離と中心を求める
+    const USHORT depth = (USHORT)(1000 << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+    Vector4 first = ::NuiTransformDepthImageToSkeleton( 0, 0, depth, depthResolution );
+    Vector4 last = ::NuiTransformDepthImageToSkeleton( width_ - 1, height_ - 1, depth, depthResolution );
+    const float firstX = first.x / first.z;
+    const float firstY = -first.y / first.z;
+    fx_ = (width_ - 1) / (last.x / last.z - firstX);
+    fy_ = (height_ - 1) / (-last.y / last.z - firstY);
+    cx_ = -firstX * fx_;
+    cy_ = -firstY * fy_;
+
+    resolution_ = volumeResolution;
+    voxelSize_ = volumeSize / volumeResolution;
+    truncation_ = voxelSize_ * TRUNCATION_VOXELS;
+    origin_[0] = -volumeSize / 2;
+    origin_[1] = -volumeSize / 2;
+    origin_[2] = nearDistance;
+
+    const size_t count = (size_t)resolution_ * resolution_ * resolution_;
+    tsdf_.assign( count, 0 );
+    weight_.assign( count, 0 );
+  }
+
+  // 引数からボリュームの1辺のボクセルの数を取り出す
+  //   -tsdf <数>  1辺のボクセルの数(128、256 など。指定しない場合は0、統合しない)
+  //   取り出した引数は argv から取り除き、argc を減らす
+  static int selectResolution( int& argc, char* argv[] )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-tsdf" ) {
+        int resolution = atoi( argv[i + 1] );
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return resolution;
+      }
+    }
+
+    return 0;
+  }
+
+  // 統合したモデルを消す
+  void reset()
+  {
+    std::fill( tsdf_.begin(), tsdf_.end(), (SHORT)0 );
+    std::fill( weight_.begin(), weight_.end(), (BYTE)0 );
+  }
+
+  int getResolution() const
+  {
+    return resolution_;
+  }
+
+  // ボリュームが使うメモリ(バイト)
+  size_t getMemoryUsage() const
+  {
+    return tsdf_.size() * sizeof(SHORT) + weight_.size() * sizeof(BYTE);
+  }
+
+  // 距離画像を統合する
+  //   distance   : DepthUnpacker で分けた距離の画像のデータ(mm)
+  //   cameraPose : カメラの座標からボリュームの座標への変換
+  void integrate( const USHORT* distance, const RigidTransform& cameraPose )
+  {
+    const RigidTransform worldToCamera = cameraPose.inverse();
+
+    // X方向に1ボクセル進んだときの、カメラの座標での移動量
+    const float voxelX[3] = { voxelSize_, 0, 0 };
+    float step[3];
+    worldToCamera.rotate( voxelX, step );
+
+    Concurrency::parallel_for( 0, resolution_, [&]( int z ) {
+      for ( int y = 0; y < resolution_; ++y ) {
+        // 行の先頭のボクセルの中心の、カメラの座標
+        const float center[3] = {
+          origin_[0] + 0.5f * voxelSize_,
+          origin_[1] + (y + 0.5f) * voxelSize_,
+          origin_[2] + (z + 0.5f) * voxelSize_,
+        };
+        float base[3];
+        worldToCamera.transform( center, base );
+
+        const size_t row = ((size_t)z * resolution_ + y) * resolution_;
+        int x = 0;
+        if ( isSse2_ ) {
+          x = integrateRowSse2( distance, base, step, row );
+        }
+
+        integrateRowScalar( distance, base, step, row, x );
+      }
+    } );
+  }
+
+  // 統合したモデルを、カメラの位置から見たポイントクラウドにする
+  //   cloud : 書き込むポイントクラウド(距離画像と同じ大きさ、表面がない画素は NaN)
+  //   色は書き込まない
+  template< typename PointT >
+  void raycast( const RigidTransform& cameraPose, pcl::PointCloud< PointT >& cloud ) const
+  {
+    const int count = width_ * height_;
+    if ( (cloud.width != width_) || (cloud.height != height_) || ((int)cloud.points.size() != count) ) {
+      cloud.points.resize( count );
+      cloud.width = width_;
+      cloud.height = height_;
+    }
+    cloud.is_dense = false;
+
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+    Concurrency::parallel_for( 0, (int)height_, [&]( int v ) {
+      for ( int u = 0; u < (int)width_; ++u ) {
+        // カメラの座標での光線(Z = 1)
+        const float ray[3] = { (u - cx_) / fx_, (v - cy_) / fy_, 1.0f };
+        const float z = castRay( cameraPose, ray );
+
+        PointT& point = cloud.points[(v * width_) + u];
+        if ( z > 0 ) {
+          point.x = ray[0] * z;
+          point.y = ray[1] * z;
+          point.z = z;
+        }
+        else {
+          point.x = point.y = point.z = nan;
+        }
+      }
+    } );
+  }
+
+private:
+
+  enum
+  {
+    TRUNCATION_VOXELS = 4,  // 切り捨て距離(ボクセルの数)
+    MAX_WEIGHT = 64,        // 重みの上限(動くものが残り続けないようにする)
+    TSDF_SCALE = 32767,     // -1～1 を SHORT で持つための倍率
+  };
+
+  // 1行を4ボクセルずつ統合する(統合した数を返す)
+  int integrateRowSse2( const USHORT* distance, const float base[3], const float step[3], size_t row )
+  {
+    const __m128 lane = _mm_set_ps( 3, 2, 1, 0 );
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps( 1.0f );
+    const __m128 fx = _mm_set1_ps( fx_ );
+    const __m128 fy = _mm_set1_ps( fy_ );
+    const __m128 cx = _mm_set1_ps( cx_ + 0.5f );
+    const __m128 cy = _mm_set1_ps( cy_ + 0.5f );
+    const __m128 width = _mm_set1_ps( (float)width_ );
+    const __m128 height = _mm_set1_ps( (float)height_ );
+
+    int pixel[4];
+    float depth[4];
+
+    int x = 0;
+    for ( ; x + 4 <= resolution_; x += 4 ) {
+      const __m128 index = _mm_add_ps( _mm_set1_ps( (float)x ), lane );
+      const __m128 px = _mm_add_ps( _mm_set1_ps( base[0] ), _mm_mul_ps( index, _mm_set1_ps( step[0] ) ) );
+      const __m128 py = _mm_add_ps( _mm_set1_ps( base[1] ), _mm_mul_ps( index, _mm_set1_ps( step[1] ) ) );
+      const __m128 pz = _mm_add_ps( _mm_set1_ps( base[2] ), _mm_mul_ps( index, _mm_set1_ps( step[2] ) ) );
+
+      // 距離画像に投影する
+      const __m128 inverseZ = _mm_div_ps( one, pz );
+      const __m128 u = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( px, inverseZ ), fx ), cx );
+      const __m128 v = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( py, inverseZ ), fy ), cy );
+
+      // カメラより前にあり、画面の中に投影されるボクセルだけを統合する
+      const __m128 inside = _mm_and_ps(
+        _mm_and_ps( _mm_cmpgt_ps( pz, zero ), _mm_and_ps( _mm_cmpge_ps( u, zero ), _mm_cmplt_ps( u, width ) ) ),
+        _mm_and_ps( _mm_cmpge_ps( v, zero ), _mm_cmplt_ps( v, height ) ) );
+      const int mask = _mm_movemask_ps( inside );
+      if ( mask == 0 ) {
+        continue;
+      }
+
+      // 画素の番号(画面の中では u、v は正なので、切り捨てで整数にする)
+      const __m128 ui = _mm_cvtepi32_ps( _mm_cvttps_epi32( u ) );
+      const __m128 vi = _mm_cvtepi32_ps( _mm_cvttps_epi32( v ) );
+      _mm_storeu_si128( (__m128i*)pixel, _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( vi, width ), ui ) ) );
+      _mm_storeu_ps( depth, pz );
+
+      for ( int k = 0; k < 4; ++k ) {
+        if ( (mask & (1 << k)) != 0 ) {
+          updateVoxel( row + x + k, distance[pixel[k]], depth[k] );
+        }
+      }
+    }
+
+    return x;
+  }
+
+  // 1行の残りを1ボクセルずつ統合する
+  void integrateRowScalar( const USHORT* distance, const float base[3], const float step[3], size_t row, int x )
+  {
+    for ( ; x < resolution_; ++x ) {
+      const float pz = base[2] + x * step[2];
+      if ( pz <= 0 ) {
+        continue;
+      }
+
+      const float u = (base[0] + x * step[0]) / pz * fx_ + cx_ + 0.5f;
+      const float v = (base[1] + x * step[1]) / pz * fy_ + cy_ + 0.5f;
+      if ( (u < 0) || (u >= width_) || (v < 0) || (v >= height_) ) {
+        continue;
+      }
+
+      updateVoxel( row + x, distance[((int)v * width_) + (int)u], pz );
+    }
+  }
+
+  // ボクセルに、距離画像の1画素を統合する
+  //   depth : 画素の距離(mm)
+  //   z     : ボクセルのカメラからの距離(m)
+  void updateVoxel( size_t index, USHORT depth, float z )
+  {
+    if ( depth == 0 ) {
+      return;
+    }
+
+    // 表面より切り捨て距離以上奥のボクセルは、見えていないので統合しない
+    const float sdf = depth * 0.001f - z;
+    if ( sdf < -truncation_ ) {
+      return;
+    }
+
+    const float value = std::min( 1.0f, sdf / truncation_ );
+    const int weight = weight_[index];
+    const float previous = tsdf_[index] * (1.0f / TSDF_SCALE);
+    tsdf_[index] = (SHORT)(((previous * weight + value) / (weight + 1)) * TSDF_SCALE);
+    weight_[index] = (BYTE)std::min( weight + 1, (int)MAX_WEIGHT );
+  }
+
+  // 光線が最初に表面と交わる位置の、カメラからの距離(Z)を求める(交わらない場合は0)
+  float castRay( const RigidTransform& cameraPose, const float ray[3] ) const
+  {
+    float direction[3];
+    cameraPose.rotate( ray, direction );
+    const float* start = cameraPose.translation;
+
+    // 光線がボリュームの中を通る区間
+    float nearT = 0;
+    float farT = std::numeric_limits< float >::max();
+    const float volumeSize = resolution_ * voxelSize_;
+    for ( int a = 0; a < 3; ++a ) {
+      if ( std::abs( direction[a] ) < 1e-6f ) {
+        if ( (start[a] < origin_[a]) || (start[a] > origin_[a] + volumeSize) ) {
+          return 0;
+        }
+        continue;
+      }
+
+      float t0 = (origin_[a] - start[a]) / direction[a];
+      float t1 = (origin_[a] + volumeSize - start[a]) / direction[a];
+      nearT = std::max( nearT, std::min( t0, t1 ) );
+      farT = std::min( farT, std::max( t0, t1 ) );
+    }
+
+    if ( nearT >= farT ) {
+      return 0;
+    }
+
+    // 切り捨て距離の半分ずつ進み、表面から遠い(値が1の)ところは倍の幅で進む
+    const float length = std::sqrt( direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2] );
+    const float fineStep = truncation_ * 0.5f / length;
+
+    float previousT = nearT;
+    float previous = 0;
+    bool previousValid = sample( start, direction, previousT, previous );
+    for ( float t = nearT + fineStep; t < farT; ) {
+      float value = 0;
+      const bool valid = sample( start, direction, t, value );
+      if ( valid && previousValid ) {
+        // 裏側から見た面
+        if ( (previous < 0) && (value > 0) ) {
+          return 0;
+        }
+
+        // 正から負に変わった位置を、補間した値の比で求める
+        if ( (previous > 0) && (value <= 0) ) {
+          float a = previous;
+          float b = value;
+          interpolate( start, direction, previousT, a );
+          interpolate( start, direction, t, b );
+          if ( (a > 0) && (b <= 0) ) {
+            return previousT + (t - previousT) * a / (a - b);
+          }
+          return previousT + (t - previousT) * previous / (previous - value);
+        }
+      }
+
+      previousT = t;
+      previous = value;
+      previousValid = valid;
+      t += (valid && (value >= 1.0f)) ? (fineStep * 2) : fineStep;
+    }
+
+    return 0;
+  }
+
+  // 光線上の位置のボクセルの値(一番近いボクセル、まだ統合していない場合はfalse)
+  bool sample( const float start[3], const float direction[3], float t, float& value ) const
+  {
+    int index[3];
+    for ( int a = 0; a < 3; ++a ) {
+      index[a] = (int)std::floor( (start[a] + direction[a] * t - origin_[a]) / voxelSize_ );
+      if ( (index[a] < 0) || (index[a] >= resolution_) ) {
+        return false;
+      }
+    }
+
+    const size_t i = ((size_t)index[2] * resolution_ + index[1]) * resolution_ + index[0];
+    if ( weight_[i] == 0 ) {
+      return false;
+    }
+
+    value = tsdf_[i] * (1.0f / TSDF_SCALE);
+    return true;
+  }
+
+  // 光線上の位置の値を、周りの8つのボクセルから補間する(できない場合は value を変えない)
+  void interpolate( const float start[3], const float direction[3], float t, float& value ) const
+  {
+    int index[3];
+    float fraction[3];
+    for ( int a = 0; a < 3; ++a ) {
+      const float g = (start[a] + direction[a] * t - origin_[a]) / voxelSize_ - 0.5f;
+      index[a] = (int)std::floor( g );
+      fraction[a] = g - index[a];
+      if ( (index[a] < 0) || (index[a] + 1 >= resolution_) ) {
+        return;
+      }
+    }
+
+    float result = 0;
+    for ( int corner = 0; corner < 8; ++corner ) {
+      const int dx = corner & 1;
+      const int dy = (corner >> 1) & 1;
+      const int dz = (corner >> 2) & 1;
+      const size_t i = ((size_t)(index[2] + dz) * resolution_ + (index[1] + dy)) * resolution_ + (index[0] + dx);
+      if ( weight_[i] == 0 ) {
+        return;
+      }
+
+      const float w = (dx ? fraction[0] : 1 - fraction[0]) *
+                      (dy ? fraction[1] : 1 - fraction[1]) *
+                      (dz ? fraction[2] : 1 - fraction[2]);
+      result += w * tsdf_[i] * (1.0f / TSDF_SCALE);
+    }
+
+    value = result;
+  }
+
+private:
+
+  bool isSse2_;
+
+  // 距離カメラ
+  DWORD width_;
+  DWORD height_;
+  float fx_;
+  float fy_;
+  float cx_;
+  float cy_;
+
+  // ボリューム
+  int resolution_;
+  float voxelSize_;
+  float truncation_;
+  float origin_[3];           // ボリュームの角の座標(m)
+  std::vector< SHORT > tsdf_;  // 正規化した距離 * TSDF_SCALE
+  std::vector< BYTE > weight_; // 統合した回数(MAX_WEIGHT まで)
+};
@@ -0,0 +1,313 @@
+﻿#pragma once
+
+#include <Windows.h>
+#include <ppl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <pcl\point_types.h>
+
+// ボクセルグリッドによるポイントクラウドの間引き
+//
+// 点の座標を一辺 leafSize(m)の立方体(ボクセル)の番号に変換し、同じボクセルに入った点を
+// その重心(色は平均)の1点にまとめる。番号は、オープンアドレス法のハッシュ表で数える。
+//
+// 入力の点を区間に分けて、区間ごとのハッシュ表に並列に集計してから、最後に1つの表にまとめる。
+// ハッシュ表と出力のクラウドは使いまわすので、大きさが変わらなければフレームごとのメモリ確保はしない。
+// 出力は整列していないクラウド(幅 = 点の数、高さ = 1)で、NaN の点は含まない。
+class VoxelDownsampler
+{
+public:
+
+  typedef pcl::PointXYZRGBA PointT;
+
+  VoxelDownsampler()
+    : leafSize_( 0 )
+    , frameCount_( 0 )
+    , pointsIn_( 0 )
+    , pointsOut_( 0 )
+    , totalTime_( 0 )
+  {
+    ::QueryPerformanceFrequency( &frequency_ );
+
+    // 区間の数は、プロセッサの数にする
+    SYSTEM_INFO info;
+    ::GetSystemInfo( &info );
+    partitions_.resize( std::max( (DWORD)1, std::min( info.dwNumberOfProcessors, (DWORD)MAX_PARTITIONS ) ) );
+  }
+
+  // ボクセルの一辺の長さ(m、0の場合は間引かない)
+  void setLeafSize( float leafSize )
+  {
+    leafSize_ = std::max( leafSize, 0.0f );
+    resetStatistics();
+  }
+
+  float getLeafSize() const
+  {
+    return leafSize_;
+  }
+
+  bool isEnabled() const
+  {
+    return leafSize_ > 0;
+  }
+
+  // 引数からボクセルの大きさを取り出す
+  //   -leaf <m>  ボクセルの一辺の長さ(指定しない場合は0、間引かない)
+  //   取り出した引数は argv から取り除き、argc を減らす
+  static float selectLeafSize( int& argc, char* argv[] )
+  {
+    for ( int i = 1; i < argc - 1; ++i ) {
+      if ( std::string( argv[i] ) == "-leaf" ) {
+        float leafSize = (float)atof( argv[i + 1] );
+        for ( int j = i; j < argc - 2; ++j ) {
+          argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+        return leafSize;
+      }
+    }
+
+    return 0;
+  }
+
+  // 間引く
+  //   input  : 入力のクラウド(整列していてもいなくてもよい、NaN の点は無視する)
+  //   output : 出力のクラウド(input とは別のクラウド)
+  void filter( const pcl::PointCloud< PointT >& input, pcl::PointCloud< PointT >& output )
+  {
+    LARGE_INTEGER start;
+    ::QueryPerformanceCounter( &start );
+
+    const int count = (int)input.points.size();
+    const int partitionCount = (int)partitions_.size();
+    const int partitionSize = (count + partitionCount - 1) / partitionCount;
+    const float inverseLeaf = 1.0f / leafSize_;
+
+    // 区間ごとに集計する
+    Concurrency::parallel_for( 0, partitionCount, [&]( int p ) {
+      VoxelTable& table = partitions_[p];
+      const int begin = std::min( p * partitionSize, count );
+      const int end = std::min( begin + partitionSize, count );
+      table.clear( end - begin );
+
+      // 隣り合う点は同じボクセルに入ることが多いので、直前のボクセルを覚えておく
+      ULONGLONG lastKey = emptyKey();
+      Voxel* voxel = 0;
+      for ( int i = begin; i < end; ++i ) {
+        const PointT& point = input.points[i];
+
+        // NaN は自分自身と等しくない
+        if ( point.z != point.z ) {
+          continue;
+        }
+
+        ULONGLONG key = makeKey( point, inverseLeaf );
+        if ( key != lastKey ) {
+          voxel = &table.find( key );
+          lastKey = key;
+        }
+
+        voxel->x += point.x;
+        voxel->y += point.y;
+        voxel->z += point.z;
+        voxel->r += point.r;
+        voxel->g += point.g;
+        voxel->b += point.b;
+        voxel->count += 1;
+      }
+    } );
+
+    // 区間ごとの集計を1つにまとめる
+    int occupied = 0;
+    for ( int p = 0; p < partitionCount; ++p ) {
+      occupied += (int)partitions_[p].used.size();
+    }
+
+    merged_.clear( occupied );
+    for ( int p = 0; p < partitionCount; ++p ) {
+      const VoxelTable& table = partitions_[p];
+      for ( size_t i = 0; i < table.used.size(); ++i ) {
+        const int slot = table.used[i];
+        merged_.find( table.keys[slot] ).add( table.voxels[slot] );
+      }
+    }
+
+    // ボクセルごとに重心の点を出力する(確保済みの容量は残る)
+    output.points.resize( merged_.used.size() );
+    for ( size_t i = 0; i < merged_.used.size(); ++i ) {
+      const Voxel& voxel = merged_.voxels[merged_.used[i]];
+      const float inverseCount = 1.0f / voxel.count;
+
+      PointT& point = output.points[i];
+      point.x = voxel.x * inverseCount;
+      point.y = voxel.y * inverseCount;
+      point.z = voxel.z * inverseCount;
+      point.r = (UCHAR)(voxel.r / voxel.count);
+      point.g = (UCHAR)(voxel.g / voxel.count);
+      point.b = (UCHAR)(voxel.b / voxel.count);
+      point.a = 255;
+    }
+
+    output.width = (UINT)output.points.size();
+    output.height = 1;
+    output.is_dense = true;
+
+    // 統計
+    LARGE_INTEGER end;
+    ::QueryPerformanceCounter( &end );
+    frameCount_ += 1;
+    pointsIn_ += count;
+    pointsOut_ += output.points.size();
+    totalTime_ += end.QuadPart - start.QuadPart;
+  }
+
+  // 1フレームあたりの入力と出力の点の数、処理時間を表示する
+  void printStatistics( std::ostream& out ) const
+  {
+    if ( frameCount_ == 0 ) {
+      return;
+    }
+
+    out << "downsample (leaf " << leafSize_ << " m) : "
+        << (pointsIn_ / frameCount_) << " -> " << (pointsOut_ / frameCount_) << " points/frame, "
+        << std::fixed << std::setprecision( 3 )
+        << (totalTime_ * 1000.0 / frequency_.QuadPart / frameCount_) << " ms/frame ("
+        << frameCount_ << " frames)" << std::endl;
+    out.unsetf( std::ios::floatfield );
+  }
+
+  void resetStatistics()
+  {
+    frameCount_ = 0;
+    pointsIn_ = 0;
+    pointsOut_ = 0;
+    totalTime_ = 0;
+  }
+
+private:
+
+  enum
+  {
+    MAX_PARTITIONS = 16,
+    KEY_BITS = 21,          // 1軸あたりのビット数(符号付き)
+  };
+
+  // ハッシュ表の空きを表す番号(makeKey は 63ビットまでしか使わない)
+  static ULONGLONG emptyKey()
+  {
+    return ~0ULL;
+  }
+
+  // ボクセルの集計
+  struct Voxel
+  {
+    float x, y, z;
+    UINT r, g, b;
+    UINT count;
+
+    void add( const Voxel& rhs )
+    {
+      x += rhs.x;
+      y += rhs.y;
+      z += rhs.z;
+      r += rhs.r;
+      g += rhs.g;
+      b += rhs.b;
+      count += rhs.count;
+    }
+  };
+
+  // ボクセルの番号からボクセルへのハッシュ表(オープンアドレス法)
+  struct VoxelTable
+  {
+    std::vector< ULONGLONG > keys;
+    std::vector< Voxel > voxels;
+    std::vector< int > used;      // 使っている場所(クリアと出力に使う)
+    int shift;
+
+    VoxelTable()
+      : shift( 64 )
+    {
+    }
+
+    // 空にする(count 個の番号が入る大きさを確保する)
+    void clear( int count )
+    {
+      // 使用率が半分以下になる、2のべき乗の大きさ
+      size_t capacity = 16;
+      int bits = 4;
+      while ( capacity < (size_t)count * 2 ) {
+        capacity *= 2;
+        ++bits;
+      }
+
+      if ( keys.size() < capacity ) {
+        keys.assign( capacity, emptyKey() );
+        voxels.resize( capacity );
+        used.reserve( capacity );
+        shift = 64 - bits;
+        used.clear();
+      }
+      else {
+        // 使った場所だけを空に戻す
+        for ( size_t i = 0; i < used.size(); ++i ) {
+          keys[used[i]] = emptyKey();
+        }
+        used.clear();
+      }
+    }
+
+    // 番号のボクセルを取得する(ない場合は追加する)
+    Voxel& find( ULONGLONG key )
+    {
+      const size_t mask = keys.size() - 1;
+      size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> shift);
+      while ( keys[slot] != key ) {
+        if ( keys[slot] == emptyKey() ) {
+          keys[slot] = key;
+          used.push_back( (int)slot );
+
+          Voxel& voxel = voxels[slot];
+          memset( &voxel, 0, sizeof(voxel) );
+          return voxel;
+        }
+
+        slot = (slot + 1) & mask;
+      }
+
+      return voxels[slot];
+    }
+  };
+
+  // 点の座標をボクセルの番号にする(各軸 KEY_BITS ビットずつ並べる)
+  static ULONGLONG makeKey( const PointT& point, float inverseLeaf )
+  {
+    const ULONGLONG mask = (1ULL << KEY_BITS) - 1;
+    ULONGLONG x = (ULONGLONG)(int)std::floor( point.x * inverseLeaf ) & mask;
+    ULONGLONG y = (ULONGLONG)(int)std::floor( point.y * inverseLeaf ) & mask;
+    ULONGLONG z = (ULONGLONG)(int)std::floor( point.z * inverseLeaf ) & mask;
+    return (x << (KEY_BITS * 2)) | (y << KEY_BITS) | z;
+  }
+
+private:
+
+  float leafSize_;
+
+  std::vector< VoxelTable > partitions_;
+  VoxelTable merged_;
+
+  // 統計
+  LARGE_INTEGER frequency_;
+  LONGLONG frameCount_;
+  LONGLONG pointsIn_;
+  LONGLONG pointsOut_;
+  LONGLONG totalTime_;
+};
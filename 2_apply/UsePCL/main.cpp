@@ -1,11 +1,74 @@
-#include "KinectControl.h"
+﻿#include "KinectControl.h"
+#include "RecordedFrameSource.h"
+#include "SyntheticFrameSource.h"
 
-void main()
+// 引数
+//   (なし)                   Kinectのフレームを使う
+//   synthetic                Kinectの代わりに合成したフレームを使う
+//   play <ファイル名> [fast] 記録したファイル(Finger の record で記録したもの)を再生する
+//   benchmark [ファイル名]   合成したフレーム(ファイル名を指定した場合は記録したファイル)で処理時間を計測する
+//
+//   -color <解像度>          RGBカメラの解像度(640x480、1280x960。ResolutionSelector を参照)
+//   -depth <解像度>          距離カメラの解像度(80x60、320x240、640x480)
+//   -sink <出力先>           画像の出力先(screen、null、images:<接頭辞>、shm:<名前>。FrameSinkSelector を参照)
+//                            screen 以外では、ポイントクラウドも表示しない
+//   -leaf <m>                ポイントクラウドを一辺 m のボクセルで間引く(VoxelDownsampler を参照)
+//   -tsdf <数>               距離画像を1辺がこの数のボクセルのボリュームに統合して表示する(TsdfVolume を参照)
+//   -export <形式>:<名前>    ポイントクラウドをファイルに書き出す(pcd、ply、archive。CloudExporter を参照)
+//   -normals <画素>          窓の半径を指定して法線を求め、法線の向きで色を付ける(IntegralNormalEstimator を参照)
+void main( int argc, char* argv[] )
 {
   try {
+    // 画面への表示は別のスレッドで行い、メインループを待たせない
+    FrameSinkSelector sinks;
+    AsyncFrameSink async;
+    FrameSink* sink = sinks.select( argc, argv );
+    if ( sink->isVisible() ) {
+      async.open( sink );
+      sink = &async;
+    }
+
+    ResolutionSelector resolutions;
+    resolutions.select( argc, argv );
+    float leafSize = VoxelDownsampler::selectLeafSize( argc, argv );
+    int volumeResolution = TsdfVolume::selectResolution( argc, argv );
+    CloudFormat exportFormat = CLOUD_FORMAT_PCD;
+    std::string exportPath;
+    bool isExport = CloudExporter::select( argc, argv, exportFormat, exportPath );
+    int normalRadius = IntegralNormalEstimator::selectRadius( argc, argv );
+
+    // フレームを参照する KinectControl より先に作成する
+    SyntheticFrameSource synthetic( resolutions.getColorResolution(), resolutions.getDepthResolution() );
+    RecordedFrameSource recorded;
     KinectControl kinect;
-    kinect.initialize();
-    kinect.run();
+    kinect.setSink( sink );
+    kinect.setLeafSize( leafSize );
+    kinect.setVolumeResolution( volumeResolution );
+    kinect.setNormalRadius( normalRadius );
+    if ( isExport ) {
+      kinect.setExport( exportFormat, exportPath );
+    }
+
+    std::string mode = (argc > 1) ? argv[1] : "";
+    if ( ((mode == "benchmark") || (mode == "play")) && (argc > 2) ) {
+      bool isRealTime = (mode == "play") && !((argc > 3) && (std::string( argv[3] ) == "fast"));
+      recorded.open( argv[2], isRealTime );
+      kinect.initialize( &recorded );
+    }
+    else if ( (mode == "synthetic") || (mode == "benchmark") ) {
+      kinect.initialize( &synthetic );
+    }
+    else {
+      kinect.initialize( resolutions.getColorResolution(), resolutions.getDepthResolution() );
+    }
+
+    if ( mode == "benchmark" ) {
+      KernelBenchmark kernelBenchmark;
+      kinect.benchmark( kernelBenchmark );
+    }
+    else {
+      kinect.run();
+    }
   }
   catch ( std::exception& ex ) {
     std::cout << ex.what() << std::endl;